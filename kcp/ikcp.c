@@ -29,6 +29,7 @@ const IUINT32 IKCP_CMD_PUSH = 81;		// cmd: push data
 const IUINT32 IKCP_CMD_ACK  = 82;		// cmd: ack
 const IUINT32 IKCP_CMD_WASK = 83;		// cmd: window probe (ask)
 const IUINT32 IKCP_CMD_WINS = 84;		// cmd: window size (tell)
+const IUINT32 IKCP_CMD_SACK = 85;		// cmd: una + selective ack ranges
 const IUINT32 IKCP_ASK_SEND = 1;		// need to send IKCP_CMD_WASK
 const IUINT32 IKCP_ASK_TELL = 2;		// need to send IKCP_CMD_WINS
 const IUINT32 IKCP_WND_SND = 32;
@@ -42,6 +43,11 @@ const IUINT32 IKCP_THRESH_INIT = 2;
 const IUINT32 IKCP_THRESH_MIN = 2;
 const IUINT32 IKCP_PROBE_INIT = 7000;		// 7 secs to probe window size
 const IUINT32 IKCP_PROBE_LIMIT = 120000;	// up to 120 secs to probe window
+const IUINT32 IKCP_SACK_FLAG = 0x80;		// frg bit of ACK/WASK/WINS: sender understands SACK
+const IUINT32 IKCP_SACK_RANGE = 4;		// 16 bits offset from una + 16 bits count
+const int IKCP_SACK_UNKNOWN = 0;
+const int IKCP_SACK_YES = 1;
+const int IKCP_SACK_NO = 2;
 
 
 //---------------------------------------------------------------------
@@ -282,6 +288,8 @@ ikcpcb* ikcp_create(IUINT32 conv, void *user)
 	kcp->ssthresh = IKCP_THRESH_INIT;
 	kcp->fastresend = 0;
 	kcp->nocwnd = 0;
+	kcp->sack = 0;
+	kcp->sack_peer = IKCP_SACK_UNKNOWN;
 	kcp->xmit = 0;
     kcp->dead_link = IKCP_DEADLINK;
 	kcp->output = NULL;
@@ -565,6 +573,51 @@ static void ikcp_parse_una(ikcpcb *kcp, IUINT32 una)
 #endif
 }
 
+static int ikcp_sack_has(IUINT32 una, const char *ranges, IUINT32 len, IUINT32 sn)
+{
+	IUINT32 off = sn - una;
+	IUINT16 start, count;
+	for (; len >= IKCP_SACK_RANGE; len -= IKCP_SACK_RANGE) {
+		ranges = ikcp_decode16u(ranges, &start);
+		ranges = ikcp_decode16u(ranges, &count);
+		if (off >= start && off - start < count) return 1;
+	}
+	return 0;
+}
+
+static void ikcp_parse_sack(ikcpcb *kcp, IUINT32 una, const char *ranges, IUINT32 len)
+{
+	struct IQUEUEHEAD *p, *prev;
+	IUINT32 acked = 0;
+
+	// walk backwards so every segment left in snd_buf gains one fastack
+	// per newly acknowledged segment above it, as separate ACKs would do
+	for (p = kcp->snd_buf.prev; p != &kcp->snd_buf; p = prev) {
+		IKCPSEG *seg = iqueue_entry(p, IKCPSEG, node);
+		prev = p->prev;
+		if (ikcp_sack_has(una, ranges, len, seg->sn)) {
+			iqueue_del(p);
+			ikcp_segment_delete(kcp, seg);
+			kcp->nsnd_buf--;
+			acked++;
+		}
+		else {
+			seg->fastack += acked;
+		}
+	}
+}
+
+static void ikcp_parse_capability(ikcpcb *kcp, IUINT32 cmd, IUINT8 frg)
+{
+	if (kcp->sack_peer == IKCP_SACK_YES) return;
+	if (cmd == IKCP_CMD_SACK || (frg & IKCP_SACK_FLAG)) {
+		kcp->sack_peer = IKCP_SACK_YES;
+	}
+	else if (cmd == IKCP_CMD_ACK) {
+		kcp->sack_peer = IKCP_SACK_NO;
+	}
+}
+
 
 //---------------------------------------------------------------------
 // ack append
@@ -682,7 +735,7 @@ void ikcp_parse_data(ikcpcb *kcp, IKCPSEG *newseg)
 // return 0 if get conv error.
 int ikcp_get_conv(const char *data, long size, IUINT32* conv_out)
 {
-    if (data == NULL || size < (int)IKCP_OVERHEAD)
+    if (data == NULL || (size < (int)IKCP_OVERHEAD && !ikcp_is_compact(data, size)))
         return 0;
 
     ikcp_decode32u(data, conv_out);
@@ -726,12 +779,16 @@ int ikcp_input(ikcpcb *kcp, const char *data, long size)
 		if ((long)size < (long)len) return -2;
 
 		if (cmd != IKCP_CMD_PUSH && cmd != IKCP_CMD_ACK &&
-			cmd != IKCP_CMD_WASK && cmd != IKCP_CMD_WINS) 
+			cmd != IKCP_CMD_WASK && cmd != IKCP_CMD_WINS &&
+			cmd != IKCP_CMD_SACK) 
 			return -3;
 
 		kcp->rmt_wnd = wnd;
 		ikcp_parse_una(kcp, una);
 		ikcp_shrink_buf(kcp);
+		if (cmd != IKCP_CMD_PUSH) {
+			ikcp_parse_capability(kcp, cmd, frg);
+		}
 
 		if (cmd == IKCP_CMD_ACK) {
 			if (_itimediff(kcp->current, ts) >= 0) {
@@ -746,6 +803,19 @@ int ikcp_input(ikcpcb *kcp, const char *data, long size)
 					(long)kcp->rx_rto);
 			}
 		}
+		else if (cmd == IKCP_CMD_SACK) {
+			if (_itimediff(kcp->current, ts) >= 0) {
+				ikcp_update_ack(kcp, _itimediff(kcp->current, ts));
+			}
+			ikcp_parse_sack(kcp, una, data, len);
+			ikcp_shrink_buf(kcp);
+			if (ikcp_canlog(kcp, IKCP_LOG_IN_ACK)) {
+				ikcp_log(kcp, IKCP_LOG_IN_ACK, 
+					"input sack: una=%lu ranges=%lu rtt=%ld rto=%ld", una,
+					len / IKCP_SACK_RANGE, (long)_itimediff(kcp->current, ts),
+					(long)kcp->rx_rto);
+			}
+		}
 		else if (cmd == IKCP_CMD_PUSH) {
 			if (ikcp_canlog(kcp, IKCP_LOG_IN_DATA)) {
 				ikcp_log(kcp, IKCP_LOG_IN_DATA, 
@@ -844,6 +914,221 @@ static int ikcp_wnd_unused(const ikcpcb *kcp)
 }
 
 
+//---------------------------------------------------------------------
+// compact header
+// flag byte: bit 7 always set, bits 0-2 cmd - IKCP_CMD_PUSH, then
+// optional fields: frg (u8), wnd / una (varint, else same as previous),
+// ts (zigzag delta to previous, else same), then sn (zigzag delta to
+// previous) and len (varint) are always present. previous values start
+// from zero at the beginning of each datagram.
+//---------------------------------------------------------------------
+#define IKCP_COMPACT_MARK	0x80
+#define IKCP_COMPACT_FRG	0x08
+#define IKCP_COMPACT_WND	0x10
+#define IKCP_COMPACT_UNA	0x20
+#define IKCP_COMPACT_TS		0x40
+#define IKCP_COMPACT_CMD	0x07
+
+static inline char *ikcp_encode_varint(char *p, const char *end, IUINT32 v)
+{
+	while (v >= 0x80) {
+		if (p >= end) return NULL;
+		*(unsigned char*)p++ = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	if (p >= end) return NULL;
+	*(unsigned char*)p++ = (unsigned char)v;
+	return p;
+}
+
+static inline const char *ikcp_decode_varint(const char *p, const char *end, IUINT32 *v)
+{
+	IUINT32 x = 0;
+	int shift;
+	for (shift = 0; shift < 35 && p < end; shift += 7) {
+		unsigned char c = *(const unsigned char*)p++;
+		x |= (IUINT32)(c & 0x7f) << shift;
+		if ((c & 0x80) == 0) {
+			*v = x;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+static inline IUINT32 ikcp_zigzag(IUINT32 delta)
+{
+	return (delta << 1) ^ (IUINT32)((IINT32)delta >> 31);
+}
+
+static inline IUINT32 ikcp_unzigzag(IUINT32 v)
+{
+	return (v >> 1) ^ (IUINT32)(-(IINT32)(v & 1));
+}
+
+int ikcp_is_compact(const char *data, long size)
+{
+	return data != NULL && size > 4 && (((const unsigned char*)data)[4] & IKCP_COMPACT_MARK);
+}
+
+long ikcp_encode_compact(const char *data, long size, char *out)
+{
+	const char *end = out + size;
+	char *p = out;
+	IUINT32 conv, ts, sn, una, len;
+	IUINT32 pwnd = 0, pts = 0, psn = 0, puna = 0;
+	IUINT16 wnd;
+	IUINT8 cmd, frg, flag;
+
+	if (data == NULL || size < (long)IKCP_OVERHEAD) return 0;
+	memcpy(p, data, 4);
+	p += 4;
+
+	while (size >= (long)IKCP_OVERHEAD) {
+		data = ikcp_decode32u(data, &conv);
+		data = ikcp_decode8u(data, &cmd);
+		data = ikcp_decode8u(data, &frg);
+		data = ikcp_decode16u(data, &wnd);
+		data = ikcp_decode32u(data, &ts);
+		data = ikcp_decode32u(data, &sn);
+		data = ikcp_decode32u(data, &una);
+		data = ikcp_decode32u(data, &len);
+		size -= IKCP_OVERHEAD;
+		if (cmd < IKCP_CMD_PUSH || cmd > IKCP_CMD_SACK || (long)len > size) return 0;
+
+		flag = IKCP_COMPACT_MARK | (IUINT8)(cmd - IKCP_CMD_PUSH);
+		if (frg) flag |= IKCP_COMPACT_FRG;
+		if (wnd != pwnd) flag |= IKCP_COMPACT_WND;
+		if (una != puna) flag |= IKCP_COMPACT_UNA;
+		if (ts != pts) flag |= IKCP_COMPACT_TS;
+		if (p >= end) return 0;
+		*p++ = (char)flag;
+		if (frg) {
+			if (p >= end) return 0;
+			*p++ = (char)frg;
+		}
+		if ((flag & IKCP_COMPACT_WND) && (p = ikcp_encode_varint(p, end, wnd)) == NULL) return 0;
+		if ((flag & IKCP_COMPACT_UNA) && (p = ikcp_encode_varint(p, end, una)) == NULL) return 0;
+		if ((flag & IKCP_COMPACT_TS) && (p = ikcp_encode_varint(p, end, ikcp_zigzag(ts - pts))) == NULL) return 0;
+		if ((p = ikcp_encode_varint(p, end, ikcp_zigzag(sn - psn))) == NULL) return 0;
+		if ((p = ikcp_encode_varint(p, end, len)) == NULL) return 0;
+		if ((long)len > end - p) return 0;
+		memcpy(p, data, len);
+		p += len;
+		data += len;
+		size -= len;
+		pwnd = wnd;
+		puna = una;
+		pts = ts;
+		psn = sn;
+	}
+
+	if (size != 0 || p >= end) return 0;
+	return (long)(p - out);
+}
+
+long ikcp_decode_compact(const char *data, long size, char *out, long outsize)
+{
+	const char *end = data + size;
+	char *p = out;
+	IUINT32 conv, ts = 0, sn = 0, una = 0, len, v;
+	IUINT32 wnd = 0;
+	IUINT8 flag, frg;
+	IKCPSEG seg;
+
+	if (!ikcp_is_compact(data, size)) return -1;
+	ikcp_decode32u(data, &conv);
+	data += 4;
+
+	while (data < end) {
+		flag = *(const unsigned char*)data++;
+		if ((flag & IKCP_COMPACT_MARK) == 0) return -1;
+		if ((flag & IKCP_COMPACT_CMD) > IKCP_CMD_SACK - IKCP_CMD_PUSH) return -1;
+		frg = 0;
+		if (flag & IKCP_COMPACT_FRG) {
+			if (data >= end) return -1;
+			frg = *(const unsigned char*)data++;
+		}
+		if ((flag & IKCP_COMPACT_WND) && (data = ikcp_decode_varint(data, end, &wnd)) == NULL) return -1;
+		if ((flag & IKCP_COMPACT_UNA) && (data = ikcp_decode_varint(data, end, &una)) == NULL) return -1;
+		if (flag & IKCP_COMPACT_TS) {
+			if ((data = ikcp_decode_varint(data, end, &v)) == NULL) return -1;
+			ts += ikcp_unzigzag(v);
+		}
+		if ((data = ikcp_decode_varint(data, end, &v)) == NULL) return -1;
+		sn += ikcp_unzigzag(v);
+		if ((data = ikcp_decode_varint(data, end, &len)) == NULL) return -1;
+		if ((long)len > end - data || wnd > 0xffff) return -1;
+		if ((long)(IKCP_OVERHEAD + len) > outsize - (long)(p - out)) return -2;
+
+		seg.conv = conv;
+		seg.cmd = IKCP_CMD_PUSH + (flag & IKCP_COMPACT_CMD);
+		seg.frg = frg;
+		seg.wnd = wnd;
+		seg.ts = ts;
+		seg.sn = sn;
+		seg.una = una;
+		seg.len = len;
+		p = ikcp_encode_seg(p, &seg);
+		memcpy(p, data, len);
+		p += len;
+		data += len;
+	}
+
+	return (long)(p - out);
+}
+
+
+//---------------------------------------------------------------------
+// ikcp_flush_sack: all pending acks as one segment, una covers the
+// in-order part and the ranges describe rcv_buf, ts echoes the latest
+// arrival for rtt estimation. must be the first thing in the buffer.
+//---------------------------------------------------------------------
+static char *ikcp_flush_sack(ikcpcb *kcp, char *ptr)
+{
+	IKCPSEG seg;
+	struct IQUEUEHEAD *p;
+	char *ranges = ptr + IKCP_OVERHEAD;
+	IUINT32 maxranges = (kcp->mtu - IKCP_OVERHEAD) / IKCP_SACK_RANGE;
+	IUINT32 nranges = 0, start = 0, count = 0;
+
+	for (p = kcp->rcv_buf.next; p != &kcp->rcv_buf; p = p->next) {
+		IKCPSEG *rseg = iqueue_entry(p, IKCPSEG, node);
+		IUINT32 off = rseg->sn - kcp->rcv_nxt;
+		if (off > 0xffff) break;
+		if (count > 0 && off == start + count) {
+			count++;
+			continue;
+		}
+		if (count > 0) {
+			ranges = ikcp_encode16u(ranges, (IUINT16)start);
+			ranges = ikcp_encode16u(ranges, (IUINT16)count);
+			if (++nranges >= maxranges) {
+				count = 0;
+				break;
+			}
+		}
+		start = off;
+		count = 1;
+	}
+	if (count > 0) {
+		ranges = ikcp_encode16u(ranges, (IUINT16)start);
+		ranges = ikcp_encode16u(ranges, (IUINT16)count);
+		nranges++;
+	}
+
+	seg.conv = kcp->conv;
+	seg.cmd = IKCP_CMD_SACK;
+	seg.frg = IKCP_SACK_FLAG;
+	seg.wnd = ikcp_wnd_unused(kcp);
+	seg.una = kcp->rcv_nxt;
+	seg.len = nranges * IKCP_SACK_RANGE;
+	ikcp_ack_get(kcp, kcp->ackcount - 1, &seg.sn, &seg.ts);
+	ikcp_encode_seg(ptr, &seg);
+	return ranges;
+}
+
+
 //---------------------------------------------------------------------
 // ikcp_flush
 //---------------------------------------------------------------------
@@ -865,7 +1150,7 @@ void ikcp_flush(ikcpcb *kcp)
 
 	seg.conv = kcp->conv;
 	seg.cmd = IKCP_CMD_ACK;
-	seg.frg = 0;
+	seg.frg = kcp->sack ? IKCP_SACK_FLAG : 0;
 	seg.wnd = ikcp_wnd_unused(kcp);
 	seg.una = kcp->rcv_nxt;
 	seg.len = 0;
@@ -874,14 +1159,19 @@ void ikcp_flush(ikcpcb *kcp)
 
 	// flush acknowledges
 	count = kcp->ackcount;
-	for (i = 0; i < count; i++) {
-		size = (int)(ptr - buffer);
-		if (size + IKCP_OVERHEAD > (int)kcp->mtu) {
-			ikcp_output(kcp, buffer, size);
-			ptr = buffer;
+	if (count > 0 && kcp->sack && kcp->sack_peer == IKCP_SACK_YES) {
+		ptr = ikcp_flush_sack(kcp, ptr);
+	}
+	else {
+		for (i = 0; i < count; i++) {
+			size = (int)(ptr - buffer);
+			if (size + IKCP_OVERHEAD > (int)kcp->mtu) {
+				ikcp_output(kcp, buffer, size);
+				ptr = buffer;
+			}
+			ikcp_ack_get(kcp, i, &seg.sn, &seg.ts);
+			ptr = ikcp_encode_seg(ptr, &seg);
 		}
-		ikcp_ack_get(kcp, i, &seg.sn, &seg.ts);
-		ptr = ikcp_encode_seg(ptr, &seg);
 	}
 
 	kcp->ackcount = 0;
@@ -932,6 +1222,18 @@ void ikcp_flush(ikcpcb *kcp)
 
 	kcp->probe = 0;
 
+	// advertise SACK with data until the remote end answers with any ack
+	if (kcp->sack && kcp->sack_peer == IKCP_SACK_UNKNOWN &&
+		(kcp->nsnd_buf > 0 || kcp->nsnd_que > 0)) {
+		seg.cmd = IKCP_CMD_WINS;
+		size = (int)(ptr - buffer);
+		if (size + IKCP_OVERHEAD > (int)kcp->mtu) {
+			ikcp_output(kcp, buffer, size);
+			ptr = buffer;
+		}
+		ptr = ikcp_encode_seg(ptr, &seg);
+	}
+
 	// calculate window size
 	cwnd = _imin_(kcp->snd_wnd, kcp->rmt_wnd);
 	if (kcp->nocwnd == 0) cwnd = _imin_(kcp->cwnd, cwnd);
@@ -1183,6 +1485,15 @@ int ikcp_nodelay(ikcpcb *kcp, int nodelay, int interval, int resend, int nc)
 }
 
 
+int ikcp_sack(ikcpcb *kcp, int sack)
+{
+	if (kcp) {
+		kcp->sack = sack ? 1 : 0;
+	}
+	return 0;
+}
+
+
 int ikcp_wndsize(ikcpcb *kcp, int sndwnd, int rcvwnd)
 {
 	if (kcp) {
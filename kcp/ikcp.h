@@ -300,6 +300,7 @@ struct IKCPCB
 	int fastresend;
 	int nocwnd;
 	int logmask;
+	int sack, sack_peer;
 	int (*output)(const char *buf, int len, struct IKCPCB *kcp, void *user);
 	void (*writelog)(const char *log, struct IKCPCB *kcp, void *user);
 };
@@ -387,6 +388,22 @@ int ikcp_waitsnd(const ikcpcb *kcp);
 // nc: 0:normal congestion control(default), 1:disable congestion control
 int ikcp_nodelay(ikcpcb *kcp, int nodelay, int interval, int resend, int nc);
 
+// sack: 1:acknowledge with one IKCP_CMD_SACK segment (una + ranges) once the
+// remote end is known to support it, 0:always one IKCP_CMD_ACK per segment.
+// the capability is advertised in the frg field of ACK/WASK/WINS segments,
+// which older peers ignore, so both ends may be configured independently.
+int ikcp_sack(ikcpcb *kcp, int sack);
+
+// compact header: conv stays in the first 4 bytes, every segment header
+// becomes a flag byte (bit 7 set, never a classic cmd) followed by varints
+// and deltas against the previous segment of the same datagram.
+// ikcp_encode_compact returns the new length, 0 if it would not be smaller;
+// ikcp_decode_compact returns the classic length, below zero if malformed
+// or 'outsize' is too small. decoded datagrams can go to ikcp_input.
+int ikcp_is_compact(const char *data, long size);
+long ikcp_encode_compact(const char *data, long size, char *out);
+long ikcp_decode_compact(const char *data, long size, char *out, long outsize);
+
 int ikcp_rcvbuf_count(const ikcpcb *kcp);
 int ikcp_sndbuf_count(const ikcpcb *kcp);
 
@@ -0,0 +1,48 @@
+#!/bin/bash
+#====================================================================
+# 本机端到端压测: loadgen -> tun-cli -> tun-svr -> loadgen(回显)
+# 用法: bench-e2e.sh [并发连接数] [消息长度] [秒数]
+#====================================================================
+
+BINDIR=$(cd "$(dirname "$0")/../src" && pwd)
+CONNS=${1:-64}
+MSG=${2:-16384}
+SECS=${3:-10}
+
+TMPDIR=$(mktemp -d /tmp/fasttun-bench.XXXXXX)
+CONF=$TMPDIR/bench.ini
+cat > $CONF <<INI
+[local]
+listen=127.0.0.1:25085
+remote=127.0.0.1:25519
+kcpremote=127.0.0.1:25443
+
+[server]
+listen=127.0.0.1:25519
+kcplisten=127.0.0.1:25443
+connect=127.0.0.1:25080
+INI
+
+PIDS=""
+cleanup()
+{
+    [ -n "$PIDS" ] && kill $PIDS 2>/dev/null
+    wait 2>/dev/null
+    rm -rf $TMPDIR
+}
+trap cleanup EXIT
+
+$BINDIR/loadgen.out -s 127.0.0.1:25080 &
+PIDS="$PIDS $!"
+$BINDIR/server.out -c $CONF > $TMPDIR/tun-svr.log 2>&1 &
+SVR=$!
+$BINDIR/client.out -c $CONF > $TMPDIR/tun-cli.log 2>&1 &
+CLI=$!
+PIDS="$PIDS $SVR $CLI"
+sleep 1
+
+# 持续连接上的吞吐和往返延迟
+$BINDIR/loadgen.out -c 127.0.0.1:25085 -n $CONNS -m $MSG -t $SECS -p $CLI,$SVR || exit 1
+echo
+# 小消息、每次往返后重连, 测建连速率
+$BINDIR/loadgen.out -c 127.0.0.1:25085 -n $CONNS -m 64 -t $SECS -C -p $CLI,$SVR || exit 1
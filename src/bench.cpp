@@ -0,0 +1,1606 @@
+#include "fasttun_base.h"
+#include "cache.h"
+#include "timer_wheel.h"
+#include "conv_allocator.h"
+#include "conv_table.h"
+#include "kcp_tunnel.h"
+#include "latency.h"
+#include "lossy_link.h"
+#include "path_mtu.h"
+#include "connection.h"
+#include "epoll_poller.h"
+
+#include <map>
+#include <vector>
+
+#include <time.h>
+#include <malloc.h>
+#include <pthread.h>
+
+using namespace tun;
+
+//--------------------------------------------------------------------------
+static double nowSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+static void report(const char *name, const char *variant, double secs, uint64 ops, uint64 bytes)
+{
+    printf("%-24s %-16s %10.3f ms %12.0f ops/s %10.1f MB/s\n",
+           name, variant, secs*1000, ops/secs, bytes/secs/(1024*1024));
+}
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+// Cache: 环形缓冲区 vs 原先的 std::list 实现
+template <class T>
+class ListCache
+{
+    typedef bool (T::*FuncType)(const void *, size_t);
+  public:
+    ListCache(T *host, FuncType func) : mHost(host), mFunc(func), mCachedList() {}
+
+    void cache(const void *data, size_t len)
+    {
+        Data d;
+        d.len = len;
+        d.data = (char *)malloc(len);
+        memcpy(d.data, data, len);
+        mCachedList.push_back(d);
+    }
+
+    bool flushAll()
+    {
+        typename DataList::iterator it = mCachedList.begin();
+        for (; it != mCachedList.end(); )
+        {
+            if (!(mHost->*mFunc)((*it).data, (*it).len))
+                return false;
+            free((*it).data);
+            mCachedList.erase(it++);
+        }
+        return true;
+    }
+
+  private:
+    struct Data
+    {
+        size_t len;
+        char *data;
+    };
+    typedef std::list<Data> DataList;
+
+    T *mHost;
+    FuncType mFunc;
+    DataList mCachedList;
+};
+
+struct CacheSink
+{
+    uint64 bytes;
+
+    CacheSink() : bytes(0) {}
+
+    bool flush(const void *data, size_t len)
+    {
+        bytes += ((const uint8 *)data)[len-1]+len;
+        return true;
+    }
+};
+
+template <class C>
+static void runCacheBench(const char *variant, const size_t *lens, int nlens, int rounds, int batch)
+{
+    static char payload[2048];
+    CacheSink sink;
+    C c(&sink, &CacheSink::flush);
+
+    uint64 ops = 0, bytes = 0;
+    double beg = nowSeconds();
+    for (int r = 0; r < rounds; ++r)
+    {
+        for (int i = 0; i < batch; ++i)
+        {
+            size_t len = lens[(r+i)%nlens];
+            c.cache(payload, len);
+            ++ops;
+            bytes += len;
+        }
+        c.flushAll();
+    }
+    report("cache", variant, nowSeconds()-beg, ops, bytes);
+}
+
+static void benchCache()
+{
+    static const int NLENS = 64;
+    size_t lens[NLENS];
+    for (int i = 0; i < NLENS; ++i)
+        lens[i] = 64+random()%1400;
+
+    runCacheBench< ListCache<CacheSink> >("std::list", lens, NLENS, 20000, 128);
+    runCacheBench< Cache<CacheSink, 1024*1024> >("ring", lens, NLENS, 20000, 128);
+}
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+// 定时器: 分层时间轮 vs 基于有序容器的定时器
+// 模拟10万个连接: 每条KCP管道按 10~40ms 周期更新, 每个桥接有30s的心跳和连接检查;
+// 每毫秒另有1%的KCP定时器因收包被重新调度
+static const int TIMER_COUNT = 100000;
+static const uint32 TIMER_SIM_MS = 10000;
+
+static uint32 s_benchRand = 1;
+static inline uint32 benchRand()
+{
+    s_benchRand = s_benchRand*1103515245+12345;
+    return (s_benchRand>>8)&0xFFFFFF;
+}
+
+static inline uint32 timerInterval(int i)
+{
+    return i%3 == 0 ? 10+i%31 : 30000;
+}
+
+struct WheelBenchTimer : public WheelTimer::Handler
+{
+    WheelTimer timer;
+    uint64 *fired;
+
+    WheelBenchTimer() : timer(this), fired(NULL) {}
+
+    virtual void onTimeout(WheelTimer *pTimer)
+    {
+        ++*fired;
+    }
+};
+
+static void benchTimerWheel()
+{
+    uint64 fired = 0, ops = 0;
+    uint32 now = 1;
+    TimerWheel w;
+    w.process(now);
+
+    WheelBenchTimer *timers = new WheelBenchTimer[TIMER_COUNT];
+    s_benchRand = 1;
+    double beg = nowSeconds();
+    for (int i = 0; i < TIMER_COUNT; ++i)
+    {
+        timers[i].fired = &fired;
+        uint32 interval = timerInterval(i);
+        w.schedule(&timers[i].timer, now+benchRand()%interval+1, interval,
+                   interval >= 1000 ? 1000 : 0);
+        ++ops;
+    }
+
+    for (; now <= TIMER_SIM_MS; ++now)
+    {
+        for (int j = 0; j < TIMER_COUNT/300; ++j)
+        {
+            int i = benchRand()%TIMER_COUNT/3*3;
+            w.schedule(&timers[i].timer, now+timerInterval(i), timerInterval(i));
+            ops += 2;
+        }
+
+        w.process(now);
+        w.nextExpire();
+    }
+    double secs = nowSeconds()-beg;
+    delete [] timers;
+
+    report("timer", "wheel", secs, ops+fired, 0);
+}
+
+struct MapBenchTimer;
+typedef std::multimap<uint64, MapBenchTimer *> TimerMap;
+struct MapBenchTimer
+{
+    TimerMap::iterator it;
+    bool scheduled;
+    uint32 interval;
+};
+
+static void benchTimerMap()
+{
+    uint64 fired = 0, ops = 0;
+    uint32 now = 1;
+    TimerMap m;
+
+    MapBenchTimer *timers = new MapBenchTimer[TIMER_COUNT];
+    s_benchRand = 1;
+    double beg = nowSeconds();
+    for (int i = 0; i < TIMER_COUNT; ++i)
+    {
+        timers[i].interval = timerInterval(i);
+        timers[i].it = m.insert(std::make_pair((uint64)(now+benchRand()%timers[i].interval+1), &timers[i]));
+        timers[i].scheduled = true;
+        ++ops;
+    }
+
+    for (; now <= TIMER_SIM_MS; ++now)
+    {
+        for (int j = 0; j < TIMER_COUNT/300; ++j)
+        {
+            int i = benchRand()%TIMER_COUNT/3*3;
+            if (timers[i].scheduled)
+                m.erase(timers[i].it);
+            timers[i].it = m.insert(std::make_pair((uint64)(now+timers[i].interval), &timers[i]));
+            timers[i].scheduled = true;
+            ops += 2;
+        }
+
+        while (!m.empty() && m.begin()->first <= now)
+        {
+            MapBenchTimer *t = m.begin()->second;
+            m.erase(m.begin());
+            t->it = m.insert(std::make_pair((uint64)(now+t->interval), t));
+            ++fired;
+        }
+    }
+    double secs = nowSeconds()-beg;
+    delete [] timers;
+
+    report("timer", "std::multimap", secs, ops+fired, 0);
+}
+
+static void benchTimer()
+{
+    benchTimerMap();
+    benchTimerWheel();
+}
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+// kcp会话号分配: 数组空闲链表 vs 原先预填充 std::list 的 IDGenerator
+static const int CONV_CYCLES = 5000000;
+static const int CONV_WORKSET = 4096;
+
+template <int MaxNum>
+class ListConvGen : public IDGenerator<uint32, MaxNum>
+{
+  public:
+    ListConvGen()
+    {
+        for (uint32 id = 100; id < 100+MaxNum; ++id)
+            this->restorId(id);
+    }
+};
+
+static void benchConvList()
+{
+    uint32 live[CONV_WORKSET];
+    s_benchRand = 1;
+    double beg = nowSeconds();
+    ListConvGen<10000> *gen = new ListConvGen<10000>();
+    for (int i = 0; i < CONV_WORKSET; ++i)
+        gen->genNewId(live[i]);
+    for (int i = 0; i < CONV_CYCLES; ++i)
+    {
+        int k = benchRand()%CONV_WORKSET;
+        gen->restorId(live[k]);
+        gen->genNewId(live[k]);
+    }
+    delete gen;
+    double secs = nowSeconds()-beg;
+
+    report("conv", "std::list", secs, (uint64)CONV_CYCLES*2, 0);
+}
+
+static void benchConvAllocator()
+{
+    uint32 live[CONV_WORKSET];
+    s_benchRand = 1;
+    double beg = nowSeconds();
+    ConvAllocator *a = new ConvAllocator();
+    for (int i = 0; i < CONV_WORKSET; ++i)
+        a->alloc(live[i]);
+    for (int i = 0; i < CONV_CYCLES; ++i)
+    {
+        int k = benchRand()%CONV_WORKSET;
+        a->release(live[k]);
+        a->alloc(live[k]);
+    }
+    delete a;
+    double secs = nowSeconds()-beg;
+
+    report("conv", "ConvAllocator", secs, (uint64)CONV_CYCLES*2, 0);
+}
+
+static void benchConv()
+{
+    benchConvList();
+    benchConvAllocator();
+}
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+// 收包时按会话号查找管道: 开放寻址哈希表 vs 原先的 std::map
+static const int DEMUX_PACKETS = 5000000;
+
+struct DemuxBenchTun
+{
+    uint64 packets;
+};
+
+static void benchDemuxN(int ntunnels)
+{
+    ConvAllocator alloc;
+    std::vector<uint32> convs(ntunnels);
+    DemuxBenchTun *tunnels = new DemuxBenchTun[ntunnels];
+    std::map<uint32, DemuxBenchTun *> m;
+    ConvTable<DemuxBenchTun> t;
+    for (int i = 0; i < ntunnels; ++i)
+    {
+        alloc.alloc(convs[i]);
+        tunnels[i].packets = 0;
+        m.insert(std::make_pair(convs[i], &tunnels[i]));
+        t.insert(convs[i], &tunnels[i]);
+    }
+
+    char variant[32];
+    s_benchRand = 1;
+    double beg = nowSeconds();
+    for (int i = 0; i < DEMUX_PACKETS; ++i)
+    {
+        std::map<uint32, DemuxBenchTun *>::iterator it = m.find(convs[benchRand()%ntunnels]);
+        if (it != m.end())
+            ++it->second->packets;
+    }
+    double secs = nowSeconds()-beg;
+    snprintf(variant, sizeof(variant), "std::map/%d", ntunnels);
+    report("demux", variant, secs, DEMUX_PACKETS, 0);
+
+    s_benchRand = 1;
+    beg = nowSeconds();
+    for (int i = 0; i < DEMUX_PACKETS; ++i)
+    {
+        DemuxBenchTun *p = t.find(convs[benchRand()%ntunnels]);
+        if (p)
+            ++p->packets;
+    }
+    secs = nowSeconds()-beg;
+    snprintf(variant, sizeof(variant), "ConvTable/%d", ntunnels);
+    report("demux", variant, secs, DEMUX_PACKETS, 0);
+
+    uint64 total = 0;
+    for (int i = 0; i < ntunnels; ++i)
+        total += tunnels[i].packets;
+    assert(total == (uint64)DEMUX_PACKETS*2);
+    delete [] tunnels;
+}
+
+static void benchDemux()
+{
+    benchDemuxN(1000);
+    benchDemuxN(10000);
+    benchDemuxN(100000);
+}
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+// KCP: 各模式在模拟链路上的表现
+// 两端都在本进程内, 由虚拟时钟驱动, 同样的参数每次结果相同
+static const int KCP_BENCH_BYTES = 4*1024*1024;
+static const int KCP_BENCH_MSG = 4000;
+static const uint32 KCP_BENCH_TIMEOUT = 600*1000;
+
+struct KcpBenchEnd
+{
+    ikcpcb *kcp;
+    LossyLink *link; // 本端发出的方向
+    const uint32 *now;
+    uint64 wireBytes;
+};
+
+static int kcpBenchOutput(const char *buf, int len, ikcpcb *kcp, void *user)
+{
+    KcpBenchEnd *e = (KcpBenchEnd *)user;
+    e->wireBytes += len;
+    e->link->send(buf, len, *e->now);
+    return 0;
+}
+
+static ikcpcb* kcpBenchCreate(KcpBenchEnd *e, const KcpArg &arg)
+{
+    // 与 KcpTunnel::create 相同的设置
+    ikcpcb *kcp = ikcp_create(1, e);
+    kcp->output = kcpBenchOutput;
+    ikcp_nodelay(kcp, arg.nodelay, arg.interval, arg.resend, arg.nc);
+    ikcp_wndsize(kcp, arg.sndwnd > 0 ? arg.sndwnd : 32, arg.rcvwnd > 0 ? arg.rcvwnd : 32);
+    if (arg.minrto > 0)
+        kcp->rx_minrto = arg.minrto;
+    ikcp_setmtu(kcp, arg.mtu);
+    ikcp_sack(kcp, arg.sack);
+    return kcp;
+}
+
+struct KcpLinkResult
+{
+    uint64 recvd;
+    uint32 elapsed;
+    uint64 fwdBytes; // 发送端发出的字节数
+    uint64 revBytes; // 接收端发出的字节数, 即确认流量
+    uint32 rexmit;
+    LatencyHistogram latency;
+    uint32 mtu;       // 结束时发送端的MTU
+    uint32 settledAt; // 路径MTU探测结束的时刻
+};
+
+// 与 KcpTunnel::_applyPathMtu 相同: 原MTU超过新值两倍时等发送队列清空再调小
+static void kcpBenchApplyMtu(ikcpcb *kcp, const PathMtuProber &prober)
+{
+    uint32 mtu = prober.mtu();
+    if (0 == mtu || mtu == kcp->mtu)
+        return;
+    if (mtu < kcp->mtu && kcp->mtu > 2*mtu && (kcp->nsnd_buf > 0 || kcp->nsnd_que > 0))
+        return;
+    ikcp_setmtu(kcp, mtu);
+}
+
+// 端点 a 经 profile 链路向 b 单向发送 KCP_BENCH_BYTES, 两端参数可以不同;
+// 给出 prober 时 a 按 KcpTunnel 的方式探测路径MTU, 探测包带DF
+static void runKcpLink(const KcpArg &argA, const KcpArg &argB, const LinkProfile &profile, KcpLinkResult &r,
+                       PathMtuProber *prober = NULL)
+{
+    uint32 now = 0;
+    LossyLink ab(profile, 1), ba(profile, 2);
+    KcpBenchEnd a = {NULL, &ab, &now, 0}, b = {NULL, &ba, &now, 0};
+    a.kcp = kcpBenchCreate(&a, argA);
+    b.kcp = kcpBenchCreate(&b, argB);
+
+    char msg[KCP_BENCH_MSG];
+    memset(msg, 0x5a, sizeof(msg));
+    std::string pkt;
+    uint64 sent = 0, recvd = 0;
+    static char probe[PathMtuProber::MAX_MTU];
+    uint8 cmd = 0;
+    uint32 probeId = 0, probeSize = 0;
+    if (prober)
+        prober->start(argA.mtu, now);
+    r.settledAt = 0;
+    while (recvd < (uint64)KCP_BENCH_BYTES && now < KCP_BENCH_TIMEOUT)
+    {
+        while (ab.recv(pkt, now))
+        {
+            if (PathMtuProber::parse(pkt.data(), pkt.size(), cmd, probeId, probeSize))
+            {
+                if (PathMtuProber::CMD_PROBE == cmd)
+                {
+                    b.wireBytes += PathMtuProber::buildAck(probe, 1, probeId, probeSize);
+                    ba.send(probe, PathMtuProber::HEADER_SIZE, now);
+                }
+                continue;
+            }
+            ikcp_input(b.kcp, pkt.data(), pkt.size());
+        }
+        while (ba.recv(pkt, now))
+        {
+            if (PathMtuProber::parse(pkt.data(), pkt.size(), cmd, probeId, probeSize))
+            {
+                if (prober && PathMtuProber::CMD_PROBE_ACK == cmd)
+                    prober->onAck(probeId);
+                continue;
+            }
+            ikcp_input(a.kcp, pkt.data(), pkt.size());
+        }
+
+        if (prober)
+        {
+            prober->setProbeTimeout(2*a.kcp->rx_rto);
+            if (prober->poll(now, probeSize, probeId))
+            {
+                a.wireBytes += PathMtuProber::buildProbe(probe, 1, probeId, probeSize);
+                ab.send(probe, probeSize, now, true);
+            }
+            kcpBenchApplyMtu(a.kcp, *prober);
+            if (0 == r.settledAt && !prober->isSearching())
+                r.settledAt = now;
+        }
+
+        // 发送端按 KcpTunnel::_canFlush 的水位持续写入
+        while (sent < (uint64)KCP_BENCH_BYTES && ikcp_waitsnd(a.kcp) < 2*(int)a.kcp->snd_wnd)
+        {
+            memcpy(msg, &now, sizeof(now));
+            ikcp_send(a.kcp, msg, sizeof(msg));
+            sent += sizeof(msg);
+        }
+
+        ikcp_update(a.kcp, now);
+        ikcp_update(b.kcp, now);
+
+        int len = 0;
+        while ((len = ikcp_recv(b.kcp, msg, sizeof(msg))) > 0)
+        {
+            uint32 stamp = 0;
+            memcpy(&stamp, msg, sizeof(stamp));
+            r.latency.record(now-stamp);
+            recvd += len;
+        }
+
+        // 推进到下一个需要处理的时刻
+        uint32 next = min(ikcp_check(a.kcp, now), ikcp_check(b.kcp, now));
+        uint32 arrive = 0;
+        if (ab.nextArrival(arrive))
+            next = min(next, arrive);
+        if (ba.nextArrival(arrive))
+            next = min(next, arrive);
+        now = max(next, now+1);
+    }
+
+    r.recvd = recvd;
+    r.elapsed = now;
+    r.fwdBytes = a.wireBytes;
+    r.revBytes = b.wireBytes;
+    r.rexmit = a.kcp->xmit;
+    r.mtu = a.kcp->mtu;
+    ikcp_release(a.kcp);
+    ikcp_release(b.kcp);
+}
+
+static void benchKcpLink(const char *mode, const KcpArg &arg, const char *linkName, const LinkProfile &profile)
+{
+    KcpLinkResult r;
+    runKcpLink(arg, arg, profile, r);
+
+    char variant[64];
+    snprintf(variant, sizeof(variant), "%s/%s", mode, linkName);
+    if (r.recvd < (uint64)KCP_BENCH_BYTES)
+    {
+        printf("%-24s %-16s stalled! %llu/%d bytes in %u ms\n",
+               "kcp", variant, (unsigned long long)r.recvd, KCP_BENCH_BYTES, r.elapsed);
+    }
+    else
+    {
+        // 额外开销含包头、重传和确认包
+        printf("%-24s %-16s %8.1f KB/s p50 %6llu ms p99 %6llu ms overhead %6.1f%% rexmit %u\n",
+               "kcp", variant, r.recvd/1024.0/(r.elapsed*0.001),
+               (unsigned long long)r.latency.percentile(0.5),
+               (unsigned long long)r.latency.percentile(0.99),
+               (r.fwdBytes+r.revBytes)*100.0/r.recvd-100, r.rexmit);
+    }
+}
+
+static void benchKcp()
+{
+    static const struct
+    {
+        const char *name;
+        const KcpArg *arg;
+    } s_modes[] = {
+        {"Normal", &kcpmode::Normal},
+        {"Fast", &kcpmode::Fast},
+        {"Fast2", &kcpmode::Fast2},
+        {"Fast3", &kcpmode::Fast3},
+        {"Interactive", &kcpmode::Interactive},
+        {"Bulk", &kcpmode::Bulk},
+    };
+    static const struct
+    {
+        const char *name;
+        const LinkProfile *profile;
+    } s_links[] = {
+        {"clean", &linkprofile::Clean},
+        {"lossy", &linkprofile::Lossy},
+        {"burst", &linkprofile::Burst},
+        {"slow", &linkprofile::Slow},
+    };
+
+    for (size_t l = 0; l < sizeof(s_links)/sizeof(s_links[0]); ++l)
+    {
+        for (size_t m = 0; m < sizeof(s_modes)/sizeof(s_modes[0]); ++m)
+            benchKcpLink(s_modes[m].name, *s_modes[m].arg, s_links[l].name, *s_links[l].profile);
+    }
+}
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+// Sack: 逐个ACK与 una+区间 的SACK分片, 比较每收到1MB数据反向链路上的确认流量;
+// mixed 为发送端支持SACK而接收端不支持, 应退回逐个ACK
+static void benchSack()
+{
+    static const struct
+    {
+        const char *name;
+        int sackA;
+        int sackB;
+    } s_modes[] = {
+        {"ack", 0, 0},
+        {"sack", 1, 1},
+        {"mixed", 1, 0},
+    };
+    static const struct
+    {
+        const char *name;
+        const LinkProfile *profile;
+    } s_links[] = {
+        {"clean", &linkprofile::Clean},
+        {"lossy", &linkprofile::Lossy},
+        {"burst", &linkprofile::Burst},
+    };
+
+    for (size_t l = 0; l < sizeof(s_links)/sizeof(s_links[0]); ++l)
+    {
+        for (size_t m = 0; m < sizeof(s_modes)/sizeof(s_modes[0]); ++m)
+        {
+            KcpArg argA = kcpmode::Fast3, argB = kcpmode::Fast3;
+            argA.sack = s_modes[m].sackA;
+            argB.sack = s_modes[m].sackB;
+            KcpLinkResult r;
+            runKcpLink(argA, argB, *s_links[l].profile, r);
+
+            char variant[64];
+            snprintf(variant, sizeof(variant), "%s/%s", s_modes[m].name, s_links[l].name);
+            double mb = r.recvd/(1024.0*1024);
+            printf("%-24s %-16s %8.1f KB/s reverse %7.0f B/MB forward %8.0f B/MB rexmit %u%s\n",
+                   "sack", variant, r.recvd/1024.0/(r.elapsed*0.001), r.revBytes/mb, r.fwdBytes/mb,
+                   r.rexmit, r.recvd < (uint64)KCP_BENCH_BYTES ? " stalled!" : "");
+        }
+    }
+}
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+// Header: 经典24字节包头与紧凑包头的线上开销和编解码速度
+// 数据报按常见形态拼出: 字段取值与长时间运行的管道相近(时间戳、序号都已很大)
+static const int HEADER_ROUNDS = 200000;
+
+static void headerSegment(std::string &out, uint8 cmd, uint32 ts, uint32 sn, uint32 una, uint32 len)
+{
+    char hdr[24];
+    uint32 conv = 0x00501234;
+    uint16 wnd = 128;
+    memcpy(hdr, &conv, 4);
+    hdr[4] = (char)cmd;
+    hdr[5] = 0;
+    memcpy(hdr+6, &wnd, 2);
+    memcpy(hdr+8, &ts, 4);
+    memcpy(hdr+12, &sn, 4);
+    memcpy(hdr+16, &una, 4);
+    memcpy(hdr+20, &len, 4);
+    out.append(hdr, sizeof(hdr));
+    out.append(len, 'p');
+}
+
+static void benchHeaderShape(const char *variant, const std::string &dgram, size_t payload)
+{
+    char enc[2048], dec[4096];
+    long enclen = ikcp_encode_compact(dgram.data(), dgram.size(), enc);
+    long declen = enclen > 0 ? ikcp_decode_compact(enc, enclen, dec, sizeof(dec)) : -1;
+    if (enclen <= 0 || declen != (long)dgram.size() || memcmp(dec, dgram.data(), declen) != 0)
+    {
+        printf("%-24s %-16s roundtrip failed! %ld %ld\n", "header", variant, enclen, declen);
+        return;
+    }
+
+    // 结果写入 volatile, 避免循环被优化掉
+    volatile long sink = 0;
+    double beg = nowSeconds();
+    for (int i = 0; i < HEADER_ROUNDS; ++i)
+        sink = ikcp_encode_compact(dgram.data(), dgram.size(), enc);
+    double encSecs = nowSeconds()-beg;
+
+    beg = nowSeconds();
+    for (int i = 0; i < HEADER_ROUNDS; ++i)
+        sink = ikcp_decode_compact(enc, enclen, dec, sizeof(dec));
+    double decSecs = nowSeconds()-beg;
+
+    printf("%-24s %-16s header %4u -> %3ld bytes (datagram %4u -> %4ld)  encode %5.0f ns %6.0f MB/s  decode %5.0f ns %6.0f MB/s\n",
+           "header", variant, (unsigned)(dgram.size()-payload), enclen-(long)payload,
+           (unsigned)dgram.size(), enclen,
+           encSecs*1e9/HEADER_ROUNDS, dgram.size()*(double)HEADER_ROUNDS/encSecs/(1024*1024),
+           decSecs*1e9/HEADER_ROUNDS, dgram.size()*(double)HEADER_ROUNDS/decSecs/(1024*1024));
+    (void)sink;
+}
+
+static void benchHeader()
+{
+    const uint32 ts = 123456789, sn = 1000000, una = 500000;
+    std::string d;
+
+    // 交互: 回显数据顺带上一条的ACK
+    headerSegment(d, 82, ts-3, una-1, una, 0);
+    headerSegment(d, 81, ts, sn, una, 64);
+    benchHeaderShape("interactive", d, 64);
+
+    // 8条小消息在一次 flush 中合并
+    d.clear();
+    for (uint32 i = 0; i < 8; ++i)
+        headerSegment(d, 81, ts, sn+i, una, 100);
+    benchHeaderShape("small-msgs", d, 800);
+
+    // 整MSS的大块数据
+    d.clear();
+    headerSegment(d, 81, ts, sn, una, 1376);
+    benchHeaderShape("bulk", d, 1376);
+
+    // 旧版对端的逐个ACK
+    d.clear();
+    for (uint32 i = 0; i < 32; ++i)
+        headerSegment(d, 82, ts-40+i, una+i, una+32, 0);
+    benchHeaderShape("acks", d, 0);
+
+    // SACK: una + 2个区间
+    d.clear();
+    headerSegment(d, 85, ts, una+40, una+32, 8);
+    benchHeaderShape("sack", d, 8);
+}
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+// Pmtu: 固定 mtu=1400 与路径MTU探测, 路径MTU小于1400时固定值的数据报被IP分片, 任一片丢失即整包重传;
+// 路径MTU更大时探测到的值减少包头和包数, 同样的发送窗口下吞吐更高
+static void benchPmtu()
+{
+    //                                       rtt jitter loss  enter exit bloss reorder delay dup bandwidth queue mtu
+    static const LinkProfile s_tunnel = {60,  5,     0.02, 0,    0,   0,    0,      0,    0,  0,        0,    1252,};
+    static const LinkProfile s_pppoe  = {40,  5,     0.005,0,    0,   0,    0,      0,    0,  0,        0,    1464,};
+    static const LinkProfile s_jumbo  = {2,   0,     0,    0,    0,   0,    0,      0,    0,  0,        0,    8972,};
+    static const struct
+    {
+        const char *name;
+        const LinkProfile *profile;
+    } s_links[] = {
+        {"tunnel", &s_tunnel},
+        {"pppoe", &s_pppoe},
+        {"jumbo", &s_jumbo},
+    };
+
+    for (size_t l = 0; l < sizeof(s_links)/sizeof(s_links[0]); ++l)
+    {
+        for (int probe = 0; probe < 2; ++probe)
+        {
+            KcpArg arg = kcpmode::Fast3;
+            PathMtuProber prober;
+            KcpLinkResult r;
+            runKcpLink(arg, arg, *s_links[l].profile, r, probe ? &prober : NULL);
+
+            char variant[64], settled[32];
+            snprintf(variant, sizeof(variant), "%s/%s", probe ? "probe" : "fixed", s_links[l].name);
+            if (probe && r.settledAt > 0)
+                snprintf(settled, sizeof(settled), "%u ms", r.settledAt);
+            else
+                snprintf(settled, sizeof(settled), "-");
+            printf("%-24s %-16s %8.1f KB/s mtu %4u settled %8s overhead %6.1f%% rexmit %5u probes %3llu%s\n",
+                   "pmtu", variant, r.recvd/1024.0/(r.elapsed*0.001), r.mtu, settled,
+                   (r.fwdBytes+r.revBytes)*100.0/r.recvd-100, r.rexmit,
+                   (unsigned long long)prober.probesSent(),
+                   r.recvd < (uint64)KCP_BENCH_BYTES ? " stalled!" : "");
+        }
+    }
+}
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+// Accept: accept 后再设置非阻塞和 close-on-exec vs 一次 accept4
+static const int ACCEPT_CONNS = 20000;
+static const int ACCEPT_BATCH = 64;
+
+static void benchAcceptVariant(const char *variant, bool useAccept4)
+{
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrlen = sizeof(addr);
+
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (lfd < 0 || bind(lfd, (const SA *)&addr, sizeof(addr)) < 0 ||
+        listen(lfd, 1024) < 0 || getsockname(lfd, (SA *)&addr, &addrlen) < 0)
+    {
+        printf("%-24s %-16s listen failed! %s\n", "accept", variant, coreStrError());
+        if (lfd >= 0)
+            close(lfd);
+        return;
+    }
+
+    // 客户端以RST关闭, 不留 TIME_WAIT
+    struct linger lg = {1, 0};
+    int clients[ACCEPT_BATCH], accepted[ACCEPT_BATCH];
+    double secs = 0;
+    for (int done = 0; done < ACCEPT_CONNS; done += ACCEPT_BATCH)
+    {
+        for (int i = 0; i < ACCEPT_BATCH; ++i)
+        {
+            clients[i] = socket(AF_INET, SOCK_STREAM, 0);
+            setsockopt(clients[i], SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+            ::connect(clients[i], (const SA *)&addr, sizeof(addr));
+        }
+
+        double beg = nowSeconds();
+        for (int i = 0; i < ACCEPT_BATCH; ++i)
+        {
+            if (useAccept4)
+            {
+                accepted[i] = accept4(lfd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC);
+            }
+            else
+            {
+                accepted[i] = accept(lfd, NULL, NULL);
+                core::setNonblocking(accepted[i]);
+                fcntl(accepted[i], F_SETFD, FD_CLOEXEC);
+            }
+        }
+        secs += nowSeconds()-beg;
+
+        for (int i = 0; i < ACCEPT_BATCH; ++i)
+        {
+            close(clients[i]);
+            close(accepted[i]);
+        }
+    }
+    close(lfd);
+
+    report("accept", variant, secs, ACCEPT_CONNS, 0);
+}
+
+static void benchAccept()
+{
+    benchAcceptVariant("accept+fcntl", false);
+    benchAcceptVariant("accept4", true);
+}
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+// Idle: 空闲桥接的常驻内存, 休眠前后对比
+// 每个桥接按服务端计: 两个读过数据的TCP连接(内部连接和控制连接)加一个kcp管道.
+// 连接读入共享的 gRecvArena, 自身不持有接收缓冲区
+static const int IDLE_BRIDGES = 20000;
+
+static size_t residentBytes()
+{
+    // 释放的小块内存留在堆中, 先归还给系统再读RSS
+    malloc_trim(0);
+
+    long pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (NULL == fp)
+        return 0;
+    if (fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(fp);
+    return resident*sysconf(_SC_PAGESIZE);
+}
+
+static void reportResident(const char *variant, size_t bytes, double secs)
+{
+    printf("%-24s %-16s %10.3f ms %12.1f MB per 100k bridges\n",
+           "idle", variant, secs*1000, bytes*(100000.0/IDLE_BRIDGES)/(1024*1024));
+}
+
+static void benchIdle()
+{
+    static char payload[8*1024];
+    EpollPoller poller;
+    KcpTunnelGroup<true> group(&poller);
+    std::vector<Connection *> conns;
+    std::vector<KcpTunnel<true> *> tunnels;
+    size_t base = residentBytes();
+
+    double beg = nowSeconds();
+    for (int i = 0; i < IDLE_BRIDGES; ++i)
+    {
+        tunnels.push_back(static_cast<KcpTunnel<true> *>(group.createTunnel(i+1)));
+        for (int j = 0; j < 2; ++j)
+        {
+            // 收过一次整块数据; 关闭套接字只为不占用文件描述符
+            int sv[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+            {
+                printf("%-24s %-16s socketpair failed! %s\n", "idle", "active", coreStrError());
+                return;
+            }
+            core::setNonblocking(sv[0]);
+            Connection *pConn = new Connection(&poller);
+            pConn->acceptConnection(sv[0]);
+            ::send(sv[1], payload, sizeof(payload), 0);
+            pConn->handleInputNotification(sv[0]);
+            pConn->shutdown();
+            close(sv[1]);
+            conns.push_back(pConn);
+        }
+    }
+    reportResident("active", residentBytes()-base, nowSeconds()-beg);
+
+    beg = nowSeconds();
+    for (size_t i = 0; i < tunnels.size(); ++i)
+        tunnels[i]->hibernate();
+    reportResident("hibernated", residentBytes()-base, nowSeconds()-beg);
+
+    for (size_t i = 0; i < conns.size(); ++i)
+        delete conns[i];
+    group.shutdown();
+}
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+// Fair: 大流量连接与交互连接、kcp更新定时器共用一个事件循环
+// 后台线程持续向若干连接灌数据, 另一个线程每毫秒向交互连接写一个时间戳;
+// 统计交互消息从写入到被处理的延迟, 以及10ms周期定时器的触发延迟
+static const int FAIR_BULK_CONNS = 8;
+static const int FAIR_SECS = 2;
+static const uint32 FAIR_TIMER_INTERVAL = 10;
+
+struct FairState
+{
+    int bulkFds[FAIR_BULK_CONNS];
+    int pingFd;
+    volatile bool running;
+};
+
+static void* fairBulkWriter(void *arg)
+{
+    FairState *st = (FairState *)arg;
+    static char chunk[256*1024];
+    while (st->running)
+    {
+        for (int i = 0; i < FAIR_BULK_CONNS && st->running; ++i)
+        {
+            if (::send(st->bulkFds[i], chunk, sizeof(chunk), 0) < 0 && errno != EAGAIN)
+                return NULL;
+        }
+    }
+    return NULL;
+}
+
+static void* fairPingWriter(void *arg)
+{
+    FairState *st = (FairState *)arg;
+    while (st->running)
+    {
+        uint64 stamp = core::getTimeStamp();
+        ::send(st->pingFd, &stamp, sizeof(stamp), 0);
+        usleep(1000);
+    }
+    return NULL;
+}
+
+class FairSink : public Connection::Handler, public WheelTimer::Handler
+{
+  public:
+    FairSink() : bytes(0), ping(), timer(), mPending(), mCopy(), mTimer(this), mExpire(0) {}
+
+    void start()
+    {
+        mExpire = getMonoClock()+FAIR_TIMER_INTERVAL;
+        gTimerWheel.schedule(&mTimer, mExpire);
+    }
+
+    virtual void onRecv(Connection *pConn, const void *data, size_t datalen)
+    {
+        if (pConn != pingConn)
+        {
+            // 模拟转发时拷贝进kcp发送队列的开销
+            mCopy.assign((const char *)data, datalen);
+            bytes += datalen;
+            return;
+        }
+
+        mPending.append((const char *)data, datalen);
+        uint64 now = core::getTimeStamp();
+        size_t off = 0;
+        for (; off+sizeof(uint64) <= mPending.size(); off += sizeof(uint64))
+            ping.record(now-*(const uint64 *)(mPending.data()+off));
+        mPending.erase(0, off);
+    }
+
+    virtual void onTimeout(WheelTimer *pTimer)
+    {
+        timer.record(getMonoClock()-mExpire);
+        mExpire += FAIR_TIMER_INTERVAL;
+        gTimerWheel.schedule(&mTimer, mExpire);
+    }
+
+    Connection *pingConn;
+    uint64 bytes;
+    LatencyHistogram ping;  // 时间戳计数
+    LatencyHistogram timer; // 毫秒
+
+  private:
+    std::string mPending;
+    std::string mCopy;
+    WheelTimer mTimer;
+    uint32 mExpire;
+};
+
+static void benchFairVariant(const char *variant, size_t budget, bool serveTimers)
+{
+    EpollPoller epoll;
+    EventPoller &poller = epoll;
+    if (serveTimers)
+        poller.setTimerWheel(&gTimerWheel);
+    Connection::setReadBudget(budget);
+
+    FairState st;
+    st.running = true;
+    FairSink sink;
+    std::vector<Connection *> conns;
+    for (int i = 0; i <= FAIR_BULK_CONNS; ++i)
+    {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+        {
+            printf("%-24s %-16s socketpair failed! %s\n", "fair", variant, coreStrError());
+            return;
+        }
+        // 大缓冲区让一次读事件能积压足够多的数据
+        int bufsize = 4*1024*1024;
+        setsockopt(sv[0], SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+        setsockopt(sv[1], SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+        core::setNonblocking(sv[0]);
+        Connection *pConn = new Connection(&poller);
+        pConn->acceptConnection(sv[0]);
+        pConn->setEventHandler(&sink);
+        conns.push_back(pConn);
+        if (i < FAIR_BULK_CONNS)
+            st.bulkFds[i] = sv[1];
+        else
+            st.pingFd = sv[1];
+    }
+    sink.pingConn = conns.back();
+
+    pthread_t bulk, ping;
+    pthread_create(&bulk, NULL, fairBulkWriter, &st);
+    pthread_create(&ping, NULL, fairPingWriter, &st);
+    gTimerWheel.process(getMonoClock());
+    sink.start();
+
+    // 与 server.cpp 的主循环相同
+    double beg = nowSeconds();
+    double maxWait = 0;
+    while (nowSeconds()-beg < FAIR_SECS)
+    {
+        poller.processPendingEvents(maxWait);
+        gTimerWheel.process(getMonoClock());
+        maxWait = min(gTimerWheel.nextExpire(), (uint32)100)*0.001;
+    }
+    double secs = nowSeconds()-beg;
+
+    st.running = false;
+    for (size_t i = 0; i < conns.size(); ++i)
+        delete conns[i];
+    for (int i = 0; i < FAIR_BULK_CONNS; ++i)
+        close(st.bulkFds[i]);
+    close(st.pingFd);
+    pthread_join(bulk, NULL);
+    pthread_join(ping, NULL);
+
+    double usPerStamp = 1e6/core::stampsPerSecond();
+    printf("%-24s %-16s %8.1f MB/s  ping p50 %6.0f us  p99 %6.0f us  timer p99 %3llu ms  max %3llu ms\n",
+           "fair", variant, sink.bytes/secs/(1024*1024),
+           sink.ping.percentile(0.5)*usPerStamp, sink.ping.percentile(0.99)*usPerStamp,
+           (unsigned long long)sink.timer.percentile(0.99), (unsigned long long)sink.timer.max());
+}
+
+static void benchFair()
+{
+    benchFairVariant("unbounded", 0, false);
+    benchFairVariant("budget", Connection::DEFAULT_READ_BUDGET, true);
+    Connection::setReadBudget(Connection::DEFAULT_READ_BUDGET);
+}
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+// Clock: 事件循环按整毫秒等待 vs 精确到微秒等待, 对kcp往返时延的影响
+// 两个kcp端点经本机数据报套接字相连, 由 gTimerWheel 按 ikcp_check 驱动, 与 KcpTunnel 相同;
+// 另一个线程不定时地向发起端写入触发, 发起端把时间戳交给kcp, 对端原样回显
+static const int CLOCK_SECS = 3;
+
+struct ClockEnd : public InputNotificationHandler, public WheelTimer::Handler
+{
+    ikcpcb *kcp;
+    int fd;
+    int triggerFd;
+    bool echo;
+    WheelTimer timer;
+    uint32 expire;
+    LatencyHistogram rtt;
+    LatencyHistogram late; // kcp更新比预约时刻晚了多少微秒
+    double sum, sumSq;
+
+    ClockEnd() : kcp(NULL), fd(-1), triggerFd(-1), echo(false), timer(this), expire(0), rtt(), late(), sum(0), sumSq(0) {}
+
+    virtual int handleInputNotification(int s)
+    {
+        char buf[2048];
+        if (s == triggerFd)
+        {
+            while (recv(triggerFd, buf, sizeof(buf), 0) > 0) {}
+            uint64 stamp = core::getTimeStamp();
+            ikcp_send(kcp, (const char *)&stamp, sizeof(stamp));
+            return 0;
+        }
+
+        int len = 0;
+        while ((len = recv(fd, buf, sizeof(buf), 0)) > 0)
+            ikcp_input(kcp, buf, len);
+        while ((len = ikcp_recv(kcp, buf, sizeof(buf))) > 0)
+        {
+            if (echo)
+            {
+                ikcp_send(kcp, buf, len);
+                continue;
+            }
+
+            uint64 stamp = 0;
+            memcpy(&stamp, buf, sizeof(stamp));
+            double us = (core::getTimeStamp()-stamp)*1e6/core::stampsPerSecond();
+            rtt.record((uint64)us);
+            sum += us;
+            sumSq += us*us;
+        }
+        return 0;
+    }
+
+    virtual void onTimeout(WheelTimer *pTimer)
+    {
+        uint64 nowUs = getMonoClockUs();
+        late.record(nowUs-(uint64)expire*1000);
+        uint32 now = (uint32)(nowUs/1000);
+        ikcp_update(kcp, now);
+        expire = ikcp_check(kcp, now);
+        gTimerWheel.schedule(&timer, expire);
+    }
+};
+
+static int clockKcpOutput(const char *buf, int len, ikcpcb *kcp, void *user)
+{
+    ::send(((ClockEnd *)user)->fd, buf, len, 0);
+    return 0;
+}
+
+static void* clockTriggerWriter(void *arg)
+{
+    FairState *st = (FairState *)arg;
+    uint32 seed = 1;
+    while (st->running)
+    {
+        char c = 0;
+        ::send(st->pingFd, &c, 1, 0);
+        seed = seed*1103515245+12345;
+        usleep(3000+(seed>>16)%5000);
+    }
+    return NULL;
+}
+
+static void benchClockVariant(const char *variant, bool precise)
+{
+    EpollPoller epoll;
+    EventPoller &poller = epoll;
+    int sv[2], tv[2];
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0 || socketpair(AF_UNIX, SOCK_DGRAM, 0, tv) < 0)
+    {
+        printf("%-24s %-16s socketpair failed! %s\n", "clock", variant, coreStrError());
+        return;
+    }
+
+    ClockEnd a, b;
+    ClockEnd *ends[2] = {&a, &b};
+    b.echo = true;
+    a.triggerFd = tv[0];
+    for (int i = 0; i < 2; ++i)
+    {
+        ClockEnd *e = ends[i];
+        e->fd = sv[i];
+        core::setNonblocking(e->fd);
+        e->kcp = ikcp_create(1, e);
+        e->kcp->output = clockKcpOutput;
+        ikcp_nodelay(e->kcp, kcpmode::Fast3.nodelay, kcpmode::Fast3.interval, kcpmode::Fast3.resend, kcpmode::Fast3.nc);
+        ikcp_setmtu(e->kcp, kcpmode::Fast3.mtu);
+        poller.registerForRead(e->fd, e);
+        e->expire = getMonoClock();
+        gTimerWheel.schedule(&e->timer, e->expire);
+    }
+    core::setNonblocking(tv[0]);
+    poller.registerForRead(tv[0], &a);
+
+    FairState st;
+    st.running = true;
+    st.pingFd = tv[1];
+    pthread_t trigger;
+    pthread_create(&trigger, NULL, clockTriggerWriter, &st);
+
+    // 与 server.cpp 的主循环相同, 只有等待时长的算法不同
+    double beg = nowSeconds();
+    double maxWait = 0;
+    while (nowSeconds()-beg < CLOCK_SECS)
+    {
+        poller.processPendingEvents(maxWait);
+        gTimerWheel.process(getMonoClock());
+        if (precise)
+            maxWait = gTimerWheel.nextWait(100);
+        else
+            maxWait = min(gTimerWheel.nextExpire(), (uint32)100)*0.001;
+    }
+
+    st.running = false;
+    pthread_join(trigger, NULL);
+    for (int i = 0; i < 2; ++i)
+    {
+        ClockEnd *e = ends[i];
+        e->timer.cancel();
+        poller.deregisterForRead(e->fd);
+        ikcp_release(e->kcp);
+        close(e->fd);
+    }
+    poller.deregisterForRead(tv[0]);
+    close(tv[0]);
+    close(tv[1]);
+
+    uint64 n = a.rtt.count();
+    double mean = n > 0 ? a.sum/n : 0;
+    double stddev = n > 0 ? sqrt(max(a.sumSq/n-mean*mean, 0.0)) : 0;
+    printf("%-24s %-16s rtt mean %6.0f us  stddev %5.0f us  p50 %6llu us  p99 %6llu us"
+           "  update late p50 %5llu us  p99 %5llu us\n",
+           "clock", variant, mean, stddev,
+           (unsigned long long)a.rtt.percentile(0.5), (unsigned long long)a.rtt.percentile(0.99),
+           (unsigned long long)a.late.percentile(0.5), (unsigned long long)a.late.percentile(0.99));
+}
+
+static void benchClock()
+{
+    benchClockVariant("ms", false);
+    benchClockVariant("precise", true);
+}
+//--------------------------------------------------------------------------
+
+struct BenchCase
+{
+    const char *name;
+    void (*func)();
+};
+
+//--------------------------------------------------------------------------
+// Stream: 交互式小块写入在消息模式和流模式下的报文数和延迟
+// 一对 KcpTunnel 经本机UDP相连, 由 gTimerWheel 驱动; 每隔一段时间随机写入0~n条64字节的记录,
+// 记录带发送时间戳, 接收端按记录边界拆出后统计延迟. 报文数取 /proc/net/snmp 的UDP发出计数, 含ACK
+static const int STREAM_SECS = 3;
+static const size_t STREAM_RECORD = 64;
+
+static uint64 udpOutDatagrams()
+{
+    FILE *fp = fopen("/proc/net/snmp", "r");
+    if (NULL == fp)
+        return 0;
+
+    // 第一行 Udp: 是字段名, 第二行是数值
+    char line[512];
+    unsigned long long out = 0;
+    bool header = true;
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (strncmp(line, "Udp:", 4) != 0)
+            continue;
+        if (header)
+        {
+            header = false;
+            continue;
+        }
+        unsigned long long in = 0, noports = 0, errs = 0;
+        sscanf(line+4, "%llu %llu %llu %llu", &in, &noports, &errs, &out);
+        break;
+    }
+    fclose(fp);
+    return out;
+}
+
+class StreamSink : public KcpTunnelHandler, public WheelTimer::Handler
+{
+  public:
+    StreamSink(ITunnel *pTunnel, uint32 tick = 1, int maxPerTick = 0)
+            :bytes(0), latency(), mpTunnel(pTunnel), mTick(tick), mMaxPerTick(maxPerTick), mPending(), mTimer(this), mSeed(1)
+    {}
+
+    void start()
+    {
+        gTimerWheel.schedule(&mTimer, getMonoClock()+mTick, mTick);
+    }
+    void stop()
+    {
+        mTimer.cancel();
+    }
+
+    virtual void onTimeout(WheelTimer *pTimer)
+    {
+        mSeed = mSeed*1103515245+12345;
+        int n = (mSeed>>16)%(mMaxPerTick+1);
+        char rec[STREAM_RECORD];
+        memset(rec, 0x5a, sizeof(rec));
+        for (int i = 0; i < n; ++i)
+        {
+            uint64 stamp = core::getTimeStamp();
+            memcpy(rec, &stamp, sizeof(stamp));
+            mpTunnel->send(rec, sizeof(rec));
+        }
+    }
+
+    virtual void onRecv(const void *data, size_t datalen)
+    {
+        mPending.append((const char *)data, datalen);
+        uint64 now = core::getTimeStamp();
+        size_t off = 0;
+        for (; off+STREAM_RECORD <= mPending.size(); off += STREAM_RECORD)
+        {
+            uint64 stamp = 0;
+            memcpy(&stamp, mPending.data()+off, sizeof(stamp));
+            latency.record(now-stamp);
+        }
+        bytes += off;
+        mPending.erase(0, off);
+    }
+
+    uint64 bytes;
+    LatencyHistogram latency;
+
+  private:
+    ITunnel *mpTunnel;
+    uint32 mTick;
+    int mMaxPerTick;
+    std::string mPending;
+    WheelTimer mTimer;
+    uint32 mSeed;
+};
+
+static void benchStreamVariant(const char *mode, int stream, const char *load, uint32 tick, int maxPerTick,
+                               unsigned short port)
+{
+    char variant[64];
+    snprintf(variant, sizeof(variant), "%s/%s", mode, load);
+
+    EpollPoller epoll;
+    EventPoller &poller = epoll;
+    sockaddr_in addr;
+    char addrStr[32];
+    snprintf(addrStr, sizeof(addrStr), "127.0.0.1:%u", port);
+    core::str2Ipv4(addrStr, addr);
+
+    KcpTunnelGroup<true> svrGroup(&poller);
+    KcpTunnelGroup<false> cliGroup(&poller);
+    if (!svrGroup.create((const SA *)&addr, sizeof(addr)) || !cliGroup.create((const SA *)&addr, sizeof(addr)))
+    {
+        printf("%-24s %-16s create tunnel group failed! %s\n", "stream", variant, coreStrError());
+        return;
+    }
+    KcpArg arg = kcpmode::Fast3;
+    arg.stream = stream;
+    cliGroup.setKcpMode(arg);
+
+    ITunnel *cli = cliGroup.createTunnel(1);
+    ITunnel *svr = svrGroup.createTunnel(1);
+    StreamSink writer(cli, tick, maxPerTick), reader(svr);
+    svr->setEventHandler(&reader);
+
+    gTimerWheel.process(getMonoClock());
+    uint64 datagrams = udpOutDatagrams();
+    writer.start();
+
+    double beg = nowSeconds();
+    double maxWait = 0;
+    while (nowSeconds()-beg < STREAM_SECS)
+    {
+        poller.processPendingEvents(maxWait);
+        gTimerWheel.process(getMonoClock());
+        maxWait = gTimerWheel.nextWait(100);
+    }
+    writer.stop();
+    datagrams = udpOutDatagrams()-datagrams;
+
+    double usPerStamp = 1e6/core::stampsPerSecond();
+    printf("%-24s %-16s %8.0f datagrams/MB  p50 %6.0f us  p99 %6.0f us  (%.1f KB/s)\n",
+           "stream", variant, reader.bytes > 0 ? datagrams/(reader.bytes/(1024.0*1024)) : 0,
+           reader.latency.percentile(0.5)*usPerStamp, reader.latency.percentile(0.99)*usPerStamp,
+           reader.bytes/1024.0/STREAM_SECS);
+
+    cliGroup.shutdown();
+    svrGroup.shutdown();
+}
+
+static void benchStream()
+{
+    benchStreamVariant("message", 0, "sparse", 25, 1, 25460);
+    benchStreamVariant("stream", 1, "sparse", 25, 1, 25461);
+    benchStreamVariant("message", 0, "light", 1, 1, 25462);
+    benchStreamVariant("stream", 1, "light", 1, 1, 25463);
+    benchStreamVariant("message", 0, "burst", 1, 4, 25464);
+    benchStreamVariant("stream", 1, "burst", 1, 4, 25465);
+}
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+// Ack: ACK的发送时机对ACK报文数和往返时延的影响
+// 一对 KcpTunnel 经本机UDP相连: bulk 持续单向发送, 统计每个数据报对应的纯ACK报文数;
+// ping 每5ms发一条带时间戳的记录, 对端回显, 统计往返时延
+static const int ACK_SECS = 3;
+static const size_t ACK_BULK_CHUNK = 16*1024;
+
+class AckPeer : public KcpTunnelHandler, public WheelTimer::Handler
+{
+  public:
+    AckPeer(ITunnel *pTunnel, bool bulk, bool echo)
+            :bytes(0), rtt(), mpTunnel(pTunnel), mbBulk(bulk), mbEcho(echo), mPending(), mTimer(this)
+    {}
+
+    void start()
+    {
+        gTimerWheel.schedule(&mTimer, getMonoClock()+1, mbBulk ? 1 : 5);
+    }
+    void stop()
+    {
+        mTimer.cancel();
+    }
+
+    virtual void onTimeout(WheelTimer *pTimer)
+    {
+        static char chunk[ACK_BULK_CHUNK];
+        if (mbBulk)
+        {
+            while (mpTunnel->getCachedSize() < ACK_BULK_CHUNK)
+                mpTunnel->send(chunk, sizeof(chunk));
+            return;
+        }
+
+        char rec[STREAM_RECORD];
+        memset(rec, 0, sizeof(rec));
+        uint64 stamp = core::getTimeStamp();
+        memcpy(rec, &stamp, sizeof(stamp));
+        mpTunnel->send(rec, sizeof(rec));
+    }
+
+    virtual void onRecv(const void *data, size_t datalen)
+    {
+        bytes += datalen;
+        if (mbEcho)
+        {
+            mpTunnel->send(data, datalen);
+            return;
+        }
+        if (mbBulk)
+            return;
+
+        mPending.append((const char *)data, datalen);
+        uint64 now = core::getTimeStamp();
+        size_t off = 0;
+        for (; off+STREAM_RECORD <= mPending.size(); off += STREAM_RECORD)
+        {
+            uint64 stamp = 0;
+            memcpy(&stamp, mPending.data()+off, sizeof(stamp));
+            rtt.record(now-stamp);
+        }
+        mPending.erase(0, off);
+    }
+
+    uint64 bytes;
+    LatencyHistogram rtt;
+
+  private:
+    ITunnel *mpTunnel;
+    bool mbBulk;
+    bool mbEcho;
+    std::string mPending;
+    WheelTimer mTimer;
+};
+
+static void benchAckVariant(const char *load, bool bulk, const char *mode, int ackdelay, unsigned short port)
+{
+    char variant[64];
+    snprintf(variant, sizeof(variant), "%s/%s", load, mode);
+
+    EpollPoller epoll;
+    EventPoller &poller = epoll;
+    sockaddr_in addr;
+    char addrStr[32];
+    snprintf(addrStr, sizeof(addrStr), "127.0.0.1:%u", port);
+    core::str2Ipv4(addrStr, addr);
+
+    KcpTunnelGroup<true> svrGroup(&poller);
+    KcpTunnelGroup<false> cliGroup(&poller);
+    if (!svrGroup.create((const SA *)&addr, sizeof(addr)) || !cliGroup.create((const SA *)&addr, sizeof(addr)))
+    {
+        printf("%-24s %-16s create tunnel group failed! %s\n", "ack", variant, coreStrError());
+        return;
+    }
+    KcpArg arg = kcpmode::Fast3;
+    arg.ackdelay = ackdelay;
+    svrGroup.setKcpMode(arg);
+    cliGroup.setKcpMode(arg);
+
+    KcpTunnel<false> *cli = static_cast<KcpTunnel<false> *>(cliGroup.createTunnel(1));
+    KcpTunnel<true> *svr = static_cast<KcpTunnel<true> *>(svrGroup.createTunnel(1));
+    AckPeer sender(cli, bulk, false), receiver(svr, bulk, !bulk);
+    cli->setEventHandler(&sender);
+    svr->setEventHandler(&receiver);
+
+    gTimerWheel.process(getMonoClock());
+    sender.start();
+
+    double beg = nowSeconds();
+    double maxWait = 0;
+    while (nowSeconds()-beg < ACK_SECS)
+    {
+        poller.processPendingEvents(maxWait);
+        gTimerWheel.process(getMonoClock());
+        maxWait = gTimerWheel.nextWait(100);
+    }
+    sender.stop();
+
+    // 数据报: 发送端收到的纯ACK报文 / 接收端收到的含数据报文
+    uint64 dataPackets = svr->packetsRecv()-svr->ackPacketsRecv();
+    uint64 ackPackets = cli->ackPacketsRecv();
+    double usPerStamp = 1e6/core::stampsPerSecond();
+    if (bulk)
+    {
+        printf("%-24s %-16s %8.1f MB/s  %5.3f ack-only/data packet\n",
+               "ack", variant, receiver.bytes/(1024.0*1024)/ACK_SECS,
+               dataPackets > 0 ? (double)ackPackets/dataPackets : 0);
+    }
+    else
+    {
+        // 回显的数据顺带ACK, 不再统计纯ACK报文
+        printf("%-24s %-16s rtt p50 %6.0f us  p99 %6.0f us\n",
+               "ack", variant, sender.rtt.percentile(0.5)*usPerStamp, sender.rtt.percentile(0.99)*usPerStamp);
+    }
+
+    cliGroup.shutdown();
+    svrGroup.shutdown();
+}
+
+static void benchAck()
+{
+    static const struct
+    {
+        const char *name;
+        int ackdelay;
+    } s_modes[] = {
+        {"interval", -1},
+        {"batch", 0},
+        {"delay2", 2},
+    };
+
+    unsigned short port = 25470;
+    for (int bulk = 1; bulk >= 0; --bulk)
+    {
+        for (size_t m = 0; m < sizeof(s_modes)/sizeof(s_modes[0]); ++m)
+            benchAckVariant(bulk ? "bulk" : "ping", bulk != 0, s_modes[m].name, s_modes[m].ackdelay, port++);
+    }
+}
+//--------------------------------------------------------------------------
+
+static BenchCase s_benchCases[] = {
+    {"cache", benchCache},
+    {"timer", benchTimer},
+    {"conv", benchConv},
+    {"demux", benchDemux},
+    {"kcp", benchKcp},
+    {"accept", benchAccept},
+    {"idle", benchIdle},
+    {"fair", benchFair},
+    {"clock", benchClock},
+    {"stream", benchStream},
+    {"ack", benchAck},
+    {"sack", benchSack},
+    {"header", benchHeader},
+    {"pmtu", benchPmtu},
+};
+
+int main(int argc, char *argv[])
+{
+    core::createTrace();
+    core::output2File("bench.log");
+
+    int ncases = sizeof(s_benchCases)/sizeof(s_benchCases[0]);
+    for (int i = 0; i < ncases; ++i)
+    {
+        bool run = argc <= 1;
+        for (int j = 1; j < argc && !run; ++j)
+            run = strcmp(argv[j], s_benchCases[i].name) == 0;
+
+        if (run)
+            s_benchCases[i].func();
+    }
+
+    core::closeTrace();
+    exit(0);
+}
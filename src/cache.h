@@ -3,31 +3,44 @@
 
 #include "fasttun_base.h"
 #include "disk_cache.h"
+#include "cache_budget.h"
+#include "ring_buffer.h"
+#include "stats.h"
+#include "latency.h"
+
+#include <deque>
 
 NAMESPACE_BEG(tun)
 
 template <class T, int MAX_LEN_CACHE_IN_MEM = 256*1024>
-class Cache
+class Cache : public CacheBudget::ICache, public DiskCache::Handler, public StatsSource
 {
     typedef bool (T::*FuncType)(const void *, size_t);
+    typedef void (T::*ReadyFuncType)();
   public:
-    Cache(T *host, FuncType func)
+    // onReady: flushAll 因磁盘数据尚未读回而中断后, 数据就绪时回调宿主重新 flush
+    Cache(T *host, FuncType func, ReadyFuncType onReady = NULL)
             :mHost(host)
             ,mFunc(func)
-            ,mCachedList()
+            ,mOnReady(onReady)
+            ,mMemCache()
             ,mDiskCache()
             ,mLenCacheInMem(0)
             ,mLenCacheInFile(0)
-    {}
+            ,mbStalled(false)
+            ,mStatsId(0)
+            ,mTags()
+    {
+        mDiskCache.setHandler(this);
+        gCacheBudget.regCache(this);
+        mStatsId = gStats.add(this);
+    }
 
     virtual ~Cache()
     {
-        typename DataList::iterator it = this->mCachedList.begin();
-        for (; it != this->mCachedList.end(); ++it)
-        {
-            free((*it).data);
-        }
-        this->mCachedList.clear();
+        clear();
+        gCacheBudget.unregCache(this);
+        gStats.remove(this);
     }
 
     bool empty() const
@@ -35,13 +48,31 @@ class Cache
         return 0 == mLenCacheInMem && 0 == mLenCacheInFile;
     }
 
+    inline size_t memSize() const
+    {
+        return mLenCacheInMem;
+    }
+    inline size_t diskSize() const
+    {
+        return mLenCacheInFile;
+    }
+    inline size_t size() const
+    {
+        return mLenCacheInMem+mLenCacheInFile;
+    }
+
     void cache(const void *data, size_t len)
     {
         assert(len > 0 && "cache() && len>0");
 
+        // 记录数据入口, 冲刷时恢复, 延迟统计才能算上在缓存中的时间
+        mTags.push_back(gLatency.ingress);
+
         // cache in file
-        if (mLenCacheInMem+len > MAX_LEN_CACHE_IN_MEM || mLenCacheInFile > 0)
+        if (mLenCacheInMem+len > MAX_LEN_CACHE_IN_MEM || mLenCacheInFile > 0 ||
+            !gCacheBudget.canCacheInMem(len))
         {
+            // 转存的数据由 DiskCache 计入预算; 暂存块仍在内存中, 超出的部分由 CacheBudget::update 转存回落
             int ret = mDiskCache.write(data, len);
             if (ret == (int)len)
             {
@@ -53,85 +84,139 @@ class Cache
         }
 
         // cache in mem
-        Data d;
         mLenCacheInMem += len;
-        d.len = len;
-        d.data = (char *)malloc(len);
-        assert(d.data != NULL && "cache() malloc failed");
-        memcpy(d.data, data, len);
-        this->mCachedList.push_back(d);
+        gCacheBudget.onMemAlloc(len);
+        mMemCache.push(data, len);
     }
 
     void clear()
     {
-        typename DataList::iterator it = this->mCachedList.begin();
-        for (; it != this->mCachedList.end(); ++it)
-        {
-            free((*it).data);
-        }
-        this->mCachedList.clear();
+        mMemCache.clear();
+        gCacheBudget.onMemFree(mLenCacheInMem);
+        mLenCacheInMem = 0;
 
         mDiskCache.clear();
+        mLenCacheInFile = 0;
+
+        mTags.clear();
+        mbStalled = false;
     }
 
+    // 返回 false 时缓存中仍有数据, 宿主须继续缓存新数据以保证顺序
     bool flushAll()
     {
-        typename DataList::iterator it = this->mCachedList.begin();
-        for (; it != this->mCachedList.end(); )
+        // 宿主回调中不能再向本缓存写入, 否则记录指针可能失效
+        size_t sz = 0;
+        for (const void *ptr = mMemCache.front(sz); ptr != NULL; ptr = mMemCache.front(sz))
         {
-            if ((mHost->*mFunc)((*it).data, (*it).len))
-            {
-                mLenCacheInMem -= (*it).len;
-                free((*it).data);
-                mCachedList.erase(it++);
-            }
-            else
-            {
+            if (!_flushOne(ptr, sz))
                 return false;
-            }
+
+            mLenCacheInMem -= sz;
+            gCacheBudget.onMemFree(sz);
+            mMemCache.pop();
         }
 
-        for (ssize_t sz = mDiskCache.peeksize(); sz > 0; sz = mDiskCache.peeksize())
+        for (const void *ptr = mDiskCache.peek(sz); ptr != NULL; ptr = mDiskCache.peek(sz))
         {
-            char *ptr = (char *)malloc(sz);
-            if (NULL == ptr)
-            {
-                ErrorPrint("malloc failed size=%lld", sz);
-                assert(false);
-            }
-            assert(mDiskCache.read(ptr, sz) == sz);
+            if (!_flushOne(ptr, sz))
+                return false;
 
-            if ((mHost->*mFunc)(ptr, sz))
-            {
-                mLenCacheInFile -= sz;
-                free(ptr);
-            }
-            else
+            mLenCacheInFile -= sz;
+            mDiskCache.pop();
+        }
+
+        if (!mDiskCache.empty())
+        {
+            // 数据还在从磁盘读回, 读回后经 onDiskCacheReadable 通知
+            mbStalled = true;
+            return false;
+        }
+
+        return true;
+    }
+
+    // CacheBudget::ICache
+    virtual size_t spillableSize() const
+    {
+        // 磁盘中已有数据时内存里的是更早的数据, 转存会打乱顺序
+        size_t sz = mDiskCache.stagingSize();
+        return 0 == mLenCacheInFile ? sz+mLenCacheInMem : sz;
+    }
+
+    virtual void spill()
+    {
+        if (mLenCacheInFile > 0)
+        {
+            mDiskCache.commit();
+            return;
+        }
+
+        size_t sz = 0;
+        for (const void *ptr = mMemCache.front(sz); ptr != NULL; ptr = mMemCache.front(sz))
+        {
+            int ret = mDiskCache.write(ptr, sz);
+            if (ret != (int)sz)
             {
-                free(ptr);
-                mDiskCache.rollback(sz);
-                return false;
+                ErrorPrint("Cache::spill() write to file failed! return code:%d", ret);
+                break;
             }
+
+            mLenCacheInMem -= sz;
+            mLenCacheInFile += sz;
+            gCacheBudget.onMemFree(sz);
+            mMemCache.pop();
         }
+        mDiskCache.commit();
+    }
 
-        return true;
+    // StatsSource
+    virtual void collectStats(StatsWriter &w)
+    {
+        // 空缓存占绝大多数, 不输出
+        if (empty())
+            return;
+
+        w.gauge("fasttun_cache_mem_bytes", "cache", mStatsId, mLenCacheInMem);
+        w.gauge("fasttun_cache_disk_bytes", "cache", mStatsId, mLenCacheInFile);
+    }
+
+    // DiskCache::Handler
+    virtual void onDiskCacheReadable()
+    {
+        if (mbStalled)
+        {
+            mbStalled = false;
+            if (mOnReady)
+                (mHost->*mOnReady)();
+        }
     }
 
   private:
-    struct Data
+    // 内存和磁盘中的记录都按写入顺序冲刷, 与 mTags 一一对应
+    bool _flushOne(const void *ptr, size_t sz)
     {
-        size_t len;
-        char *data;
-    };
+        assert(!mTags.empty() && "Cache::_flushOne() tags mismatch");
 
-    typedef std::list<Data> DataList;
+        IngressScope scope(mTags.front());
+        if (!(mHost->*mFunc)(ptr, sz))
+            return false;
 
+        mTags.pop_front();
+        return true;
+    }
+
+  private:
     T *mHost;
     FuncType mFunc;
-    DataList mCachedList;
+    ReadyFuncType mOnReady;
+    RingBuffer mMemCache;
     DiskCache mDiskCache;
     size_t mLenCacheInMem;
     size_t mLenCacheInFile;
+    bool mbStalled;
+    uint32 mStatsId;
+    std::deque<LatencyTag> mTags;
 };
 
 NAMESPACE_END // namespace tun
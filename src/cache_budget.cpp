@@ -0,0 +1,89 @@
+#include "cache_budget.h"
+#include <vector>
+
+NAMESPACE_BEG(tun)
+
+CacheBudget gCacheBudget;
+
+const size_t CacheBudget::WAITER_LOW_WATER;
+
+void CacheBudget::regCache(ICache *c)
+{
+    mCaches.insert(c);
+}
+
+void CacheBudget::unregCache(ICache *c)
+{
+    mCaches.erase(c);
+}
+
+void CacheBudget::waitFor(Waiter *w)
+{
+    mWaiters.insert(w);
+}
+
+void CacheBudget::cancelWait(Waiter *w)
+{
+    mWaiters.erase(w);
+}
+
+void CacheBudget::update()
+{
+    if (isUnderPressure())
+        reclaim();
+
+    // 回落到低水位后才恢复数据源, 避免频繁抖动; 转存只是把积压挪到磁盘,
+    // 下游仍然积压的数据源继续暂停, 否则磁盘占用没有上限
+    if (mWaiters.empty() || mMemUsed+mIOUsed > lowWater())
+        return;
+
+    std::vector<Waiter *> ready;
+    Waiters::iterator it = mWaiters.begin();
+    for (; it != mWaiters.end(); ++it)
+    {
+        if ((*it)->getBacklog() <= WAITER_LOW_WATER)
+            ready.push_back(*it);
+    }
+
+    for (size_t i = 0; i < ready.size(); ++i)
+        mWaiters.erase(ready[i]);
+    for (size_t i = 0; i < ready.size(); ++i)
+        ready[i]->onCacheBudgetAvailable();
+}
+
+void CacheBudget::reclaim()
+{
+    // 转存出去的数据写入磁盘后终将释放, 因此只需把缓存自身占用降到低水位
+    while (mMemUsed > lowWater())
+    {
+        ICache *victim = NULL;
+        size_t victimSize = 0;
+        Caches::iterator it = mCaches.begin();
+        for (; it != mCaches.end(); ++it)
+        {
+            size_t sz = (*it)->spillableSize();
+            if (sz > victimSize)
+            {
+                victim = *it;
+                victimSize = sz;
+            }
+        }
+
+        if (NULL == victim)
+            break;
+
+        size_t memUsed = mMemUsed;
+        victim->spill();
+        if (mMemUsed >= memUsed)
+        {
+            WarningPrint("CacheBudget::reclaim() spill failed! memused=%u limit=%u",
+                         mMemUsed, mMemLimit);
+            break;
+        }
+
+        DebugPrint("CacheBudget::reclaim() spilled %u bytes to disk, memused=%u limit=%u",
+                   memUsed-mMemUsed, mMemUsed, mMemLimit);
+    }
+}
+
+NAMESPACE_END // namespace tun
@@ -0,0 +1,153 @@
+#ifndef __CACHEBUDGET_H__
+#define __CACHEBUDGET_H__
+
+#include "fasttun_base.h"
+#include <set>
+
+NAMESPACE_BEG(tun)
+
+// 进程级缓存内存预算
+// 所有 Cache 实例和连接发送队列的内存占用都记在这里. 预算是软上限, 靠高低水位回落而不是拒绝缓存:
+// 内存不足时新数据进入磁盘缓存的暂存块, 暂存块本身仍在内存中, 直到 update 转存或写满才释放.
+// 超过高水位(7/8预算)时优先把占用最大的缓存转存到磁盘, 并通知数据源暂停读取, 直到内存占用回落到
+// 低水位(3/4预算)且该数据源自己的下游积压(含已转存到磁盘的部分)降到 WAITER_LOW_WATER 以下.
+// 写入或读回途中的缓冲区(IO内存)和预读回内存的块同样计入预算, 磁盘慢时表现为内存紧张, 由数据源反压.
+// 内存按缓冲区实际大小计, 磁盘按数据计(不含记录头); 同一份数据任一时刻只计入内存、IO内存、磁盘中的一项
+class CacheBudget
+{
+  public:
+    struct ICache
+    {
+        virtual ~ICache() {}
+
+        // 可转存到磁盘的内存数据长度
+        virtual size_t spillableSize() const = 0;
+        virtual void spill() = 0;
+    };
+
+    struct Waiter
+    {
+        virtual ~Waiter() {}
+
+        // 下游尚未发出的积压, 内存和磁盘中的都算
+        virtual size_t getBacklog() const = 0;
+        virtual void onCacheBudgetAvailable() = 0;
+    };
+
+    static const size_t DEFAULT_MEM_LIMIT = 64*1024*1024;
+    static const size_t WAITER_LOW_WATER = 64*1024;
+
+    CacheBudget(size_t memLimit = DEFAULT_MEM_LIMIT)
+            :mMemLimit(memLimit)
+            ,mMemUsed(0)
+            ,mIOUsed(0)
+            ,mDiskUsed(0)
+            ,mCaches()
+            ,mWaiters()
+    {}
+
+    virtual ~CacheBudget() {}
+
+    void regCache(ICache *c);
+    void unregCache(ICache *c);
+
+    inline void onMemAlloc(size_t len)
+    {
+        mMemUsed += len;
+    }
+    inline void onMemFree(size_t len)
+    {
+        assert(mMemUsed >= len && "CacheBudget::onMemFree() mMemUsed >= len");
+        mMemUsed -= len;
+    }
+    inline void onIOAlloc(size_t len)
+    {
+        mIOUsed += len;
+    }
+    inline void onIOFree(size_t len)
+    {
+        assert(mIOUsed >= len && "CacheBudget::onIOFree() mIOUsed >= len");
+        mIOUsed -= len;
+    }
+    inline void onDiskAlloc(size_t len)
+    {
+        mDiskUsed += len;
+    }
+    inline void onDiskFree(size_t len)
+    {
+        assert(mDiskUsed >= len && "CacheBudget::onDiskFree() mDiskUsed >= len");
+        mDiskUsed -= len;
+    }
+
+    inline bool canCacheInMem(size_t len) const
+    {
+        return mMemUsed+mIOUsed+len <= mMemLimit;
+    }
+    inline bool isUnderPressure() const
+    {
+        return mMemUsed+mIOUsed > highWater();
+    }
+    // 磁盘缓存提前读回或保留在内存中的块不能使占用超过低水位, 否则刚转存的数据又回到内存
+    inline bool canPrefetch(size_t len) const
+    {
+        return mMemUsed+mIOUsed+len <= lowWater();
+    }
+
+    // 数据源在下游积压且内存紧张时调用, 内存回落且自己的积压排空后收到 onCacheBudgetAvailable
+    void waitFor(Waiter *w);
+    void cancelWait(Waiter *w);
+
+    // call it every frame
+    void update();
+
+    inline void setMemLimit(size_t limit)
+    {
+        mMemLimit = limit;
+    }
+    inline size_t getMemLimit() const
+    {
+        return mMemLimit;
+    }
+    inline size_t getMemUsed() const
+    {
+        return mMemUsed;
+    }
+    inline size_t getIOUsed() const
+    {
+        return mIOUsed;
+    }
+    inline size_t getDiskUsed() const
+    {
+        return mDiskUsed;
+    }
+
+  private:
+    inline size_t highWater() const
+    {
+        return mMemLimit/8*7;
+    }
+    inline size_t lowWater() const
+    {
+        return mMemLimit/4*3;
+    }
+
+    void reclaim();
+
+  private:
+    typedef std::set<ICache *> Caches;
+    typedef std::set<Waiter *> Waiters;
+
+    size_t mMemLimit;
+    size_t mMemUsed;
+    size_t mIOUsed;
+    size_t mDiskUsed;
+
+    Caches mCaches;
+    Waiters mWaiters;
+};
+
+extern CacheBudget gCacheBudget;
+
+NAMESPACE_END // namespace tun
+
+#endif // __CACHEBUDGET_H__
@@ -5,10 +5,15 @@
 #include "connection.h"
 #include "kcp_tunnel.h"
 #include "fast_connection.h"
+#include "cache_budget.h"
+#include "disk_io.h"
+#include "timer_wheel.h"
+#include "stats.h"
+#include "latency.h"
+#include "loop_profiler.h"
 
 using namespace tun;
 
-core::Timers tun::gTimer;
 
 typedef KcpTunnelGroup<false> MyTunnelGroup;
 static MyTunnelGroup *gTunnelManager = NULL;
@@ -18,7 +23,9 @@ static sockaddr_in RemoteAddr;
 static sockaddr_in KcpRemoteAddr;
 
 //--------------------------------------------------------------------------
-class ClientBridge : public Connection::Handler, public FastConnection::Handler
+class ClientBridge : public Connection::Handler
+                   , public FastConnection::Handler
+                   , public CacheBudget::Waiter
 {
   public:
     struct Handler
@@ -33,6 +40,7 @@ class ClientBridge : public Connection::Handler, public FastConnection::Handler
             ,mIntConn(poller)
             ,mExtConn(poller, gTunnelManager)
             ,mLastExtConnTime(0)
+            ,mbWaitingBudget(false)
     {}
 
     virtual ~ClientBridge()
@@ -49,7 +57,7 @@ class ClientBridge : public Connection::Handler, public FastConnection::Handler
         }
         mIntConn.setEventHandler(this);
 
-        mLastExtConnTime = core::getClock();
+        mLastExtConnTime = getMonoClock();
         mExtConn.setEventHandler(this);
         if (!mExtConn.connect((const SA *)&RemoteAddr, sizeof(RemoteAddr)))
         {
@@ -62,10 +70,20 @@ class ClientBridge : public Connection::Handler, public FastConnection::Handler
 
     void shutdown()
     {
+        gCacheBudget.cancelWait(this);
+        mbWaitingBudget = false;
         mIntConn.shutdown();
         mExtConn.shutdown();
     }
 
+    // 关闭并清空状态, 放回对象池等待下一个连接
+    void recycle()
+    {
+        shutdown();
+        mExtConn.recycle();
+        mIntConn.recycle();
+    }
+
     // Connection::Handler
     virtual void onConnected(FastConnection *pConn)
     {
@@ -91,35 +109,103 @@ class ClientBridge : public Connection::Handler, public FastConnection::Handler
 
     virtual void onRecv(Connection *pConn, const void *data, size_t datalen)
     {
+        gLoopProfiler.noteBridge(this);
         mExtConn.send(data, datalen);
         if (!mExtConn.isConnected())
             _reconnectExternal();
+        _checkBackpressure();
     }
 
     // FastConnection::Handler
     virtual void onDisconnected(FastConnection *pConn)
     {
         _reconnectExternal();
+        _updateSourceRead();
     }
     virtual void onError(FastConnection *pConn)
     {
         _reconnectExternal();
+        _updateSourceRead();
         WarningPrint("a fast connection ocur an error! reason:%s", coreStrError());
     }
     virtual void onCreateKcpTunnelFailed(FastConnection *pConn)
     {
         _reconnectExternal();
+        _updateSourceRead();
         WarningPrint("create fast connection faild!");
     }
 
+    virtual void onCongested(FastConnection *pConn)
+    {
+        _updateSourceRead();
+    }
+    virtual void onDrained(FastConnection *pConn)
+    {
+        _updateSourceRead();
+    }
+
+    // 本地连接发送积压时暂停从管道接收
+    virtual void onCongested(Connection *pConn)
+    {
+        _updateTunnelRecv();
+    }
+    virtual void onDrained(Connection *pConn)
+    {
+        _updateTunnelRecv();
+    }
+
     virtual void onRecv(FastConnection *pConn, const void *data, size_t datalen)
     {
+        gLoopProfiler.noteBridge(this);
         mIntConn.send(data, datalen);
     }
 
+    // CacheBudget::Waiter
+    virtual size_t getBacklog() const
+    {
+        return mExtConn.getCachedSize();
+    }
+    virtual void onCacheBudgetAvailable()
+    {
+        mbWaitingBudget = false;
+        _updateSourceRead();
+    }
+
+    void _checkBackpressure()
+    {
+        if (!mbWaitingBudget && gCacheBudget.isUnderPressure() &&
+            mExtConn.getCachedSize() > 0)
+        {
+            mbWaitingBudget = true;
+            gCacheBudget.waitFor(this);
+            _updateSourceRead();
+        }
+    }
+
+    // 管道拥塞或内存紧张时暂停读取数据源, 借助TCP流控反压
+    void _updateSourceRead()
+    {
+        if (mExtConn.isCongested() || mbWaitingBudget)
+            mIntConn.pauseRead();
+        else
+            mIntConn.resumeRead();
+    }
+
+    // 管道未建立时新参数在建管道时生效
+    void retune(const KcpArg &arg)
+    {
+        mExtConn.retune(arg);
+    }
+
+    // 接收队列满后kcp通告窗口为0, 由kcp流控反压对端, 不在本端无限缓存
+    void _updateTunnelRecv()
+    {
+        mExtConn.setRecvPaused(mIntConn.isConnected() && mIntConn.isCongested());
+    }
+
     void _reconnectExternal()
     {
-        ulong curtick = core::getClock();
+        ulong curtick = getMonoClock();
         if (curtick > mLastExtConnTime+10000)
         {
             mLastExtConnTime = curtick;
@@ -135,6 +221,7 @@ class ClientBridge : public Connection::Handler, public FastConnection::Handler
     FastConnection mExtConn;
 
     ulong mLastExtConnTime;
+    bool mbWaitingBudget;
 };
 //--------------------------------------------------------------------------
 
@@ -148,6 +235,7 @@ class Client : public Listener::Handler, public ClientBridge::Handler
             ,mListener(poller)
             ,mBridges()
             ,mShutedBridges()
+            ,mFreeBridges()
     {
     }
 
@@ -155,6 +243,13 @@ class Client : public Listener::Handler, public ClientBridge::Handler
     {
     }
 
+    // 须在 create 之前设置
+    void setAcceptOptions(int backlog, int acceptBatch)
+    {
+        mListener.setBacklog(backlog);
+        mListener.setAcceptBatch(acceptBatch);
+    }
+
     bool create(const SA *sa, socklen_t salen)
     {
         if (!mListener.initialise(sa, salen))
@@ -183,6 +278,10 @@ class Client : public Listener::Handler, public ClientBridge::Handler
             }
         }
         mBridges.clear();
+
+        for (size_t i = 0; i < mFreeBridges.size(); ++i)
+            delete mFreeBridges[i];
+        mFreeBridges.clear();
     }
 
     // call it ervery frame
@@ -190,19 +289,26 @@ class Client : public Listener::Handler, public ClientBridge::Handler
     {
         BridgeList::iterator it = mShutedBridges.begin();
         for (; it != mShutedBridges.end(); ++it)
-        {
-            (*it)->shutdown();
-            delete *it;
-        }
+            _freeBridge(*it);
         mShutedBridges.clear();
     }
 
     virtual void onAccept(int connfd)
     {
-        ClientBridge *bridge = new ClientBridge(mEventPoller, this);
+        ClientBridge *bridge = NULL;
+        if (!mFreeBridges.empty())
+        {
+            bridge = mFreeBridges.back();
+            mFreeBridges.pop_back();
+        }
+        else
+        {
+            bridge = new ClientBridge(mEventPoller, this);
+        }
+
         if (!bridge->acceptConnection(connfd))
         {
-            delete bridge;
+            _freeBridge(bridge);
             return;
         }
 
@@ -210,6 +316,15 @@ class Client : public Listener::Handler, public ClientBridge::Handler
         DebugPrint("a connection createted! cursize:%u", mBridges.size());
     }
 
+    // 在线调整所有管道的kcp参数
+    void retune(const KcpArg &arg)
+    {
+        BridgeList::iterator it = mBridges.begin();
+        for (; it != mBridges.end(); ++it)
+            (*it)->retune(arg);
+        InfoPrint("retune kcp tunnels! count=%u", (uint32)mBridges.size());
+    }
+
     virtual void onIntConnDisconnected(ClientBridge *pBridge)
     {
         onBridgeShut(pBridge);
@@ -234,7 +349,24 @@ class Client : public Listener::Handler, public ClientBridge::Handler
         mShutedBridges.insert(pBridge);
     }
 
+    // 短连接频繁时复用桥接对象, 省去连接对象和缓冲区的反复分配
+    void _freeBridge(ClientBridge *pBridge)
+    {
+        if (mFreeBridges.size() < MAX_FREE_BRIDGES)
+        {
+            pBridge->recycle();
+            mFreeBridges.push_back(pBridge);
+        }
+        else
+        {
+            pBridge->shutdown();
+            delete pBridge;
+        }
+    }
+
   private:
+    static const size_t MAX_FREE_BRIDGES = 256;
+
     typedef std::set<ClientBridge *> BridgeList;
 
     EventPoller *mEventPoller;
@@ -242,14 +374,53 @@ class Client : public Listener::Handler, public ClientBridge::Handler
 
     BridgeList mBridges;
     BridgeList mShutedBridges;
+    std::vector<ClientBridge *> mFreeBridges;
 };
 //--------------------------------------------------------------------------
 
+//--------------------------------------------------------------------------
+// kcp参数: 先按 kcpmode 取预设, 再用各项配置覆盖
+static void loadKcpArg(Ini &ini, KcpArg &arg)
+{
+    std::string mode = ini.getString("local", "kcpmode", "fast3");
+    if (!kcpmode::byName(mode.c_str(), arg))
+    {
+        WarningPrint("unknown kcpmode! %s, use fast3", mode.c_str());
+        arg = kcpmode::Fast3;
+    }
+
+    const char *tunings[] = {"sndwnd", "rcvwnd", "minrto"};
+    int *fields[] = {&arg.sndwnd, &arg.rcvwnd, &arg.minrto};
+    for (size_t i = 0; i < sizeof(tunings)/sizeof(tunings[0]); ++i)
+    {
+        std::string value = ini.getString("local", tunings[i], "");
+        if (value != "")
+            *fields[i] = atoi(value.c_str());
+    }
+
+    std::string stream = ini.getString("local", "kcpstream", "");
+    if (stream != "")
+        arg.stream = atoi(stream.c_str()) != 0 ? 1 : 0;
+    std::string ackDelay = ini.getString("local", "ackdelay", "");
+    if (ackDelay != "")
+        arg.ackdelay = atoi(ackDelay.c_str());
+    arg.sack = atoi(ini.getString("local", "sack", "1").c_str()) != 0 ? 1 : 0;
+    arg.compact = atoi(ini.getString("local", "kcpcompact", "1").c_str()) != 0 ? 1 : 0;
+    arg.pmtud = atoi(ini.getString("local", "pmtud", "1").c_str()) != 0 ? 1 : 0;
+}
+//--------------------------------------------------------------------------
+
 static bool s_continueMainLoop = true;
+static bool s_reloadKcpArg = false;
 void sigHandler(int signo)
 {
     switch (signo)
     {
+    case SIGHUP:
+        {
+            s_reloadKcpArg = true;
+        }
+        break;
     case SIGPIPE:
         {
             WarningPrint("broken pipe!");
@@ -294,6 +465,11 @@ int main(int argc, char *argv[])
     const char *remoteAddr = NULL;
     const char *kcpRemoteAddr = NULL;
     const char *pidPath = NULL;
+    std::string statsAddr;
+    double slowMs = 0;
+    int backlog = Listener::DEFAULT_BACKLOG;
+    int acceptBatch = Listener::DEFAULT_ACCEPT_BATCH;
+    KcpArg kcpArg = kcpmode::Fast3;
 
     int opt = 0;
     while ((opt = getopt(argc, argv, "f:c:l:r:v")) != -1)
@@ -363,12 +539,27 @@ int main(int argc, char *argv[])
         static std::string s_listenAddr = ini.getString("local", "listen", "");
         static std::string s_remoteAddr = ini.getString("local", "remote", "");
         static std::string s_kcpRemoteAddr = ini.getString("local", "kcpremote", s_remoteAddr.c_str());
+        std::string cacheMem = ini.getString("local", "cachemem", "");
+        statsAddr = ini.getString("local", "stats", "");
+        slowMs = atof(ini.getString("local", "slowms", "0").c_str());
+        std::string backlogStr = ini.getString("local", "backlog", "");
+        std::string acceptBatchStr = ini.getString("local", "acceptbatch", "");
+        if (backlogStr != "" && atoi(backlogStr.c_str()) > 0)
+            backlog = atoi(backlogStr.c_str());
+        if (acceptBatchStr != "" && atoi(acceptBatchStr.c_str()) > 0)
+            acceptBatch = atoi(acceptBatchStr.c_str());
         if (s_listenAddr != "")
             listenAddr = s_listenAddr.c_str();
         if (s_remoteAddr != "")
             remoteAddr = s_remoteAddr.c_str();
         if (s_kcpRemoteAddr != "")
             kcpRemoteAddr = s_kcpRemoteAddr.c_str();
+        if (cacheMem != "" && atoi(cacheMem.c_str()) > 0)
+            gCacheBudget.setMemLimit((size_t)atoi(cacheMem.c_str())*1024*1024);
+        std::string readBudget = ini.getString("local", "readbudget", "");
+        if (readBudget != "" && atoi(readBudget.c_str()) >= 0)
+            Connection::setReadBudget((size_t)atoi(readBudget.c_str())*1024);
+        loadKcpArg(ini, kcpArg);
     }
 
     if (NULL == listenAddr || NULL == remoteAddr || NULL == kcpRemoteAddr)
@@ -392,9 +583,12 @@ int main(int argc, char *argv[])
 #else
     EventPoller *netPoller = new SelectPoller();
 #endif
+    // 事件之间穿插处理到期的定时器
+    netPoller->setTimerWheel(&gTimerWheel);
 
     // kcp tunnel manager
     gTunnelManager = new MyTunnelGroup(netPoller);
+    gTunnelManager->setKcpMode(kcpArg);
     if (!gTunnelManager->create(kcpRemoteAddr))
     {
         ErrorPrint("initialise Tunnel Manager error!");
@@ -405,6 +599,7 @@ int main(int argc, char *argv[])
 
     // create client
     Client cli(netPoller);
+    cli.setAcceptOptions(backlog, acceptBatch);
     if (!cli.create((const SA *)&ListenAddr, sizeof(ListenAddr)))
     {
         ErrorPrint("create client error!");
@@ -428,36 +623,73 @@ int main(int argc, char *argv[])
     // sigaction(SIGKILL, &newAct, NULL);
     sigaction(SIGTERM, &newAct, NULL);
 
+    // 重新读取kcp参数, 已建立的管道在线调整
+    sigaction(SIGHUP, &newAct, NULL);
+
+    // 本地统计端点, 可选
+    StatsServer statsSvr(netPoller, &gTimerWheel);
+    if (statsAddr != "" && !statsSvr.initialise(statsAddr.c_str()))
+        WarningPrint("start stats endpoint failed! addr=%s", statsAddr.c_str());
+    gStats.add(&gLatency);
+
+    // 事件循环剖析, 可选
+    gLoopProfiler.setSlowThreshold(slowMs);
+    gStats.add(&gLoopProfiler);
+
+    // 缓存溢出到磁盘的读写放到后台线程, 启动失败则退化为同步读写
+    if (!gDiskIO.start(netPoller))
+        WarningPrint("start disk io thread failed! fall back to synchronous disk io");
+
     static const uint32 MAX_WAIT = 60000;
     double maxWait = 0;
-    uint32 curClock = 0, nextKcpUpdateInterval = 0, nextTimerCheckInterval = 0;
     DebugPrint("Enter Main Loop...");
     while (s_continueMainLoop)
     {
-        curClock = core::getClock();
+        uint64 loopStart = core::getTimeStamp();
+        uint64 spareStart = netPoller->spareTime();
 
         netPoller->processPendingEvents(maxWait);
 
-        nextKcpUpdateInterval = gTunnelManager->update();
+        gCacheBudget.update();
 
-        gTimer.process(curClock);
-        nextTimerCheckInterval = gTimer.nextExp(curClock);
-        if (0 == nextTimerCheckInterval)
-            nextTimerCheckInterval = MAX_WAIT;
+        // kcp更新、心跳和连接检查都挂在时间轮上
+        gTimerWheel.process(getMonoClock());
 
         cli.update();
 
-        maxWait  = min(nextKcpUpdateInterval, nextTimerCheckInterval);
-        maxWait *= 0.001f;
+        if (s_reloadKcpArg)
+        {
+            s_reloadKcpArg = false;
+            if (confPath)
+            {
+                Ini ini(confPath);
+                loadKcpArg(ini, kcpArg);
+                gTunnelManager->setKcpMode(kcpArg);
+                cli.retune(kcpArg);
+            }
+            else
+            {
+                WarningPrint("no config file to reload!");
+            }
+        }
+
+        maxWait = gTimerWheel.nextWait(MAX_WAIT);
+
+        // 本轮耗时扣除阻塞在等待上的时间
+        gLatency.loopBusy.record(core::getTimeStamp()-loopStart-(netPoller->spareTime()-spareStart));
     }
     DebugPrint("Leave Main Loop...");
 
     // finalise
+    gStats.remove(&gLatency);
+    gStats.remove(&gLoopProfiler);
+    statsSvr.finalise();
     cli.finalise();
 
     gTunnelManager->shutdown();
     delete gTunnelManager;
 
+    gDiskIO.stop();
     delete netPoller;
 
     // uninit log
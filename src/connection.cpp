@@ -1,11 +1,30 @@
 #include "connection.h"
+#include "recv_arena.h"
+#include "cache_budget.h"
 
 NAMESPACE_BEG(tun)
 
+const size_t Connection::MAX_READ_SIZE;
+const size_t Connection::LIMIT_LEN;
+const size_t Connection::SEND_HIGH_WATER;
+const size_t Connection::SEND_LOW_WATER;
+
+static size_t s_readBudget = Connection::DEFAULT_READ_BUDGET;
+
+void Connection::setReadBudget(size_t budget)
+{
+    s_readBudget = budget > 0 ? min(budget, LIMIT_LEN) : LIMIT_LEN;
+}
+
+size_t Connection::getReadBudget()
+{
+    return s_readBudget;
+}
+
 Connection::~Connection()
 {
+    gStats.remove(this);
     shutdown();
-    free(mBuffer);
 }
 
 bool Connection::acceptConnection(int connfd)
@@ -16,25 +35,13 @@ bool Connection::acceptConnection(int connfd)
         return false;
     }
 
+    // Listener 接受的连接已是非阻塞的, 不再单独设置
     mFd = connfd;
-
-    // set nonblocking
-    if (!core::setNonblocking(mFd))
-    {
-        ErrorPrint("[acceptConnection] set nonblocking error! %s", coreStrError());
-        goto err_1;
-    }
-
+    resetFdState();
     tryRegReadEvent();
 
     mConnStatus = ConnStatus_Connected;
     return true;
-
-err_1:
-    close(mFd);
-    mFd = -1;
-
-    return false;
 }
 
 bool Connection::connect(const char *ip, int port)
@@ -68,6 +75,7 @@ bool Connection::connect(const SA *sa, socklen_t salen)
         ErrorPrint("[connect] create socket error! %s", coreStrError());
         return false;
     }
+    resetFdState();
 
     // set nonblocking
     if (!core::setNonblocking(mFd))
@@ -120,6 +128,18 @@ void Connection::shutdown()
     for (; it != mTcpPacketList.end(); ++it)
         delete *it;
     mTcpPacketList.clear();
+
+    // 不通知处理器, 宿主关闭连接时自行恢复数据源
+    gCacheBudget.onMemFree(mPendingLen);
+    mPendingLen = 0;
+    mbCongested = false;
+}
+
+void Connection::recycle()
+{
+    shutdown();
+    mbReadPaused = false;
+    resetFdState();
 }
 
 void Connection::send(const void *data, size_t datalen)
@@ -135,18 +155,29 @@ void Connection::send(const void *data, size_t datalen)
         return;
     }
 
+    // 由KCP收到的数据, 记录到交给TCP发送为止的延迟
+    if (LatencyTag::Source_Kcp == gLatency.ingress.source)
+        gLatency.kcpToTcp.record(core::getTimeStamp()-gLatency.ingress.stamp);
+
     const char *ptr = (const char *)data;
     if (tryFlushRemainPacket())
     {
         int sentlen = ::send(mFd, data, datalen, 0);
         // int sentlen = -1; errno = EAGAIN;
+        if (sentlen > 0)
+            mBytesSent += sentlen;
         if ((size_t)sentlen == datalen)
+        {
+            checkCongestion();
             return;
+        }
 
         if (sentlen > 0)
         {
+            // 只发出一部分说明发送缓冲区已满, 此时 errno 是旧值, 不能当作错误
             ptr += sentlen;
             datalen -= sentlen;
+            errno = EAGAIN;
         }
     }
 
@@ -155,6 +186,21 @@ void Connection::send(const void *data, size_t datalen)
 
     cachePacket(ptr, datalen);
     tryRegWriteEvent(); // 注册发送缓冲区可写事件
+    checkCongestion();
+}
+
+void Connection::pauseRead()
+{
+    mbReadPaused = true;
+    if (mFd >= 0)
+        tryUnregReadEvent();
+}
+
+void Connection::resumeRead()
+{
+    mbReadPaused = false;
+    if (mFd >= 0 && ConnStatus_Connected == mConnStatus)
+        tryRegReadEvent();
 }
 
 bool Connection::getpeername(SA *sa, socklen_t *salen) const
@@ -181,28 +227,29 @@ int Connection::handleInputNotification(int fd)
         return 0;
     }
 
-    char *buf = mBuffer;
-    int curlen = 0;
+    // 读入事件循环共享的接收区, 一次读事件的数据连续存放, 整块交给上层
+    size_t budget = getReadBudget();
+    char *buf = gRecvArena.acquire(budget);
+    size_t curlen = 0;
+    size_t want = mReadSize;
     for (;;)
     {
-        int recvlen = recv(mFd, buf+curlen, MAXLEN, 0);
+        size_t len = min(want, budget-curlen);
+        int recvlen = recv(mFd, buf+curlen, len, 0);
         if (recvlen > 0)
+        {
             curlen += recvlen;
+            mBytesRecv += recvlen;
+        }
 
-        if (recvlen >= MAXLEN)
+        if (recvlen > 0 && (size_t)recvlen == len)
         {
-            if (curlen >= LIMIT_LEN)
+            if (curlen >= budget)
                 break;
 
-            if (buf == mBuffer)
-            {
-                buf = (char *)malloc(curlen+MAXLEN);
-                memcpy(buf, mBuffer, curlen);
-            }
-            else
-            {
-                buf = (char *)realloc(buf, curlen+MAXLEN);
-            }
+            // 读满说明还有数据, 本次事件中后续的读取加倍
+            if (want < MAX_READ_SIZE)
+                want <<= 1;
         }
         else
         {
@@ -218,16 +265,14 @@ int Connection::handleInputNotification(int fd)
             break;
         }
     }
-
-    if (curlen >= LIMIT_LEN)
-    {
-        WarningPrint("get big data! recvlen=%d", curlen);
-    }
+    adjustReadSize(curlen);
 
     if (curlen > 0 && mHandler)
+    {
+        IngressScope scope(LatencyTag(LatencyTag::Source_Tcp, core::getTimeStamp()));
         mHandler->onRecv(this, buf, curlen);
-    if (buf != mBuffer)
-        free(buf);
+    }
+    gRecvArena.release(buf);
 
     if (mHandler)
     {
@@ -282,14 +327,48 @@ int Connection::handleOutputNotification(int fd)
         tryFlushRemainPacket();
         if (checkSocketErrors())
             return 0;
+        checkCongestion();
     }
 
     return 0;
 }
 
+void Connection::collectStats(StatsWriter &w)
+{
+    if (mFd < 0)
+        return;
+
+    w.gauge("fasttun_conn_pending_send_bytes", "fd", mFd, mPendingLen);
+    w.counter("fasttun_conn_sent_bytes_total", "fd", mFd, mBytesSent);
+    w.counter("fasttun_conn_recv_bytes_total", "fd", mFd, mBytesRecv);
+}
+
+// 统计按fd导出, 换了套接字就从头计数
+void Connection::resetFdState()
+{
+    mReadSize = INIT_READ_SIZE;
+    mBytesSent = 0;
+    mBytesRecv = 0;
+}
+
+void Connection::adjustReadSize(size_t eventLen)
+{
+    // 一次读事件需要多次 recv 时放大到能一次读完, 远小于读取长度时减半
+    size_t maxSize = min(MAX_READ_SIZE, getReadBudget());
+    if (eventLen > mReadSize)
+    {
+        while (mReadSize < eventLen && mReadSize < maxSize)
+            mReadSize <<= 1;
+    }
+    else if (eventLen < mReadSize/4 && mReadSize > MIN_READ_SIZE)
+    {
+        mReadSize >>= 1;
+    }
+}
+
 void Connection::tryRegReadEvent()
 {
-    if (!mbRegForRead)
+    if (!mbRegForRead && !mbReadPaused)
     {
         mbRegForRead = true;
         mEventPoller->registerForRead(mFd, this);
@@ -337,6 +416,12 @@ bool Connection::tryFlushRemainPacket()
         assert(p->buflen > p->sentlen && "p->buflen > p->sentlen");
         size_t len = p->buflen - p->sentlen;
         int sentlen = ::send(mFd, p->buf+p->sentlen, len, 0);
+        if (sentlen > 0)
+        {
+            mBytesSent += sentlen;
+            mPendingLen -= sentlen;
+            gCacheBudget.onMemFree(sentlen);
+        }
 
         if (len == (size_t)sentlen)
         {
@@ -346,7 +431,10 @@ bool Connection::tryFlushRemainPacket()
         }
 
         if (sentlen > 0)
+        {
             p->sentlen += sentlen;
+            errno = EAGAIN;
+        }
         break;
     }
 
@@ -367,6 +455,25 @@ void Connection::cachePacket(const void *data, size_t datalen)
     p->buflen = datalen;
     p->sentlen = 0;
     mTcpPacketList.push_back(p);
+
+    mPendingLen += datalen;
+    gCacheBudget.onMemAlloc(datalen);
+}
+
+void Connection::checkCongestion()
+{
+    bool congested = mbCongested ? mPendingLen > SEND_LOW_WATER : mPendingLen >= SEND_HIGH_WATER;
+    if (congested == mbCongested)
+        return;
+
+    mbCongested = congested;
+    if (mHandler)
+    {
+        if (mbCongested)
+            mHandler->onCongested(this);
+        else
+            mHandler->onDrained(this);
+    }
 }
 
 bool Connection::checkSocketErrors()
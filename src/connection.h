@@ -3,10 +3,12 @@
 
 #include "fasttun_base.h"
 #include "event_poller.h"
+#include "stats.h"
+#include "latency.h"
 
 NAMESPACE_BEG(tun)
 
-class Connection : public InputNotificationHandler, public OutputNotificationHandler
+class Connection : public InputNotificationHandler, public OutputNotificationHandler, public StatsSource
 {
   public:
     class Handler
@@ -19,6 +21,10 @@ class Connection : public InputNotificationHandler, public OutputNotificationHan
 
         virtual void onRecv(Connection *pConn, const void *data, size_t datalen) = 0;
         virtual void onError(Connection *pConn) {}
+
+        // 发送队列超过高水位/回落到低水位, 数据源应据此暂停/恢复
+        virtual void onCongested(Connection *pConn) {}
+        virtual void onDrained(Connection *pConn) {}
     };
 
     enum EConnStatus
@@ -30,6 +36,12 @@ class Connection : public InputNotificationHandler, public OutputNotificationHan
         ConnStatus_Connected,
     };
 
+    static const size_t DEFAULT_READ_BUDGET = 64*1024;
+
+    // 对端收得慢时积压在发送队列中的数据计入 gCacheBudget, 超过高水位视为拥塞, 回落到低水位解除
+    static const size_t SEND_HIGH_WATER = 256*1024;
+    static const size_t SEND_LOW_WATER = 64*1024;
+
     Connection(EventPoller *poller)
             :mFd(-1)
             ,mConnStatus(ConnStatus_Closed)
@@ -37,25 +49,52 @@ class Connection : public InputNotificationHandler, public OutputNotificationHan
             ,mEventPoller(poller)
             ,mbRegForRead(false)
             ,mbRegForWrite(false)
+            ,mbReadPaused(false)
             ,mTcpPacketList()
-            ,mBuffer(NULL)
+            ,mPendingLen(0)
+            ,mbCongested(false)
+            ,mReadSize(INIT_READ_SIZE)
+            ,mBytesSent(0)
+            ,mBytesRecv(0)
     {
         assert(mEventPoller && "Connection::mEventPoller != NULL");
-
-        mBuffer = (char *)malloc(MAXLEN);
-        assert(mBuffer != NULL && "Connection malloc buffer failed");
+        gStats.add(this);
     }
 
     virtual ~Connection();
 
+    // connfd 须是非阻塞的(由 Listener 接受)
     bool acceptConnection(int connfd);
     bool connect(const char *ip, int port);
     bool connect(const SA *sa, socklen_t salen);
 
     void shutdown();    
 
+    // 关闭并清空上一个套接字留下的状态(读暂停、读取长度、收发计数), 以便对象池复用
+    void recycle();
+
     void send(const void *data, size_t datalen);
 
+    // 暂停/恢复读事件, 用于下游积压时借助TCP流控反压数据源
+    void pauseRead();
+    void resumeRead();
+
+    inline bool isReadPaused() const
+    {
+        return mbReadPaused;
+    }
+
+    // 发送队列中尚未写入套接字的数据长度
+    inline size_t getPendingSize() const
+    {
+        return mPendingLen;
+    }
+
+    inline bool isCongested() const
+    {
+        return mbCongested;
+    }
+
     inline void setEventHandler(Handler *h)
     {
         mHandler = h;
@@ -66,6 +105,17 @@ class Connection : public InputNotificationHandler, public OutputNotificationHan
         return mConnStatus == ConnStatus_Connected;
     }
 
+    // 下一次读事件单次 recv 的长度, 随该连接近期每次读事件的数据量调整
+    inline size_t getReadSize() const
+    {
+        return mReadSize;
+    }
+
+    // 每次读事件最多读取的字节数, 读满即返回, 余下的数据等下一轮事件循环(水平触发会再次通知).
+    // 大流量连接不会独占事件循环, 其他连接和kcp更新的延迟有上限. 0 表示不限(仍以 LIMIT_LEN 为界)
+    static void setReadBudget(size_t budget);
+    static size_t getReadBudget();
+
     bool getpeername(SA *sa, socklen_t *salen) const;
     bool gethostname(SA *sa, socklen_t *salen) const;
 
@@ -75,6 +125,9 @@ class Connection : public InputNotificationHandler, public OutputNotificationHan
     // OutputNotificationHandler
     virtual int handleOutputNotification(int fd);
 
+    // StatsSource
+    virtual void collectStats(StatsWriter &w);
+
   private:
     void tryRegReadEvent();
     void tryUnregReadEvent();
@@ -84,13 +137,19 @@ class Connection : public InputNotificationHandler, public OutputNotificationHan
 
     bool tryFlushRemainPacket();
     void cachePacket(const void *data, size_t datalen);
+    void checkCongestion();
+
+    void adjustReadSize(size_t eventLen);
+    void resetFdState();
 
     bool checkSocketErrors();
     EReason _checkSocketErrors();
 
   private:
-    static const int MAXLEN = 8*1024;
-    static const int LIMIT_LEN = 1024*1024;
+    static const size_t MIN_READ_SIZE = 4*1024;
+    static const size_t INIT_READ_SIZE = 16*1024;
+    static const size_t MAX_READ_SIZE = 256*1024;
+    static const size_t LIMIT_LEN = 1024*1024;
     typedef std::list<TcpPacket *> TcpPacketList;
 
     int mFd;
@@ -100,10 +159,16 @@ class Connection : public InputNotificationHandler, public OutputNotificationHan
     EventPoller *mEventPoller;
     bool mbRegForRead;
     bool mbRegForWrite;
+    bool mbReadPaused;
 
     TcpPacketList mTcpPacketList;
+    size_t mPendingLen;
+    bool mbCongested;
+
+    size_t mReadSize;
 
-    char *mBuffer;
+    uint64 mBytesSent;
+    uint64 mBytesRecv;
 };
 
 NAMESPACE_END // namespace tun 
@@ -0,0 +1,87 @@
+#include "conv_allocator.h"
+
+NAMESPACE_BEG(tun)
+
+const uint32 ConvAllocator::NONE;
+
+ConvAllocator::ConvAllocator(uint32 maxConvs)
+        :mMaxConvs(min(maxConvs, (uint32)MAX_CONVS))
+        ,mSlots()
+        ,mFreeHead(NONE)
+        ,mFreeTail(NONE)
+        ,mFreeCount(0)
+{
+}
+
+ConvAllocator::~ConvAllocator()
+{
+}
+
+bool ConvAllocator::alloc(uint32 &conv)
+{
+    uint32 index = NONE;
+    if (mFreeCount > 0 && (mFreeCount > (size_t)QUARANTINE || mSlots.size() >= mMaxConvs))
+    {
+        index = mFreeHead;
+        mFreeHead = mSlots[index].next;
+        if (NONE == mFreeHead)
+            mFreeTail = NONE;
+        --mFreeCount;
+    }
+    else if (mSlots.size() < mMaxConvs)
+    {
+        Slot s;
+        s.next = NONE;
+        s.gen = 1;
+        s.used = 0;
+        index = (uint32)mSlots.size();
+        mSlots.push_back(s);
+    }
+    else
+    {
+        return false;
+    }
+
+    Slot &s = mSlots[index];
+    s.next = NONE;
+    s.used = 1;
+
+    // 代数从1开始, 会话号不会为0
+    conv = ((uint32)s.gen<<INDEX_BITS)|index;
+    return true;
+}
+
+bool ConvAllocator::release(uint32 conv)
+{
+    if (!isAllocated(conv))
+        return false;
+
+    uint32 index = indexOf(conv);
+    Slot &s = mSlots[index];
+    s.used = 0;
+    s.gen = (s.gen+1)&GEN_MASK;
+    if (0 == s.gen)
+        s.gen = 1;
+
+    s.next = NONE;
+    if (NONE == mFreeTail)
+        mFreeHead = index;
+    else
+        mSlots[mFreeTail].next = index;
+    mFreeTail = index;
+    ++mFreeCount;
+
+    return true;
+}
+
+bool ConvAllocator::isAllocated(uint32 conv) const
+{
+    uint32 index = indexOf(conv);
+    if (index >= mSlots.size())
+        return false;
+
+    const Slot &s = mSlots[index];
+    return s.used && s.gen == (conv>>INDEX_BITS);
+}
+
+NAMESPACE_END // namespace tun
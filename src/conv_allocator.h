@@ -0,0 +1,75 @@
+#ifndef __CONVALLOCATOR_H__
+#define __CONVALLOCATOR_H__
+
+#include "fasttun_base.h"
+
+#include <vector>
+
+NAMESPACE_BEG(tun)
+
+// kcp会话号分配器
+// 会话号 = [代数 12位][槽位 20位], 槽位数组按需增长, 空闲槽位以数组下标串成FIFO链表, 分配释放均为O(1).
+// 槽位释放后代数加1, 并且至少再经过 QUARANTINE 次释放才会被复用,
+// 因此旧会话残留的UDP包不会落到新会话上
+class ConvAllocator
+{
+  public:
+    enum
+    {
+        INDEX_BITS = 20,
+        GEN_BITS = 32-INDEX_BITS,
+        MAX_CONVS = 1<<INDEX_BITS,
+        INDEX_MASK = MAX_CONVS-1,
+        GEN_MASK = (1<<GEN_BITS)-1,
+
+        // 空闲槽位不超过该数量时优先开辟新槽位, 而不是立即复用刚释放的
+        QUARANTINE = 1024,
+    };
+
+    ConvAllocator(uint32 maxConvs = MAX_CONVS);
+    virtual ~ConvAllocator();
+
+    bool alloc(uint32 &conv);
+    // 会话号不是当前分配出去的(重复释放或已过期)时返回false
+    bool release(uint32 conv);
+
+    bool isAllocated(uint32 conv) const;
+
+    static inline uint32 indexOf(uint32 conv)
+    {
+        return conv&INDEX_MASK;
+    }
+
+    // 当前已分配的个数
+    inline size_t size() const
+    {
+        return mSlots.size()-mFreeCount;
+    }
+    inline size_t maxSize() const
+    {
+        return mMaxConvs;
+    }
+
+  private:
+    struct Slot
+    {
+        uint32 next;
+        uint16 gen;
+        uint16 used;
+    };
+
+    static const uint32 NONE = 0xFFFFFFFF;
+
+    typedef std::vector<Slot> Slots;
+
+    uint32 mMaxConvs;
+    Slots mSlots;
+
+    uint32 mFreeHead;
+    uint32 mFreeTail;
+    size_t mFreeCount;
+};
+
+NAMESPACE_END // namespace tun
+
+#endif // __CONVALLOCATOR_H__
@@ -0,0 +1,173 @@
+#ifndef __CONVTABLE_H__
+#define __CONVTABLE_H__
+
+#include "fasttun_base.h"
+
+NAMESPACE_BEG(tun)
+
+// 会话号 -> 对象 的开放寻址哈希表
+// 线性探测, 键值连续存放在同一数组中, 每个收到的UDP包只需访问一两条缓存行;
+// 删除时后移回填, 不留墓碑. 会话号0保留为空槽标记
+template <class T>
+class ConvTable
+{
+  public:
+    ConvTable()
+            :mEntries(NULL)
+            ,mMask(0)
+            ,mShift(32)
+            ,mSize(0)
+    {}
+
+    virtual ~ConvTable()
+    {
+        free(mEntries);
+    }
+
+    inline T* find(uint32 conv) const
+    {
+        if (0 == mSize || 0 == conv)
+            return NULL;
+
+        for (size_t i = _hash(conv); ; i = (i+1)&mMask)
+        {
+            const Entry &e = mEntries[i];
+            if (e.conv == conv)
+                return e.value;
+            if (0 == e.conv)
+                return NULL;
+        }
+    }
+
+    // 会话号已存在或为0时返回false
+    bool insert(uint32 conv, T *value)
+    {
+        if (0 == conv)
+            return false;
+        if ((mSize+1)*2 > mMask+1)
+            _rehash(mMask > 0 ? (mMask+1)*2 : INIT_CAPACITY);
+
+        size_t i = _hash(conv);
+        for (; mEntries[i].conv != 0; i = (i+1)&mMask)
+        {
+            if (mEntries[i].conv == conv)
+                return false;
+        }
+
+        mEntries[i].conv = conv;
+        mEntries[i].value = value;
+        ++mSize;
+        return true;
+    }
+
+    // 返回被删除的对象, 不存在时返回NULL
+    T* erase(uint32 conv)
+    {
+        if (0 == mSize || 0 == conv)
+            return NULL;
+
+        size_t i = _hash(conv);
+        for (; mEntries[i].conv != conv; i = (i+1)&mMask)
+        {
+            if (0 == mEntries[i].conv)
+                return NULL;
+        }
+
+        T *value = mEntries[i].value;
+
+        // 把后面探测链上的元素前移填补空位
+        size_t j = i;
+        for (;;)
+        {
+            j = (j+1)&mMask;
+            if (0 == mEntries[j].conv)
+                break;
+
+            size_t home = _hash(mEntries[j].conv);
+            if (((j-home)&mMask) >= ((j-i)&mMask))
+            {
+                mEntries[i] = mEntries[j];
+                i = j;
+            }
+        }
+        mEntries[i].conv = 0;
+        mEntries[i].value = NULL;
+        --mSize;
+
+        return value;
+    }
+
+    void clear()
+    {
+        free(mEntries);
+        mEntries = NULL;
+        mMask = 0;
+        mShift = 32;
+        mSize = 0;
+    }
+
+    inline size_t size() const
+    {
+        return mSize;
+    }
+    inline bool empty() const
+    {
+        return 0 == mSize;
+    }
+
+    // 按槽位遍历, 空槽返回NULL
+    inline size_t capacity() const
+    {
+        return mEntries ? mMask+1 : 0;
+    }
+    inline T* valueAt(size_t i) const
+    {
+        return mEntries[i].value;
+    }
+
+  private:
+    struct Entry
+    {
+        uint32 conv;
+        T *value;
+    };
+
+    static const size_t INIT_CAPACITY = 16;
+
+    inline size_t _hash(uint32 conv) const
+    {
+        // 斐波那契散列, 取乘积的高位, 会话号高位的代数也参与散列
+        return (size_t)((uint32)(conv*2654435761U)>>mShift);
+    }
+
+    void _rehash(size_t capacity)
+    {
+        Entry *old = mEntries;
+        size_t oldCapacity = this->capacity();
+
+        mEntries = (Entry *)calloc(capacity, sizeof(Entry));
+        assert(mEntries != NULL && "ConvTable::_rehash() calloc failed!");
+        mMask = capacity-1;
+        mShift = 32;
+        for (size_t c = capacity; c > 1; c >>= 1)
+            --mShift;
+        mSize = 0;
+
+        for (size_t i = 0; i < oldCapacity; ++i)
+        {
+            if (old[i].conv != 0)
+                insert(old[i].conv, old[i].value);
+        }
+        free(old);
+    }
+
+  private:
+    Entry *mEntries;
+    size_t mMask;
+    int mShift;
+    size_t mSize;
+};
+
+NAMESPACE_END // namespace tun
+
+#endif // __CONVTABLE_H__
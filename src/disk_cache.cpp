@@ -1,86 +1,402 @@
 #include "disk_cache.h"
+#include "cache_budget.h"
 
 NAMESPACE_BEG(tun)
 
+const size_t DiskCache::MIN_BLOCK_SIZE;
+const size_t DiskCache::BLOCK_SIZE;
+const size_t DiskCache::PREFETCH_BLOCKS;
+
 DiskCache::~DiskCache()
 {
-    if (mpFile)
-        fclose(mpFile);
+    clear();
 }
 
 ssize_t DiskCache::write(const void *data, size_t datalen)
 {
     assert(data && datalen > 0);
-    if (NULL == mpFile)
+    if (mFd < 0)
         _createFile();
-    if (NULL == mpFile)
+    if (mFd < 0)
         return -1;
 
-    long curpos = ftell(mpFile);
-    if (curpos < 0)
-        return -10;
-    if (fseek(mpFile, 0, SEEK_END) < 0)
-        return -11;
+    RecordHead head = (RecordHead)datalen;
+    size_t reclen = sizeof(head)+datalen;
+    Block *tail = NULL;
+    if (!mBlocks.empty() && Block_Staging == mBlocks.back().state)
+        tail = &mBlocks.back();
 
-    if (fwrite(&datalen, 1, sizeof(datalen), mpFile) != sizeof(datalen))
-        return -2;
-    if (fwrite(data, 1, datalen, mpFile) != datalen)
-        return -3;
+    size_t minCapacity = reclen;
+    if (tail && tail->capacity-tail->len < reclen)
+    {
+        // 未满 BLOCK_SIZE 的暂存块就地扩大, 零星的小记录不必各占一整块内存
+        if (tail->capacity < BLOCK_SIZE)
+        {
+            if (!_growStagingBlock(*tail, tail->len+reclen))
+                return -10;
+        }
+        else
+        {
+            // 写满的数据流下一块直接按整块分配
+            minCapacity = max(minCapacity, tail->capacity);
+            _sealBlock(*tail);
+            tail = NULL;
+        }
+    }
+    if (NULL == tail)
+    {
+        if (!_newStagingBlock(minCapacity))
+            return -10;
+        tail = &mBlocks.back();
+    }
+
+    memcpy(tail->buf+tail->len, &head, sizeof(head));
+    memcpy(tail->buf+tail->len+sizeof(head), data, datalen);
+    tail->len += reclen;
+    tail->datalen += datalen;
+    mDataLen += datalen;
 
-    fseek(mpFile, curpos, SEEK_SET);
     return datalen;
 }
 
 ssize_t DiskCache::read(void *data, size_t datalen)
 {
-    if (NULL == mpFile)
-        return 0;
-
-    size_t peeksz = peeksize();
-    if (0 == peeksz)
+    size_t peeksz = 0;
+    const void *ptr = peek(peeksz);
+    if (NULL == ptr)
         return 0;
     if (datalen < peeksz)
         return -2;
 
-    fseek(mpFile, sizeof(peeksz), SEEK_CUR);
-    return fread(data, 1, peeksz, mpFile);
+    memcpy(data, ptr, peeksz);
+    pop();
+    return peeksz;
 }
 
 size_t DiskCache::peeksize()
 {
-    if (NULL == mpFile)
-        return 0;
-
     size_t peeksz = 0;
-    if (fread(&peeksz, 1, sizeof(peeksz), mpFile) != sizeof(peeksz))
+    if (NULL == peek(peeksz))
         return 0;
-
-    fseek(mpFile, -sizeof(peeksz), SEEK_CUR);
     return peeksz;
 }
 
-void DiskCache::rollback(size_t n)
+const void* DiskCache::peek(size_t &datalen)
 {
-    if (mpFile)
-        fseek(mpFile, -(n+sizeof(size_t)), SEEK_CUR);
+    datalen = 0;
+    if (mBlocks.empty())
+        return NULL;
+
+    Block &h = mBlocks.front();
+    if (Block_OnDisk == h.state)
+        _prefetch();
+    if (Block_OnDisk == h.state || Block_Loading == h.state)
+        return NULL;
+
+    RecordHead head = 0;
+    memcpy(&head, h.buf+h.rpos, sizeof(head));
+    if (h.rpos+sizeof(head)+head > h.len)
+    {
+        ErrorPrint("DiskCache::peek() corrupted record! len=%u", head);
+        return NULL;
+    }
+
+    datalen = head;
+    return h.buf+h.rpos+sizeof(head);
+}
+
+void DiskCache::pop()
+{
+    assert(!mBlocks.empty() && "DiskCache::pop() without peek");
+
+    Block &h = mBlocks.front();
+    assert(h.buf != NULL && h.state != Block_Loading && "DiskCache::pop() without peek");
+
+    RecordHead head = 0;
+    memcpy(&head, h.buf+h.rpos, sizeof(head));
+    assert(h.rpos+sizeof(head)+head <= h.len && "DiskCache::pop() incomplete record");
+
+    h.rpos += sizeof(head)+head;
+    mDataLen -= head;
+
+    if (h.rpos == h.len)
+    {
+        _releaseHeadBlock();
+        _prefetch();
+    }
 }
 
 void DiskCache::clear()
 {
-    if (mpFile)
+    BlockList::iterator it = mBlocks.begin();
+    for (; it != mBlocks.end(); ++it)
+    {
+        switch (it->state)
+        {
+        case Block_Staging:
+        case Block_Loaded:
+            free(it->buf);
+            gCacheBudget.onMemFree(it->capacity);
+            break;
+        case Block_Writing:
+        case Block_Loading:
+            // 在途任务完成后由 DiskIO 释放 buf 及其IO内存
+            it->job->owner = NULL;
+            it->job->user = NULL;
+            break;
+        case Block_OnDisk:
+            gCacheBudget.onDiskFree(it->datalen);
+            break;
+        default:
+            break;
+        }
+    }
+    mBlocks.clear();
+    mFreeSlots.clear();
+    mFileEnd = 0;
+    mDataLen = 0;
+
+    if (mFd >= 0)
     {
-        fclose(mpFile);
-        mpFile = NULL;
+        // 关闭排在该文件所有在途任务之后
+        gDiskIO.submit(gDiskIO.newJob(DiskIO::Op_Close, mFd, 0, NULL, 0, NULL, NULL));
+        mFd = -1;
+    }
+}
+
+void DiskCache::commit()
+{
+    if (!mBlocks.empty() && Block_Staging == mBlocks.back().state)
+        _sealBlock(mBlocks.back());
+}
+
+void DiskCache::onDiskIOComplete(DiskIO::Job *job)
+{
+    Block *b = (Block *)job->user;
+    assert(b != NULL && b->job == job);
+    b->job = NULL;
+
+    if (DiskIO::Op_Write == job->op)
+    {
+        if (job->ret != (ssize_t)job->len)
+        {
+            // 写失败时数据仍留在内存中, 不丢数据
+            ErrorPrint("DiskCache::onDiskIOComplete() write failed! ret=%d err=%s",
+                       (int)job->ret, strerror(job->err));
+            b->state = Block_Loaded;
+            gCacheBudget.onMemAlloc(b->capacity);
+            return;
+        }
+
+        // 即将被消费的块保留在内存中, 省去一次读回
+        size_t n = 0;
+        BlockList::iterator it = mBlocks.begin();
+        for (; it != mBlocks.end() && n < PREFETCH_BLOCKS && &*it != b; ++it, ++n) {}
+
+        if (it != mBlocks.end() && n < PREFETCH_BLOCKS && gCacheBudget.canPrefetch(b->capacity))
+        {
+            b->state = Block_Loaded;
+            gCacheBudget.onMemAlloc(b->capacity);
+        }
+        else
+        {
+            free(b->buf);
+            b->buf = NULL;
+            b->state = Block_OnDisk;
+            gCacheBudget.onDiskAlloc(b->datalen);
+        }
+    }
+    else if (DiskIO::Op_Read == job->op)
+    {
+        if (job->ret != (ssize_t)job->len)
+        {
+            ErrorPrint("DiskCache::onDiskIOComplete() read failed! ret=%d err=%s",
+                       (int)job->ret, strerror(job->err));
+            free(b->buf);
+            b->buf = NULL;
+            b->state = Block_OnDisk;
+            gCacheBudget.onDiskAlloc(b->datalen);
+            return;
+        }
+
+        b->state = Block_Loaded;
+        gCacheBudget.onMemAlloc(b->capacity);
+
+        // 同步模式下在 peek 内部完成, 无需通知
+        if (mHandler && gDiskIO.isRunning() && b == &mBlocks.front())
+            mHandler->onDiskCacheReadable();
     }
 }
 
 bool DiskCache::_createFile()
 {
-    if (mpFile)
-        fclose(mpFile);
+    char path[] = "/tmp/fasttun-cache-XXXXXX";
+    mFd = mkstemp(path);
+    if (mFd < 0)
+    {
+        ErrorPrint("DiskCache::_createFile() mkstemp failed! %s", coreStrError());
+        return false;
+    }
+    unlink(path);
+
+    mFileEnd = 0;
+    return true;
+}
+
+bool DiskCache::_newStagingBlock(size_t minCapacity)
+{
+    size_t cap = max(MIN_BLOCK_SIZE, minCapacity);
+    char *buf = (char *)malloc(cap);
+    if (NULL == buf)
+    {
+        ErrorPrint("DiskCache::_newStagingBlock() malloc failed size=%u", cap);
+        return false;
+    }
+
+    Block b;
+    b.state = Block_Staging;
+    b.slot.offset = 0;
+    b.slot.capacity = 0;
+    b.buf = buf;
+    b.capacity = cap;
+    b.len = b.rpos = 0;
+    b.datalen = 0;
+    b.job = NULL;
+    mBlocks.push_back(b);
+
+    gCacheBudget.onMemAlloc(cap);
+    return true;
+}
+
+bool DiskCache::_growStagingBlock(Block &b, size_t minCapacity)
+{
+    assert(Block_Staging == b.state);
+
+    size_t cap = b.capacity;
+    while (cap < minCapacity && cap < BLOCK_SIZE)
+        cap <<= 1;
+    cap = max(cap, minCapacity);
+
+    char *buf = (char *)realloc(b.buf, cap);
+    if (NULL == buf)
+    {
+        ErrorPrint("DiskCache::_growStagingBlock() realloc failed size=%u", cap);
+        return false;
+    }
+
+    gCacheBudget.onMemAlloc(cap-b.capacity);
+    b.buf = buf;
+    b.capacity = cap;
+    return true;
+}
+
+void DiskCache::_sealBlock(Block &b)
+{
+    assert(Block_Staging == b.state);
+
+    b.slot = _allocSlot(b.capacity);
+    b.state = Block_Writing;
+    b.job = gDiskIO.newJob(DiskIO::Op_Write, mFd, b.slot.offset, b.buf, b.len, this, &b);
+
+    // 写入完成前仍占用内存, 转记为IO内存
+    gCacheBudget.onMemFree(b.capacity);
+    gCacheBudget.onIOAlloc(b.capacity);
+    b.job->accounted = b.capacity;
+
+    // 同步模式下会在这里直接回调 onDiskIOComplete
+    gDiskIO.submit(b.job);
+}
+
+DiskCache::Slot DiskCache::_allocSlot(size_t capacity)
+{
+    SlotList::iterator it = mFreeSlots.begin();
+    for (; it != mFreeSlots.end(); ++it)
+    {
+        if (it->capacity >= capacity)
+        {
+            Slot slot = *it;
+            mFreeSlots.erase(it);
+            return slot;
+        }
+    }
+
+    Slot slot;
+    slot.offset = mFileEnd;
+    slot.capacity = capacity;
+    mFileEnd += capacity;
+    return slot;
+}
+
+void DiskCache::_releaseHeadBlock()
+{
+    assert(!mBlocks.empty());
+
+    Block &h = mBlocks.front();
+    switch (h.state)
+    {
+    case Block_Staging:
+        free(h.buf);
+        gCacheBudget.onMemFree(h.capacity);
+        break;
+    case Block_Writing:
+        // 写任务仍持有 buf, 完成后由 DiskIO 释放;
+        // 其占用的文件空间可以立即复用, 之后的写入一定排在它后面
+        h.job->owner = NULL;
+        h.job->user = NULL;
+        mFreeSlots.push_back(h.slot);
+        break;
+    case Block_Loaded:
+        free(h.buf);
+        gCacheBudget.onMemFree(h.capacity);
+        mFreeSlots.push_back(h.slot);
+        break;
+    default:
+        assert(false && "DiskCache::_releaseHeadBlock() block not in memory");
+        break;
+    }
+    mBlocks.pop_front();
 
-    mpFile = tmpfile();
-    return mpFile != NULL;
+    if (mBlocks.empty() && mFileEnd > 0)
+    {
+        // 全部消费完毕, 收缩文件
+        gDiskIO.submit(gDiskIO.newJob(DiskIO::Op_Truncate, mFd, 0, NULL, 0, NULL, NULL));
+        mFreeSlots.clear();
+        mFileEnd = 0;
+    }
+}
+
+void DiskCache::_prefetch()
+{
+    size_t n = 0;
+    BlockList::iterator it = mBlocks.begin();
+    for (; it != mBlocks.end() && n < PREFETCH_BLOCKS; ++it, ++n)
+    {
+        if (it->state != Block_OnDisk)
+            continue;
+        // 队首块总要读回, 否则无法继续消费
+        if (n > 0 && !gCacheBudget.canPrefetch(it->len))
+            break;
+
+        char *buf = (char *)malloc(it->len);
+        if (NULL == buf)
+        {
+            ErrorPrint("DiskCache::_prefetch() malloc failed size=%u", it->len);
+            return;
+        }
+
+        it->buf = buf;
+        it->capacity = it->len;
+        it->state = Block_Loading;
+        it->job = gDiskIO.newJob(DiskIO::Op_Read, mFd, it->slot.offset, buf, it->len, this, &*it);
+
+        // 读回期间缓冲区记为IO内存
+        gCacheBudget.onDiskFree(it->datalen);
+        gCacheBudget.onIOAlloc(it->capacity);
+        it->job->accounted = it->capacity;
+
+        // 同步模式下会在这里直接回调 onDiskIOComplete
+        gDiskIO.submit(it->job);
+    }
 }
 
 NAMESPACE_END // namespace tun
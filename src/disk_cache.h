@@ -2,31 +2,135 @@
 #define __DISKCACHE_H__
 
 #include "fasttun_base.h"
+#include "disk_io.h"
 
 NAMESPACE_BEG(tun)
 
-class DiskCache
+// 分块追加式磁盘缓存
+// 记录以 [uint32 len][data] 的格式追加到内存中的暂存块, 暂存块从 MIN_BLOCK_SIZE 起按倍数扩大,
+// 块写满 BLOCK_SIZE 后交给 DiskIO 异步写入文件,
+// 写入期间及写入前的数据仍可直接从内存读取; 队首的若干块会提前异步读回内存,
+// 消费完的块所占文件空间回收复用. 事件循环线程从不等待磁盘.
+// 按块的状态计入 CacheBudget: 暂存或已读回时按缓冲区大小计为内存, 写入或读回途中计为IO内存,
+// 仅在文件中时按数据长度(不含记录头)计为磁盘
+class DiskCache : public DiskIO::Handler
 {
   public:
+    struct Handler
+    {
+        virtual ~Handler() {}
+
+        // 之前因数据尚未读回而 peek 失败, 现在有数据可读了
+        virtual void onDiskCacheReadable() = 0;
+    };
+
     DiskCache()
-            :mpFile(NULL)
+            :mHandler(NULL)
+            ,mFd(-1)
+            ,mFileEnd(0)
+            ,mBlocks()
+            ,mFreeSlots()
+            ,mDataLen(0)
     {}
 
     virtual ~DiskCache();
 
+    inline void setHandler(Handler *h)
+    {
+        mHandler = h;
+    }
+
     ssize_t write(const void *data, size_t datalen);
     ssize_t read(void *data, size_t datalen);
     size_t peeksize();
 
-    void rollback(size_t n);
+    // 返回下一条记录的指针, 在下一次调用 write/peek/pop/clear 之前有效.
+    // 返回 NULL 而 empty() 为假时表示数据还在读回途中, 读回后通知 Handler
+    const void* peek(size_t &datalen);
+    void pop();
 
     void clear();
 
+    // 把暂存块提交给 DiskIO 写入文件, 释放其占用的内存
+    void commit();
+
+    // 暂存块的缓冲区大小, 即 commit 能释放的内存
+    inline size_t stagingSize() const
+    {
+        if (!mBlocks.empty() && Block_Staging == mBlocks.back().state)
+            return mBlocks.back().capacity;
+        return 0;
+    }
+
+    inline bool empty() const
+    {
+        return 0 == mDataLen;
+    }
+
+    // 尚未被消费的数据长度(不含记录头)
+    inline size_t size() const
+    {
+        return mDataLen;
+    }
+
+    // DiskIO::Handler
+    virtual void onDiskIOComplete(DiskIO::Job *job);
+
   private:
+    enum EBlockState
+    {
+        Block_Staging, // 暂存在内存中, 仍在追加
+        Block_Writing, // 正在写入文件, buf 由写任务持有
+        Block_OnDisk,  // 仅在文件中
+        Block_Loading, // 正在读回内存
+        Block_Loaded,  // 已在文件中, 同时在内存中
+    };
+
+    struct Slot
+    {
+        off_t offset;
+        size_t capacity;
+    };
+
+    struct Block
+    {
+        int state;
+        Slot slot;
+        char *buf;
+        size_t capacity; // 缓冲区大小, 在内存中(含写入或读回途中)时按它计入 CacheBudget
+        size_t len;  // 已写入的长度
+        size_t rpos; // 已消费的长度
+        size_t datalen; // 块中记录的数据长度(不含记录头), 仅在文件中时按它计入 CacheBudget
+        DiskIO::Job *job;
+    };
+
+    typedef std::list<Block> BlockList;
+    typedef std::list<Slot> SlotList;
+    typedef uint32 RecordHead;
+
     bool _createFile();
+    bool _newStagingBlock(size_t minCapacity);
+    bool _growStagingBlock(Block &b, size_t minCapacity);
+    void _sealBlock(Block &b);
+    Slot _allocSlot(size_t capacity);
+    void _releaseHeadBlock();
+    void _prefetch();
 
   private:
-    FILE *mpFile;
+    static const size_t MIN_BLOCK_SIZE = 4*1024;
+    static const size_t BLOCK_SIZE = 128*1024;
+    // 队首预读的块数
+    static const size_t PREFETCH_BLOCKS = 2;
+
+    Handler *mHandler;
+
+    int mFd;
+    off_t mFileEnd;
+
+    BlockList mBlocks;
+    SlotList mFreeSlots;
+
+    size_t mDataLen;
 };
 
 NAMESPACE_END // namespace tun
@@ -0,0 +1,272 @@
+#include "disk_io.h"
+#include "cache_budget.h"
+
+#include <sys/eventfd.h>
+
+NAMESPACE_BEG(tun)
+
+const size_t DiskIO::MAX_INFLIGHT;
+
+DiskIO gDiskIO;
+
+DiskIO::DiskIO()
+        :mEventPoller(NULL)
+        ,mThread()
+        ,mbRunning(false)
+        ,mReqEvent(-1)
+        ,mDoneEvent(-1)
+        ,mReqQueue()
+        ,mDoneQueue()
+        ,mInFlight(0)
+        ,mBacklog()
+{
+}
+
+DiskIO::~DiskIO()
+{
+    stop();
+}
+
+bool DiskIO::start(EventPoller *poller)
+{
+    if (mbRunning)
+        return true;
+
+    mReqEvent = eventfd(0, 0);
+    mDoneEvent = eventfd(0, EFD_NONBLOCK);
+    if (mReqEvent < 0 || mDoneEvent < 0)
+    {
+        ErrorPrint("DiskIO::start() eventfd failed! %s", coreStrError());
+        stop();
+        return false;
+    }
+
+    mEventPoller = poller;
+    if (!mEventPoller->registerForRead(mDoneEvent, this))
+    {
+        ErrorPrint("DiskIO::start() registerForRead failed!");
+        stop();
+        return false;
+    }
+
+    if (pthread_create(&mThread, NULL, _threadProc, this) != 0)
+    {
+        ErrorPrint("DiskIO::start() pthread_create failed!");
+        stop();
+        return false;
+    }
+
+    mbRunning = true;
+    return true;
+}
+
+void DiskIO::stop()
+{
+    if (mbRunning)
+    {
+        // 退出任务排在所有在途任务之后, 线程退出前会把它们执行完
+        Job *job = newJob(Op_Quit, -1, 0, NULL, 0, NULL, NULL);
+        mBacklog.push_back(job);
+        while (!mBacklog.empty())
+        {
+            _submitBacklog();
+            processCompletions();
+        }
+        pthread_join(mThread, NULL);
+
+        // 退出后才提交的任务按原顺序先执行, 再回调, 回调中的新任务随后同步执行
+        JobList rest;
+        while (mReqQueue.pop(job))
+            rest.push_back(job);
+        rest.splice(rest.end(), mBacklog);
+
+        JobList::iterator it = rest.begin();
+        for (; it != rest.end(); ++it)
+            _execute(*it);
+
+        mbRunning = false;
+        while (mDoneQueue.pop(job))
+            _complete(job);
+        for (it = rest.begin(); it != rest.end(); ++it)
+            _complete(*it);
+        mInFlight = 0;
+    }
+
+    if (mEventPoller)
+    {
+        mEventPoller->deregisterForRead(mDoneEvent);
+        mEventPoller = NULL;
+    }
+    if (mReqEvent >= 0)
+    {
+        close(mReqEvent);
+        mReqEvent = -1;
+    }
+    if (mDoneEvent >= 0)
+    {
+        close(mDoneEvent);
+        mDoneEvent = -1;
+    }
+}
+
+DiskIO::Job* DiskIO::newJob(int op, int fd, off_t offset, char *buf, size_t len, Handler *owner, void *user)
+{
+    Job *job = new Job();
+    job->op = op;
+    job->fd = fd;
+    job->offset = offset;
+    job->buf = buf;
+    job->len = len;
+    job->accounted = 0;
+    job->owner = owner;
+    job->user = user;
+    job->ret = 0;
+    job->err = 0;
+    return job;
+}
+
+void DiskIO::submit(Job *job)
+{
+    if (!mbRunning)
+    {
+        _execute(job);
+        _complete(job);
+        return;
+    }
+
+    mBacklog.push_back(job);
+    _submitBacklog();
+}
+
+void DiskIO::processCompletions()
+{
+    Job *job = NULL;
+    while (mDoneQueue.pop(job))
+    {
+        --mInFlight;
+        _complete(job);
+    }
+
+    _submitBacklog();
+}
+
+int DiskIO::handleInputNotification(int fd)
+{
+    eventfd_t val = 0;
+    eventfd_read(mDoneEvent, &val);
+
+    processCompletions();
+    return 0;
+}
+
+void* DiskIO::_threadProc(void *arg)
+{
+    ((DiskIO *)arg)->_run();
+    return NULL;
+}
+
+void DiskIO::_run()
+{
+    for (;;)
+    {
+        Job *job = NULL;
+        while (mReqQueue.pop(job))
+        {
+            bool quit = Op_Quit == job->op;
+            _execute(job);
+            while (!mDoneQueue.push(job))
+            {
+                // 在途任务数受 MAX_INFLIGHT 限制, 不会走到这里
+                sched_yield();
+            }
+            _signal(mDoneEvent);
+
+            if (quit)
+                return;
+        }
+
+        eventfd_t val = 0;
+        if (eventfd_read(mReqEvent, &val) < 0 && errno != EINTR)
+        {
+            ErrorPrint("DiskIO::_run() eventfd_read failed! %s", coreStrError());
+            return;
+        }
+    }
+}
+
+void DiskIO::_execute(Job *job)
+{
+    ssize_t ret = 0;
+    switch (job->op)
+    {
+    case Op_Write:
+        ret = pwrite(job->fd, job->buf, job->len, job->offset);
+        break;
+    case Op_Read:
+        ret = pread(job->fd, job->buf, job->len, job->offset);
+        break;
+    case Op_Truncate:
+        ret = ftruncate(job->fd, job->offset);
+        break;
+    case Op_Close:
+        ret = close(job->fd);
+        break;
+    default:
+        break;
+    }
+
+    job->ret = ret;
+    job->err = ret < 0 ? errno : 0;
+}
+
+void DiskIO::_complete(Job *job)
+{
+    if (job->accounted > 0)
+    {
+        gCacheBudget.onIOFree(job->accounted);
+        job->accounted = 0;
+    }
+
+    if (job->owner)
+    {
+        job->owner->onDiskIOComplete(job);
+    }
+    else
+    {
+        if (job->ret < 0)
+        {
+            WarningPrint("DiskIO::_complete() orphan job failed! op=%d err=%s",
+                         job->op, strerror(job->err));
+        }
+        if (job->buf)
+            free(job->buf);
+    }
+
+    delete job;
+}
+
+void DiskIO::_submitBacklog()
+{
+    bool submitted = false;
+    while (!mBacklog.empty() && mInFlight < MAX_INFLIGHT)
+    {
+        Job *job = mBacklog.front();
+        mBacklog.pop_front();
+
+        bool ok = mReqQueue.push(job);
+        assert(ok && "DiskIO::_submitBacklog() request queue overflow");
+        ++mInFlight;
+        submitted = true;
+    }
+
+    if (submitted)
+        _signal(mReqEvent);
+}
+
+void DiskIO::_signal(int fd)
+{
+    if (eventfd_write(fd, 1) < 0)
+        ErrorPrint("DiskIO::_signal() eventfd_write failed! %s", coreStrError());
+}
+
+NAMESPACE_END // namespace tun
@@ -0,0 +1,144 @@
+#ifndef __DISKIO_H__
+#define __DISKIO_H__
+
+#include "fasttun_base.h"
+#include "event_poller.h"
+
+#include <pthread.h>
+
+NAMESPACE_BEG(tun)
+
+// 单生产者单消费者无锁队列, 仅用于事件循环线程与磁盘线程之间传递任务
+template <class T, size_t N>
+class SpscQueue
+{
+  public:
+    SpscQueue() : mHead(0), mTail(0) {}
+
+    // 仅生产者线程调用
+    bool push(const T &v)
+    {
+        size_t tail = mTail;
+        if (tail-__atomic_load_n(&mHead, __ATOMIC_ACQUIRE) >= N)
+            return false;
+
+        mItems[tail%N] = v;
+        __atomic_store_n(&mTail, tail+1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    // 仅消费者线程调用
+    bool pop(T &v)
+    {
+        size_t head = mHead;
+        if (head == __atomic_load_n(&mTail, __ATOMIC_ACQUIRE))
+            return false;
+
+        v = mItems[head%N];
+        __atomic_store_n(&mHead, head+1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+  private:
+    T mItems[N];
+    size_t mHead;
+    size_t mTail;
+};
+
+// 异步磁盘IO
+// 所有磁盘读写由单个后台线程按提交顺序(FIFO)执行, 因此对同一文件的读总能看到之前提交的写;
+// 完成的任务经 eventfd 通知事件循环, 在事件循环线程中回调 Handler.
+// 未启动(或已停止)时任务在提交时同步执行并立即回调
+class DiskIO : public InputNotificationHandler
+{
+  public:
+    enum EOp
+    {
+        Op_Write,
+        Op_Read,
+        Op_Truncate,
+        Op_Close,
+        Op_Quit,
+    };
+
+    struct Job;
+    struct Handler
+    {
+        virtual ~Handler() {}
+        virtual void onDiskIOComplete(Job *job) = 0;
+    };
+
+    struct Job
+    {
+        int op;
+        int fd;
+        off_t offset;
+        char *buf;
+        size_t len;
+
+        // 计入 CacheBudget 的IO内存, 任务完成时释放
+        size_t accounted;
+
+        // 为空表示发起者已放弃该任务, 完成后由 DiskIO 释放 buf
+        Handler *owner;
+        void *user;
+
+        ssize_t ret;
+        int err;
+    };
+
+    DiskIO();
+    virtual ~DiskIO();
+
+    bool start(EventPoller *poller);
+    void stop();
+
+    inline bool isRunning() const
+    {
+        return mbRunning;
+    }
+
+    Job* newJob(int op, int fd, off_t offset, char *buf, size_t len, Handler *owner, void *user);
+    void submit(Job *job);
+
+    // 事件循环线程中处理已完成的任务
+    void processCompletions();
+
+    // InputNotificationHandler
+    virtual int handleInputNotification(int fd);
+
+  private:
+    static void* _threadProc(void *arg);
+    void _run();
+
+    void _execute(Job *job);
+    void _complete(Job *job);
+    void _submitBacklog();
+    void _signal(int fd);
+
+  private:
+    // 同时在途的任务上限, 超出的任务暂存在 mBacklog 中, 因此两个队列都不会溢出
+    static const size_t MAX_INFLIGHT = 1024;
+
+    typedef SpscQueue<Job *, MAX_INFLIGHT> JobQueue;
+    typedef std::list<Job *> JobList;
+
+    EventPoller *mEventPoller;
+    pthread_t mThread;
+    bool mbRunning;
+
+    int mReqEvent;
+    int mDoneEvent;
+
+    JobQueue mReqQueue;
+    JobQueue mDoneQueue;
+
+    size_t mInFlight;
+    JobList mBacklog;
+};
+
+extern DiskIO gDiskIO;
+
+NAMESPACE_END // namespace tun
+
+#endif // __DISKIO_H__
@@ -3,10 +3,20 @@
 #ifdef HAS_EPOLL
 
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+
+// 内核的 epoll_pwait2 使用64位 timespec, 只在 timespec 与之一致的64位平台上直接调用
+#if defined(__NR_epoll_pwait2) && defined(__LP64__)
+#define HAS_EPOLL_PWAIT2
+#endif
 
 NAMESPACE_BEG(tun)
 
 EpollPoller::EpollPoller(int expectedSize)
+        :mEpfd(-1)
+        ,mTimerFd(-1)
+        ,mbPwait2(true)
 {
     mEpfd = epoll_create(expectedSize);
     if (mEpfd == -1)
@@ -17,6 +27,10 @@ EpollPoller::EpollPoller(int expectedSize)
 
 EpollPoller::~EpollPoller()
 {
+    if (mTimerFd != -1)
+    {
+        close(mTimerFd);
+    }
     if (mEpfd != -1)
     {
         close(mEpfd);
@@ -27,14 +41,20 @@ int EpollPoller::processPendingEvents(double maxWait)
 {
     const int MAX_EVENTS = 10;
     struct epoll_event events[MAX_EVENTS];
-    int maxWaitInMilliseconds = int(ceil(maxWait * 1000));
-    
+
     uint64 startTime = getTimeStamp();
-    int nfds = epoll_wait(mEpfd, events, MAX_EVENTS, maxWaitInMilliseconds);
+    int nfds = _wait(events, MAX_EVENTS, maxWait);
     mSpareTime += getTimeStamp() - startTime;
 
     for (int i = 0; i < nfds; ++i)
     {
+        if (events[i].data.fd == mTimerFd)
+        {
+            uint64 expirations = 0;
+            read(mTimerFd, &expirations, sizeof(expirations));
+            continue;
+        }
+
         if (events[i].events & (EPOLLERR|EPOLLHUP))
         {
             this->triggerError(events[i].data.fd);
@@ -56,6 +76,65 @@ int EpollPoller::processPendingEvents(double maxWait)
     return nfds;
 }
 
+int EpollPoller::_wait(struct epoll_event *events, int maxEvents, double maxWait)
+{
+    // 不等待和无限等待不需要计时
+    if (maxWait <= 0)
+        return epoll_wait(mEpfd, events, maxEvents, maxWait < 0 ? -1 : 0);
+
+#ifdef HAS_EPOLL_PWAIT2
+    if (mbPwait2)
+    {
+        struct timespec ts;
+        ts.tv_sec = (time_t)maxWait;
+        ts.tv_nsec = (long)((maxWait-ts.tv_sec)*1e9);
+        int ret = syscall(__NR_epoll_pwait2, mEpfd, events, maxEvents, &ts, NULL, 0);
+        if (ret >= 0 || errno != ENOSYS)
+            return ret;
+
+        mbPwait2 = false;
+        WarningPrint("EpollPoller::_wait() epoll_pwait2 not supported, use timerfd instead");
+    }
+#endif
+
+    if (_armTimer(maxWait))
+        return epoll_wait(mEpfd, events, maxEvents, -1);
+
+    // timerfd 也不可用时退回毫秒精度, 向上取整避免提前醒来空转
+    return epoll_wait(mEpfd, events, maxEvents, int(ceil(maxWait * 1000)));
+}
+
+bool EpollPoller::_armTimer(double maxWait)
+{
+    if (-1 == mTimerFd)
+    {
+        mTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+        if (-1 == mTimerFd)
+            return false;
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = mTimerFd;
+        if (epoll_ctl(mEpfd, EPOLL_CTL_ADD, mTimerFd, &ev) < 0)
+        {
+            ErrorPrint("EpollPoller::_armTimer() epoll_ctl failed! err:%s", coreStrError());
+            close(mTimerFd);
+            mTimerFd = -1;
+            return false;
+        }
+    }
+
+    // 全0表示撤销定时, 至少等1纳秒; 重新设置会覆盖上一次未到期的定时
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = (time_t)maxWait;
+    its.it_value.tv_nsec = (long)((maxWait-its.it_value.tv_sec)*1e9);
+    if (0 == its.it_value.tv_sec && 0 == its.it_value.tv_nsec)
+        its.it_value.tv_nsec = 1;
+    return timerfd_settime(mTimerFd, 0, &its, NULL) == 0;
+}
+
 bool EpollPoller::doRegister(int fd, bool isRead, bool isRegister)
 {
     struct epoll_event ev;
@@ -5,6 +5,8 @@
 
 #ifdef HAS_EPOLL
 
+struct epoll_event;
+
 NAMESPACE_BEG(tun)
 
 class EpollPoller : public EventPoller
@@ -41,8 +43,14 @@ class EpollPoller : public EventPoller
     virtual int processPendingEvents(double maxWait);
 
     bool doRegister(int fd, bool isRead, bool isRegister);
+
+    // 等待事件, maxWait 精确到微秒: 优先用 epoll_pwait2, 内核不支持时改用 timerfd 计时
+    int _wait(struct epoll_event *events, int maxEvents, double maxWait);
+    bool _armTimer(double maxWait);
   private:
     int mEpfd;
+    int mTimerFd;
+    bool mbPwait2;
 };
 
 NAMESPACE_END // namespace tun
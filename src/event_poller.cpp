@@ -1,9 +1,12 @@
 #include "event_poller.h"
+#include "loop_profiler.h"
+#include "timer_wheel.h"
 
 NAMESPACE_BEG(tun)
 
 EventPoller::EventPoller()
         :mSpareTime(0)
+        ,mpTimerWheel(NULL)
         ,mFdReadHandlers()
         ,mFdWriteHandlers()
 {
@@ -60,7 +63,11 @@ bool EventPoller::triggerRead(int fd)
         return false;
     }
 
-    iter->second->handleInputNotification(fd);
+    {
+        LoopProfiler::Scope scope(LoopProfiler::Site_Read, typeid(*iter->second), fd);
+        iter->second->handleInputNotification(fd);
+    }
+    serveTimers();
 
     return true;
 }
@@ -74,7 +81,11 @@ bool EventPoller::triggerWrite(int fd)
         return false;
     }
 
-    iter->second->handleOutputNotification(fd);
+    {
+        LoopProfiler::Scope scope(LoopProfiler::Site_Write, typeid(*iter->second), fd);
+        iter->second->handleOutputNotification(fd);
+    }
+    serveTimers();
 
     return true;
 }
@@ -89,6 +100,13 @@ bool EventPoller::triggerError(int fd)
     return true;
 }
 
+void EventPoller::serveTimers()
+{
+    // 时钟未前进时 process 立即返回
+    if (mpTimerWheel)
+        mpTimerWheel->process(getMonoClock());
+}
+
 bool EventPoller::isRegistered(int fd, bool isForRead) const
 {
     return isForRead ? (mFdReadHandlers.find(fd) != mFdReadHandlers.end()) :
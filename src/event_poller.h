@@ -10,6 +10,8 @@
 
 NAMESPACE_BEG(tun)
 
+class TimerWheel;
+
 class InputNotificationHandler
 {
   public:
@@ -48,6 +50,12 @@ class EventPoller
         return mSpareTime;
     }
 
+    // 设置后每处理完一个事件就推进一次时间轮, 到期的kcp更新和ACK不必等到整批事件处理完
+    inline void setTimerWheel(TimerWheel *p)
+    {
+        mpTimerWheel = p;
+    }
+
     InputNotificationHandler *findForRead(int fd);
     OutputNotificationHandler *findForWrite(int fd);
   protected:
@@ -64,8 +72,11 @@ class EventPoller
     bool isRegistered(int fd, bool isForRead) const;
 
     int recalcMaxFD() const;
+
+    void serveTimers();
   protected:
     uint64 mSpareTime;
+    TimerWheel *mpTimerWheel;
   private:
     typedef std::map<int, InputNotificationHandler *> FDReadHandlers;
     typedef std::map<int, OutputNotificationHandler *> FDWriteHandlers;
@@ -1,34 +1,58 @@
 #include "fast_connection.h"
+#include "conv_allocator.h"
 
 NAMESPACE_BEG(tun)
 
 //--------------------------------------------------------------------------
-template <int MaxNum>
-class ConvGen : public IDGenerator<uint32, MaxNum>
+static ConvAllocator s_convAllocator;
+
+// 本进程的标识, 随确认消息发给服务端, 服务端据此把同一客户端的连接归为一个对端
+static uint64 localPeerId()
 {
-    typedef IDGenerator<uint32, MaxNum> IDGen;
-  public:
-    ConvGen() : IDGen()
+    static uint64 s_peerId = 0;
+    if (0 == s_peerId)
     {
-        static const uint32 BEGID = 100;
-        for (uint32 id = BEGID; id < BEGID+MaxNum; ++id)
-        {
-            this->restorId(id);
-        }
+        s_peerId = ((uint64)getpid()<<40) ^ getTimeStamp() ^ ((uint64)random()<<16);
+        s_peerId &= ~(1ULL<<63);
+        if (0 == s_peerId)
+            s_peerId = 1;
     }
+    return s_peerId;
+}
 
-    virtual ~ConvGen()
-    {
-        this->mAvailableIds.clear();
-    }
-};
+// 可在线调整的kcp参数, 客户端随建管道确认发给服务端, 之后任一端都可以用调整消息发给对端.
+// 窗口有方向, 对端的发送窗口即本端的接收窗口, 读出时互换
+static const size_t KCP_TUNING_SIZE = 7*sizeof(int32);
+
+static void writeKcpTuning(MemoryStream &stream, const KcpArg &arg)
+{
+    stream<<(int32)arg.nodelay<<(int32)arg.interval<<(int32)arg.resend<<(int32)arg.nc
+          <<(int32)arg.sndwnd<<(int32)arg.rcvwnd<<(int32)arg.minrto;
+}
+
+static bool readKcpTuning(MemoryStream &stream, KcpArg &arg)
+{
+    if (stream.length() < KCP_TUNING_SIZE)
+        return false;
 
-static ConvGen<10000> s_convGen;
+    int32 v[7];
+    for (int i = 0; i < 7; ++i)
+        stream>>v[i];
+    arg.nodelay = v[0];
+    arg.interval = v[1];
+    arg.resend = v[2];
+    arg.nc = v[3];
+    arg.sndwnd = v[5];
+    arg.rcvwnd = v[4];
+    arg.minrto = v[6];
+    return true;
+}
 //--------------------------------------------------------------------------
 
 FastConnection::~FastConnection()
 {
     shutdown();
+    delete mpConnection;
     delete mMsgRcv;
     delete mCache;
 }
@@ -38,35 +62,38 @@ bool FastConnection::acceptConnection(int connfd)
     shutdown();
 
     uint32 conv = 0;
-    if (!s_convGen.genNewId(conv))
+    if (!s_convAllocator.alloc(conv))
     {
         ErrorPrint("FastConnection::acceptConnection() no available convids!");
         return false;
     }
 
     // create a connection object on an exists socket
-    mpConnection = new Connection(mEventPoller);
+    // 连接对象在关闭后保留, 下次复用
+    if (NULL == mpConnection)
+        mpConnection = new Connection(mEventPoller);
     if (!mpConnection->acceptConnection(connfd))
     {
-        delete mpConnection;
-        mpConnection = NULL;
-        s_convGen.restorId(conv);
+        s_convAllocator.release(conv);
         return false;
     }
     mpConnection->setEventHandler(this);
+    mPeerId = 0;
+    mLastRecvTime = getMonoClock();
 
     // create kcp tunnel
     mbTunnelConnected = false;
     mpKcpTunnel = mpTunnelGroup->createTunnel(conv);
     if (NULL == mpKcpTunnel)
     {
-        s_convGen.restorId(conv);
+        s_convAllocator.release(conv);
         return false;
     }
 
     mpKcpTunnel->setEventHandler(this);
+    mpKcpTunnel->setRecvPaused(mbRecvPaused);
     MemoryStream stream;
-    stream<<conv;
+    stream<<conv<<mpKcpTunnel->getFeatures();
     sendMessage(MsgId_CreateKcpTunnel, stream.data(), stream.length());
 
     return true;
@@ -90,14 +117,12 @@ bool FastConnection::connect(const SA *sa, socklen_t salen)
 {
     shutdown();
 
-    mpConnection = new Connection(mEventPoller);
+    if (NULL == mpConnection)
+        mpConnection = new Connection(mEventPoller);
     mpConnection->setEventHandler(this);
+    mLastRecvTime = getMonoClock();
     if (!mpConnection->connect(sa, salen))
-    {
-        delete mpConnection;
-        mpConnection = NULL;
         return false;
-    }
 
     return true;
 }
@@ -107,17 +132,29 @@ void FastConnection::shutdown()
     mMsgRcv->clear();
     if (mpKcpTunnel)
     {
-        s_convGen.restorId(mpKcpTunnel->getConv());
+        s_convAllocator.release(mpKcpTunnel->getConv());
         mpTunnelGroup->destroyTunnel(mpKcpTunnel);
         mbTunnelConnected = false;
         mpKcpTunnel = NULL;
     }
+    mFeatures = 0;
+    mbTunnelSndQueueHigh = false;
+    _checkCongestion(false);
     if (mpConnection)
-    {
         mpConnection->shutdown();
-        delete mpConnection;
-        mpConnection = NULL;
-    }
+}
+
+void FastConnection::recycle()
+{
+    shutdown();
+    if (mpConnection)
+        mpConnection->recycle();
+
+    // 重连时保留的积压数据对下一个连接没有意义
+    mCache->clear();
+    _checkCongestion(false);
+    mbRecvPaused = false;
+    mPeerId = 0;
 }
 
 int FastConnection::send(const void *data, size_t datalen)
@@ -125,10 +162,12 @@ int FastConnection::send(const void *data, size_t datalen)
     if (mpKcpTunnel && mbTunnelConnected)
     {
         _flushAll();
-        return mpKcpTunnel->send(data, datalen);
+        if (mCache->empty())
+            return mpKcpTunnel->send(data, datalen);
     }
 
     mCache->cache(data, datalen);
+    _checkCongestion(true);
     return datalen;
 }
 
@@ -137,6 +176,7 @@ void FastConnection::_flushAll()
     if (mpKcpTunnel && mbTunnelConnected && !mCache->empty())
     {
         mCache->flushAll();
+        _checkCongestion(true);
     }
 }
 
@@ -146,9 +186,39 @@ bool FastConnection::flush(const void *data, size_t datalen)
     return true;
 }
 
+size_t FastConnection::getCachedSize() const
+{
+    size_t len = mCache->size();
+    if (mpKcpTunnel)
+        len += mpKcpTunnel->getCachedSize();
+    return len;
+}
+
+void FastConnection::setRecvPaused(bool paused)
+{
+    mbRecvPaused = paused;
+    if (mpKcpTunnel)
+        mpKcpTunnel->setRecvPaused(paused);
+}
+
+bool FastConnection::retune(const KcpArg &arg)
+{
+    if (NULL == mpKcpTunnel || !mbTunnelConnected)
+        return false;
+
+    mpKcpTunnel->retune(arg);
+    if (mFeatures & ITunnel::Feature_Tuning)
+    {
+        MemoryStream stream;
+        writeKcpTuning(stream, mpKcpTunnel->getKcpArg());
+        sendMessage(MsgId_TuneKcpTunnel, stream.data(), stream.length());
+    }
+    return true;
+}
+
 void FastConnection::triggerHeartBeatPacket()
 {
-    mHeartBeatRecord.packetSentTime = core::getClock();
+    mHeartBeatRecord.packetSentTime = getMonoClock();
     sendMessage(MsgId_HeartBeat_Request, NULL, 0);
 }
 
@@ -172,6 +242,7 @@ void FastConnection::onDisconnected(Connection *pConn)
 
 void FastConnection::onRecv(Connection *pConn, const void *data, size_t datalen)
 {
+    mLastRecvTime = getMonoClock();
     mMsgRcv->input(data, datalen, pConn);
 }
 
@@ -184,10 +255,39 @@ void FastConnection::onError(Connection *pConn)
 
 void FastConnection::onRecv(const void *data, size_t datalen)
 {
+    mLastRecvTime = getMonoClock();
     if (mpHandler)
         mpHandler->onRecv(this, data, datalen);
 }
 
+void FastConnection::onSendQueueHigh()
+{
+    mbTunnelSndQueueHigh = true;
+    _checkCongestion(true);
+}
+
+void FastConnection::onSendQueueLow()
+{
+    mbTunnelSndQueueHigh = false;
+    _checkCongestion(true);
+}
+
+void FastConnection::_checkCongestion(bool notify)
+{
+    bool congested = mbTunnelSndQueueHigh || mCache->size() >= CACHE_HIGH_WATER;
+    if (congested == mbCongested)
+        return;
+
+    mbCongested = congested;
+    if (notify && mpHandler)
+    {
+        if (mbCongested)
+            mpHandler->onCongested(this);
+        else
+            mpHandler->onDrained(this);
+    }
+}
+
 void FastConnection::onRecvMsg(const void *data, uint8 datalen, void *user)
 {
     MemoryStream stream;
@@ -213,8 +313,23 @@ void FastConnection::onRecvMsg(const void *data, uint8 datalen, void *user)
             }
 
             mpKcpTunnel->setEventHandler(this);
+            mpKcpTunnel->setRecvPaused(mbRecvPaused);
             mbTunnelConnected = true;
-            sendMessage(MsgId_ConfirmCreateKcpTunnel, NULL, 0);
+
+            // 旧版本服务端不带特性; 本端确认后即可使用, 服务端收到的数据报按格式自动识别
+            uint32 features = 0;
+            if (datalen >= sizeof(msgid)+sizeof(conv)+sizeof(features))
+                stream>>features;
+            features &= mpKcpTunnel->getFeatures();
+            mpKcpTunnel->setPeerFeatures(features);
+            mFeatures = features;
+
+            // 服务端按本端的kcp参数调整它那一端的管道
+            MemoryStream confirm;
+            confirm<<localPeerId()<<features;
+            if (features & ITunnel::Feature_Tuning)
+                writeKcpTuning(confirm, mpKcpTunnel->getKcpArg());
+            sendMessage(MsgId_ConfirmCreateKcpTunnel, confirm.data(), confirm.length());
             _flushAll();
         }
         break;
@@ -227,14 +342,39 @@ void FastConnection::onRecvMsg(const void *data, uint8 datalen, void *user)
                 break;
             }
             mbTunnelConnected = true;
+
+            // 旧版本客户端不带对端标识
+            if (datalen >= sizeof(msgid)+sizeof(mPeerId))
+            {
+                stream>>mPeerId;
+                if (mPeerId != 0 && mpHandler)
+                    mpHandler->onPeerIdentified(this);
+            }
+            uint32 features = 0;
+            if (datalen >= sizeof(msgid)+sizeof(mPeerId)+sizeof(features))
+                stream>>features;
+            mpKcpTunnel->setPeerFeatures(features);
+            mFeatures = features;
+
+            KcpArg arg = mpKcpTunnel->getKcpArg();
+            if ((features & ITunnel::Feature_Tuning) && readKcpTuning(stream, arg))
+                mpKcpTunnel->retune(arg);
             _flushAll();
         }
         break;
+    case MsgId_TuneKcpTunnel:
+        if (mpKcpTunnel)
+        {
+            KcpArg arg = mpKcpTunnel->getKcpArg();
+            if (readKcpTuning(stream, arg))
+                mpKcpTunnel->retune(arg);
+        }
+        break;
     case MsgId_HeartBeat_Request:
         sendMessage(MsgId_HeartBeat_Response, NULL, 0);
         break;
     case MsgId_HeartBeat_Response:
-        mHeartBeatRecord.packetRecvTime = core::getClock();
+        mHeartBeatRecord.packetRecvTime = getMonoClock();
         break;
     default:
         ErrorPrint("FastConnection::handleMessage() undefined message!");
@@ -24,6 +24,13 @@ class FastConnection : public Connection::Handler, public KcpTunnelHandler
         
         virtual void onCreateKcpTunnelFailed(FastConnection *pConn) {}
 
+        // 服务端收到客户端的对端标识
+        virtual void onPeerIdentified(FastConnection *pConn) {}
+
+        // 发送积压超过高水位/回落到低水位, 数据源应据此暂停/恢复读取
+        virtual void onCongested(FastConnection *pConn) {}
+        virtual void onDrained(FastConnection *pConn) {}
+
         virtual void onRecv(FastConnection *pConn, const void *data, size_t datalen) {}
     };
     
@@ -33,12 +40,18 @@ class FastConnection : public Connection::Handler, public KcpTunnelHandler
             ,mpConnection(NULL)
             ,mpKcpTunnel(NULL)
             ,mbTunnelConnected(false)
+            ,mbTunnelSndQueueHigh(false)
+            ,mbCongested(false)
+            ,mbRecvPaused(false)
             ,mpHandler(NULL)
             ,mCache(NULL)
             ,mMsgRcv(NULL)
             ,mHeartBeatRecord()
+            ,mPeerId(0)
+            ,mLastRecvTime(0)
+            ,mFeatures(0)
     {
-        mCache = new MyCache(this, &FastConnection::flush);
+        mCache = new MyCache(this, &FastConnection::flush, &FastConnection::_flushAll);
         mMsgRcv = new MsgRcv(this, &FastConnection::onRecvMsg, &FastConnection::onRecvMsgErr);
     }
     
@@ -50,12 +63,40 @@ class FastConnection : public Connection::Handler, public KcpTunnelHandler
 
     void shutdown();
 
+    // 关闭并丢弃积压数据, 以便对象池复用
+    void recycle();
+
     int send(const void *data, size_t datalen);
     void _flushAll();
     bool flush(const void *data, size_t datalen);
 
+    // 尚未交给kcp的积压数据长度
+    size_t getCachedSize() const;
+
+    // 下游积压时暂停从kcp管道接收, 由kcp流控反压对端; 重建管道后仍然有效
+    void setRecvPaused(bool paused);
+    inline bool isRecvPaused() const
+    {
+        return mbRecvPaused;
+    }
+
+    // 调整本端管道的kcp参数(见 ITunnel::retune), 对端支持时一并调整对端; 管道未建立时返回false
+    bool retune(const KcpArg &arg);
+
     void triggerHeartBeatPacket();
     const HeartBeatRecord& getHeartBeatRecord() const;
+
+    // 对端进程标识, 未知时为0
+    inline uint64 getPeerId() const
+    {
+        return mPeerId;
+    }
+
+    // 最近一次收到对端数据(控制连接或kcp管道)的时刻, 可作为隐式心跳
+    inline uint32 getLastRecvTime() const
+    {
+        return mLastRecvTime;
+    }
     
     // Connection::Handler
     virtual void onConnected(Connection *pConn);
@@ -66,6 +107,8 @@ class FastConnection : public Connection::Handler, public KcpTunnelHandler
 
     // KcpTunnel::Handler
     virtual void onRecv(const void *data, size_t datalen);
+    virtual void onSendQueueHigh();
+    virtual void onSendQueueLow();
 
     inline void setEventHandler(Handler *h)
     {
@@ -89,11 +132,18 @@ class FastConnection : public Connection::Handler, public KcpTunnelHandler
         return false;
     }
 
+    inline bool isCongested() const
+    {
+        return mbCongested;
+    }
+
   private:  
     void onRecvMsg(const void *data, uint8 datalen, void *user);
     void onRecvMsgErr(void *user);
     
     void sendMessage(int msgid, const void *data, size_t datalen);  
+
+    void _checkCongestion(bool notify);
     
   private:  
     enum
@@ -102,8 +152,12 @@ class FastConnection : public Connection::Handler, public KcpTunnelHandler
         MsgId_ConfirmCreateKcpTunnel,
         MsgId_HeartBeat_Request,
         MsgId_HeartBeat_Response,
+        MsgId_TuneKcpTunnel,
     };
     
+    // 管道建立前缓存超过该长度即视为拥塞
+    static const size_t CACHE_HIGH_WATER = 256*1024;
+
     typedef Cache<FastConnection> MyCache;
     typedef msg::MessageReceiver<FastConnection, 64, uint8> MsgRcv;
     
@@ -113,6 +167,9 @@ class FastConnection : public Connection::Handler, public KcpTunnelHandler
     Connection *mpConnection;
     ITunnel *mpKcpTunnel;
     bool mbTunnelConnected;
+    bool mbTunnelSndQueueHigh;
+    bool mbCongested;
+    bool mbRecvPaused;
     
     Handler *mpHandler;
 
@@ -121,6 +178,10 @@ class FastConnection : public Connection::Handler, public KcpTunnelHandler
     MsgRcv *mMsgRcv;
 
     HeartBeatRecord mHeartBeatRecord;
+
+    uint64 mPeerId;
+    uint32 mLastRecvTime;
+    uint32 mFeatures; // 双方都支持的管道特性
 };
 
 NAMESPACE_END // namespace tun
@@ -1,9 +1,17 @@
 #include "fasttun_base.h"
 
 #include <execinfo.h>
+#include <time.h>
 
 NAMESPACE_BEG(tun)
 
+uint64 getMonoClockUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64)ts.tv_sec*1000000+ts.tv_nsec/1000;
+}
+
 void daemonize(const char *path)
 {
     /* Our process ID and Session ID */
@@ -31,14 +31,13 @@ using core::MemoryStream;
 using core::getTimeStamp;
 using core::coreStrError;
 using core::Ini;
-using core::TimerHandler;
-using core::TimerHandle;
 
 typedef struct sockaddr SA;
 
 #define GLOBAL_TUN_ID  100
 #define LISTENQ 32
 #define DEFAULT_CONF_PATH "/etc/fasttun/config.ini"
+#define HIBERNATE_IDLE_TIME 10000 // kcp管道空闲超过该毫秒数后释放缓冲区进入休眠
 
 NAMESPACE_BEG(tun)
 
@@ -127,6 +126,18 @@ class IDGenerator
 };
 //--------------------------------------------------------------------------
 
+//--------------------------------------------------------------------------
+// 单调时钟(微秒), 不受系统时间调整影响
+uint64 getMonoClockUs();
+
+// 定时器轮、kcp和心跳使用的毫秒时钟, 与 getMonoClockUs 同源,
+// 等待下一个定时器时可以精确到毫秒内的剩余时间
+inline uint32 getMonoClock()
+{
+    return (uint32)(getMonoClockUs()/1000);
+}
+//--------------------------------------------------------------------------
+
 //--------------------------------------------------------------------------
 struct HeartBeatRecord
 {
@@ -142,7 +153,7 @@ struct HeartBeatRecord
 
     bool isTimeout() const
     {
-        uint32 curClock = core::getClock();
+        uint32 curClock = getMonoClock();
         if (curClock >= packetSentTime &&
             curClock >= packetRecvTime &&
             curClock-packetSentTime <= HEARTBEAT_INTERVAL*2 &&           
@@ -155,8 +166,6 @@ struct HeartBeatRecord
 };
 //--------------------------------------------------------------------------
 
-extern core::Timers gTimer;
-
 void daemonize(const char *path);
 void print_stack_frames();
 
@@ -0,0 +1,148 @@
+#include "heartbeat.h"
+
+#include <vector>
+
+NAMESPACE_BEG(tun)
+
+const uint32 PeerHeartBeat::CONNCHECK_INTERVAL;
+const uint32 PeerHeartBeat::TIMER_SLACK;
+
+//--------------------------------------------------------------------------
+PeerHeartBeat::PeerHeartBeat(uint32 peerIp, uint64 peerId)
+        :mPeerIp(peerIp)
+        ,mPeerId(peerId)
+        ,mMembers()
+        ,mRecord()
+        ,mHeartBeatTimer(this)
+        ,mConnCheckTimer(this)
+{
+    uint32 curClock = getMonoClock();
+    gTimerWheel.schedule(&mHeartBeatTimer,
+                         curClock+HeartBeatRecord::HEARTBEAT_INTERVAL,
+                         HeartBeatRecord::HEARTBEAT_INTERVAL,
+                         TIMER_SLACK);
+    gTimerWheel.schedule(&mConnCheckTimer,
+                         curClock+CONNCHECK_INTERVAL,
+                         CONNCHECK_INTERVAL,
+                         TIMER_SLACK);
+}
+
+PeerHeartBeat::~PeerHeartBeat()
+{
+    mHeartBeatTimer.cancel();
+    mConnCheckTimer.cancel();
+}
+
+void PeerHeartBeat::addMember(Member *m)
+{
+    mMembers.insert(m);
+}
+
+void PeerHeartBeat::removeMember(Member *m)
+{
+    mMembers.erase(m);
+}
+
+void PeerHeartBeat::onTimeout(WheelTimer *pTimer)
+{
+    uint32 curClock = getMonoClock();
+    uint32 lastRecv = _lastRecvTime();
+
+    if (pTimer == &mHeartBeatTimer)
+    {
+        // 最近收到过数据则本轮不必再发心跳
+        if (curClock-lastRecv < HeartBeatRecord::HEARTBEAT_INTERVAL)
+            return;
+
+        Members::iterator it = mMembers.begin();
+        for (; it != mMembers.end(); ++it)
+        {
+            if ((*it)->sendHeartBeat())
+            {
+                mRecord.packetSentTime = curClock;
+                break;
+            }
+        }
+    }
+    else if (pTimer == &mConnCheckTimer)
+    {
+        mRecord.packetRecvTime = lastRecv;
+        if (!mRecord.isTimeout())
+            return;
+
+        char ip[INET_ADDRSTRLEN] = {0};
+        inet_ntop(AF_INET, &mPeerIp, ip, sizeof(ip));
+        InfoPrint("Peer Timeout! peer=%s peerid=%llu members=%u",
+                  ip, (unsigned long long)mPeerId, (uint32)mMembers.size());
+
+        std::vector<Member *> members(mMembers.begin(), mMembers.end());
+        for (size_t i = 0; i < members.size(); ++i)
+        {
+            if (mMembers.find(members[i]) != mMembers.end())
+                members[i]->onPeerTimeout();
+        }
+    }
+}
+
+uint32 PeerHeartBeat::_lastRecvTime() const
+{
+    uint32 lastRecv = 0;
+    Members::const_iterator it = mMembers.begin();
+    for (; it != mMembers.end(); ++it)
+    {
+        uint32 t = (*it)->getLastRecvTime();
+        if (it == mMembers.begin() || (int32)(t-lastRecv) > 0)
+            lastRecv = t;
+    }
+    return lastRecv;
+}
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+HeartBeatManager::~HeartBeatManager()
+{
+    Peers::iterator it = mPeers.begin();
+    for (; it != mPeers.end(); ++it)
+        delete it->second;
+    mPeers.clear();
+}
+
+PeerHeartBeat* HeartBeatManager::join(uint32 peerIp, uint64 peerId, PeerHeartBeat::Member *m)
+{
+    PeerHeartBeat *pPeer = NULL;
+    if (0 == peerId)
+    {
+        pPeer = new PeerHeartBeat(peerIp, 0);
+    }
+    else
+    {
+        PeerKey key(peerIp, peerId);
+        Peers::iterator it = mPeers.find(key);
+        if (it != mPeers.end())
+        {
+            pPeer = it->second;
+        }
+        else
+        {
+            pPeer = new PeerHeartBeat(peerIp, peerId);
+            mPeers.insert(std::make_pair(key, pPeer));
+        }
+    }
+
+    pPeer->addMember(m);
+    return pPeer;
+}
+
+void HeartBeatManager::leave(PeerHeartBeat *pPeer, PeerHeartBeat::Member *m)
+{
+    pPeer->removeMember(m);
+    if (!pPeer->empty())
+        return;
+
+    if (pPeer->getPeerId() != 0)
+        mPeers.erase(PeerKey(pPeer->getPeerIp(), pPeer->getPeerId()));
+    delete pPeer;
+}
+//--------------------------------------------------------------------------
+
+NAMESPACE_END // namespace tun
@@ -0,0 +1,101 @@
+#ifndef __HEARTBEAT_H__
+#define __HEARTBEAT_H__
+
+#include "fasttun_base.h"
+#include "timer_wheel.h"
+
+#include <map>
+#include <set>
+
+NAMESPACE_BEG(tun)
+
+// 按对端聚合的心跳
+// 同一对端的所有成员共用一路心跳, 任一成员收到的数据都视为对端存活(隐式心跳),
+// 对端超时后通知全部成员. 对端由来源IP和对端自报的标识共同确定, 其他主机冒用标识不能让这一组保持存活
+class PeerHeartBeat : public WheelTimer::Handler
+{
+  public:
+    struct Member
+    {
+        virtual ~Member() {}
+
+        // 最近一次从对端收到数据的时刻
+        virtual uint32 getLastRecvTime() const = 0;
+        // 通过该成员发送心跳请求, 失败返回false
+        virtual bool sendHeartBeat() = 0;
+        // 成员须延迟销毁, 不能在回调中离开
+        virtual void onPeerTimeout() = 0;
+    };
+
+    static const uint32 CONNCHECK_INTERVAL = 30000;
+    // 心跳和连接检查对精度要求不高, 对齐到整秒, 大量对端的定时器合并到同一批处理
+    static const uint32 TIMER_SLACK = 1000;
+
+    PeerHeartBeat(uint32 peerIp, uint64 peerId);
+    virtual ~PeerHeartBeat();
+
+    // 网络字节序
+    inline uint32 getPeerIp() const
+    {
+        return mPeerIp;
+    }
+    inline uint64 getPeerId() const
+    {
+        return mPeerId;
+    }
+
+    void addMember(Member *m);
+    void removeMember(Member *m);
+
+    inline bool empty() const
+    {
+        return mMembers.empty();
+    }
+    inline size_t size() const
+    {
+        return mMembers.size();
+    }
+
+    // WheelTimer::Handler
+    virtual void onTimeout(WheelTimer *pTimer);
+
+  private:
+    uint32 _lastRecvTime() const;
+
+  private:
+    typedef std::set<Member *> Members;
+
+    uint32 mPeerIp;
+    uint64 mPeerId;
+    Members mMembers;
+    HeartBeatRecord mRecord;
+
+    WheelTimer mHeartBeatTimer;
+    WheelTimer mConnCheckTimer;
+};
+
+class HeartBeatManager
+{
+  public:
+    HeartBeatManager() : mPeers() {}
+    virtual ~HeartBeatManager();
+
+    // 按 (peerIp, peerId) 分组, peerIp 为网络字节序; peerId 为0表示对端身份未知, 成员独占一路心跳
+    PeerHeartBeat* join(uint32 peerIp, uint64 peerId, PeerHeartBeat::Member *m);
+    void leave(PeerHeartBeat *pPeer, PeerHeartBeat::Member *m);
+
+    inline size_t peerCount() const
+    {
+        return mPeers.size();
+    }
+
+  private:
+    typedef std::pair<uint32, uint64> PeerKey;
+    typedef std::map<PeerKey, PeerHeartBeat *> Peers;
+
+    Peers mPeers;
+};
+
+NAMESPACE_END // namespace tun
+
+#endif // __HEARTBEAT_H__
@@ -0,0 +1,10 @@
+#include "kcp_tunnel.h"
+
+NAMESPACE_BEG(tun)
+
+//--------------------------------------------------------------------------
+char gKcpEncodeBuf[KCP_CODEC_BUF_SIZE];
+char gKcpDecodeBuf[KCP_CODEC_BUF_SIZE];
+//--------------------------------------------------------------------------
+
+NAMESPACE_END // namespace tun
@@ -5,12 +5,22 @@
 #include "event_poller.h"
 #include "cache.h"
 #include "udppacket_sender.h"
+#include "timer_wheel.h"
+#include "conv_table.h"
+#include "stats.h"
+#include "latency.h"
+#include "loop_profiler.h"
+#include "path_mtu.h"
 #include "../kcp/ikcp.h"
 
+#include <deque>
+#include <string>
+#include <vector>
+
 NAMESPACE_BEG(tun)
 
 //--------------------------------------------------------------------------
-// Kcp参数
+// Kcp参数. nodelay, interval, resend, nc, sndwnd, rcvwnd, minrto 建管道时由客户端指定, 运行中可以调整
 struct KcpArg
 {
     int nodelay; // 是否启用 nodelay模式，0不启用；1启用
@@ -18,13 +28,51 @@ struct KcpArg
     int resend; // 快速重传模式，默认0关闭，可以设置2(2次ACK跨越将会直接重传)
     int nc; // 是否关闭流控，默认是0代表不关闭，1代表关闭
     int mtu;
+    int stream; // 流模式, 小块写入合并成整MSS的分片, 没有在途数据时立即发出; 只影响发送端
+    int ackdelay; // 一批数据报输入后ACK最多延迟的毫秒数, 0为批末立即发出, 负数为等到下一个 interval
+    int sack; // 对端支持时用一个 una+区间 的SACK分片代替逐个ACK, 与旧版本对端自动协商
+    int compact; // 紧凑包头, 建管道时与对端协商, 双方都开启才使用
+    int pmtud; // 路径MTU探测, 双方都开启时以探测到的最大数据报代替 mtu, 探测失败时沿用 mtu
+    int sndwnd; // 发送窗口(分片数), 0为kcp默认值32
+    int rcvwnd; // 接收窗口(分片数), 0为kcp默认值32
+    int minrto; // 最小重传超时(毫秒), 0为kcp默认值(nodelay时30, 否则100)
 };
 
 NAMESPACE_BEG(kcpmode)
-static KcpArg Normal = {0, 30, 2, 0, 1400,};
-static KcpArg Fast   = {0, 20, 2, 1, 1400,};
-static KcpArg Fast2  = {1, 20, 2, 1, 1400,};
-static KcpArg Fast3  = {1, 10, 2, 1, 1400,};
+//                          nodelay interval resend nc mtu stream ackdelay sack compact pmtud sndwnd rcvwnd minrto
+static KcpArg Normal      = {0,     30,      2,     0, 1400, 0,   2,       1,   1,      1,    0,     0,     0,};
+static KcpArg Fast        = {0,     20,      2,     1, 1400, 0,   2,       1,   1,      1,    0,     0,     0,};
+static KcpArg Fast2       = {1,     20,      2,     1, 1400, 0,   2,       1,   1,      1,    0,     0,     0,};
+static KcpArg Fast3       = {1,     10,      2,     1, 1400, 0,   2,       1,   1,      1,    0,     0,     0,};
+// 交互: 立即确认, 更早重传; 大流量: 大窗口, 合并小块写入
+static KcpArg Interactive = {1,     10,      1,     1, 1400, 0,   0,       1,   1,      1,    32,    64,    10,};
+static KcpArg Bulk        = {0,     20,      2,     1, 1400, 1,   2,       1,   1,      1,    128,   128,   0,};
+
+// 按名字取预设, 不区分大小写, 名字无效时返回false
+static inline bool byName(const char *name, KcpArg &arg)
+{
+    static const struct
+    {
+        const char *name;
+        const KcpArg *arg;
+    } s_modes[] = {
+        {"normal", &Normal},
+        {"fast", &Fast},
+        {"fast2", &Fast2},
+        {"fast3", &Fast3},
+        {"interactive", &Interactive},
+        {"bulk", &Bulk},
+    };
+    for (size_t i = 0; i < sizeof(s_modes)/sizeof(s_modes[0]); ++i)
+    {
+        if (strcasecmp(name, s_modes[i].name) == 0)
+        {
+            arg = *s_modes[i].arg;
+            return true;
+        }
+    }
+    return false;
+}
 NAMESPACE_END // namespace kcpmode
 //--------------------------------------------------------------------------
 
@@ -83,6 +131,10 @@ class TunnelGroup : public ITunnelGroup
     {
         return sendto(mFd, data, datalen, 0, (SA *)&mSockAddr, sizeof(mSockAddr));
     }
+    int _processSendDontFragment(const void *data, size_t datalen)
+    {
+        return sendDontFragment(mFd, data, datalen, (SA *)&mSockAddr, sizeof(mSockAddr));
+    }
 
     virtual int getSockFd() const
     {
@@ -147,18 +199,44 @@ class TunnelGroup<true> : public ITunnelGroup
 struct KcpTunnelHandler
 {
     virtual void onRecv(const void *data, size_t datalen) = 0;
+
+    // 待发送队列超过高水位/回落到低水位
+    virtual void onSendQueueHigh() {}
+    virtual void onSendQueueLow() {}
 };
 
 struct ITunnel : public IUdpSender
 {
+    // 建管道时协商的可选特性
+    enum
+    {
+        Feature_CompactHeader = 1,
+        Feature_PathMtu = 2,
+        Feature_Tuning = 4,     // 支持在线调整kcp参数
+    };
+
     virtual ~ITunnel() {};
 
     virtual int send(const void *data, size_t datalen) = 0;
     virtual void _output(const void *data, size_t datalen) = 0;
 
     virtual uint32 getConv() const = 0;
+    virtual size_t getCachedSize() const = 0;
 
     virtual void setEventHandler(KcpTunnelHandler *h) = 0;
+
+    // 暂停时不再从kcp取出数据交给上层, 接收队列满后通告窗口为0, 由kcp流控让对端停发
+    virtual void setRecvPaused(bool paused) = 0;
+
+    // 本端开启的特性, 建管道时发给对端
+    virtual uint32 getFeatures() const = 0;
+    // 双方都开启的特性生效; 收到的数据报总是按格式自动识别, 生效前后都能解析
+    virtual void setPeerFeatures(uint32 features) = 0;
+
+    virtual const KcpArg& getKcpArg() const = 0;
+    // 不重建管道调整 nodelay, interval, resend, nc, sndwnd, rcvwnd, minrto, 其余字段不变;
+    // 取值超出范围时截断, 对端发来的参数也可以直接传入
+    virtual void retune(const KcpArg &arg) = 0;
 };
 
 template <bool IsServer>
@@ -173,6 +251,24 @@ class Tunnel : public ITunnel
 
     void onRecvPeerAddr(const SA *sa, socklen_t salen) {}
 
+    // 路径MTU探测包绕过发送队列直接发出, 失败即视为丢失
+    bool _canProbe() const
+    {
+        return true;
+    }
+    int _outputDontFragment(const void *data, size_t datalen)
+    {
+        return this->mpGroup->_processSendDontFragment(data, datalen);
+    }
+
+    // 休眠时释放/唤醒时重建输出缓冲
+    bool _outputIdle() const
+    {
+        return mUdpSender.empty();
+    }
+    void _releaseOutput() {}
+    void _prepareOutput() {}
+
     // IUdpSender
     virtual int processSend(const void *data, size_t datalen)
     {
@@ -208,9 +304,8 @@ class Tunnel<true> : public ITunnel
   public:    
     virtual void _output(const void *data, size_t datalen)
     {
-        if (this->mAddrSettled)
+        if (this->mAddrSettled && this->mCache->flushAll())
         {
-            this->mCache->flushAll();
             mUdpSender.send(data, datalen);
         }
         else
@@ -225,11 +320,41 @@ class Tunnel<true> : public ITunnel
         mAddrSettled = true;
     }   
 
+    bool _canProbe() const
+    {
+        return this->mAddrSettled;
+    }
+    int _outputDontFragment(const void *data, size_t datalen)
+    {
+        return sendDontFragment(mpGroup->getSockFd(), data, datalen,
+                                (SA *)&this->mSockAddr, sizeof(this->mSockAddr));
+    }
+
     bool flush(const void *data, size_t datalen)
     {
         mUdpSender.send(data, datalen);
         return true;
     }
+    void onCacheReady()
+    {
+        if (this->mAddrSettled)
+            this->mCache->flushAll();
+    }
+
+    bool _outputIdle() const
+    {
+        return this->mCache->empty() && mUdpSender.empty();
+    }
+    void _releaseOutput()
+    {
+        delete this->mCache;
+        this->mCache = NULL;
+    }
+    void _prepareOutput()
+    {
+        if (NULL == this->mCache)
+            this->mCache = new MyCache(this, &Tunnel<true>::flush, &Tunnel<true>::onCacheReady);
+    }
 
     // IUdpSender
     virtual int processSend(const void *data, size_t datalen)
@@ -250,9 +375,10 @@ class Tunnel<true> : public ITunnel
     Tunnel(MyTunnelGroup *pGroup)
             :mpGroup(pGroup)
             ,mAddrSettled(false)
+            ,mCache(NULL)
             ,mUdpSender(this)
     {
-        this->mCache = new MyCache(this, &Tunnel<true>::flush);
+        _prepareOutput();
     }
     virtual ~Tunnel()
     {
@@ -270,7 +396,7 @@ class Tunnel<true> : public ITunnel
 };
 
 template <bool IsServer>
-class KcpTunnel : public Tunnel<IsServer>
+class KcpTunnel : public Tunnel<IsServer>, public WheelTimer::Handler, public StatsSource
 {
     typedef TunnelGroup<IsServer> MyTunnelGroup;
     typedef Cache< KcpTunnel<IsServer> > SndCache;
@@ -282,6 +408,24 @@ class KcpTunnel : public Tunnel<IsServer>
             ,mConv(0)
             ,mSentCount(0)
             ,mRecvCount(0)
+            ,mBytesSent(0)
+            ,mBytesRecv(0)
+            ,mbSndQueueHigh(false)
+            ,mbRecvPaused(false)
+            ,mSndCache(NULL)
+            ,mCoalesce()
+            ,mFlushTimer(this)
+            ,mFlushAt(0)
+            ,mPacketsRecv(0)
+            ,mAckPacketsRecv(0)
+            ,mUpdateTimer(this)
+            ,mSendMarks()
+            ,mKcpArg()
+            ,mLastActive(0)
+            ,mbHibernated(false)
+            ,mSaved()
+            ,mbCompactHeader(false)
+            ,mProber()
     {
         this->mSndCache = new SndCache(this, &KcpTunnel<IsServer>::flushSndBuf);
     }
@@ -296,27 +440,152 @@ class KcpTunnel : public Tunnel<IsServer>
     {
         return mConv;
     }
+    virtual size_t getCachedSize() const
+    {
+        return (mSndCache ? mSndCache->size() : 0)+mCoalesce.size();
+    }
     virtual void setEventHandler(KcpTunnelHandler *h)
     {
         mHandler = h;
     }   
+    virtual void setRecvPaused(bool paused);
+    inline bool isRecvPaused() const
+    {
+        return mbRecvPaused;
+    }
+    virtual uint32 getFeatures() const
+    {
+        return (mKcpArg.compact ? ITunnel::Feature_CompactHeader : 0) |
+                (mKcpArg.pmtud ? ITunnel::Feature_PathMtu : 0) |
+                ITunnel::Feature_Tuning;
+    }
+    virtual void setPeerFeatures(uint32 features);
+    virtual const KcpArg& getKcpArg() const
+    {
+        return mKcpArg;
+    }
+    virtual void retune(const KcpArg &arg);
+    inline bool isCompactHeader() const
+    {
+        return mbCompactHeader;
+    }
+    inline const PathMtuProber& pathMtu() const
+    {
+        return mProber;
+    }
+    // 当前生效的MTU
+    inline uint32 mtu() const
+    {
+        return mKcpCb ? mKcpCb->mtu : 0;
+    }
+
+    // 开启紧凑包头后在这里转码
+    virtual void _output(const void *data, size_t datalen);
 
     bool input(const void *data, size_t datalen);
+
+    // 一批数据报输入完毕: 交付收到的数据, 按 ackdelay 安排ACK.
+    // 接收缓冲有空洞(乱序或丢包)或攒够一个整包的ACK时立即发出, 保证对端的快速重传
+    void flushInput(uint32 current);
+
+    inline uint64 packetsRecv() const
+    {
+        return mPacketsRecv;
+    }
+    inline uint64 ackPacketsRecv() const
+    {
+        return mAckPacketsRecv;
+    }
+
+    // 没有待收发数据时释放 ikcpcb 和缓存, 只保留续接会话所需的状态, 收发数据时自动唤醒.
+    // 空闲 HIBERNATE_IDLE_TIME 后由 update 调用
+    bool hibernate();
+
+    inline bool isHibernated() const
+    {
+        return mbHibernated;
+    }
+
+    // 驱动kcp并按 ikcp_check 的结果在 gTimerWheel 上预约下一次更新
     uint32 update(uint32 current);
 
+    // WheelTimer::Handler
+    virtual void onTimeout(WheelTimer *pTimer);
+
+    // StatsSource
+    virtual void collectStats(StatsWriter &w);
+
     bool _flushAll();   
     bool flushSndBuf(const void *data, size_t datalen);
+    void _sendSegments(const char *data, size_t datalen);
+    void _submitCoalesced();
+    void _flushSoon();
+    void _flushAt(uint32 when);
+    void _flushNow();
     bool _canFlush() const;
+    void _checkSndQueue();
+    void _checkSendMarks();
+    bool _canHibernate() const;
+    bool _wake();
+    void _applyKcpArg();
+    void _sendProbe(uint32 size, uint32 id);
+    void _applyPathMtu();
     
   private:      
+    // 一次 ikcp_send 的最后一个分片序号之后的位置, snd_nxt 越过它时数据已全部首次发出
+    struct SendMark
+    {
+        uint32 snEnd;
+        uint64 stamp;
+    };
+
+    // 休眠期间保留的kcp状态, 唤醒后序号和RTT估计从断点继续
+    struct KcpState
+    {
+        uint32 sndNxt;
+        uint32 rcvNxt;
+        uint32 rmtWnd;
+        uint32 cwnd;
+        uint32 incr;
+        uint32 ssthresh;
+        uint32 xmit;
+        int32 srtt;
+        int32 rttval;
+        int32 rto;
+        int sackPeer;
+    };
+
     ikcpcb *mKcpCb;
     KcpTunnelHandler *mHandler;
     uint32 mConv;
 
     int mSentCount;
     int mRecvCount;
+    uint64 mBytesSent;
+    uint64 mBytesRecv;
 
+    bool mbSndQueueHigh;
+    bool mbRecvPaused;
     SndCache *mSndCache;
+
+    // 流模式下不足一个MSS、等待与后续写入合并的尾部
+    std::string mCoalesce;
+    WheelTimer mFlushTimer;
+    uint32 mFlushAt;
+
+    uint64 mPacketsRecv;
+    uint64 mAckPacketsRecv; // 只含ACK的数据报
+
+    WheelTimer mUpdateTimer;
+    std::deque<SendMark> mSendMarks;
+
+    KcpArg mKcpArg;
+    uint32 mLastActive;
+    bool mbHibernated;
+    KcpState mSaved;
+
+    bool mbCompactHeader;
+    PathMtuProber mProber;
 };
 //--------------------------------------------------------------------------
 
@@ -337,6 +606,7 @@ class KcpTunnelGroup : public InputNotificationHandler
             ,mOutputNotifyList()
             ,mTunnels()
             ,mKcpArg(kcpmode::Fast3)
+            ,mInputConvs()
     {
     }
     
@@ -355,8 +625,6 @@ class KcpTunnelGroup : public InputNotificationHandler
     virtual void regOutputNotification(OutputNotificationHandler *p);
     virtual void unregOutputNotification(OutputNotificationHandler *p);
 
-    uint32 update();
-
     // InputNotificationHandler
     virtual int handleInputNotification(int fd);
 
@@ -367,6 +635,9 @@ class KcpTunnelGroup : public InputNotificationHandler
     {
         mKcpArg = mode;
     }
+
+    // 一次读事件最多收取的数据报个数
+    static const int INPUT_BATCH = 64;
     
   private:
     void tryRegWriteEvent()
@@ -388,7 +659,7 @@ class KcpTunnelGroup : public InputNotificationHandler
     }
     
   private:
-    typedef std::map<uint32, Tun *> Tunnels;
+    typedef ConvTable<Tun> Tunnels;
     typedef std::set<OutputNotificationHandler *> OutputNotifyList;
 
     EventPoller *mEventPoller;
@@ -398,6 +669,8 @@ class KcpTunnelGroup : public InputNotificationHandler
     
     Tunnels mTunnels;
     KcpArg mKcpArg; 
+
+    std::vector<uint32> mInputConvs; // 本批收到数据的管道
 };
 //--------------------------------------------------------------------------
 
@@ -1,6 +1,60 @@
 NAMESPACE_BEG(tun)
 
 //--------------------------------------------------------------------------
+static const int KCP_OVERHEAD = 24;
+static const uint8 KCP_CMD_PUSH = 81;
+static const uint8 KCP_CMD_ACK = 82;
+static const uint8 KCP_CMD_SACK = 85;
+
+// 数据报中只有ACK(可能附带窗口探测/通知), 没有数据分片
+static bool kcpAckOnly(const char *data, size_t datalen)
+{
+    bool hasAck = false;
+    while (datalen >= (size_t)KCP_OVERHEAD)
+    {
+        uint8 cmd = (uint8)data[4];
+        if (KCP_CMD_PUSH == cmd)
+            return false;
+        if (KCP_CMD_ACK == cmd || KCP_CMD_SACK == cmd)
+            hasAck = true;
+
+        uint32 len = 0;
+        memcpy(&len, data+20, sizeof(len)); // 与 ikcp 相同按小端编码, 见 ikcp_encode32u
+        if (len > datalen-KCP_OVERHEAD)
+            return false;
+        data += KCP_OVERHEAD+len;
+        datalen -= KCP_OVERHEAD+len;
+    }
+    return hasAck && 0 == datalen;
+}
+
+// 紧凑包头的转码缓冲, 定义在 kcp_tunnel.cpp; 解码后的包头最多为原长的8倍, 放不下的数据报按格式错误丢弃
+static const size_t KCP_CODEC_BUF_SIZE = 64*1024;
+extern char gKcpEncodeBuf[KCP_CODEC_BUF_SIZE];
+extern char gKcpDecodeBuf[KCP_CODEC_BUF_SIZE];
+
+// 可调参数的范围; 接收窗口至少容纳 _sendSegments 切出的一条消息(16个分片)
+static const int KCP_WND_DEFAULT = 32;
+static const int KCP_WND_MAX = 1024;
+static const int KCP_RCV_WND_MIN = 32;
+static const int KCP_MINRTO_MAX = 5000;
+
+static int kcpClamp(int v, int lo, int hi)
+{
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static void kcpClampTuning(KcpArg &arg)
+{
+    arg.nodelay = arg.nodelay ? 1 : 0;
+    arg.interval = kcpClamp(arg.interval, 10, 5000);
+    arg.resend = kcpClamp(arg.resend, 0, 32);
+    arg.nc = arg.nc ? 1 : 0;
+    arg.sndwnd = arg.sndwnd > 0 ? kcpClamp(arg.sndwnd, 1, KCP_WND_MAX) : 0;
+    arg.rcvwnd = arg.rcvwnd > 0 ? kcpClamp(arg.rcvwnd, KCP_RCV_WND_MIN, KCP_WND_MAX) : 0;
+    arg.minrto = arg.minrto > 0 ? kcpClamp(arg.minrto, 10, KCP_MINRTO_MAX) : 0;
+}
+
 static int kcpOutput(const char *buf, int len, ikcpcb *kcp, void *user)
 {
     ITunnel *pTunnel = (ITunnel *)user;
@@ -21,18 +75,33 @@ KcpTunnel<IsServer>::~KcpTunnel()
 template <bool IsServer>
 bool KcpTunnel<IsServer>::create(uint32 conv, const KcpArg &arg)
 {
-    if (mKcpCb)
+    if (mKcpCb || mbHibernated)
         shutdown();
 
     mConv = conv;
+    mKcpArg = arg;
+    kcpClampTuning(mKcpArg);
+    mbCompactHeader = false;
+    mProber = PathMtuProber();
     mKcpCb = ikcp_create(mConv, this);
     if (NULL == mKcpCb)
         return false;
 
     mKcpCb->output = kcpOutput;
-    ikcp_nodelay(mKcpCb, arg.nodelay, arg.interval, arg.resend, arg.nc);
+    _applyKcpArg();
     ikcp_setmtu(mKcpCb, arg.mtu);
+    ikcp_sack(mKcpCb, arg.sack);
+    if (NULL == mSndCache)
+        mSndCache = new SndCache(this, &KcpTunnel<IsServer>::flushSndBuf);
+    this->_prepareOutput();
+    mLastActive = getMonoClock();
     mSentCount = mRecvCount = 0;
+    mBytesSent = mBytesRecv = 0;
+    mbSndQueueHigh = false;
+    mbRecvPaused = false;
+    mSendMarks.clear();
+    gTimerWheel.schedule(&mUpdateTimer, getMonoClock());
+    gStats.add(this);
     DebugPrint("create kcp! conv=%u", conv);
     return true;
 }
@@ -40,6 +109,11 @@ bool KcpTunnel<IsServer>::create(uint32 conv, const KcpArg &arg)
 template <bool IsServer>
 void KcpTunnel<IsServer>::shutdown()
 {   
+    mUpdateTimer.cancel();
+    mFlushTimer.cancel();
+    mCoalesce.clear();
+    gStats.remove(this);
+    mbHibernated = false;
     if (mKcpCb)
     {
         if (mKcpCb->nrcv_que || mKcpCb->nsnd_que)
@@ -81,19 +155,27 @@ void KcpTunnel<IsServer>::shutdown()
         mKcpCb = NULL;
     }
     mSentCount = mRecvCount = 0;
+    mSendMarks.clear();
 }
 
 template <bool IsServer>
 int KcpTunnel<IsServer>::send(const void *data, size_t datalen)
 {
+    if (!_wake())
+        return -1;
+
+    mLastActive = getMonoClock();
+    mBytesSent += datalen;
     if (this->_canFlush() &&
         this->_flushAll() &&
         this->flushSndBuf(data, datalen))
     {
+        _checkSndQueue();
         return 0;
     }
     
     mSndCache->cache(data, datalen);
+    _checkSndQueue();
     return 0;
 }
 
@@ -114,61 +196,482 @@ bool KcpTunnel<IsServer>::flushSndBuf(const void *data, size_t datalen)
         return false;
     
     const char *ptr = (const char *)data;
-    size_t maxLen = mKcpCb->mss<<4;
-    for (;;)
+    if (mKcpArg.stream)
     {
-        if (datalen <= maxLen) // in most case
+        // 先补满上次剩下的尾部, 整MSS的部分直接交给kcp, 新的尾部留待合并
+        size_t mss = mKcpCb->mss;
+        if (!mCoalesce.empty())
         {
-            ikcp_send(mKcpCb, (const char *)ptr, datalen);
-            ++mSentCount;
-            break;
-        }
-        else
-        {
-            ikcp_send(mKcpCb, (const char *)ptr, maxLen);
-            ++mSentCount;
-            ptr += maxLen;
-            datalen -= maxLen;
+            size_t fill = min(mss-mCoalesce.size(), datalen);
+            mCoalesce.append(ptr, fill);
+            ptr += fill;
+            datalen -= fill;
+            if (mCoalesce.size() >= mss)
+                _submitCoalesced();
         }
+
+        size_t whole = datalen/mss*mss;
+        _sendSegments(ptr, whole);
+        mCoalesce.append(ptr+whole, datalen-whole);
+
+        // 类似Nagle: 没有在途数据时尽快发出, 否则等下一次 update 或ACK到达时与后续写入一起发出
+        if (0 == mKcpCb->nsnd_buf)
+            _flushSoon();
     }
+    else
+    {
+        _sendSegments(ptr, datalen);
+    }
+
+    uint64 now = core::getTimeStamp();
+    if (LatencyTag::Source_Tcp == gLatency.ingress.source)
+        gLatency.tcpToKcp.record(now-gLatency.ingress.stamp);
+
+    SendMark mark;
+    mark.snEnd = mKcpCb->snd_nxt+mKcpCb->nsnd_que+(mCoalesce.empty() ? 0 : 1);
+    mark.stamp = now;
+    mSendMarks.push_back(mark);
     return true;
 }
 
+template <bool IsServer>
+void KcpTunnel<IsServer>::_sendSegments(const char *data, size_t datalen)
+{
+    size_t maxLen = mKcpCb->mss<<4;
+    while (datalen > 0)
+    {
+        size_t len = min(datalen, maxLen);
+        ikcp_send(mKcpCb, data, len);
+        ++mSentCount;
+        data += len;
+        datalen -= len;
+    }
+}
+
+template <bool IsServer>
+void KcpTunnel<IsServer>::_submitCoalesced()
+{
+    if (mCoalesce.empty())
+        return;
+
+    _sendSegments(mCoalesce.data(), mCoalesce.size());
+    mCoalesce.clear();
+}
+
+template <bool IsServer>
+void KcpTunnel<IsServer>::_flushSoon()
+{
+    // 到下一毫秒再发, 同一轮事件中的其他写入可以合并进来
+    _flushAt(getMonoClock());
+}
+
+template <bool IsServer>
+void KcpTunnel<IsServer>::_flushAt(uint32 when)
+{
+    if (mFlushTimer.isScheduled() && (int32)(when-mFlushAt) >= 0)
+        return;
+
+    mFlushAt = when;
+    gTimerWheel.schedule(&mFlushTimer, when);
+}
+
+template <bool IsServer>
+void KcpTunnel<IsServer>::_flushNow()
+{
+    if (NULL == mKcpCb)
+        return;
+
+    _submitCoalesced();
+    // ikcp_flush 用 current 给分片打时间戳, 距上次 update 可能已过去一个 interval
+    mKcpCb->current = getMonoClock();
+    ikcp_flush(mKcpCb);
+    _checkSendMarks();
+    _checkSndQueue();
+}
+
 template <bool IsServer>
 bool KcpTunnel<IsServer>::_canFlush() const
 {
     return ikcp_waitsnd(mKcpCb) < 2*(int)mKcpCb->snd_wnd;
 }
 
+template <bool IsServer>
+void KcpTunnel<IsServer>::_checkSndQueue()
+{
+    // 高水位取 _canFlush 的上限, 即数据开始溢出到 mSndCache 的位置
+    int waitsnd = ikcp_waitsnd(mKcpCb);
+    if (!mbSndQueueHigh)
+    {
+        if (waitsnd >= 2*(int)mKcpCb->snd_wnd || !mSndCache->empty())
+        {
+            mbSndQueueHigh = true;
+            if (mHandler)
+                mHandler->onSendQueueHigh();
+        }
+    }
+    else if (waitsnd <= (int)mKcpCb->snd_wnd && mSndCache->empty())
+    {
+        mbSndQueueHigh = false;
+        if (mHandler)
+            mHandler->onSendQueueLow();
+    }
+}
+
+template <bool IsServer>
+void KcpTunnel<IsServer>::_checkSendMarks()
+{
+    if (mSendMarks.empty())
+        return;
+
+    // 发送队列中的分片按序移入发送窗口并立即发出
+    uint64 now = core::getTimeStamp();
+    while (!mSendMarks.empty() && (int32)(mKcpCb->snd_nxt-mSendMarks.front().snEnd) >= 0)
+    {
+        gLatency.kcpQueue.record(now-mSendMarks.front().stamp);
+        mSendMarks.pop_front();
+    }
+}
+
 template <bool IsServer>
 bool KcpTunnel<IsServer>::input(const void *data, size_t datalen)
 {
+    if (!_wake())
+        return false;
+
+    mLastActive = getMonoClock();
+
+    uint8 cmd = 0;
+    uint32 probeId = 0, probeSize = 0;
+    if (PathMtuProber::parse(data, datalen, cmd, probeId, probeSize))
+    {
+        // 探测包能到达即说明这个大小可用, 只回一个包头, 不经过kcp
+        if (PathMtuProber::CMD_PROBE == cmd)
+        {
+            char ack[PathMtuProber::HEADER_SIZE];
+            PathMtuProber::buildAck(ack, mConv, probeId, probeSize);
+            Tunnel<IsServer>::_output(ack, sizeof(ack));
+        }
+        else
+        {
+            mProber.onAck(probeId);
+            _applyPathMtu();
+        }
+        return true;
+    }
+
+    if (ikcp_is_compact((const char *)data, datalen))
+    {
+        long len = ikcp_decode_compact((const char *)data, datalen, gKcpDecodeBuf, sizeof(gKcpDecodeBuf));
+        if (len < 0)
+        {
+            WarningPrint("KcpTunnel::input() malformed compact packet! conv=%u len=%u", mConv, (uint32)datalen);
+            return false;
+        }
+        data = gKcpDecodeBuf;
+        datalen = len;
+    }
+
+    ++mPacketsRecv;
+    if (kcpAckOnly((const char *)data, datalen))
+        ++mAckPacketsRecv;
     int ret = ikcp_input(mKcpCb, (const char *)data, datalen);
+
+    // 流模式: 在途数据都已确认, 攒下的数据不必等到下一次 update
+    if (mKcpArg.stream && 0 == mKcpCb->nsnd_buf && (mKcpCb->nsnd_que > 0 || !mCoalesce.empty()))
+        _flushSoon();
     return 0 == ret;
 }
 
+template <bool IsServer>
+void KcpTunnel<IsServer>::_output(const void *data, size_t datalen)
+{
+    if (mbCompactHeader && datalen <= sizeof(gKcpEncodeBuf))
+    {
+        // 变长编码反而更长时按原格式发出, 对端按数据报识别
+        long len = ikcp_encode_compact((const char *)data, datalen, gKcpEncodeBuf);
+        if (len > 0)
+        {
+            Tunnel<IsServer>::_output(gKcpEncodeBuf, len);
+            return;
+        }
+    }
+    Tunnel<IsServer>::_output(data, datalen);
+}
+
+template <bool IsServer>
+void KcpTunnel<IsServer>::setPeerFeatures(uint32 features)
+{
+    uint32 common = features & getFeatures();
+    mbCompactHeader = (common & ITunnel::Feature_CompactHeader) != 0;
+    if (common & ITunnel::Feature_PathMtu)
+        mProber.start(mKcpArg.mtu, getMonoClock());
+    else
+        mProber.stop();
+}
+
+template <bool IsServer>
+void KcpTunnel<IsServer>::retune(const KcpArg &arg)
+{
+    mKcpArg.nodelay = arg.nodelay;
+    mKcpArg.interval = arg.interval;
+    mKcpArg.resend = arg.resend;
+    mKcpArg.nc = arg.nc;
+    mKcpArg.sndwnd = arg.sndwnd;
+    mKcpArg.rcvwnd = arg.rcvwnd;
+    mKcpArg.minrto = arg.minrto;
+    kcpClampTuning(mKcpArg);
+
+    // 休眠中只记下参数, 唤醒时生效
+    if (NULL == mKcpCb)
+        return;
+
+    _applyKcpArg();
+    // 窗口变大后积压的数据可以立即进入kcp; interval 变小时下一次 update 不能等到原来的时刻
+    _flushAll();
+    _checkSndQueue();
+    gTimerWheel.schedule(&mUpdateTimer, getMonoClock());
+    DebugPrint("retune kcp! conv=%u nodelay=%d interval=%d resend=%d nc=%d sndwnd=%u rcvwnd=%u minrto=%d",
+               mConv, mKcpArg.nodelay, mKcpArg.interval, mKcpArg.resend, mKcpArg.nc,
+               mKcpCb->snd_wnd, mKcpCb->rcv_wnd, mKcpCb->rx_minrto);
+}
+
+template <bool IsServer>
+void KcpTunnel<IsServer>::_applyKcpArg()
+{
+    // ikcp_nodelay 会重置 rx_minrto, 须在其后设置; 参数为0时恢复kcp默认值
+    ikcp_nodelay(mKcpCb, mKcpArg.nodelay, mKcpArg.interval, mKcpArg.resend, mKcpArg.nc);
+    ikcp_wndsize(mKcpCb, mKcpArg.sndwnd > 0 ? mKcpArg.sndwnd : KCP_WND_DEFAULT,
+                 mKcpArg.rcvwnd > 0 ? mKcpArg.rcvwnd : KCP_WND_DEFAULT);
+    if (mKcpArg.minrto > 0)
+        mKcpCb->rx_minrto = mKcpArg.minrto;
+}
+
+template <bool IsServer>
+void KcpTunnel<IsServer>::_sendProbe(uint32 size, uint32 id)
+{
+    PathMtuProber::buildProbe(gKcpEncodeBuf, mConv, id, size);
+    if (this->_outputDontFragment(gKcpEncodeBuf, size) < 0 && EMSGSIZE == errno)
+        mProber.onTooBig(size);
+}
+
+template <bool IsServer>
+void KcpTunnel<IsServer>::_applyPathMtu()
+{
+    // 重新查找时连原来的大小也不通且没有找到更小的, 退回配置的MTU
+    uint32 mtu = mProber.mtu();
+    if (0 == mtu && mProber.isRunning() && !mProber.isSearching())
+        mtu = mKcpArg.mtu;
+    if (NULL == mKcpCb || 0 == mtu || mtu == mKcpCb->mtu)
+        return;
+
+    // 调小时已切好的分片仍按原大小发出, 靠IP分片送达. ikcp 的输出缓冲为 3*(mtu+24),
+    // 原MTU超过新值两倍时放不下一个旧分片, 等发送队列清空再切换
+    if (mtu < mKcpCb->mtu)
+    {
+        if (mKcpCb->mtu > 2*mtu &&
+            (mKcpCb->nsnd_buf > 0 || mKcpCb->nsnd_que > 0 || !mCoalesce.empty()))
+        {
+            return;
+        }
+        // 流模式攒下的尾部可能超过新的MSS
+        _submitCoalesced();
+    }
+
+    if (ikcp_setmtu(mKcpCb, mtu) == 0)
+        DebugPrint("kcp path mtu! conv=%u mtu=%u", mConv, mtu);
+}
+
+template <bool IsServer>
+void KcpTunnel<IsServer>::flushInput(uint32 current)
+{
+    update(current);
+    if (NULL == mKcpCb || 0 == mKcpCb->ackcount || mKcpArg.ackdelay < 0)
+        return;
+
+    if (0 == mKcpArg.ackdelay || mKcpCb->nrcv_buf > 0 ||
+        mKcpCb->ackcount*KCP_OVERHEAD >= mKcpCb->mtu)
+    {
+        _flushNow();
+    }
+    else
+    {
+        _flushAt(current+mKcpArg.ackdelay);
+    }
+}
+
 template <bool IsServer>
 uint32 KcpTunnel<IsServer>::update(uint32 current)
 {
+    if (NULL == mKcpCb)
+        return 0;
+
+    LoopProfiler::Scope scope(LoopProfiler::Site_KcpUpdate, typeid(*this));
+    gLoopProfiler.noteConv(mConv);
+
+    // 合并窗口到此为止, 尾部随这次 flush 一起发出
+    _submitCoalesced();
     ikcp_update(mKcpCb, current);
+    _checkSendMarks();
     _flushAll();
+    _checkSndQueue();
+
+    uint32 probeSize = 0, probeId = 0;
+    mProber.setProbeTimeout(2*mKcpCb->rx_rto);
+    if (this->_canProbe() && mProber.poll(current, probeSize, probeId))
+        _sendProbe(probeSize, probeId);
+    _applyPathMtu();
 
-    int datalen = ikcp_peeksize(mKcpCb);
-    if (datalen > 0)
+    // 不再每帧轮询, 一次把已就绪的消息全部交付; 上层在 onRecv 中可能暂停接收
+    int datalen = 0;
+    while (!mbRecvPaused && (datalen = ikcp_peeksize(mKcpCb)) > 0)
     {
         char *buf = (char *)malloc(datalen);
         assert(buf != NULL && "ikcp_recv() malloc failed!");
         assert(ikcp_recv(mKcpCb, buf, datalen) == datalen);
 
         ++mRecvCount;
+        mBytesRecv += datalen;
         if (mHandler)
             mHandler->onRecv(buf, datalen);
         free(buf);
     }
 
+    if ((int32)(current-mLastActive) >= HIBERNATE_IDLE_TIME && hibernate())
+        return 0;
+
     uint32 nextCallTime = ikcp_check(mKcpCb, current);
+    gTimerWheel.schedule(&mUpdateTimer, nextCallTime);
     return nextCallTime > current ? nextCallTime - current : 0;
 }
+
+template <bool IsServer>
+void KcpTunnel<IsServer>::setRecvPaused(bool paused)
+{
+    if (paused == mbRecvPaused)
+        return;
+
+    mbRecvPaused = paused;
+    // 恢复后尽快交付排队的数据, ikcp_recv 腾出窗口时会向对端通告
+    if (!paused && mKcpCb)
+        gTimerWheel.schedule(&mUpdateTimer, getMonoClock());
+}
+
+template <bool IsServer>
+bool KcpTunnel<IsServer>::hibernate()
+{
+    if (NULL == mKcpCb || !_canHibernate())
+        return false;
+
+    mSaved.sndNxt = mKcpCb->snd_nxt;
+    mSaved.rcvNxt = mKcpCb->rcv_nxt;
+    mSaved.rmtWnd = mKcpCb->rmt_wnd;
+    mSaved.cwnd = mKcpCb->cwnd;
+    mSaved.incr = mKcpCb->incr;
+    mSaved.ssthresh = mKcpCb->ssthresh;
+    mSaved.xmit = mKcpCb->xmit;
+    mSaved.srtt = mKcpCb->rx_srtt;
+    mSaved.rttval = mKcpCb->rx_rttval;
+    mSaved.rto = mKcpCb->rx_rto;
+    mSaved.sackPeer = mKcpCb->sack_peer;
+
+    mUpdateTimer.cancel();
+    mFlushTimer.cancel();
+    std::string().swap(mCoalesce);
+    ikcp_release(mKcpCb);
+    mKcpCb = NULL;
+    delete mSndCache;
+    mSndCache = NULL;
+    this->_releaseOutput();
+    mbHibernated = true;
+    DebugPrint("hibernate kcp! conv=%u", mConv);
+    return true;
+}
+
+template <bool IsServer>
+bool KcpTunnel<IsServer>::_canHibernate() const
+{
+    // 发送窗口或接收窗口中还有数据、有待发的ACK或正在探测对端窗口时不能丢弃kcp状态
+    return 0 == mKcpCb->nsnd_que && 0 == mKcpCb->nsnd_buf &&
+            0 == mKcpCb->nrcv_que && 0 == mKcpCb->nrcv_buf &&
+            0 == mKcpCb->ackcount && 0 == mKcpCb->probe && mKcpCb->rmt_wnd > 0 &&
+            !mbSndQueueHigh && mSndCache->empty() && mCoalesce.empty() && mSendMarks.empty() &&
+            !mProber.isSearching() && this->_outputIdle();
+}
+
+template <bool IsServer>
+bool KcpTunnel<IsServer>::_wake()
+{
+    if (!mbHibernated)
+        return true;
+
+    mKcpCb = ikcp_create(mConv, this);
+    if (NULL == mKcpCb)
+    {
+        ErrorPrint("KcpTunnel::_wake() ikcp_create failed! conv=%u", mConv);
+        return false;
+    }
+
+    mKcpCb->output = kcpOutput;
+    _applyKcpArg();
+    ikcp_setmtu(mKcpCb, mKcpArg.mtu);
+    ikcp_sack(mKcpCb, mKcpArg.sack);
+    mKcpCb->snd_una = mKcpCb->snd_nxt = mSaved.sndNxt;
+    mKcpCb->rcv_nxt = mSaved.rcvNxt;
+    mKcpCb->rmt_wnd = mSaved.rmtWnd;
+    mKcpCb->cwnd = mSaved.cwnd;
+    mKcpCb->incr = mSaved.incr;
+    mKcpCb->ssthresh = mSaved.ssthresh;
+    mKcpCb->xmit = mSaved.xmit;
+    mKcpCb->rx_srtt = mSaved.srtt;
+    mKcpCb->rx_rttval = mSaved.rttval;
+    mKcpCb->rx_rto = mSaved.rto;
+    mKcpCb->sack_peer = mSaved.sackPeer;
+    _applyPathMtu();
+
+    mSndCache = new SndCache(this, &KcpTunnel<IsServer>::flushSndBuf);
+    this->_prepareOutput();
+    mbHibernated = false;
+    mLastActive = getMonoClock();
+    gTimerWheel.schedule(&mUpdateTimer, mLastActive);
+    DebugPrint("wake kcp! conv=%u", mConv);
+    return true;
+}
+
+template <bool IsServer>
+void KcpTunnel<IsServer>::onTimeout(WheelTimer *pTimer)
+{
+    if (pTimer == &mFlushTimer)
+    {
+        _flushNow();
+        return;
+    }
+    update(getMonoClock());
+}
+
+template <bool IsServer>
+void KcpTunnel<IsServer>::collectStats(StatsWriter &w)
+{
+    if (NULL == mKcpCb)
+        return;
+
+    w.gauge("fasttun_kcp_srtt_ms", "conv", mConv, mKcpCb->rx_srtt);
+    w.gauge("fasttun_kcp_rto_ms", "conv", mConv, mKcpCb->rx_rto);
+    w.gauge("fasttun_kcp_cwnd", "conv", mConv, mKcpCb->cwnd);
+    w.gauge("fasttun_kcp_mtu", "conv", mConv, mKcpCb->mtu);
+    w.gauge("fasttun_kcp_rmt_wnd", "conv", mConv, mKcpCb->rmt_wnd);
+    w.gauge("fasttun_kcp_snd_queue", "conv", mConv, mKcpCb->nsnd_que);
+    w.gauge("fasttun_kcp_snd_buf", "conv", mConv, mKcpCb->nsnd_buf);
+    w.gauge("fasttun_kcp_rcv_queue", "conv", mConv, mKcpCb->nrcv_que);
+    w.gauge("fasttun_kcp_rcv_buf", "conv", mConv, mKcpCb->nrcv_buf);
+    w.gauge("fasttun_kcp_cached_bytes", "conv", mConv, mSndCache->size());
+    w.counter("fasttun_kcp_retransmits_total", "conv", mConv, mKcpCb->xmit);
+    w.counter("fasttun_kcp_sent_bytes_total", "conv", mConv, mBytesSent);
+    w.counter("fasttun_kcp_recv_bytes_total", "conv", mConv, mBytesRecv);
+    w.counter("fasttun_kcp_recv_packets_total", "conv", mConv, mPacketsRecv);
+    w.counter("fasttun_kcp_recv_ack_packets_total", "conv", mConv, mAckPacketsRecv);
+    w.counter("fasttun_kcp_mtu_probes_total", "conv", mConv, mProber.probesSent());
+    w.counter("fasttun_kcp_mtu_probes_lost_total", "conv", mConv, mProber.probesLost());
+}
 //--------------------------------------------------------------------------
 
 //--------------------------------------------------------------------------
@@ -217,10 +720,9 @@ void KcpTunnelGroup<IsServer>::shutdown()
     tryUnregWriteEvent();
     mOutputNotifyList.clear();
     
-    typename Tunnels::iterator it = this->mTunnels.begin();
-    for (; it != this->mTunnels.end(); ++it)
+    for (size_t i = 0; i < this->mTunnels.capacity(); ++i)
     {
-        Tun *pTunnel = it->second;
+        Tun *pTunnel = this->mTunnels.valueAt(i);
         if (pTunnel)
         {
             pTunnel->shutdown();
@@ -240,8 +742,12 @@ void KcpTunnelGroup<IsServer>::shutdown()
 template <bool IsServer>
 ITunnel* KcpTunnelGroup<IsServer>::createTunnel(uint32 conv)
 {
-    typename Tunnels::iterator it = this->mTunnels.find(conv);
-    if (it != this->mTunnels.end())
+    if (0 == conv)
+    {
+        ErrorPrint("KcpTunnelGroup::createTunnel() invalid conv!");
+        return NULL;
+    }
+    if (this->mTunnels.find(conv) != NULL)
     {
         ErrorPrint("KcpTunnelGroup::createTunnel() tunnul already exist! conv=%u", conv);
         return NULL;
@@ -253,20 +759,14 @@ ITunnel* KcpTunnelGroup<IsServer>::createTunnel(uint32 conv)
         return NULL;
     }
 
-    this->mTunnels.insert(std::pair<uint32, Tun *>(conv, pTunnel));
+    this->mTunnels.insert(conv, pTunnel);
     return pTunnel;
 }
 
 template <bool IsServer>
 void KcpTunnelGroup<IsServer>::destroyTunnel(ITunnel *pTunnel)
 {   
-    uint32 conv = pTunnel->getConv();
-    
-    typename Tunnels::iterator it = this->mTunnels.find(conv);
-    if (it != this->mTunnels.end())
-    {
-        this->mTunnels.erase(it);
-    }
+    this->mTunnels.erase(pTunnel->getConv());
 
     static_cast<Tun *>(pTunnel)->shutdown();
     delete pTunnel;
@@ -293,55 +793,54 @@ void KcpTunnelGroup<IsServer>::unregOutputNotification(OutputNotificationHandler
     }
 }
 
-template <bool IsServer>
-uint32 KcpTunnelGroup<IsServer>::update()
-{
-    // update all tunnels
-    uint32 current = core::getClock();
-    uint32 maxWait = 0xFFFFFFFF;
-    typename Tunnels::iterator it = this->mTunnels.begin();
-    for (; it != this->mTunnels.end(); ++it)
-    {
-        Tun *pTunnel = it->second;
-        if (pTunnel)
-        {           
-            maxWait = min(maxWait, pTunnel->update(current));
-        }
-    }
-    return maxWait;
-}
-
 template <bool IsServer>
 int KcpTunnelGroup<IsServer>::handleInputNotification(int fd)
 {
-    // recv data from internet
-    int maxlen = mKcpArg.mtu;
+    // recv data from internet, 一次收取一批, 各管道在批末统一交付数据和发出ACK
+    // 对端可能按探测到的路径MTU发送, 缓冲按探测上限分配
+    int maxlen = mKcpArg.mtu > (int)PathMtuProber::MAX_MTU ? mKcpArg.mtu : (int)PathMtuProber::MAX_MTU;
     char *buf = (char *)malloc(maxlen);
     assert(buf != NULL && "udp recv! malloc failed!");
 
-    sockaddr_in addr;
-    socklen_t addrlen = sizeof(addr);
-    int recvlen = recvfrom(fd, buf, maxlen, 0, (SA *)&addr, &addrlen);
-
-    // input to kcp
-    if (recvlen > 0)
+    uint64 stamp = core::getTimeStamp();
+    mInputConvs.clear();
+    for (int i = 0; i < INPUT_BATCH; ++i)
     {
+        sockaddr_in addr;
+        socklen_t addrlen = sizeof(addr);
+        int recvlen = recvfrom(fd, buf, maxlen, 0, (SA *)&addr, &addrlen);
+        if (recvlen < 0)
+            break;
+
+        // input to kcp
         uint32 conv = 0;
-        int ret = ikcp_get_conv(buf, recvlen, (IUINT32 *)&conv);
-        typename Tunnels::iterator it = ret ? mTunnels.find(conv) : mTunnels.end();
-            
-        if (it != mTunnels.end())
+        int ret = recvlen > 0 ? ikcp_get_conv(buf, recvlen, (IUINT32 *)&conv) : 0;
+        Tun *pTunnel = ret ? mTunnels.find(conv) : NULL;
+        if (pTunnel)
+        {
+            // 先记下对端地址, 输入时直接回复的包(如MTU探测应答)才能发出
+            pTunnel->onRecvPeerAddr((const SA *)&addr, addrlen);
+            pTunnel->input(buf, recvlen);
+            size_t n = 0;
+            while (n < mInputConvs.size() && mInputConvs[n] != conv)
+                ++n;
+            if (n == mInputConvs.size())
+                mInputConvs.push_back(conv);
+        }
+    }
+    free(buf);
+
+    // 交付数据时管道可能被销毁, 按 conv 重新查找
+    uint32 current = getMonoClock();
+    for (size_t i = 0; i < mInputConvs.size(); ++i)
+    {
+        Tun *pTunnel = mTunnels.find(mInputConvs[i]);
+        if (pTunnel)
         {
-            Tun *pTunnel = it->second;
-            if (pTunnel)
-            {
-                pTunnel->input(buf, recvlen);                   
-                pTunnel->onRecvPeerAddr((const SA *)&addr, addrlen);
-                pTunnel->update(core::getClock());
-            }
+            IngressScope scope(LatencyTag(LatencyTag::Source_Kcp, stamp));
+            pTunnel->flushInput(current);
         }
-    }   
-    free(buf);  
+    }
     return 0;
 }
 
@@ -0,0 +1,98 @@
+#include "latency.h"
+
+NAMESPACE_BEG(tun)
+
+LatencyStats gLatency;
+
+//--------------------------------------------------------------------------
+uint64 LatencyHistogram::percentile(double q) const
+{
+    if (0 == mCount)
+        return 0;
+
+    uint64 rank = (uint64)(q*mCount+0.5);
+    if (rank < 1)
+        rank = 1;
+    if (rank > mCount)
+        rank = mCount;
+
+    uint64 seen = 0;
+    for (int i = 0; i < BUCKETS; ++i)
+    {
+        seen += mCounts[i];
+        if (seen >= rank)
+            return min(bucketUpper(i), mMax);
+    }
+    return mMax;
+}
+
+void LatencyHistogram::reset()
+{
+    mTotalCount += mCount;
+    mTotalSum += mSum;
+    memset(mCounts, 0, sizeof(mCounts));
+    mCount = 0;
+    mSum = 0;
+    mMax = 0;
+}
+
+uint64 LatencyHistogram::bucketUpper(int index)
+{
+    if (index < SUB_COUNT)
+        return (uint64)index;
+
+    int shift = index/SUB_COUNT-1;
+    uint64 sub = (uint64)(index%SUB_COUNT+SUB_COUNT);
+    return ((sub+1)<<shift)-1;
+}
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+void LatencyStats::collectStats(StatsWriter &w)
+{
+    _collect(w, "fasttun_latency_tcp_to_kcp", tcpToKcp);
+    _collect(w, "fasttun_latency_kcp_queue", kcpQueue);
+    _collect(w, "fasttun_latency_kcp_to_tcp", kcpToTcp);
+    _collect(w, "fasttun_latency_loop_busy", loopBusy);
+}
+
+void LatencyStats::resetStats()
+{
+    tcpToKcp.reset();
+    kcpQueue.reset();
+    kcpToTcp.reset();
+    loopBusy.reset();
+}
+
+void LatencyStats::_collect(StatsWriter &w, const char *name, const LatencyHistogram &h)
+{
+    static const struct
+    {
+        const char *suffix;
+        double q;
+    } s_quantiles[] = {
+        {"_p50_us", 0.5},
+        {"_p90_us", 0.9},
+        {"_p99_us", 0.99},
+        {"_p999_us", 0.999},
+    };
+
+    // 时间戳换算为微秒
+    double usPerStamp = 1e6/core::stampsPerSecond();
+    std::string metric;
+    for (size_t i = 0; i < sizeof(s_quantiles)/sizeof(s_quantiles[0]); ++i)
+    {
+        metric = std::string(name)+s_quantiles[i].suffix;
+        w.gauge(metric.c_str(), NULL, 0, h.percentile(s_quantiles[i].q)*usPerStamp);
+    }
+
+    metric = std::string(name)+"_max_us";
+    w.gauge(metric.c_str(), NULL, 0, h.max()*usPerStamp);
+    metric = std::string(name)+"_sum_us";
+    w.counter(metric.c_str(), NULL, 0, h.totalSum()*usPerStamp);
+    metric = std::string(name)+"_count";
+    w.counter(metric.c_str(), NULL, 0, h.totalCount());
+}
+//--------------------------------------------------------------------------
+
+NAMESPACE_END // namespace tun
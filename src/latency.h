@@ -0,0 +1,164 @@
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include "fasttun_base.h"
+#include "stats.h"
+
+NAMESPACE_BEG(tun)
+
+//--------------------------------------------------------------------------
+// 对数线性分桶的延迟直方图(HDR风格)
+// 每个2的幂区间再均分为 SUB_COUNT 个桶, 相对误差不超过 1/SUB_COUNT;
+// 记录只有一次 clz 和几次累加, 可以常开
+class LatencyHistogram
+{
+  public:
+    enum
+    {
+        SUB_BITS = 4,
+        SUB_COUNT = 1<<SUB_BITS,
+        BUCKETS = (64-SUB_BITS+1)*SUB_COUNT,
+    };
+
+    LatencyHistogram()
+            :mCount(0)
+            ,mSum(0)
+            ,mMax(0)
+            ,mTotalCount(0)
+            ,mTotalSum(0)
+    {
+        reset();
+    }
+
+    inline void record(uint64 v)
+    {
+        ++mCounts[bucketOf(v)];
+        ++mCount;
+        mSum += v;
+        if (v > mMax)
+            mMax = v;
+    }
+
+    // 返回不小于 q 分位数的桶上界, q 取 [0, 1]
+    uint64 percentile(double q) const;
+
+    // 清零区间统计, 之前的样本数和总和并入累计值
+    void reset();
+
+    inline uint64 count() const
+    {
+        return mCount;
+    }
+    inline uint64 sum() const
+    {
+        return mSum;
+    }
+    inline uint64 max() const
+    {
+        return mMax;
+    }
+
+    // 自创建起的累计值, 不受 reset 影响, 按计数器导出
+    inline uint64 totalCount() const
+    {
+        return mTotalCount+mCount;
+    }
+    inline uint64 totalSum() const
+    {
+        return mTotalSum+mSum;
+    }
+
+    static inline int bucketOf(uint64 v)
+    {
+        if (v < SUB_COUNT)
+            return (int)v;
+
+        int shift = 63-__builtin_clzll(v)-SUB_BITS;
+        return (shift+1)*SUB_COUNT+(int)((v>>shift)-SUB_COUNT);
+    }
+
+    static uint64 bucketUpper(int index);
+
+  private:
+    uint64 mCounts[BUCKETS];
+    uint64 mCount;
+    uint64 mSum;
+    uint64 mMax;
+
+    // reset 之前各区间的累计
+    uint64 mTotalCount;
+    uint64 mTotalSum;
+};
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+// 数据的入口: 从哪个方向读入以及读入时刻(core::getTimeStamp)
+struct LatencyTag
+{
+    enum ESource
+    {
+        Source_None = 0,
+        Source_Tcp,
+        Source_Kcp,
+    };
+
+    int source;
+    uint64 stamp;
+
+    LatencyTag() : source(Source_None), stamp(0) {}
+    LatencyTag(int src, uint64 t) : source(src), stamp(t) {}
+};
+
+// 代理路径上的延迟统计
+// 读入数据时设置当前入口, 数据沿调用链同步传递, 经过缓存时由缓存保存各条记录的入口,
+// 冲刷时恢复, 因此在发送处可以直接算出端到端延迟
+class LatencyStats : public StatsSource
+{
+  public:
+    LatencyStats()
+            :ingress()
+            ,tcpToKcp()
+            ,kcpQueue()
+            ,kcpToTcp()
+            ,loopBusy()
+    {}
+
+    // StatsSource
+    virtual void collectStats(StatsWriter &w);
+    virtual void resetStats();
+
+  public:
+    LatencyTag ingress;
+
+    LatencyHistogram tcpToKcp; // TCP读入 -> ikcp_send
+    LatencyHistogram kcpQueue; // ikcp_send -> 首次发出
+    LatencyHistogram kcpToTcp; // ikcp_input -> Connection::send
+    LatencyHistogram loopBusy; // 事件循环每轮除去等待的耗时
+
+  private:
+    static void _collect(StatsWriter &w, const char *name, const LatencyHistogram &h);
+};
+
+extern LatencyStats gLatency;
+
+// 在作用域内设置当前入口, 退出时恢复
+class IngressScope
+{
+  public:
+    IngressScope(const LatencyTag &tag) : mSaved(gLatency.ingress)
+    {
+        gLatency.ingress = tag;
+    }
+    ~IngressScope()
+    {
+        gLatency.ingress = mSaved;
+    }
+
+  private:
+    LatencyTag mSaved;
+};
+//--------------------------------------------------------------------------
+
+NAMESPACE_END // namespace tun
+
+#endif // __LATENCY_H__
@@ -57,7 +57,7 @@ bool Listener::initialise(const SA *sa, socklen_t salen)
         goto err_1;
     }
 
-    if (listen(mFd, LISTENQ) < 0)
+    if (listen(mFd, mBacklog) < 0)
     {
         ErrorPrint("[Listener::initialise] listen failed! %s", coreStrError());
         goto err_1;
@@ -93,10 +93,10 @@ int Listener::handleInputNotification(int fd)
     struct sockaddr_in addr;
     socklen_t addrlen;
     int newConns = 0;
-    while (newConns++ < 32)
+    while (newConns++ < mAcceptBatch)
     {
         addrlen = sizeof(addr);
-        int connfd = accept(fd, (SA *)&addr, &addrlen);
+        int connfd = _accept(fd, (SA *)&addr, &addrlen);
         if (connfd < 0)
         {
             // DebugPrint("accept failed! %s", coreStrError());
@@ -133,4 +133,25 @@ int Listener::handleInputNotification(int fd)
     return 0;
 }
 
+int Listener::_accept(int fd, SA *addr, socklen_t *addrlen)
+{
+#ifdef SOCK_NONBLOCK
+    // 一次系统调用同时设置非阻塞和 close-on-exec
+    return accept4(fd, addr, addrlen, SOCK_NONBLOCK|SOCK_CLOEXEC);
+#else
+    int connfd = accept(fd, addr, addrlen);
+    if (connfd < 0)
+        return -1;
+
+    if (!core::setNonblocking(connfd))
+    {
+        ErrorPrint("[Listener::_accept] set nonblocking error! %s", coreStrError());
+        close(connfd);
+        return -1;
+    }
+    fcntl(connfd, F_SETFD, FD_CLOEXEC);
+    return connfd;
+#endif
+}
+
 NAMESPACE_END // namespace tun
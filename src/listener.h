@@ -11,13 +11,22 @@ class Listener : InputNotificationHandler
   public:
     struct Handler
     {
+        // connfd 已是非阻塞的
         virtual void onAccept(int connfd) = 0;
     };
 
+    enum
+    {
+        DEFAULT_BACKLOG = 1024,
+        DEFAULT_ACCEPT_BATCH = 64,
+    };
+
     Listener(EventPoller *poller)
             :mFd(-1)
             ,mHandler(NULL)
             ,mEventPoller(poller)
+            ,mBacklog(DEFAULT_BACKLOG)
+            ,mAcceptBatch(DEFAULT_ACCEPT_BATCH)
     {
         assert(mEventPoller && "Listener::mEventPoller != NULL");
     }
@@ -33,13 +42,32 @@ class Listener : InputNotificationHandler
         mHandler = h;
     }
 
+    // 监听队列长度, 须在 initialise 之前设置; 实际值受 net.core.somaxconn 限制
+    inline void setBacklog(int backlog)
+    {
+        if (backlog > 0)
+            mBacklog = backlog;
+    }
+    // 每次可读事件最多接受的连接数, 太大会让其他连接等待
+    inline void setAcceptBatch(int batch)
+    {
+        if (batch > 0)
+            mAcceptBatch = batch;
+    }
+
     // InputNotificationHandler
     virtual int handleInputNotification(int fd);
+  private:
+    // 返回非阻塞的新连接
+    int _accept(int fd, SA *addr, socklen_t *addrlen);
   private:
     int mFd;
     Handler *mHandler;
 
     EventPoller *mEventPoller;
+
+    int mBacklog;
+    int mAcceptBatch;
 };
 
 NAMESPACE_END // namespace tun
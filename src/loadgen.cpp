@@ -0,0 +1,406 @@
+#include "fasttun_base.h"
+#include "select_poller.h"
+#include "epoll_poller.h"
+#include "listener.h"
+#include "connection.h"
+#include "latency.h"
+
+#include <set>
+#include <vector>
+
+using namespace tun;
+
+// 端到端压测工具, 全部在本机运行:
+//   loadgen.out -s 127.0.0.1:5080                  回显后端, 放在 tun-svr 后面
+//   loadgen.out -c 127.0.0.1:5085 -n 64 -m 16384   经 tun-cli 发起负载并输出报告
+// 每个连接发出一条消息, 收齐回显后再发下一条, 往返时间即端到端延迟;
+// -C 每次往返后断开重连, 测建连速率; -p 统计指定进程(tun-cli/tun-svr)的CPU开销;
+// -B 设置本进程每次读事件的读取上限(KB, 0为不限), 用于对比大流量下交互连接的延迟
+
+static sockaddr_in TargetAddr;
+
+//--------------------------------------------------------------------------
+// 回显后端
+class EchoServer : public Listener::Handler, public Connection::Handler
+{
+  public:
+    EchoServer(EventPoller *poller)
+            :mEventPoller(poller)
+            ,mListener(poller)
+            ,mConns()
+            ,mClosedConns()
+    {}
+
+    virtual ~EchoServer()
+    {
+        finalise();
+    }
+
+    bool create(const SA *sa, socklen_t salen)
+    {
+        if (!mListener.initialise(sa, salen))
+            return false;
+        mListener.setEventHandler(this);
+        return true;
+    }
+
+    void finalise()
+    {
+        update();
+
+        ConnList::iterator it = mConns.begin();
+        for (; it != mConns.end(); ++it)
+            delete *it;
+        mConns.clear();
+        mListener.finalise();
+    }
+
+    // 关闭的连接推迟到回调之外释放
+    void update()
+    {
+        ConnList::iterator it = mClosedConns.begin();
+        for (; it != mClosedConns.end(); ++it)
+        {
+            mConns.erase(*it);
+            delete *it;
+        }
+        mClosedConns.clear();
+    }
+
+    // Listener::Handler
+    virtual void onAccept(int connfd)
+    {
+        Connection *pConn = new Connection(mEventPoller);
+        if (!pConn->acceptConnection(connfd))
+        {
+            delete pConn;
+            return;
+        }
+        pConn->setEventHandler(this);
+        mConns.insert(pConn);
+    }
+
+    // Connection::Handler
+    virtual void onRecv(Connection *pConn, const void *data, size_t datalen)
+    {
+        pConn->send(data, datalen);
+    }
+    virtual void onDisconnected(Connection *pConn)
+    {
+        mClosedConns.insert(pConn);
+    }
+    virtual void onError(Connection *pConn)
+    {
+        mClosedConns.insert(pConn);
+    }
+
+  private:
+    typedef std::set<Connection *> ConnList;
+
+    EventPoller *mEventPoller;
+    Listener mListener;
+
+    ConnList mConns;
+    ConnList mClosedConns;
+};
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+// 负载发生器
+struct LoadStats
+{
+    uint64 bytes;
+    uint64 exchanges;
+    uint64 connects;
+    uint64 errors;
+    LatencyHistogram rtt;
+
+    LoadStats() : bytes(0), exchanges(0), connects(0), errors(0), rtt() {}
+};
+
+class Session : public Connection::Handler
+{
+  public:
+    Session(EventPoller *poller, LoadStats *stats, const std::string *msg, bool churn)
+            :mConn(poller)
+            ,mpStats(stats)
+            ,mpMsg(msg)
+            ,mbChurn(churn)
+            ,mbIdle(true)
+            ,mSentAt(0)
+            ,mPending(0)
+    {
+        mConn.setEventHandler(this);
+    }
+
+    virtual ~Session() {}
+
+    void start()
+    {
+        mbIdle = false;
+        ++mpStats->connects;
+        if (!mConn.connect((const SA *)&TargetAddr, sizeof(TargetAddr)))
+            _fail();
+    }
+
+    // 空闲的会话(出错或 -C 模式下一次往返结束)由主循环重新建连
+    inline bool isIdle() const
+    {
+        return mbIdle;
+    }
+    void restart()
+    {
+        mConn.shutdown();
+        start();
+    }
+
+    // Connection::Handler
+    virtual void onConnected(Connection *pConn)
+    {
+        _ping();
+    }
+    virtual void onDisconnected(Connection *pConn)
+    {
+        _fail();
+    }
+    virtual void onError(Connection *pConn)
+    {
+        _fail();
+    }
+
+    virtual void onRecv(Connection *pConn, const void *data, size_t datalen)
+    {
+        mpStats->bytes += datalen;
+        if (datalen >= mPending)
+        {
+            mpStats->rtt.record(core::getTimeStamp()-mSentAt);
+            ++mpStats->exchanges;
+            mPending = 0;
+            if (mbChurn)
+                mbIdle = true;
+            else
+                _ping();
+        }
+        else
+        {
+            mPending -= datalen;
+        }
+    }
+
+  private:
+    void _ping()
+    {
+        mSentAt = core::getTimeStamp();
+        mPending = mpMsg->size();
+        mConn.send(mpMsg->data(), mpMsg->size());
+    }
+
+    void _fail()
+    {
+        if (!mbIdle)
+            ++mpStats->errors;
+        mbIdle = true;
+    }
+
+  private:
+    Connection mConn;
+    LoadStats *mpStats;
+    const std::string *mpMsg;
+    bool mbChurn;
+    bool mbIdle;
+
+    uint64 mSentAt;
+    size_t mPending;
+};
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+// 进程的CPU时间(秒), 取 /proc/<pid>/stat 的 utime+stime
+static double processCpuSeconds(int pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *fp = fopen(path, "r");
+    if (NULL == fp)
+        return 0;
+
+    char buf[1024];
+    size_t len = fread(buf, 1, sizeof(buf)-1, fp);
+    fclose(fp);
+    buf[len] = '\0';
+
+    // 进程名可能含空格, 从最后一个 ')' 之后开始数
+    const char *p = strrchr(buf, ')');
+    unsigned long utime = 0, stime = 0;
+    if (NULL == p || sscanf(p+2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                            &utime, &stime) != 2)
+    {
+        return 0;
+    }
+    return (double)(utime+stime)/sysconf(_SC_CLK_TCK);
+}
+
+static double totalCpuSeconds(const std::vector<int> &pids)
+{
+    double secs = 0;
+    for (size_t i = 0; i < pids.size(); ++i)
+        secs += processCpuSeconds(pids[i]);
+    return secs;
+}
+
+static void report(const LoadStats &stats, double secs, double cpu, bool churn)
+{
+    double usPerStamp = 1e6/core::stampsPerSecond();
+    printf("%-12s %12.1f MB/s\n", "throughput", stats.bytes/secs/(1024*1024));
+    printf("%-12s %12.0f /s\n", "exchanges", stats.exchanges/secs);
+    if (churn)
+        printf("%-12s %12.0f /s\n", "connects", stats.connects/secs);
+    printf("%-12s %12.0f us\n", "rtt p50", stats.rtt.percentile(0.5)*usPerStamp);
+    printf("%-12s %12.0f us\n", "rtt p99", stats.rtt.percentile(0.99)*usPerStamp);
+    printf("%-12s %12.0f us\n", "rtt p999", stats.rtt.percentile(0.999)*usPerStamp);
+    if (cpu > 0 && stats.bytes > 0)
+    {
+        // 数据在隧道中往返各一次
+        printf("%-12s %12.2f s/GB\n", "cpu", cpu/(2.0*stats.bytes/(1024*1024*1024)));
+    }
+    printf("%-12s %12llu\n", "errors", (unsigned long long)stats.errors);
+}
+//--------------------------------------------------------------------------
+
+static bool s_continueMainLoop = true;
+void sigHandler(int signo)
+{
+    s_continueMainLoop = false;
+}
+
+int main(int argc, char *argv[])
+{
+    if (log_initialise(WarningLog | ErrorLog) != 0)
+    {
+        fprintf(stderr, "init log failed!");
+        exit(1);
+    }
+    log_reg_console();
+
+    // parse parameter
+    const char *serveAddr = NULL;
+    const char *targetAddr = NULL;
+    int conns = 64;
+    int msgSize = 16384;
+    int duration = 10;
+    bool churn = false;
+    std::vector<int> pids;
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "s:c:n:m:t:p:B:C")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            serveAddr = optarg;
+            break;
+        case 'c':
+            targetAddr = optarg;
+            break;
+        case 'n':
+            conns = atoi(optarg);
+            break;
+        case 'm':
+            msgSize = atoi(optarg);
+            break;
+        case 't':
+            duration = atoi(optarg);
+            break;
+        case 'p':
+            for (char *p = strtok(optarg, ","); p != NULL; p = strtok(NULL, ","))
+                pids.push_back(atoi(p));
+            break;
+        case 'C':
+            churn = true;
+            break;
+        case 'B':
+            Connection::setReadBudget((size_t)atoi(optarg)*1024);
+            break;
+        default:
+            break;
+        }
+    }
+
+    const char *addr = serveAddr ? serveAddr : targetAddr;
+    if (NULL == addr || !core::str2Ipv4(addr, TargetAddr) || conns <= 0 || msgSize <= 0)
+    {
+        fprintf(stderr, "usage: %s -s ip:port | -c ip:port [-n conns] [-m msgsize] [-t secs] [-C] [-B kb] [-p pid,...]\n",
+                argv[0]);
+        log_finalise();
+        exit(EXIT_FAILURE);
+    }
+
+    struct sigaction newAct;
+    newAct.sa_handler = sigHandler;
+    sigemptyset(&newAct.sa_mask);
+    newAct.sa_flags = 0;
+    sigaction(SIGINT, &newAct, NULL);
+    sigaction(SIGTERM, &newAct, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+#ifdef HAS_EPOLL
+    EventPoller *netPoller = new EpollPoller();
+#else
+    EventPoller *netPoller = new SelectPoller();
+#endif
+
+    if (serveAddr)
+    {
+        EchoServer svr(netPoller);
+        if (!svr.create((const SA *)&TargetAddr, sizeof(TargetAddr)))
+        {
+            ErrorPrint("create echo server error! %s", serveAddr);
+            delete netPoller;
+            log_finalise();
+            exit(EXIT_FAILURE);
+        }
+
+        while (s_continueMainLoop)
+        {
+            netPoller->processPendingEvents(0.1);
+            svr.update();
+        }
+        svr.finalise();
+    }
+    else
+    {
+        LoadStats stats;
+        std::string msg(msgSize, 'x');
+        std::vector<Session *> sessions;
+        for (int i = 0; i < conns; ++i)
+            sessions.push_back(new Session(netPoller, &stats, &msg, churn));
+
+        double cpuStart = totalCpuSeconds(pids);
+        ulong start = getMonoClock();
+        for (int i = 0; i < conns; ++i)
+            sessions[i]->start();
+
+        while (s_continueMainLoop && getMonoClock()-start < (ulong)duration*1000)
+        {
+            netPoller->processPendingEvents(0.01);
+            for (int i = 0; i < conns; ++i)
+            {
+                if (sessions[i]->isIdle())
+                    sessions[i]->restart();
+            }
+        }
+
+        double secs = (getMonoClock()-start)*0.001;
+        double cpu = totalCpuSeconds(pids)-cpuStart;
+        printf("loadgen: %s conns=%d msg=%d secs=%.1f%s\n", targetAddr, conns, msgSize, secs,
+               churn ? " reconnect" : "");
+        report(stats, secs, cpu, churn);
+
+        for (int i = 0; i < conns; ++i)
+            delete sessions[i];
+    }
+
+    delete netPoller;
+    log_finalise();
+    exit(0);
+}
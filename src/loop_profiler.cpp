@@ -0,0 +1,168 @@
+#include "loop_profiler.h"
+
+#include <cxxabi.h>
+
+NAMESPACE_BEG(tun)
+
+bool gLoopProfilerEnabled = false;
+LoopProfiler gLoopProfiler;
+
+//--------------------------------------------------------------------------
+static std::string demangle(const char *name)
+{
+    int status = 0;
+    char *real = abi::__cxa_demangle(name, NULL, NULL, &status);
+    if (NULL == real)
+        return name;
+
+    std::string ret = real;
+    free(real);
+    return ret;
+}
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+void LoopProfiler::Scope::_begin(int site, const std::type_info &type, int fd)
+{
+    mpProfiler = &gLoopProfiler;
+    mpParent = mpProfiler->mpCurrent;
+    mSite = site;
+    mType = type.name();
+    mFd = fd;
+    mConv = 0;
+    mBridge = NULL;
+    mChildren = 0;
+    mpProfiler->mpCurrent = this;
+    mStart = core::getTimeStamp();
+}
+
+void LoopProfiler::Scope::_end()
+{
+    uint64 total = core::getTimeStamp()-mStart;
+    mpProfiler->mpCurrent = mpParent;
+    if (mpParent)
+    {
+        mpParent->mChildren += total;
+
+        // 身份信息向外层传递, 外层的慢回调日志也能定位到具体连接
+        if (0 == mpParent->mConv)
+            mpParent->mConv = mConv;
+        if (NULL == mpParent->mBridge)
+            mpParent->mBridge = mBridge;
+        if (mpParent->mFd < 0)
+            mpParent->mFd = mFd;
+    }
+
+    mpProfiler->_record(*this, total);
+}
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+void LoopProfiler::setSlowThreshold(double ms)
+{
+    if (ms <= 0)
+    {
+        gLoopProfilerEnabled = false;
+        mSlowThreshold = 0;
+        return;
+    }
+
+    gLoopProfilerEnabled = true;
+    mSlowThreshold = (uint64)(ms*0.001*core::stampsPerSecond());
+}
+
+void LoopProfiler::_record(const Scope &s, uint64 total)
+{
+    uint64 self = total > s.mChildren ? total-s.mChildren : 0;
+
+    Record &site = mSites[s.mSite];
+    site.busy += self;
+    ++site.calls;
+    if (total > site.max)
+        site.max = total;
+
+    Handlers::iterator it = mHandlers.find(s.mType);
+    if (it == mHandlers.end())
+    {
+        Record r = {0, 0, 0};
+        it = mHandlers.insert(Handlers::value_type(s.mType, r)).first;
+    }
+    Record &r = it->second;
+    r.busy += self;
+    ++r.calls;
+    if (total > r.max)
+        r.max = total;
+
+    if (mSlowThreshold > 0 && total >= mSlowThreshold)
+    {
+        ++mSlowCount;
+        WarningPrint("slow callback! site=%s handler=%s fd=%d conv=%u bridge=%p cost=%.3fms",
+                     siteName(s.mSite), demangle(s.mType).c_str(), s.mFd, s.mConv, s.mBridge,
+                     total*1000.0/core::stampsPerSecond());
+    }
+}
+
+bool LoopProfiler::getHandler(const char *type, uint64 &busy, uint64 &calls) const
+{
+    Handlers::const_iterator it = mHandlers.find(type);
+    if (it == mHandlers.end())
+        return false;
+
+    busy = it->second.busy;
+    calls = it->second.calls;
+    return true;
+}
+
+void LoopProfiler::collectStats(StatsWriter &w)
+{
+    if (!gLoopProfilerEnabled)
+        return;
+
+    double usPerStamp = 1e6/core::stampsPerSecond();
+    for (int i = 0; i < Site_Max; ++i)
+    {
+        const Record &r = mSites[i];
+        w.counter("fasttun_loop_site_busy_us", "site", siteName(i), r.busy*usPerStamp);
+        w.counter("fasttun_loop_site_calls", "site", siteName(i), r.calls);
+        w.gauge("fasttun_loop_site_max_us", "site", siteName(i), r.max*usPerStamp);
+    }
+
+    Handlers::const_iterator it = mHandlers.begin();
+    for (; it != mHandlers.end(); ++it)
+    {
+        std::string type = demangle(it->first);
+        const Record &r = it->second;
+        w.counter("fasttun_loop_handler_busy_us", "handler", type, r.busy*usPerStamp);
+        w.counter("fasttun_loop_handler_calls", "handler", type, r.calls);
+        w.gauge("fasttun_loop_handler_max_us", "handler", type, r.max*usPerStamp);
+    }
+
+    w.counter("fasttun_loop_slow_callbacks", NULL, 0, mSlowCount);
+}
+
+void LoopProfiler::resetStats()
+{
+    memset(mSites, 0, sizeof(mSites));
+    mHandlers.clear();
+    mSlowCount = 0;
+}
+
+const char* LoopProfiler::siteName(int site)
+{
+    switch (site)
+    {
+    case Site_Read:
+        return "read";
+    case Site_Write:
+        return "write";
+    case Site_Timer:
+        return "timer";
+    case Site_KcpUpdate:
+        return "kcp_update";
+    default:
+        return "unknown";
+    }
+}
+//--------------------------------------------------------------------------
+
+NAMESPACE_END // namespace tun
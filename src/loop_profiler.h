@@ -0,0 +1,129 @@
+#ifndef __LOOPPROFILER_H__
+#define __LOOPPROFILER_H__
+
+#include "fasttun_base.h"
+#include "stats.h"
+
+#include <map>
+#include <typeinfo>
+
+NAMESPACE_BEG(tun)
+
+//--------------------------------------------------------------------------
+// 事件循环剖析
+// 按回调对象的类型累计耗时(core::getTimeStamp, 即CPU时间戳计数), 嵌套回调只计自身部分;
+// 单次回调超过阈值时打印fd、会话号和桥接对象, 用于找出卡住事件循环的连接.
+// 默认关闭, 关闭时每次回调只多读一个全局开关
+extern bool gLoopProfilerEnabled;
+
+class LoopProfiler : public StatsSource
+{
+  public:
+    enum ESite
+    {
+        Site_Read,
+        Site_Write,
+        Site_Timer,
+        Site_KcpUpdate,
+        Site_Max,
+    };
+
+    class Scope
+    {
+      public:
+        inline Scope(int site, const std::type_info &type, int fd = -1)
+                :mpProfiler(NULL)
+        {
+            if (gLoopProfilerEnabled)
+                _begin(site, type, fd);
+        }
+
+        inline ~Scope()
+        {
+            if (mpProfiler)
+                _end();
+        }
+
+      private:
+        void _begin(int site, const std::type_info &type, int fd);
+        void _end();
+
+      private:
+        friend class LoopProfiler;
+
+        LoopProfiler *mpProfiler;
+        Scope *mpParent;
+        int mSite;
+        const char *mType;
+        int mFd;
+        uint32 mConv;
+        const void *mBridge;
+        uint64 mStart;
+        uint64 mChildren;
+    };
+
+    LoopProfiler()
+            :mpCurrent(NULL)
+            ,mSlowThreshold(0)
+            ,mSlowCount(0)
+            ,mHandlers()
+    {
+        memset(mSites, 0, sizeof(mSites));
+    }
+
+    // 单次回调超过 ms 毫秒视为慢回调, 0 关闭剖析
+    void setSlowThreshold(double ms);
+
+    // 由下层补充当前回调的身份信息
+    inline void noteConv(uint32 conv)
+    {
+        if (mpCurrent && 0 == mpCurrent->mConv)
+            mpCurrent->mConv = conv;
+    }
+    inline void noteBridge(const void *bridge)
+    {
+        if (mpCurrent && NULL == mpCurrent->mBridge)
+            mpCurrent->mBridge = bridge;
+    }
+
+    inline uint64 slowCount() const
+    {
+        return mSlowCount;
+    }
+
+    // 某类型回调的自身耗时合计与调用次数, 类型名为 typeid().name()
+    bool getHandler(const char *type, uint64 &busy, uint64 &calls) const;
+
+    // StatsSource
+    virtual void collectStats(StatsWriter &w);
+    virtual void resetStats();
+
+    static const char* siteName(int site);
+
+  private:
+    struct Record
+    {
+        uint64 busy;
+        uint64 calls;
+        uint64 max;
+    };
+
+    typedef std::map<const char *, Record> Handlers;
+
+    void _record(const Scope &s, uint64 total);
+
+  private:
+    Scope *mpCurrent;
+    uint64 mSlowThreshold;
+    uint64 mSlowCount;
+
+    Record mSites[Site_Max];
+    Handlers mHandlers;
+};
+
+extern LoopProfiler gLoopProfiler;
+//--------------------------------------------------------------------------
+
+NAMESPACE_END // namespace tun
+
+#endif // __LOOPPROFILER_H__
@@ -0,0 +1,153 @@
+#include "lossy_link.h"
+
+NAMESPACE_BEG(tun)
+
+//--------------------------------------------------------------------------
+LossyLink::LossyLink(const LinkProfile &profile, uint32 seed)
+        :mProfile(profile)
+        ,mRand(seed ? seed : 1)
+        ,mbBadState(false)
+        ,mLinkFree(0)
+        ,mLastArrive(0)
+        ,mSeq(0)
+        ,mPackets()
+        ,mStats()
+{
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+void LossyLink::send(const void *data, size_t datalen, uint32 now, bool dontFragment)
+{
+    ++mStats.sent;
+    mStats.sentBytes += datalen;
+
+    if (mProfile.mtu > 0 && datalen > mProfile.mtu)
+    {
+        if (dontFragment)
+        {
+            ++mStats.tooBig;
+            return;
+        }
+        ++mStats.fragmented;
+    }
+
+    // 瓶颈链路: 按带宽串行发出, 排队超限时尾部丢弃
+    double depart = now;
+    if (mProfile.bandwidth > 0)
+    {
+        if (mLinkFree < now)
+            mLinkFree = now;
+        if (mProfile.queueLimit > 0 &&
+            (mLinkFree-now)*mProfile.bandwidth*0.001 > mProfile.queueLimit)
+        {
+            ++mStats.queueDropped;
+            return;
+        }
+
+        mLinkFree += datalen*1000.0/mProfile.bandwidth;
+        depart = mLinkFree;
+    }
+
+    if (_lost(datalen))
+    {
+        ++mStats.dropped;
+        return;
+    }
+
+    uint32 arrive = (uint32)(depart+0.5)+mProfile.rtt/2;
+    if (mProfile.jitter > 0)
+        arrive += (uint32)(_random()*(mProfile.jitter+1));
+
+    if (mProfile.reorder > 0 && _random() < mProfile.reorder)
+    {
+        // 乱序的包不推动 mLastArrive, 后面的包可以越过它
+        _enqueue(data, datalen, arrive+mProfile.reorderDelay);
+    }
+    else
+    {
+        if ((int32)(arrive-mLastArrive) < 0)
+            arrive = mLastArrive;
+        mLastArrive = arrive;
+        _enqueue(data, datalen, arrive);
+    }
+
+    if (mProfile.duplicate > 0 && _random() < mProfile.duplicate)
+    {
+        ++mStats.duplicated;
+        _enqueue(data, datalen, arrive+(uint32)(_random()*(mProfile.jitter+1)));
+    }
+}
+
+bool LossyLink::recv(std::string &out, uint32 now)
+{
+    Packets::iterator it = mPackets.begin();
+    if (it == mPackets.end() || (int32)(it->first.first-now) > 0)
+        return false;
+
+    out.swap(it->second);
+    mPackets.erase(it);
+    ++mStats.delivered;
+    return true;
+}
+
+bool LossyLink::nextArrival(uint32 &when) const
+{
+    if (mPackets.empty())
+        return false;
+
+    when = mPackets.begin()->first.first;
+    return true;
+}
+
+double LossyLink::_random()
+{
+    // xorshift64*, 不依赖全局随机数状态
+    mRand ^= mRand>>12;
+    mRand ^= mRand<<25;
+    mRand ^= mRand>>27;
+    return ((mRand*2685821657736338717ULL)>>11)*(1.0/9007199254740992.0);
+}
+
+bool LossyLink::_lost(size_t datalen)
+{
+    // 分片后任何一片丢失整个数据报都丢失
+    if (mProfile.mtu > 0 && datalen > mProfile.mtu)
+    {
+        size_t frags = (datalen+mProfile.mtu-1)/mProfile.mtu;
+        for (size_t i = 1; i < frags; ++i)
+        {
+            if (_lostOne())
+                return true;
+        }
+    }
+    return _lostOne();
+}
+
+bool LossyLink::_lostOne()
+{
+    if (mProfile.burstEnter > 0)
+    {
+        if (mbBadState)
+        {
+            if (_random() < mProfile.burstExit)
+                mbBadState = false;
+        }
+        else if (_random() < mProfile.burstEnter)
+        {
+            mbBadState = true;
+        }
+
+        if (mbBadState)
+            return _random() < mProfile.burstLoss;
+    }
+
+    return mProfile.loss > 0 && _random() < mProfile.loss;
+}
+
+void LossyLink::_enqueue(const void *data, size_t datalen, uint32 arrive)
+{
+    mPackets[Key(arrive, mSeq++)].assign((const char *)data, datalen);
+}
+//--------------------------------------------------------------------------
+
+NAMESPACE_END // namespace tun
@@ -0,0 +1,102 @@
+#ifndef __LOSSYLINK_H__
+#define __LOSSYLINK_H__
+
+#include "fasttun_base.h"
+
+#include <map>
+#include <string>
+
+NAMESPACE_BEG(tun)
+
+//--------------------------------------------------------------------------
+// 链路参数, 时间单位毫秒
+struct LinkProfile
+{
+    uint32 rtt;          // 往返时延, 单向取一半
+    uint32 jitter;       // 单向时延的随机抖动 [0, jitter]
+    double loss;         // 独立丢包率
+    double burstEnter;   // Gilbert-Elliott: 好状态转入坏状态的概率(每个包)
+    double burstExit;    // 坏状态转回好状态的概率
+    double burstLoss;    // 坏状态下的丢包率
+    double reorder;      // 乱序概率, 被选中的包额外延迟 reorderDelay
+    uint32 reorderDelay;
+    double duplicate;    // 重复概率
+    uint32 bandwidth;    // 瓶颈带宽(字节/秒), 0为不限
+    uint32 queueLimit;   // 瓶颈队列长度(字节), 超出尾部丢弃, 0为不限
+    uint32 mtu;          // 路径MTU(UDP载荷字节), 超出时带DF的包被丢弃, 否则分片, 0为不限
+};
+
+NAMESPACE_BEG(linkprofile)
+//                                rtt jitter loss  enter  exit  bloss reorder delay dup   bandwidth   queue     mtu
+static const LinkProfile Clean = {40,  0,    0,    0,     0,    0,    0,      0,    0,    0,          0,        0,};
+static const LinkProfile Lossy = {120, 10,   0.02, 0,     0,    0,    0.01,   20,   0.001,0,          0,        0,};
+static const LinkProfile Burst = {120, 10,   0.005,0.01,  0.2,  0.5,  0.01,   20,   0,    0,          0,        0,};
+static const LinkProfile Slow  = {200, 20,   0.01, 0.005, 0.25, 0.3,  0,      0,    0,    2*1024*1024,256*1024, 0,};
+NAMESPACE_END // namespace linkprofile
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+// 单向的有损数据报链路, 由调用者推进虚拟时钟, 同一种子下结果可复现
+class LossyLink
+{
+  public:
+    struct Stats
+    {
+        uint64 sent;
+        uint64 sentBytes;
+        uint64 dropped;
+        uint64 queueDropped;
+        uint64 tooBig;       // 超过路径MTU且带DF被丢弃
+        uint64 fragmented;
+        uint64 duplicated;
+        uint64 delivered;
+    };
+
+    LossyLink(const LinkProfile &profile, uint32 seed = 1);
+    virtual ~LossyLink() {}
+
+    // dontFragment 对应套接字上的DF标记
+    void send(const void *data, size_t datalen, uint32 now, bool dontFragment = false);
+
+    // 取出一个到达时刻不晚于 now 的数据报, 没有时返回false
+    bool recv(std::string &out, uint32 now);
+
+    // 下一个数据报的到达时刻, 链路空闲时返回false
+    bool nextArrival(uint32 &when) const;
+
+    inline size_t inFlight() const
+    {
+        return mPackets.size();
+    }
+    inline const Stats& stats() const
+    {
+        return mStats;
+    }
+
+  private:
+    // (到达时刻, 序号), 同一时刻按发送顺序到达
+    typedef std::pair<uint32, uint64> Key;
+    typedef std::map<Key, std::string> Packets;
+
+    double _random();
+    bool _lost(size_t datalen);
+    bool _lostOne();
+    void _enqueue(const void *data, size_t datalen, uint32 arrive);
+
+  private:
+    LinkProfile mProfile;
+    uint64 mRand;
+    bool mbBadState;
+
+    double mLinkFree;    // 瓶颈链路空闲的时刻
+    uint32 mLastArrive;  // 未乱序的包不早于前一个包到达
+    uint64 mSeq;
+
+    Packets mPackets;
+    Stats mStats;
+};
+//--------------------------------------------------------------------------
+
+NAMESPACE_END // namespace tun
+
+#endif // __LOSSYLINK_H__
@@ -0,0 +1,197 @@
+#include "path_mtu.h"
+
+NAMESPACE_BEG(tun)
+
+const uint8 PathMtuProber::CMD_PROBE;
+const uint8 PathMtuProber::CMD_PROBE_ACK;
+const size_t PathMtuProber::HEADER_SIZE;
+
+//--------------------------------------------------------------------------
+PathMtuProber::PathMtuProber()
+        :mbRunning(false)
+        ,mBase(0)
+        ,mLo(0)
+        ,mHi(0)
+        ,mCandidate(0)
+        ,mAttempts(0)
+        ,mFirstId(0)
+        ,mProbeId(0)
+        ,mSentAt(0)
+        ,mTimeout(PROBE_TIMEOUT)
+        ,mNow(0)
+        ,mRaiseAt(0)
+        ,mProbesSent(0)
+        ,mProbesLost(0)
+{
+}
+
+void PathMtuProber::start(uint32 base, uint32 now)
+{
+    if (base < MIN_MTU)
+        base = MIN_MTU;
+    if (base > MAX_MTU)
+        base = MAX_MTU;
+
+    mbRunning = true;
+    mBase = base;
+    mLo = 0;
+    mHi = MAX_MTU+1;
+    mCandidate = base;
+    mAttempts = 0;
+    mNow = now;
+}
+
+void PathMtuProber::stop()
+{
+    mbRunning = false;
+    mCandidate = 0;
+}
+
+bool PathMtuProber::poll(uint32 now, uint32 &size, uint32 &id)
+{
+    if (!mbRunning)
+        return false;
+    mNow = now;
+
+    if (0 == mCandidate)
+    {
+        if ((int32)(now-mRaiseAt) < 0)
+            return false;
+
+        // 重新查找: 先确认当前值仍然可用, 再向上找
+        mHi = MAX_MTU+1;
+        mCandidate = mLo > 0 ? mLo : mBase;
+        mLo = 0;
+        mAttempts = 0;
+    }
+
+    if (mAttempts > 0 && (int32)(now-mSentAt) < (int32)mTimeout)
+        return false;
+
+    if (mAttempts >= MAX_PROBES)
+    {
+        mProbesLost += mAttempts;
+        mHi = mCandidate;
+        _next();
+        if (0 == mCandidate)
+            return false;
+    }
+
+    if (0 == mAttempts)
+        mFirstId = mProbeId+1;
+    ++mAttempts;
+    ++mProbesSent;
+    mSentAt = now;
+    size = mCandidate;
+    id = ++mProbeId;
+    return true;
+}
+
+void PathMtuProber::onAck(uint32 id)
+{
+    if (0 == mCandidate || (int32)(id-mFirstId) < 0 || (int32)(id-mProbeId) > 0)
+        return;
+
+    mProbesLost += mAttempts-1;
+    mLo = mCandidate;
+    _next();
+}
+
+void PathMtuProber::onTooBig(uint32 size)
+{
+    if (0 == mCandidate || size != mCandidate)
+        return;
+
+    mHi = mCandidate;
+    _next();
+}
+
+void PathMtuProber::setProbeTimeout(uint32 timeout)
+{
+    if (timeout < MIN_PROBE_TIMEOUT)
+        timeout = MIN_PROBE_TIMEOUT;
+    if (timeout > PROBE_TIMEOUT)
+        timeout = PROBE_TIMEOUT;
+    mTimeout = timeout;
+}
+
+void PathMtuProber::_next()
+{
+    uint32 lo = mLo > 0 ? mLo : MIN_MTU-1;
+    mAttempts = 0;
+    if (mHi <= MIN_MTU || mHi-lo <= SEARCH_STEP)
+    {
+        // 连最小值都没有应答时 mLo 保持为0, 调用者沿用配置的MTU
+        mCandidate = 0;
+        mRaiseAt = mNow+RAISE_INTERVAL;
+        return;
+    }
+    mCandidate = lo+(mHi-lo)/2;
+}
+
+size_t PathMtuProber::buildProbe(char *buf, uint32 conv, uint32 id, uint32 size)
+{
+    return _build(buf, CMD_PROBE, conv, id, size, size);
+}
+
+size_t PathMtuProber::buildAck(char *buf, uint32 conv, uint32 id, uint32 size)
+{
+    return _build(buf, CMD_PROBE_ACK, conv, id, size, HEADER_SIZE);
+}
+
+size_t PathMtuProber::_build(char *buf, uint8 cmd, uint32 conv, uint32 id, uint32 size, size_t len)
+{
+    // 与 ikcp_encode32u 相同按小端编码
+    uint32 pad = (uint32)(len-HEADER_SIZE);
+    uint32 zero = 0;
+    memset(buf, 0, len);
+    memcpy(buf, &conv, 4);
+    buf[4] = (char)cmd;
+    memcpy(buf+8, &zero, 4);
+    memcpy(buf+12, &id, 4);
+    memcpy(buf+16, &size, 4);
+    memcpy(buf+20, &pad, 4);
+    return len;
+}
+
+bool PathMtuProber::parse(const void *data, size_t datalen, uint8 &cmd, uint32 &id, uint32 &size)
+{
+    const char *p = (const char *)data;
+    if (datalen < HEADER_SIZE)
+        return false;
+
+    cmd = (uint8)p[4];
+    if (cmd != CMD_PROBE && cmd != CMD_PROBE_ACK)
+        return false;
+    memcpy(&id, p+12, 4);
+    memcpy(&size, p+16, 4);
+    return true;
+}
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+int sendDontFragment(int fd, const void *data, size_t datalen, const SA *sa, socklen_t salen)
+{
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE)
+    // 只在这一次发送期间打开DF, 且不使用内核缓存的路径MTU
+    int saved = 0;
+    socklen_t optlen = sizeof(saved);
+    if (getsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, &saved, &optlen) < 0)
+        return -1;
+    int probe = IP_PMTUDISC_PROBE;
+    if (setsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, &probe, sizeof(probe)) < 0)
+        return -1;
+
+    int ret = sendto(fd, data, datalen, 0, sa, salen);
+    int err = errno;
+    setsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, &saved, sizeof(saved));
+    errno = err;
+    return ret;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+//--------------------------------------------------------------------------
+
+NAMESPACE_END // namespace tun
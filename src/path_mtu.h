@@ -0,0 +1,103 @@
+#ifndef __PATHMTU_H__
+#define __PATHMTU_H__
+
+#include "fasttun_base.h"
+
+NAMESPACE_BEG(tun)
+
+//--------------------------------------------------------------------------
+// 路径MTU探测(PLPMTUD), 时间单位毫秒, 只含状态机, 收发由调用者完成.
+// 以DF标记的探测包在 [MIN_MTU, MAX_MTU] 内二分查找对端能收到的最大数据报: 每个大小最多探测
+// MAX_PROBES 次, 都超时则判定过大, 本地发送报 EMSGSIZE 时立即判定过大. 上下界相差不超过
+// SEARCH_STEP 时结束, 此后每 RAISE_INTERVAL 从已确认的大小重新查找一次, 路径变小时也能跟上
+class PathMtuProber
+{
+  public:
+    enum
+    {
+        MIN_MTU = 548,      // 576 - IP/UDP头
+        MAX_MTU = 8972,     // 9000 巨帧 - IP/UDP头
+        SEARCH_STEP = 8,
+        MAX_PROBES = 3,
+        MIN_PROBE_TIMEOUT = 100,
+        PROBE_TIMEOUT = 1000,
+        RAISE_INTERVAL = 600*1000,
+    };
+
+    // 探测包与kcp分片同样以24字节包头开始: conv, cmd, 0, 0, ts, sn=探测序号, una=探测大小, len=填充长度
+    static const uint8 CMD_PROBE = 86;
+    static const uint8 CMD_PROBE_ACK = 87;
+    static const size_t HEADER_SIZE = 24;
+
+    PathMtuProber();
+    virtual ~PathMtuProber() {}
+
+    // 从 base 开始查找
+    void start(uint32 base, uint32 now);
+    void stop();
+
+    // 需要发出探测时返回true, size 为探测包大小, id 用于匹配应答
+    bool poll(uint32 now, uint32 &size, uint32 &id);
+    void onAck(uint32 id);
+    void onTooBig(uint32 size);
+
+    // 探测超时随链路的RTO调整, 限制在 [MIN_PROBE_TIMEOUT, PROBE_TIMEOUT]
+    void setProbeTimeout(uint32 timeout);
+
+    // 已确认的最大数据报, 0为尚无
+    inline uint32 mtu() const
+    {
+        return mLo;
+    }
+    inline bool isRunning() const
+    {
+        return mbRunning;
+    }
+    inline bool isSearching() const
+    {
+        return mbRunning && mCandidate > 0;
+    }
+    inline uint64 probesSent() const
+    {
+        return mProbesSent;
+    }
+    inline uint64 probesLost() const
+    {
+        return mProbesLost;
+    }
+
+    // 拼探测包/应答, buf 至少 size 字节
+    static size_t buildProbe(char *buf, uint32 conv, uint32 id, uint32 size);
+    static size_t buildAck(char *buf, uint32 conv, uint32 id, uint32 size);
+    // 是探测包或应答时返回true
+    static bool parse(const void *data, size_t datalen, uint8 &cmd, uint32 &id, uint32 &size);
+
+  private:
+    void _next();
+    static size_t _build(char *buf, uint8 cmd, uint32 conv, uint32 id, uint32 size, size_t len);
+
+  private:
+    bool mbRunning;
+    uint32 mBase;
+    uint32 mLo;         // 已确认能到达的最大值
+    uint32 mHi;         // 已知不能到达的最小值
+    uint32 mCandidate;  // 正在探测的大小, 0为本轮查找已结束
+    int mAttempts;
+    uint32 mFirstId;    // 当前大小第一次探测的序号
+    uint32 mProbeId;
+    uint32 mSentAt;
+    uint32 mTimeout;
+    uint32 mNow;
+    uint32 mRaiseAt;
+
+    uint64 mProbesSent;
+    uint64 mProbesLost;
+};
+//--------------------------------------------------------------------------
+
+// 以DF标记发出一个数据报, 超过本机出口MTU时返回-1且 errno 为 EMSGSIZE, 不影响套接字上的其他数据报
+int sendDontFragment(int fd, const void *data, size_t datalen, const SA *sa, socklen_t salen);
+
+NAMESPACE_END // namespace tun
+
+#endif // __PATHMTU_H__
@@ -0,0 +1,46 @@
+#include "recv_arena.h"
+
+NAMESPACE_BEG(tun)
+
+RecvArena gRecvArena;
+
+RecvArena::~RecvArena()
+{
+    free(mBuf);
+}
+
+char* RecvArena::acquire(size_t len)
+{
+    // 首次使用时才预留, 大块内存由 mmap 分配, 未写到的页面不占物理内存
+    if (NULL == mBuf)
+    {
+        mBuf = (char *)malloc(mCapacity);
+        assert(mBuf != NULL && "RecvArena malloc failed");
+    }
+
+    if (mUsed+len <= mCapacity)
+    {
+        char *buf = mBuf+mUsed;
+        mUsed += len;
+        return buf;
+    }
+
+    ++mFallbacks;
+    char *buf = (char *)malloc(len);
+    assert(buf != NULL && "RecvArena fallback malloc failed");
+    return buf;
+}
+
+void RecvArena::release(char *buf)
+{
+    if (buf >= mBuf && buf < mBuf+mCapacity)
+    {
+        assert((size_t)(buf-mBuf) <= mUsed && "RecvArena::release() out of order");
+        mUsed = buf-mBuf;
+        return;
+    }
+
+    free(buf);
+}
+
+NAMESPACE_END // namespace tun
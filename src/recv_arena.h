@@ -0,0 +1,52 @@
+#ifndef __RECVARENA_H__
+#define __RECVARENA_H__
+
+#include "fasttun_base.h"
+
+NAMESPACE_BEG(tun)
+
+// 事件循环共享的接收缓冲区
+// 所有连接的读事件都直接读入同一块预留的连续内存, 数据在回调返回前有效, 多次读取之间无需拷贝.
+// 预留的地址空间只有写到的页面才占用物理内存. 按栈的方式分配, 回调中嵌套的读取从后面的空间分配,
+// 空间不够时临时 malloc. 只在事件循环线程中使用
+class RecvArena
+{
+  public:
+    static const size_t DEFAULT_CAPACITY = 2*1024*1024;
+
+    RecvArena(size_t capacity = DEFAULT_CAPACITY)
+            :mBuf(NULL)
+            ,mCapacity(capacity)
+            ,mUsed(0)
+            ,mFallbacks(0)
+    {}
+
+    virtual ~RecvArena();
+
+    // 取一段 len 字节的连续缓冲区, 须按取得的相反顺序 release
+    char* acquire(size_t len);
+    void release(char *buf);
+
+    inline size_t used() const
+    {
+        return mUsed;
+    }
+
+    // 因空间不够而临时分配的次数
+    inline uint64 fallbacks() const
+    {
+        return mFallbacks;
+    }
+
+  private:
+    char *mBuf;
+    size_t mCapacity;
+    size_t mUsed;
+    uint64 mFallbacks;
+};
+
+extern RecvArena gRecvArena;
+
+NAMESPACE_END // namespace tun
+
+#endif // __RECVARENA_H__
@@ -0,0 +1,150 @@
+#include "ring_buffer.h"
+
+NAMESPACE_BEG(tun)
+
+const size_t RingBuffer::INIT_CAPACITY;
+const size_t RingBuffer::KEEP_CAPACITY;
+
+RingBuffer::~RingBuffer()
+{
+    if (mBuf)
+        free(mBuf);
+}
+
+void RingBuffer::push(const void *data, size_t datalen)
+{
+    size_t need = sizeof(RecordHead)+datalen;
+    if (!mbWrapped)
+    {
+        if (mCapacity-mTail < need)
+        {
+            if (mHead >= need) // 回绕到缓冲区头部
+            {
+                mEnd = mTail;
+                mTail = 0;
+                mbWrapped = true;
+            }
+            else
+            {
+                _grow(need);
+            }
+        }
+    }
+    else if (mHead-mTail < need)
+    {
+        _grow(need);
+    }
+
+    _write(data, datalen);
+}
+
+const void* RingBuffer::front(size_t &datalen) const
+{
+    if (0 == mCount)
+    {
+        datalen = 0;
+        return NULL;
+    }
+
+    RecordHead head = 0;
+    memcpy(&head, mBuf+mHead, sizeof(head));
+    datalen = head;
+    return mBuf+mHead+sizeof(head);
+}
+
+void RingBuffer::pop()
+{
+    assert(mCount > 0 && "RingBuffer::pop() mCount > 0");
+
+    RecordHead head = 0;
+    memcpy(&head, mBuf+mHead, sizeof(head));
+    mHead += sizeof(head)+head;
+    mUsed -= sizeof(head)+head;
+    --mCount;
+
+    if (0 == mCount)
+    {
+        _reset();
+    }
+    else if (mbWrapped && mHead == mEnd)
+    {
+        mHead = 0;
+        mbWrapped = false;
+    }
+}
+
+void RingBuffer::clear()
+{
+    mCount = 0;
+    mUsed = 0;
+    _reset();
+}
+
+void RingBuffer::_grow(size_t need)
+{
+    size_t used = mUsed;
+
+    // 未回绕且总空间足够时, 把数据挪到头部即可
+    if (!mbWrapped && used+need <= mCapacity)
+    {
+        memmove(mBuf, mBuf+mHead, used);
+        mHead = 0;
+        mTail = used;
+        return;
+    }
+
+    size_t cap = mCapacity > 0 ? mCapacity : INIT_CAPACITY;
+    while (cap < used+need)
+        cap <<= 1;
+    if (cap == mCapacity)
+        cap <<= 1;
+
+    char *buf = (char *)malloc(cap);
+    assert(buf != NULL && "RingBuffer::_grow() malloc failed");
+    if (mbWrapped)
+    {
+        memcpy(buf, mBuf+mHead, mEnd-mHead);
+        memcpy(buf+(mEnd-mHead), mBuf, mTail);
+    }
+    else if (used > 0)
+    {
+        memcpy(buf, mBuf+mHead, used);
+    }
+
+    if (mBuf)
+        free(mBuf);
+    mBuf = buf;
+    mCapacity = cap;
+    mHead = 0;
+    mTail = used;
+    mEnd = 0;
+    mbWrapped = false;
+}
+
+void RingBuffer::_write(const void *data, size_t datalen)
+{
+    RecordHead head = (RecordHead)datalen;
+    memcpy(mBuf+mTail, &head, sizeof(head));
+    memcpy(mBuf+mTail+sizeof(head), data, datalen);
+    mTail += sizeof(head)+datalen;
+    mUsed += sizeof(head)+datalen;
+    if (mUsed > mPeakUsed)
+        mPeakUsed = mUsed;
+    ++mCount;
+}
+
+void RingBuffer::_reset()
+{
+    mHead = mTail = mEnd = 0;
+    mbWrapped = false;
+
+    if (mCapacity > KEEP_CAPACITY && mPeakUsed < mCapacity/4)
+    {
+        free(mBuf);
+        mBuf = NULL;
+        mCapacity = 0;
+    }
+    mPeakUsed = 0;
+}
+
+NAMESPACE_END // namespace tun
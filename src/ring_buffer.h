@@ -0,0 +1,78 @@
+#ifndef __RINGBUFFER_H__
+#define __RINGBUFFER_H__
+
+#include "fasttun_base.h"
+
+NAMESPACE_BEG(tun)
+
+// 可增长的连续环形缓冲区
+// 记录以 [uint32 len][data] 的格式连续存放, 单条记录不会跨越缓冲区末尾,
+// 因此 front() 总能返回指向缓冲区内部的连续内存, 无需拷贝
+class RingBuffer
+{
+  public:
+    RingBuffer()
+            :mBuf(NULL)
+            ,mCapacity(0)
+            ,mHead(0)
+            ,mTail(0)
+            ,mEnd(0)
+            ,mbWrapped(false)
+            ,mCount(0)
+            ,mUsed(0)
+            ,mPeakUsed(0)
+    {}
+
+    virtual ~RingBuffer();
+
+    void push(const void *data, size_t datalen);
+
+    // 返回队首记录的指针, 在下一次调用 push/pop/clear 之前有效
+    const void* front(size_t &datalen) const;
+    void pop();
+
+    void clear();
+
+    inline bool empty() const
+    {
+        return 0 == mCount;
+    }
+    inline size_t count() const
+    {
+        return mCount;
+    }
+    inline size_t capacity() const
+    {
+        return mCapacity;
+    }
+
+  private:
+    typedef uint32 RecordHead;
+
+    void _grow(size_t need);
+    void _write(const void *data, size_t datalen);
+    void _reset();
+
+  private:
+    static const size_t INIT_CAPACITY = 4*1024;
+    // 清空时若容量超过该值且远大于本轮峰值占用则释放, 持续高负载的缓存则保留缓冲区复用
+    static const size_t KEEP_CAPACITY = 64*1024;
+
+    char *mBuf;
+    size_t mCapacity;
+
+    // 未回绕时数据位于 [mHead, mTail);
+    // 回绕后数据位于 [mHead, mEnd) 和 [0, mTail)
+    size_t mHead;
+    size_t mTail;
+    size_t mEnd;
+    bool mbWrapped;
+
+    size_t mCount;
+    size_t mUsed;
+    size_t mPeakUsed;
+};
+
+NAMESPACE_END // namespace tun
+
+#endif // __RINGBUFFER_H__
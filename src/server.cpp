@@ -6,10 +6,16 @@
 #include "kcp_tunnel.h"
 #include "fast_connection.h"
 #include "cache.h"
+#include "cache_budget.h"
+#include "disk_io.h"
+#include "timer_wheel.h"
+#include "stats.h"
+#include "latency.h"
+#include "loop_profiler.h"
+#include "heartbeat.h"
 
 using namespace tun;
 
-core::Timers tun::gTimer;
 
 typedef KcpTunnelGroup<true> MyTunnelGroup;
 static MyTunnelGroup *gTunnelManager = NULL;
@@ -20,10 +26,9 @@ static sockaddr_in ConnectAddr;
 //--------------------------------------------------------------------------
 class ServerBridge : public Connection::Handler
                    , public FastConnection::Handler
-                   , public TimerHandler
+                   , public PeerHeartBeat::Member
+                   , public CacheBudget::Waiter
 {
-    static const uint32 CONNCHECK_INTERVAL = 30000;
-
   public:
     struct Handler
     {
@@ -31,17 +36,18 @@ class ServerBridge : public Connection::Handler
         virtual void onExtConnError(ServerBridge *pBridge) = 0;
     };
 
-    ServerBridge(EventPoller *poller, Handler *h)
+    ServerBridge(EventPoller *poller, Handler *h, HeartBeatManager *pHeartBeats)
             :mEventPoller(poller)
             ,mpHandler(h)
+            ,mpHeartBeats(pHeartBeats)
+            ,mpPeer(NULL)
             ,mIntConn(poller)
             ,mExtConn(poller, gTunnelManager)
             ,mCache(NULL)
             ,mLastExtConnTime(0)
-            ,mHeartBeatTimer()
-            ,mConnCheckTimer()
+            ,mbWaitingBudget(false)
     {
-        mCache = new MyCache(this, &ServerBridge::flush);
+        mCache = new MyCache(this, &ServerBridge::flush, &ServerBridge::_flushAll);
     }
 
     virtual ~ServerBridge()
@@ -57,7 +63,7 @@ class ServerBridge : public Connection::Handler
         }
         mExtConn.setEventHandler(this);
 
-        mLastExtConnTime = core::getClock();
+        mLastExtConnTime = getMonoClock();
         mIntConn.setEventHandler(this);
         if (!mIntConn.connect((const SA *)&ConnectAddr, sizeof(ConnectAddr)))
         {
@@ -65,26 +71,35 @@ class ServerBridge : public Connection::Handler
             return false;
         }
 
-        uint32 curClock = core::getClock();
-        mHeartBeatTimer = gTimer.add(curClock+HeartBeatRecord::HEARTBEAT_INTERVAL,
-                                     HeartBeatRecord::HEARTBEAT_INTERVAL,
-                                     this, NULL);
-        mConnCheckTimer = gTimer.add(curClock+CONNCHECK_INTERVAL,
-                                     CONNCHECK_INTERVAL,
-                                     this, NULL);
+        // 对端身份确认前先独占一路心跳
+        mpPeer = mpHeartBeats->join(0, 0, this);
 
         return true;
     }
 
     void shutdown()
     {
-        mHeartBeatTimer.cancel();
-        mConnCheckTimer.cancel();
+        if (mpPeer)
+        {
+            mpHeartBeats->leave(mpPeer, this);
+            mpPeer = NULL;
+        }
+        gCacheBudget.cancelWait(this);
+        mbWaitingBudget = false;
 
         mExtConn.shutdown();
         mIntConn.shutdown();
     }
 
+    // 关闭并清空状态, 放回对象池等待下一个连接
+    void recycle()
+    {
+        shutdown();
+        mCache->clear();
+        mExtConn.recycle();
+        mIntConn.recycle();
+    }
+
     // Connection::Handler
     virtual void onConnected(Connection *pConn)
     {
@@ -93,17 +108,21 @@ class ServerBridge : public Connection::Handler
     virtual void onDisconnected(Connection *pConn)
     {
         _reconnectInternal();
+        _updateTunnelRecv();
     }
 
     virtual void onRecv(Connection *pConn, const void *data, size_t datalen)
     {
+        gLoopProfiler.noteBridge(this);
         mExtConn.send(data, datalen);
+        _checkBackpressure();
     }
 
     virtual void onError(Connection *pConn)
     {
         WarningPrint("occur an error at an internal connection! reason:%s", coreStrError());
         _reconnectInternal();
+        _updateTunnelRecv();
     }
 
     // FastConnection::Handler
@@ -124,8 +143,42 @@ class ServerBridge : public Connection::Handler
             mpHandler->onExtConnError(this);
     }
 
+    virtual void onPeerIdentified(FastConnection *pConn)
+    {
+        // 同一客户端的所有桥接共用一路心跳; 标识由客户端自报, 须来自同一IP才算同一对端
+        sockaddr_in addr;
+        socklen_t addrlen = sizeof(addr);
+        Connection *pCtrl = pConn->getConnection();
+        if (NULL == pCtrl || !pCtrl->getpeername((SA *)&addr, &addrlen) || addr.sin_family != AF_INET)
+            return;
+
+        if (mpPeer)
+            mpHeartBeats->leave(mpPeer, this);
+        mpPeer = mpHeartBeats->join(addr.sin_addr.s_addr, pConn->getPeerId(), this);
+    }
+
+    virtual void onCongested(FastConnection *pConn)
+    {
+        _updateSourceRead();
+    }
+    virtual void onDrained(FastConnection *pConn)
+    {
+        _updateSourceRead();
+    }
+
+    // 内部连接发送积压时暂停从管道接收
+    virtual void onCongested(Connection *pConn)
+    {
+        _updateTunnelRecv();
+    }
+    virtual void onDrained(Connection *pConn)
+    {
+        _updateTunnelRecv();
+    }
+
     virtual void onRecv(FastConnection *pConn, const void *data, size_t datalen)
     {
+        gLoopProfiler.noteBridge(this);
         if (!mIntConn.isConnected())
         {
             _reconnectInternal();
@@ -134,33 +187,75 @@ class ServerBridge : public Connection::Handler
         else
         {
             _flushAll();
-            mIntConn.send(data, datalen);
+            if (mCache->empty())
+                mIntConn.send(data, datalen);
+            else
+                mCache->cache(data, datalen);
         }
     }
 
-    // TimerHandler
-    virtual void onTimeout(TimerHandle handle, void *pUser)
+    // PeerHeartBeat::Member
+    virtual uint32 getLastRecvTime() const
+    {
+        return mExtConn.getLastRecvTime();
+    }
+
+    virtual bool sendHeartBeat()
+    {
+        if (!mExtConn.isConnected())
+            return false;
+
+        mExtConn.triggerHeartBeatPacket();
+        return true;
+    }
+
+    virtual void onPeerTimeout()
+    {
+        InfoPrint("External Connection Timeout!");
+        if (mpHandler)
+            mpHandler->onExtConnError(this);
+    }
+
+    // CacheBudget::Waiter
+    virtual size_t getBacklog() const
+    {
+        return mExtConn.getCachedSize();
+    }
+    virtual void onCacheBudgetAvailable()
     {
-        if (handle == mHeartBeatTimer)
+        mbWaitingBudget = false;
+        _updateSourceRead();
+    }
+
+    void _checkBackpressure()
+    {
+        if (!mbWaitingBudget && gCacheBudget.isUnderPressure() &&
+            mExtConn.getCachedSize() > 0)
         {
-            mExtConn.triggerHeartBeatPacket();
+            mbWaitingBudget = true;
+            gCacheBudget.waitFor(this);
+            _updateSourceRead();
         }
-        else if (handle == mConnCheckTimer)
-        {
-            const HeartBeatRecord &rec = mExtConn.getHeartBeatRecord();
+    }
 
-            if (rec.isTimeout())
-            {
-                InfoPrint("External Connection Timeout!");
-                if (mpHandler)
-                    mpHandler->onExtConnError(this);
-            }
-        }
+    // 管道拥塞或内存紧张时暂停读取数据源, 借助TCP流控反压
+    void _updateSourceRead()
+    {
+        if (mExtConn.isCongested() || mbWaitingBudget)
+            mIntConn.pauseRead();
+        else
+            mIntConn.resumeRead();
+    }
+
+    // 接收队列满后kcp通告窗口为0, 由kcp流控反压对端, 不在本端无限缓存
+    void _updateTunnelRecv()
+    {
+        mExtConn.setRecvPaused(mIntConn.isConnected() && mIntConn.isCongested());
     }
 
     void _reconnectInternal()
     {
-        ulong curtick = core::getClock();
+        ulong curtick = getMonoClock();
         if (curtick > mLastExtConnTime+1000)
         {
             mLastExtConnTime = curtick;
@@ -187,6 +282,9 @@ class ServerBridge : public Connection::Handler
     EventPoller *mEventPoller;
     Handler *mpHandler;
 
+    HeartBeatManager *mpHeartBeats;
+    PeerHeartBeat *mpPeer;
+
     Connection mIntConn;
     FastConnection mExtConn;
 
@@ -194,8 +292,7 @@ class ServerBridge : public Connection::Handler
 
     ulong mLastExtConnTime;
 
-    TimerHandle mHeartBeatTimer;
-    TimerHandle mConnCheckTimer;
+    bool mbWaitingBudget;
 };
 //--------------------------------------------------------------------------
 
@@ -207,8 +304,10 @@ class Server : public Listener::Handler, public ServerBridge::Handler
             :Listener::Handler()
             ,mEventPoller(poller)
             ,mListener(poller)
+            ,mHeartBeats()
             ,mBridges()
             ,mShutedBridges()
+            ,mFreeBridges()
     {
     }
 
@@ -216,6 +315,13 @@ class Server : public Listener::Handler, public ServerBridge::Handler
     {
     }
 
+    // 须在 create 之前设置
+    void setAcceptOptions(int backlog, int acceptBatch)
+    {
+        mListener.setBacklog(backlog);
+        mListener.setAcceptBatch(acceptBatch);
+    }
+
     bool create(const SA *sa, socklen_t salen)
     {
         if (!mListener.initialise(sa, salen))
@@ -244,6 +350,10 @@ class Server : public Listener::Handler, public ServerBridge::Handler
             }
         }
         mBridges.clear();
+
+        for (size_t i = 0; i < mFreeBridges.size(); ++i)
+            delete mFreeBridges[i];
+        mFreeBridges.clear();
     }
 
     // call it ervery frame
@@ -251,19 +361,26 @@ class Server : public Listener::Handler, public ServerBridge::Handler
     {
         BridgeList::iterator it = mShutedBridges.begin();
         for (; it != mShutedBridges.end(); ++it)
-        {
-            (*it)->shutdown();
-            delete *it;
-        }
+            _freeBridge(*it);
         mShutedBridges.clear();
     }
 
     virtual void onAccept(int connfd)
     {
-        ServerBridge *bridge = new ServerBridge(mEventPoller, this);
+        ServerBridge *bridge = NULL;
+        if (!mFreeBridges.empty())
+        {
+            bridge = mFreeBridges.back();
+            mFreeBridges.pop_back();
+        }
+        else
+        {
+            bridge = new ServerBridge(mEventPoller, this, &mHeartBeats);
+        }
+
         if (!bridge->acceptConnection(connfd))
         {
-            delete bridge;
+            _freeBridge(bridge);
             return;
         }
 
@@ -295,17 +412,69 @@ class Server : public Listener::Handler, public ServerBridge::Handler
         mShutedBridges.insert(pBridge);
     }
 
+    // 短连接频繁时复用桥接对象, 省去连接对象、缓冲区和缓存的反复分配
+    void _freeBridge(ServerBridge *pBridge)
+    {
+        if (mFreeBridges.size() < MAX_FREE_BRIDGES)
+        {
+            pBridge->recycle();
+            mFreeBridges.push_back(pBridge);
+        }
+        else
+        {
+            pBridge->shutdown();
+            delete pBridge;
+        }
+    }
+
   private:
+    static const size_t MAX_FREE_BRIDGES = 256;
+
     typedef std::set<ServerBridge *> BridgeList;
 
     EventPoller *mEventPoller;
     Listener mListener;
 
+    HeartBeatManager mHeartBeats;
+
     BridgeList mBridges;
     BridgeList mShutedBridges;
+    std::vector<ServerBridge *> mFreeBridges;
 };
 //--------------------------------------------------------------------------
 
+//--------------------------------------------------------------------------
+// kcp参数: 先按 kcpmode 取预设, 再用各项配置覆盖; 客户端在建管道时指定的参数优先
+static void loadKcpArg(Ini &ini, KcpArg &arg)
+{
+    std::string mode = ini.getString("server", "kcpmode", "fast3");
+    if (!kcpmode::byName(mode.c_str(), arg))
+    {
+        WarningPrint("unknown kcpmode! %s, use fast3", mode.c_str());
+        arg = kcpmode::Fast3;
+    }
+
+    const char *tunings[] = {"sndwnd", "rcvwnd", "minrto"};
+    int *fields[] = {&arg.sndwnd, &arg.rcvwnd, &arg.minrto};
+    for (size_t i = 0; i < sizeof(tunings)/sizeof(tunings[0]); ++i)
+    {
+        std::string value = ini.getString("server", tunings[i], "");
+        if (value != "")
+            *fields[i] = atoi(value.c_str());
+    }
+
+    std::string stream = ini.getString("server", "kcpstream", "");
+    if (stream != "")
+        arg.stream = atoi(stream.c_str()) != 0 ? 1 : 0;
+    std::string ackDelay = ini.getString("server", "ackdelay", "");
+    if (ackDelay != "")
+        arg.ackdelay = atoi(ackDelay.c_str());
+    arg.sack = atoi(ini.getString("server", "sack", "1").c_str()) != 0 ? 1 : 0;
+    arg.compact = atoi(ini.getString("server", "kcpcompact", "1").c_str()) != 0 ? 1 : 0;
+    arg.pmtud = atoi(ini.getString("server", "pmtud", "1").c_str()) != 0 ? 1 : 0;
+}
+//--------------------------------------------------------------------------
+
 static bool s_continueMainLoop = true;
 void sigHandler(int signo)
 {
@@ -355,6 +524,11 @@ int main(int argc, char *argv[])
     const char *kcpListenAddr = NULL;
     const char *connectAddr = NULL;
     const char *pidPath = NULL;
+    std::string statsAddr;
+    double slowMs = 0;
+    int backlog = Listener::DEFAULT_BACKLOG;
+    int acceptBatch = Listener::DEFAULT_ACCEPT_BATCH;
+    KcpArg kcpArg = kcpmode::Fast3;
 
     int opt = 0;
     while ((opt = getopt(argc, argv, "f:c:l:r:v")) != -1)
@@ -424,12 +598,27 @@ int main(int argc, char *argv[])
         static std::string s_listenAddr = ini.getString("server", "listen", "");
         static std::string s_kcpListenAddr = ini.getString("server", "kcplisten", s_listenAddr.c_str());
         static std::string s_connectAddr = ini.getString("server", "connect", "");
+        std::string cacheMem = ini.getString("server", "cachemem", "");
+        statsAddr = ini.getString("server", "stats", "");
+        slowMs = atof(ini.getString("server", "slowms", "0").c_str());
+        std::string backlogStr = ini.getString("server", "backlog", "");
+        std::string acceptBatchStr = ini.getString("server", "acceptbatch", "");
+        if (backlogStr != "" && atoi(backlogStr.c_str()) > 0)
+            backlog = atoi(backlogStr.c_str());
+        if (acceptBatchStr != "" && atoi(acceptBatchStr.c_str()) > 0)
+            acceptBatch = atoi(acceptBatchStr.c_str());
         if (s_listenAddr != "")
             listenAddr = s_listenAddr.c_str();
         if (s_connectAddr != "")
             connectAddr = s_connectAddr.c_str();
         if (s_kcpListenAddr != "")
             kcpListenAddr = s_kcpListenAddr.c_str();
+        if (cacheMem != "" && atoi(cacheMem.c_str()) > 0)
+            gCacheBudget.setMemLimit((size_t)atoi(cacheMem.c_str())*1024*1024);
+        std::string readBudget = ini.getString("server", "readbudget", "");
+        if (readBudget != "" && atoi(readBudget.c_str()) >= 0)
+            Connection::setReadBudget((size_t)atoi(readBudget.c_str())*1024);
+        loadKcpArg(ini, kcpArg);
     }
 
     if (NULL == listenAddr || NULL == connectAddr || NULL == kcpListenAddr)
@@ -453,9 +642,12 @@ int main(int argc, char *argv[])
 #else
     EventPoller *netPoller = new SelectPoller();
 #endif
+    // 事件之间穿插处理到期的定时器
+    netPoller->setTimerWheel(&gTimerWheel);
 
     // kcp tunnel manager
     gTunnelManager = new MyTunnelGroup(netPoller);
+    gTunnelManager->setKcpMode(kcpArg);
     if (!gTunnelManager->create((const SA *)&KcpListenAddr, sizeof(KcpListenAddr)))
     {
         ErrorPrint("initialise Tunnel Manager error!");
@@ -466,6 +658,7 @@ int main(int argc, char *argv[])
 
     // create server
     Server svr(netPoller);
+    svr.setAcceptOptions(backlog, acceptBatch);
     if (!svr.create((const SA *)&ListenAddr, sizeof(ListenAddr)))
     {
         ErrorPrint("create server error!");
@@ -489,36 +682,54 @@ int main(int argc, char *argv[])
     // sigaction(SIGKILL, &newAct, NULL);
     sigaction(SIGTERM, &newAct, NULL);
 
+    // 本地统计端点, 可选
+    StatsServer statsSvr(netPoller, &gTimerWheel);
+    if (statsAddr != "" && !statsSvr.initialise(statsAddr.c_str()))
+        WarningPrint("start stats endpoint failed! addr=%s", statsAddr.c_str());
+    gStats.add(&gLatency);
+
+    // 事件循环剖析, 可选
+    gLoopProfiler.setSlowThreshold(slowMs);
+    gStats.add(&gLoopProfiler);
+
+    // 缓存溢出到磁盘的读写放到后台线程, 启动失败则退化为同步读写
+    if (!gDiskIO.start(netPoller))
+        WarningPrint("start disk io thread failed! fall back to synchronous disk io");
+
     static const uint32 MAX_WAIT = 60000;
     double maxWait = 0;
-    uint32 curClock = 0, nextKcpUpdateInterval = 0, nextTimerCheckInterval = 0;
     DebugPrint("Enter Main Loop...");
     while (s_continueMainLoop)
     {
-        curClock = core::getClock();
+        uint64 loopStart = core::getTimeStamp();
+        uint64 spareStart = netPoller->spareTime();
 
         netPoller->processPendingEvents(maxWait);
 
-        nextKcpUpdateInterval = gTunnelManager->update();
+        gCacheBudget.update();
 
-        gTimer.process(curClock);
-        nextTimerCheckInterval = gTimer.nextExp(curClock);
-        if (0 == nextTimerCheckInterval)
-            nextTimerCheckInterval = MAX_WAIT;
+        // kcp更新、心跳和连接检查都挂在时间轮上
+        gTimerWheel.process(getMonoClock());
 
         svr.update();
 
-        maxWait  = min(nextKcpUpdateInterval, nextTimerCheckInterval);
-        maxWait *= 0.001f;
+        maxWait = gTimerWheel.nextWait(MAX_WAIT);
+
+        // 本轮耗时扣除阻塞在等待上的时间
+        gLatency.loopBusy.record(core::getTimeStamp()-loopStart-(netPoller->spareTime()-spareStart));
     }
     DebugPrint("Leave Main Loop...");
 
     // finalise
+    gStats.remove(&gLatency);
+    gStats.remove(&gLoopProfiler);
+    statsSvr.finalise();
     svr.finalise();
 
     gTunnelManager->shutdown();
     delete gTunnelManager;
 
+    gDiskIO.stop();
     delete netPoller;
 
     // uninit log
@@ -0,0 +1,476 @@
+#include "stats.h"
+
+#include <sys/un.h>
+
+NAMESPACE_BEG(tun)
+
+StatsRegistry gStats;
+
+//--------------------------------------------------------------------------
+void StatsWriter::_add(const char *name, const char *type, const char *label, uint64 id, double value,
+                       const std::string &text)
+{
+    Metric &m = mMetrics[name];
+    m.type = type;
+
+    Sample s;
+    s.label = label;
+    s.id = id;
+    s.text = text;
+    s.value = value;
+    m.samples.push_back(s);
+}
+
+std::string StatsWriter::str() const
+{
+    std::string out;
+    char buf[256];
+
+    if (Format_Json == mFormat)
+        out += "{";
+
+    Metrics::const_iterator it = mMetrics.begin();
+    for (; it != mMetrics.end(); ++it)
+    {
+        const std::string &name = it->first;
+        const Metric &m = it->second;
+
+        if (Format_Prometheus == mFormat)
+        {
+            snprintf(buf, sizeof(buf), "# TYPE %s %s\n", name.c_str(), m.type);
+            out += buf;
+            for (size_t i = 0; i < m.samples.size(); ++i)
+            {
+                const Sample &s = m.samples[i];
+                if (s.label && !s.text.empty())
+                {
+                    snprintf(buf, sizeof(buf), "%s{%s=\"%s\"} %.15g\n",
+                             name.c_str(), s.label, s.text.c_str(), s.value);
+                }
+                else if (s.label)
+                {
+                    snprintf(buf, sizeof(buf), "%s{%s=\"%llu\"} %.15g\n",
+                             name.c_str(), s.label, (unsigned long long)s.id, s.value);
+                }
+                else
+                {
+                    snprintf(buf, sizeof(buf), "%s %.15g\n", name.c_str(), s.value);
+                }
+                out += buf;
+            }
+        }
+        else
+        {
+            snprintf(buf, sizeof(buf), "%s\"%s\":{\"type\":\"%s\",\"samples\":[",
+                     it == mMetrics.begin() ? "" : ",", name.c_str(), m.type);
+            out += buf;
+            for (size_t i = 0; i < m.samples.size(); ++i)
+            {
+                const Sample &s = m.samples[i];
+                if (s.label && !s.text.empty())
+                {
+                    snprintf(buf, sizeof(buf), "%s{\"%s\":\"%s\",\"value\":%.15g}",
+                             i > 0 ? "," : "", s.label, s.text.c_str(), s.value);
+                }
+                else if (s.label)
+                {
+                    snprintf(buf, sizeof(buf), "%s{\"%s\":%llu,\"value\":%.15g}",
+                             i > 0 ? "," : "", s.label, (unsigned long long)s.id, s.value);
+                }
+                else
+                {
+                    snprintf(buf, sizeof(buf), "%s{\"value\":%.15g}", i > 0 ? "," : "", s.value);
+                }
+                out += buf;
+            }
+            out += "]}";
+        }
+    }
+
+    if (Format_Json == mFormat)
+        out += "}\n";
+    return out;
+}
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+uint32 StatsRegistry::add(StatsSource *s)
+{
+    mSources.insert(s);
+    return ++mNextId;
+}
+
+void StatsRegistry::remove(StatsSource *s)
+{
+    mSources.erase(s);
+}
+
+void StatsRegistry::collect(StatsWriter &w) const
+{
+    w.gauge("fasttun_stats_sources", NULL, 0, (double)mSources.size());
+
+    Sources::const_iterator it = mSources.begin();
+    for (; it != mSources.end(); ++it)
+        (*it)->collectStats(w);
+}
+
+void StatsRegistry::reset()
+{
+    Sources::const_iterator it = mSources.begin();
+    for (; it != mSources.end(); ++it)
+        (*it)->resetStats();
+}
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+// 读完请求头后一次生成响应, 写完即关闭
+class StatsServer::Client : public InputNotificationHandler, public OutputNotificationHandler, public WheelTimer::Handler
+{
+  public:
+    Client(StatsServer *pServer, int fd)
+            :mpServer(pServer)
+            ,mEventPoller(pServer->mEventPoller)
+            ,mFd(fd)
+            ,mRequest()
+            ,mResponse()
+            ,mSent(0)
+            ,mbRegForWrite(false)
+            ,mIdleTimer(this)
+    {
+        mEventPoller->registerForRead(mFd, this);
+        _touch();
+    }
+
+    virtual ~Client()
+    {
+        close();
+    }
+
+    inline bool isClosed() const
+    {
+        return mFd < 0;
+    }
+
+    void close()
+    {
+        if (mFd < 0)
+            return;
+
+        if (mbRegForWrite)
+            mEventPoller->deregisterForWrite(mFd);
+        else
+            mEventPoller->deregisterForRead(mFd);
+        ::close(mFd);
+        mFd = -1;
+        mIdleTimer.cancel();
+        mpServer->_onClientClosed();
+    }
+
+    virtual int handleInputNotification(int fd)
+    {
+        char buf[1024];
+        int len = recv(mFd, buf, sizeof(buf), 0);
+        if (len < 0 && (EAGAIN == errno || EWOULDBLOCK == errno))
+            return 0;
+        if (len <= 0)
+        {
+            close();
+            return 0;
+        }
+
+        _touch();
+        mRequest.append(buf, len);
+        if (mRequest.find("\r\n\r\n") == std::string::npos &&
+            mRequest.find("\n\n") == std::string::npos &&
+            mRequest.size() < MAX_REQUEST)
+        {
+            return 0;
+        }
+
+        mResponse = StatsServer::buildResponse(mRequest);
+        mEventPoller->deregisterForRead(mFd);
+        mEventPoller->registerForWrite(mFd, this);
+        mbRegForWrite = true;
+        return handleOutputNotification(mFd);
+    }
+
+    virtual int handleOutputNotification(int fd)
+    {
+        while (mSent < mResponse.size())
+        {
+            int len = ::send(mFd, mResponse.data()+mSent, mResponse.size()-mSent, 0);
+            if (len < 0 && (EAGAIN == errno || EWOULDBLOCK == errno))
+                return 0;
+            if (len <= 0)
+                break;
+            mSent += len;
+            _touch();
+        }
+
+        close();
+        return 0;
+    }
+
+    // 空闲超时: 请求没有发完或响应一直发不出去
+    virtual void onTimeout(WheelTimer *pTimer)
+    {
+        close();
+    }
+
+  private:
+    void _touch()
+    {
+        mpServer->mpTimerWheel->schedule(&mIdleTimer, getMonoClock()+mpServer->mIdleTimeout);
+    }
+
+  private:
+    static const size_t MAX_REQUEST = 4096;
+
+    StatsServer *mpServer;
+    EventPoller *mEventPoller;
+    int mFd;
+
+    std::string mRequest;
+    std::string mResponse;
+    size_t mSent;
+    bool mbRegForWrite;
+
+    WheelTimer mIdleTimer;
+};
+
+StatsServer::~StatsServer()
+{
+    finalise();
+}
+
+bool StatsServer::initialise(const char *addr)
+{
+    if (mFd >= 0)
+    {
+        ErrorPrint("StatsServer already inited!");
+        return false;
+    }
+
+    const char *path = NULL;
+    if (strncmp(addr, "unix:", 5) == 0)
+        path = addr+5;
+    else if ('/' == addr[0])
+        path = addr;
+
+    if (path)
+    {
+        struct sockaddr_un un;
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(un.sun_path))
+        {
+            ErrorPrint("StatsServer::initialise() unix socket path too long! %s", path);
+            return false;
+        }
+        strcpy(un.sun_path, path);
+
+        mFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (mFd < 0)
+        {
+            ErrorPrint("StatsServer::initialise() create socket error! %s", coreStrError());
+            return false;
+        }
+
+        // 清理上次异常退出残留的套接字文件
+        unlink(path);
+        if (bind(mFd, (const SA *)&un, sizeof(un)) < 0)
+        {
+            ErrorPrint("StatsServer::initialise() bind %s error! %s", path, coreStrError());
+            goto err_1;
+        }
+        mUnixPath = path;
+    }
+    else
+    {
+        sockaddr_in sin;
+        if (!core::str2Ipv4(addr, sin))
+        {
+            ErrorPrint("StatsServer::initialise() invalid address! %s", addr);
+            return false;
+        }
+        if ((ntohl(sin.sin_addr.s_addr)>>24) != 127)
+        {
+            ErrorPrint("StatsServer::initialise() only loopback address is allowed! %s", addr);
+            return false;
+        }
+
+        mFd = socket(AF_INET, SOCK_STREAM, 0);
+        if (mFd < 0)
+        {
+            ErrorPrint("StatsServer::initialise() create socket error! %s", coreStrError());
+            return false;
+        }
+
+        int opt = 1;
+        setsockopt(mFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        if (bind(mFd, (const SA *)&sin, sizeof(sin)) < 0)
+        {
+            ErrorPrint("StatsServer::initialise() bind %s error! %s", addr, coreStrError());
+            goto err_1;
+        }
+    }
+
+    if (!core::setNonblocking(mFd))
+    {
+        ErrorPrint("StatsServer::initialise() set nonblocking error! %s", coreStrError());
+        goto err_1;
+    }
+
+    if (listen(mFd, LISTENQ) < 0)
+    {
+        ErrorPrint("StatsServer::initialise() listen failed! %s", coreStrError());
+        goto err_1;
+    }
+
+    if (!mEventPoller->registerForRead(mFd, this))
+    {
+        ErrorPrint("StatsServer::initialise() registerForRead failed! %s", coreStrError());
+        goto err_1;
+    }
+
+    InfoPrint("stats endpoint listening on %s", addr);
+    return true;
+
+err_1:
+    close(mFd);
+    mFd = -1;
+    if (!mUnixPath.empty())
+    {
+        unlink(mUnixPath.c_str());
+        mUnixPath.clear();
+    }
+
+    return false;
+}
+
+void StatsServer::finalise()
+{
+    Clients::iterator it = mClients.begin();
+    for (; it != mClients.end(); ++it)
+        delete *it;
+    mClients.clear();
+    mReapTimer.cancel();
+
+    if (mFd >= 0)
+    {
+        mEventPoller->deregisterForRead(mFd);
+        close(mFd);
+        mFd = -1;
+    }
+    if (!mUnixPath.empty())
+    {
+        unlink(mUnixPath.c_str());
+        mUnixPath.clear();
+    }
+}
+
+int StatsServer::handleInputNotification(int fd)
+{
+    // 已关闭的客户端在这里统一释放, 避免在其自身的回调中析构
+    _reap();
+
+    int connfd = accept(mFd, NULL, NULL);
+    if (connfd < 0)
+        return 0;
+
+    if (mClients.size() >= MAX_CLIENTS || !core::setNonblocking(connfd))
+    {
+        WarningPrint("StatsServer::handleInputNotification() reject stats client! clients=%u",
+                     (uint32)mClients.size());
+        close(connfd);
+        return 0;
+    }
+
+    mClients.push_back(new Client(this, connfd));
+    return 0;
+}
+
+void StatsServer::onTimeout(WheelTimer *pTimer)
+{
+    _reap();
+}
+
+std::string StatsServer::buildResponse(const std::string &request)
+{
+    char method[16] = {0}, path[128] = {0};
+    sscanf(request.c_str(), "%15s %127s", method, path);
+
+    std::string body;
+    const char *status = "200 OK";
+    const char *contentType = "text/plain; version=0.0.4";
+    if (strcmp(path, "/reset") == 0)
+    {
+        // 会改变状态, 只接受POST, 本机浏览器中的页面不能借一个 <img> 清零统计
+        if (strcmp(method, "POST") == 0)
+        {
+            gStats.reset();
+            body = "ok\n";
+        }
+        else
+        {
+            status = "405 Method Not Allowed";
+            body = "use POST /reset\n";
+        }
+    }
+    else if (strcmp(method, "GET") != 0)
+    {
+        status = "405 Method Not Allowed";
+        body = "method not allowed\n";
+    }
+    else if (strcmp(path, "/metrics") == 0 || strcmp(path, "/") == 0)
+    {
+        StatsWriter w(StatsWriter::Format_Prometheus);
+        gStats.collect(w);
+        body = w.str();
+    }
+    else if (strcmp(path, "/json") == 0)
+    {
+        StatsWriter w(StatsWriter::Format_Json);
+        gStats.collect(w);
+        body = w.str();
+        contentType = "application/json";
+    }
+    else
+    {
+        status = "404 Not Found";
+        body = "try /metrics, /json or /reset\n";
+    }
+
+    char head[256];
+    snprintf(head, sizeof(head),
+             "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %u\r\nConnection: close\r\n\r\n",
+             status, contentType, (uint32)body.size());
+    return head+body;
+}
+
+void StatsServer::_onClientClosed()
+{
+    // 客户端在自身的回调中关闭, 到下一次处理定时器时再释放
+    if (!mReapTimer.isScheduled())
+        mpTimerWheel->schedule(&mReapTimer, getMonoClock());
+}
+
+void StatsServer::_reap()
+{
+    Clients::iterator it = mClients.begin();
+    for (; it != mClients.end(); )
+    {
+        if ((*it)->isClosed())
+        {
+            delete *it;
+            mClients.erase(it++);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+//--------------------------------------------------------------------------
+
+NAMESPACE_END // namespace tun
@@ -0,0 +1,187 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include "fasttun_base.h"
+#include "event_poller.h"
+#include "timer_wheel.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+NAMESPACE_BEG(tun)
+
+//--------------------------------------------------------------------------
+// 统计输出, 同名指标的样本聚合在一起, 按 Prometheus 文本格式或JSON输出
+class StatsWriter
+{
+  public:
+    enum EFormat
+    {
+        Format_Prometheus,
+        Format_Json,
+    };
+
+    StatsWriter(EFormat fmt) : mFormat(fmt), mMetrics() {}
+
+    // label 为NULL时样本不带标签
+    inline void gauge(const char *name, const char *label, uint64 id, double value)
+    {
+        _add(name, "gauge", label, id, value);
+    }
+    inline void counter(const char *name, const char *label, uint64 id, double value)
+    {
+        _add(name, "counter", label, id, value);
+    }
+
+    // 标签取字符串值
+    inline void gauge(const char *name, const char *label, const std::string &text, double value)
+    {
+        _add(name, "gauge", label, 0, value, text);
+    }
+    inline void counter(const char *name, const char *label, const std::string &text, double value)
+    {
+        _add(name, "counter", label, 0, value, text);
+    }
+
+    std::string str() const;
+
+  private:
+    struct Sample
+    {
+        const char *label;
+        uint64 id;
+        std::string text;
+        double value;
+    };
+
+    struct Metric
+    {
+        const char *type;
+        std::vector<Sample> samples;
+    };
+
+    typedef std::map<std::string, Metric> Metrics;
+
+    void _add(const char *name, const char *type, const char *label, uint64 id, double value,
+              const std::string &text = std::string());
+
+  private:
+    EFormat mFormat;
+    Metrics mMetrics;
+};
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+// 统计数据源
+// 计数器是各对象上的普通成员, 只在事件循环线程中累加, 热路径上无锁也无原子操作;
+// 队列深度等状态量在采集时才读取
+struct StatsSource
+{
+    virtual ~StatsSource() {}
+    virtual void collectStats(StatsWriter &w) = 0;
+
+    // 清零直方图等区间统计, 累计计数器不受影响
+    virtual void resetStats() {}
+};
+
+// 统计注册表, 只在事件循环线程中使用
+class StatsRegistry
+{
+  public:
+    StatsRegistry() : mSources(), mNextId(0) {}
+    virtual ~StatsRegistry() {}
+
+    // 返回进程内唯一的编号, 可用作没有天然标识的数据源的标签
+    uint32 add(StatsSource *s);
+    void remove(StatsSource *s);
+
+    void collect(StatsWriter &w) const;
+    void reset();
+
+    inline size_t size() const
+    {
+        return mSources.size();
+    }
+
+  private:
+    typedef std::set<StatsSource *> Sources;
+
+    Sources mSources;
+    uint32 mNextId;
+};
+
+extern StatsRegistry gStats;
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+// 本地统计端点, 以HTTP/1.0提供 /metrics (Prometheus) 和 /json, POST /reset 清零区间统计
+// 只监听Unix域套接字或回环地址; 客户端空闲超时后断开, 关闭的客户端延后到下一次处理定时器时释放
+class StatsServer : public InputNotificationHandler, public WheelTimer::Handler
+{
+  public:
+    enum
+    {
+        DEFAULT_IDLE_TIMEOUT = 10*1000,
+    };
+
+    StatsServer(EventPoller *poller, TimerWheel *wheel)
+            :mEventPoller(poller)
+            ,mpTimerWheel(wheel)
+            ,mFd(-1)
+            ,mUnixPath()
+            ,mClients()
+            ,mIdleTimeout(DEFAULT_IDLE_TIMEOUT)
+            ,mReapTimer(this)
+    {}
+
+    virtual ~StatsServer();
+
+    // "unix:/path" 或 "/path" 为Unix域套接字, 否则为 "127.0.0.1:port"
+    bool initialise(const char *addr);
+    void finalise();
+
+    // 客户端空闲超时, 毫秒
+    inline void setIdleTimeout(uint32 timeout)
+    {
+        mIdleTimeout = timeout;
+    }
+    inline size_t clientCount() const
+    {
+        return mClients.size();
+    }
+
+    // InputNotificationHandler
+    virtual int handleInputNotification(int fd);
+
+    // WheelTimer::Handler
+    virtual void onTimeout(WheelTimer *pTimer);
+
+    static std::string buildResponse(const std::string &request);
+
+  private:
+    class Client;
+
+    void _onClientClosed();
+    void _reap();
+
+  private:
+    static const size_t MAX_CLIENTS = 16;
+
+    typedef std::list<Client *> Clients;
+
+    EventPoller *mEventPoller;
+    TimerWheel *mpTimerWheel;
+    int mFd;
+    std::string mUnixPath;
+
+    Clients mClients;
+    uint32 mIdleTimeout;
+    WheelTimer mReapTimer;
+};
+//--------------------------------------------------------------------------
+
+NAMESPACE_END // namespace tun
+
+#endif // __STATS_H__
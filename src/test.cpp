@@ -30,7 +30,7 @@ class ClientBridge : public Connection::Handler
             ,mCache(NULL)
             ,mLastExtConnTime(0)
     {
-        mCache = new MyCache(this, &ClientBridge::flush);
+        mCache = new MyCache(this, &ClientBridge::flush, &ClientBridge::_flushAll);
     }
     
     virtual ~ClientBridge()
@@ -54,7 +54,7 @@ class ClientBridge : public Connection::Handler
         mpIntConn->setEventHandler(this);
 
         mpExtConn = new Connection(mEventPoller);
-        mLastExtConnTime = core::getClock();
+        mLastExtConnTime = getMonoClock();
         if (!mpExtConn->connect((const SA *)&RemoteAddr, sizeof(RemoteAddr)))
         {
             mpIntConn->shutdown();
@@ -121,7 +121,10 @@ class ClientBridge : public Connection::Handler
             else
             {
                 _flushAll();
-                mpExtConn->send(data, datalen);
+                if (mCache->empty())
+                    mpExtConn->send(data, datalen);
+                else
+                    mCache->cache(data, datalen);
             }
             DebugPrint("internal recvlen=%u", datalen);
         }
@@ -143,7 +146,7 @@ class ClientBridge : public Connection::Handler
 
     void _reconnectExternal()
     {
-        ulong curtick = core::getClock();
+        ulong curtick = getMonoClock();
         if (curtick > mLastExtConnTime+1000)
         {
             mLastExtConnTime = curtick;
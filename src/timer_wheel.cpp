@@ -0,0 +1,303 @@
+#include "timer_wheel.h"
+#include "loop_profiler.h"
+
+NAMESPACE_BEG(tun)
+
+TimerWheel gTimerWheel;
+
+//--------------------------------------------------------------------------
+void WheelTimer::cancel()
+{
+    if (mpWheel)
+        mpWheel->cancel(this);
+}
+//--------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------
+TimerWheel::TimerWheel()
+        :mNextTick(1)
+        ,mNowTick(0)
+        ,mNowClock(0)
+        ,mbStarted(false)
+        ,mCount(0)
+        ,mUpperCount(0)
+{
+    for (int i = 0; i < SLOT_COUNT; ++i)
+        _listInit(&mSlots[i]);
+    memset(mBitmap, 0, sizeof(mBitmap));
+}
+
+TimerWheel::~TimerWheel()
+{
+    for (int i = 0; i < SLOT_COUNT; ++i)
+    {
+        WheelTimer *head = &mSlots[i];
+        while (head->mNext != head)
+            cancel(head->mNext);
+    }
+}
+
+void TimerWheel::schedule(WheelTimer *pTimer, uint32 expire, uint32 interval, uint32 slack)
+{
+    pTimer->cancel();
+
+    if (!mbStarted)
+    {
+        mNowClock = getMonoClock();
+        mbStarted = true;
+    }
+
+    int32 delta = (int32)(expire-mNowClock);
+    uint64 e = mNowTick+(delta > 0 ? delta : 0);
+    if (slack > 1)
+        e = (e+slack-1)/slack*slack;
+
+    pTimer->mExpire = e;
+    pTimer->mInterval = interval;
+    pTimer->mSlack = slack;
+    pTimer->mpWheel = this;
+    ++mCount;
+    _add(pTimer);
+}
+
+void TimerWheel::cancel(WheelTimer *pTimer)
+{
+    if (pTimer->mpWheel != this)
+        return;
+
+    _unlink(pTimer);
+    pTimer->mpWheel = NULL;
+    --mCount;
+}
+
+int TimerWheel::process(uint32 now)
+{
+    if (!mbStarted)
+    {
+        mNowClock = now;
+        mbStarted = true;
+        return 0;
+    }
+
+    int32 elapsed = (int32)(now-mNowClock);
+    if (elapsed <= 0)
+        return 0;
+    mNowClock = now;
+    mNowTick += elapsed;
+
+    int fired = 0;
+    while (mNextTick <= mNowTick)
+    {
+        int index = (int)(mNextTick&ROOT_MASK);
+        if (0 == index)
+        {
+            for (int level = 1; level < LEVELS && !_cascade(level); ++level) {}
+        }
+        else if (0 == (mBitmap[index>>6]&(1ULL<<(index&63))))
+        {
+            // 跳过空槽, 只停在有定时器的槽或需要进位的边界上
+            uint64 skip = _firstRootSlot(index)-index;
+            mNextTick += min(skip, mNowTick+1-mNextTick);
+            continue;
+        }
+
+        ++mNextTick;
+
+        // 整槽取出批量处理, 回调中可以任意增删定时器
+        WheelTimer work;
+        WheelTimer *head = &mSlots[index];
+        if (head->mNext == head)
+            continue;
+
+        work.mNext = head->mNext;
+        work.mPrev = head->mPrev;
+        work.mNext->mPrev = &work;
+        work.mPrev->mNext = &work;
+        _listInit(head);
+        mBitmap[index>>6] &= ~(1ULL<<(index&63));
+        for (WheelTimer *p = work.mNext; p != &work; p = p->mNext)
+            p->mSlot = SLOT_NONE;
+
+        while (work.mNext != &work)
+        {
+            WheelTimer *pTimer = work.mNext;
+            _unlink(pTimer);
+
+            if (pTimer->mInterval > 0)
+            {
+                // 落后太多时不补发, 从当前时刻重新计时
+                uint64 e = pTimer->mExpire+pTimer->mInterval;
+                if (e <= mNowTick)
+                    e = mNowTick+pTimer->mInterval;
+                if (pTimer->mSlack > 1)
+                    e = (e+pTimer->mSlack-1)/pTimer->mSlack*pTimer->mSlack;
+                pTimer->mExpire = e;
+                _add(pTimer);
+            }
+            else
+            {
+                pTimer->mpWheel = NULL;
+                --mCount;
+            }
+
+            ++fired;
+            if (pTimer->mHandler)
+            {
+                LoopProfiler::Scope scope(LoopProfiler::Site_Timer, typeid(*pTimer->mHandler));
+                pTimer->mHandler->onTimeout(pTimer);
+            }
+        }
+    }
+
+    return fired;
+}
+
+uint32 TimerWheel::nextExpire() const
+{
+    if (0 == mCount)
+        return 0xFFFFFFFF;
+
+    uint64 best = (uint64)-1;
+
+    // 第0层: 从当前槽开始环形查找
+    int index = (int)(mNextTick&ROOT_MASK);
+    int slot = _firstRootSlot(index);
+    if (slot < ROOT_SIZE)
+    {
+        best = mNextTick+(slot-index);
+    }
+    else
+    {
+        slot = _firstRootSlot(0);
+        if (slot < index)
+            best = mNextTick+(ROOT_SIZE-index)+slot;
+    }
+
+    // 上层: 取最近一个非空槽的进位时刻, 进位后再精确计算
+    for (int level = 1; level < LEVELS && mUpperCount > 0; ++level)
+    {
+        uint64 bits = mBitmap[(ROOT_SIZE>>6)+level-1];
+        if (0 == bits)
+            continue;
+
+        int shift = ROOT_BITS+(level-1)*LEVEL_BITS;
+        uint64 span = 1ULL<<shift;
+        uint64 boundary = (mNextTick+span-1)&~(span-1);
+        int from = (int)((boundary>>shift)&LEVEL_MASK);
+        uint64 rotated = (bits>>from)|(from > 0 ? bits<<(LEVEL_SIZE-from) : 0);
+        uint64 cand = boundary+((uint64)__builtin_ctzll(rotated)<<shift);
+        best = min(best, cand);
+    }
+
+    if (best <= mNowTick)
+        return 0;
+    uint64 wait = best-mNowTick;
+    return wait < 0xFFFFFFFF ? (uint32)wait : 0xFFFFFFFE;
+}
+
+double TimerWheel::nextWait(uint32 limit) const
+{
+    uint32 wait = nextExpire();
+    if (wait >= limit)
+        return limit*0.001;
+
+    // 到期时刻是 mNowClock+wait 这一毫秒的起点, 按整毫秒等待平均要多睡半毫秒
+    uint64 nowUs = getMonoClockUs();
+    int32 ms = (int32)(mNowClock+wait-(uint32)(nowUs/1000));
+    int64 us = (int64)ms*1000-(int64)(nowUs%1000);
+    return us > 0 ? us*0.000001 : 0;
+}
+
+void TimerWheel::_add(WheelTimer *pTimer)
+{
+    uint64 e = pTimer->mExpire;
+    int slot = 0;
+    if (e < mNextTick)
+    {
+        // 已过期, 下一个tick处理
+        slot = (int)(mNextTick&ROOT_MASK);
+    }
+    else if (e-mNextTick < ROOT_SIZE)
+    {
+        slot = (int)(e&ROOT_MASK);
+    }
+    else
+    {
+        int level = 1;
+        for (; level < LEVELS-1; ++level)
+        {
+            if (e-mNextTick < (1ULL<<(ROOT_BITS+level*LEVEL_BITS)))
+                break;
+        }
+
+        // 超出范围的放在最高层最远的槽, 进位时按真实到期时刻重新放置
+        uint64 maxDelta = (1ULL<<(ROOT_BITS+(LEVELS-1)*LEVEL_BITS))-1;
+        if (e-mNextTick > maxDelta)
+            e = mNextTick+maxDelta;
+
+        int shift = ROOT_BITS+(level-1)*LEVEL_BITS;
+        slot = ROOT_SIZE+(level-1)*LEVEL_SIZE+(int)((e>>shift)&LEVEL_MASK);
+        ++mUpperCount;
+    }
+
+    WheelTimer *head = &mSlots[slot];
+    pTimer->mPrev = head->mPrev;
+    pTimer->mNext = head;
+    head->mPrev->mNext = pTimer;
+    head->mPrev = pTimer;
+    pTimer->mSlot = slot;
+    mBitmap[slot>>6] |= 1ULL<<(slot&63);
+}
+
+void TimerWheel::_unlink(WheelTimer *pTimer)
+{
+    pTimer->mPrev->mNext = pTimer->mNext;
+    pTimer->mNext->mPrev = pTimer->mPrev;
+
+    int slot = pTimer->mSlot;
+    if (slot != SLOT_NONE)
+    {
+        WheelTimer *head = &mSlots[slot];
+        if (head->mNext == head)
+            mBitmap[slot>>6] &= ~(1ULL<<(slot&63));
+        if (slot >= ROOT_SIZE)
+            --mUpperCount;
+    }
+
+    pTimer->mPrev = pTimer->mNext = NULL;
+    pTimer->mSlot = SLOT_NONE;
+}
+
+bool TimerWheel::_cascade(int level)
+{
+    int shift = ROOT_BITS+(level-1)*LEVEL_BITS;
+    int index = (int)((mNextTick>>shift)&LEVEL_MASK);
+    int slot = ROOT_SIZE+(level-1)*LEVEL_SIZE+index;
+
+    WheelTimer *head = &mSlots[slot];
+    while (head->mNext != head)
+    {
+        WheelTimer *pTimer = head->mNext;
+        _unlink(pTimer);
+        _add(pTimer);
+    }
+
+    // 本层也转了一圈时继续从更高一层进位
+    return index != 0;
+}
+
+int TimerWheel::_firstRootSlot(int from) const
+{
+    for (int w = from>>6; w < (ROOT_SIZE>>6); ++w)
+    {
+        uint64 bits = mBitmap[w];
+        if (w == (from>>6))
+            bits &= ~0ULL<<(from&63);
+        if (bits)
+            return (w<<6)+__builtin_ctzll(bits);
+    }
+    return ROOT_SIZE;
+}
+//--------------------------------------------------------------------------
+
+NAMESPACE_END // namespace tun
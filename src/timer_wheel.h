@@ -0,0 +1,132 @@
+#ifndef __TIMERWHEEL_H__
+#define __TIMERWHEEL_H__
+
+#include "fasttun_base.h"
+
+NAMESPACE_BEG(tun)
+
+class TimerWheel;
+
+// 侵入式定时器, 由使用者持有, 增删都不分配内存
+class WheelTimer
+{
+    friend class TimerWheel;
+  public:
+    struct Handler
+    {
+        virtual ~Handler() {}
+        virtual void onTimeout(WheelTimer *pTimer) = 0;
+    };
+
+    WheelTimer(Handler *h = NULL)
+            :mPrev(NULL)
+            ,mNext(NULL)
+            ,mpWheel(NULL)
+            ,mHandler(h)
+            ,mExpire(0)
+            ,mInterval(0)
+            ,mSlack(0)
+            ,mSlot(0)
+    {}
+
+    ~WheelTimer()
+    {
+        cancel();
+    }
+
+    inline void setHandler(Handler *h)
+    {
+        mHandler = h;
+    }
+
+    inline bool isScheduled() const
+    {
+        return mpWheel != NULL;
+    }
+
+    void cancel();
+
+  private:
+    WheelTimer *mPrev;
+    WheelTimer *mNext;
+    TimerWheel *mpWheel;
+    Handler *mHandler;
+
+    uint64 mExpire; // 到期的tick
+    uint32 mInterval;
+    uint32 mSlack;
+    int mSlot;
+};
+
+// 分层时间轮, 精度1ms
+// 第0层256个槽, 其上4层各64个槽, 覆盖全部32位时钟范围; 增删O(1), 到期时整槽批量处理.
+// 时钟以 getMonoClock() 的毫秒数为准
+class TimerWheel
+{
+    friend class WheelTimer;
+  public:
+    TimerWheel();
+    virtual ~TimerWheel();
+
+    // 在 expire 时刻(毫秒时钟)触发, interval 非0时周期触发.
+    // slack 非0时把到期时刻向上对齐到 slack 的整数倍, 使大量精度要求不高的定时器落在同一个槽中批量处理
+    void schedule(WheelTimer *pTimer, uint32 expire, uint32 interval = 0, uint32 slack = 0);
+    void cancel(WheelTimer *pTimer);
+
+    // 处理 now 及之前到期的定时器, 返回触发的个数
+    int process(uint32 now);
+
+    // 距离下一次需要调用 process 的毫秒数(可能提前, 不会推后), 没有定时器时返回 0xFFFFFFFF
+    uint32 nextExpire() const;
+
+    // 距离下一个定时器到期的秒数, 扣除当前这一毫秒已经过去的部分, 最多 limit 毫秒.
+    // 供事件循环等待用, 时钟须为 getMonoClock()
+    double nextWait(uint32 limit) const;
+
+    inline size_t size() const
+    {
+        return mCount;
+    }
+
+  private:
+    enum
+    {
+        ROOT_BITS = 8,
+        LEVEL_BITS = 6,
+        LEVELS = 5, // 含第0层
+        ROOT_SIZE = 1<<ROOT_BITS,
+        LEVEL_SIZE = 1<<LEVEL_BITS,
+        ROOT_MASK = ROOT_SIZE-1,
+        LEVEL_MASK = LEVEL_SIZE-1,
+        SLOT_COUNT = ROOT_SIZE+(LEVELS-1)*LEVEL_SIZE,
+        SLOT_NONE = -1,
+    };
+
+    void _add(WheelTimer *pTimer);
+    void _unlink(WheelTimer *pTimer);
+    bool _cascade(int level);
+    int _firstRootSlot(int from) const;
+
+    static inline void _listInit(WheelTimer *head)
+    {
+        head->mPrev = head->mNext = head;
+    }
+
+  private:
+    WheelTimer mSlots[SLOT_COUNT];
+    uint64 mBitmap[SLOT_COUNT/64];
+
+    uint64 mNextTick; // 下一个待处理的tick
+    uint64 mNowTick;  // 最近一次 process 的时刻
+    uint32 mNowClock;
+    bool mbStarted;
+
+    size_t mCount;
+    size_t mUpperCount; // 第0层以上的定时器个数
+};
+
+extern TimerWheel gTimerWheel;
+
+NAMESPACE_END // namespace tun
+
+#endif // __TIMERWHEEL_H__
@@ -26,6 +26,11 @@ class UdpPacketSender : public OutputNotificationHandler
 
     void send(const void *data, size_t datalen);
 
+    inline bool empty() const
+    {
+        return mPacketList.empty();
+    }
+
     // OutputNotificationHandler
     virtual int handleOutputNotification(int fd);
 
@@ -1,8 +1,11 @@
 #include "utest.h"
+#include "epoll_poller.h"
+#include "connection.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/un.h>
 
 #include "cppunit/extensions/TestFactoryRegistry.h"
 #include "cppunit/ui/text/TestRunner.h"
@@ -115,6 +118,2183 @@ void UTest::testDiskCache()
     }
 }
 
+void UTest::testDiskCacheRecycle()
+{
+    static const int RECORD_COUNT = 4096;
+    static const size_t MAX_RECORD_LEN = 4096;
+
+    DiskCache c;
+    char *wbuf = (char *)malloc(MAX_RECORD_LEN);
+    char *rbuf = (char *)malloc(MAX_RECORD_LEN);
+    int wseq = 0, rseq = 0;
+    for (int round = 0; round < 3; ++round)
+    {
+        for (int i = 0; i < RECORD_COUNT; ++i, ++wseq)
+        {
+            size_t len = wseq%MAX_RECORD_LEN+1;
+            memset(wbuf, wseq%256, len);
+            CPPUNIT_ASSERT(c.write(wbuf, len) == (ssize_t)len);
+
+            // 边写边读, 使消费完的段被回收
+            if (i%2 == 0)
+            {
+                size_t rlen = rseq%MAX_RECORD_LEN+1;
+                CPPUNIT_ASSERT(c.read(rbuf, MAX_RECORD_LEN) == (ssize_t)rlen);
+                memset(wbuf, rseq%256, rlen);
+                CPPUNIT_ASSERT(memcmp(rbuf, wbuf, rlen) == 0);
+                ++rseq;
+            }
+        }
+
+        size_t sz = 0;
+        const void *ptr = NULL;
+        while ((ptr = c.peek(sz)) != NULL)
+        {
+            CPPUNIT_ASSERT(sz == (size_t)(rseq%MAX_RECORD_LEN+1));
+            memset(wbuf, rseq%256, sz);
+            CPPUNIT_ASSERT(memcmp(ptr, wbuf, sz) == 0);
+            c.pop();
+            ++rseq;
+        }
+        CPPUNIT_ASSERT(c.empty());
+        CPPUNIT_ASSERT(rseq == wseq);
+    }
+
+    free(wbuf);
+    free(rbuf);
+}
+static std::string s_flushedData;
+void UTest::testDiskCacheAsync()
+{
+    static const int RECORD_COUNT = 20000;
+    static const size_t MAX_RECORD_LEN = 2048;
+
+    EventPoller *poller = new EpollPoller();
+    CPPUNIT_ASSERT(gDiskIO.start(poller));
+
+    DiskCache c;
+    char *buf = (char *)malloc(MAX_RECORD_LEN);
+    int wseq = 0, rseq = 0;
+    while (rseq < RECORD_COUNT)
+    {
+        for (int i = 0; i < 64 && wseq < RECORD_COUNT; ++i, ++wseq)
+        {
+            size_t len = (wseq*7919)%MAX_RECORD_LEN+1;
+            memset(buf, wseq%256, len);
+            CPPUNIT_ASSERT(c.write(buf, len) == (ssize_t)len);
+        }
+
+        // 数据还在读回途中时驱动事件循环接收完成通知
+        for (int i = 0; i < 32 && rseq < wseq; )
+        {
+            size_t sz = 0;
+            const void *ptr = c.peek(sz);
+            if (NULL == ptr)
+            {
+                CPPUNIT_ASSERT(!c.empty());
+                poller->processPendingEvents(0.01);
+                continue;
+            }
+
+            CPPUNIT_ASSERT(sz == (size_t)(rseq*7919)%MAX_RECORD_LEN+1);
+            memset(buf, rseq%256, sz);
+            CPPUNIT_ASSERT(memcmp(ptr, buf, sz) == 0);
+            c.pop();
+            ++rseq;
+            ++i;
+        }
+    }
+    CPPUNIT_ASSERT(c.empty());
+
+    // 未消费的数据随 clear 丢弃, 在途任务完成后释放IO内存
+    for (int i = 0; i < 1024; ++i)
+        c.write(buf, MAX_RECORD_LEN);
+    c.clear();
+    gDiskIO.stop();
+    CPPUNIT_ASSERT(gCacheBudget.getIOUsed() == 0);
+
+    free(buf);
+    delete poller;
+}
+
+void UTest::testCacheBudget()
+{
+    static const size_t LIMIT = 64*1024;
+    static const size_t CHUNK = 1024;
+    typedef tun::Cache<UTest> MyCache;
+
+    size_t oldLimit = gCacheBudget.getMemLimit();
+    gCacheBudget.setMemLimit(LIMIT);
+
+    MyCache small(this, &UTest::_onFlushCache), big(this, &UTest::_onFlushCache);
+    std::string expected;
+    char chunk[CHUNK];
+    for (size_t i = 0; i < LIMIT/CHUNK; ++i)
+    {
+        memset(chunk, i%256, CHUNK);
+        if (i%4 == 0)
+        {
+            small.cache(chunk, CHUNK);
+        }
+        else
+        {
+            big.cache(chunk, CHUNK);
+            expected.append(chunk, CHUNK);
+        }
+    }
+
+    // 内存占用不超过预算, 超出部分写入磁盘
+    CPPUNIT_ASSERT(gCacheBudget.getMemUsed() <= LIMIT);
+    CPPUNIT_ASSERT(gCacheBudget.isUnderPressure());
+
+    // 压力下优先转存占用最大的缓存
+    gCacheBudget.update();
+    CPPUNIT_ASSERT(!gCacheBudget.isUnderPressure());
+    CPPUNIT_ASSERT(0 == big.memSize());
+    CPPUNIT_ASSERT(small.memSize() > 0);
+
+    s_flushedData.clear();
+    CPPUNIT_ASSERT(big.flushAll());
+    CPPUNIT_ASSERT(big.empty());
+    CPPUNIT_ASSERT(s_flushedData == expected);
+
+    small.clear();
+    CPPUNIT_ASSERT(0 == gCacheBudget.getMemUsed());
+    CPPUNIT_ASSERT(0 == gCacheBudget.getDiskUsed());
+    gCacheBudget.setMemLimit(oldLimit);
+}
+
+bool UTest::_onFlushCache(const void *data, size_t datalen)
+{
+    s_flushedData.append((const char *)data, datalen);
+    return true;
+}
+struct CacheHost
+{
+    std::string data;
+    int ready;
+
+    CacheHost() : data(), ready(0) {}
+
+    bool onFlush(const void *p, size_t len)
+    {
+        data.append((const char *)p, len);
+        return true;
+    }
+    void onReady()
+    {
+        ++ready;
+    }
+};
+
+void UTest::testCacheAccounting()
+{
+    static const size_t LIMIT = 256*1024;
+    static const int CHUNKS = 400;
+
+    size_t oldLimit = gCacheBudget.getMemLimit();
+    gCacheBudget.setMemLimit(LIMIT);
+    EventPoller *poller = new EpollPoller();
+    CPPUNIT_ASSERT(gDiskIO.start(poller));
+    CPPUNIT_ASSERT(0 == gCacheBudget.getMemUsed()+gCacheBudget.getIOUsed()+gCacheBudget.getDiskUsed());
+
+    // 暂存块按缓冲区大小计入, 零星的小记录只占一个小块, 随数据增长倍增
+    {
+        DiskCache dc;
+        char rec[100];
+        memset(rec, 'r', sizeof(rec));
+        CPPUNIT_ASSERT(dc.write(rec, sizeof(rec)) == sizeof(rec));
+        CPPUNIT_ASSERT(gCacheBudget.getMemUsed() == dc.stagingSize() && dc.stagingSize() <= 4*1024);
+        for (int i = 0; i < 100; ++i)
+            CPPUNIT_ASSERT(dc.write(rec, sizeof(rec)) == sizeof(rec));
+        CPPUNIT_ASSERT(gCacheBudget.getMemUsed() == dc.stagingSize() && dc.stagingSize() >= 101*(sizeof(rec)+4));
+        CPPUNIT_ASSERT(dc.stagingSize() <= 2*101*(sizeof(rec)+4));
+        dc.clear();
+        CPPUNIT_ASSERT(0 == gCacheBudget.getMemUsed());
+    }
+
+    CacheHost host;
+    tun::Cache<CacheHost> c(&host, &CacheHost::onFlush, &CacheHost::onReady);
+    std::string expected;
+    char chunk[3000];
+    for (int i = 0; i < CHUNKS; ++i)
+    {
+        size_t len = 1000+(i*7)%2000;
+        memset(chunk, i%256, len);
+        c.cache(chunk, len);
+        expected.append(chunk, len);
+        gCacheBudget.update();
+    }
+
+    // 写入完成后每份数据只计入内存或磁盘中的一项; 磁盘按数据长度(不含记录头)计, 内存按缓冲区大小计
+    uint32 start = getMonoClock();
+    while (gCacheBudget.getIOUsed() > 0 && getMonoClock()-start < 3000)
+        poller->processPendingEvents(0.01);
+    CPPUNIT_ASSERT(0 == gCacheBudget.getIOUsed() && gCacheBudget.getDiskUsed() > 0);
+    CPPUNIT_ASSERT(gCacheBudget.getDiskUsed() <= c.diskSize());
+    CPPUNIT_ASSERT(gCacheBudget.getMemUsed()+gCacheBudget.getDiskUsed() >= c.size());
+    CPPUNIT_ASSERT(gCacheBudget.getMemUsed() <= LIMIT);
+
+    // 冲刷时预读的块同样计入, 全部消费后归零
+    start = getMonoClock();
+    while (!c.flushAll() && getMonoClock()-start < 3000)
+    {
+        int ready = host.ready;
+        while (host.ready == ready && getMonoClock()-start < 3000)
+            poller->processPendingEvents(0.01);
+        CPPUNIT_ASSERT(gCacheBudget.getMemUsed() <= LIMIT);
+    }
+    CPPUNIT_ASSERT(c.empty() && host.data == expected);
+    CPPUNIT_ASSERT(0 == gCacheBudget.getMemUsed() && 0 == gCacheBudget.getIOUsed() && 0 == gCacheBudget.getDiskUsed());
+
+    // 转存后直接丢弃, 在途任务完成后同样归零
+    for (int i = 0; i < CHUNKS; ++i)
+    {
+        c.cache(chunk, sizeof(chunk));
+        gCacheBudget.update();
+    }
+    c.clear();
+    gDiskIO.stop();
+    CPPUNIT_ASSERT(0 == gCacheBudget.getMemUsed() && 0 == gCacheBudget.getIOUsed() && 0 == gCacheBudget.getDiskUsed());
+
+    delete poller;
+    gCacheBudget.setMemLimit(oldLimit);
+}
+
+// 与桥接对象相同: 内存紧张且下游积压时暂停读取, 积压是它自己的缓存
+struct BudgetSource : public CacheBudget::Waiter
+{
+    tun::Cache<BudgetSource> cache;
+    size_t quota;   // 下游还能接收的字节数
+    size_t flushed;
+    bool paused;
+
+    BudgetSource() : cache(this, &BudgetSource::onFlush), quota(0), flushed(0), paused(false) {}
+
+    bool onFlush(const void *data, size_t datalen)
+    {
+        if (datalen > quota)
+            return false;
+        quota -= datalen;
+        flushed += datalen;
+        return true;
+    }
+
+    void read(const void *data, size_t datalen)
+    {
+        cache.cache(data, datalen);
+        if (!paused && gCacheBudget.isUnderPressure())
+        {
+            paused = true;
+            gCacheBudget.waitFor(this);
+        }
+    }
+
+    virtual size_t getBacklog() const
+    {
+        return cache.size();
+    }
+    virtual void onCacheBudgetAvailable()
+    {
+        paused = false;
+    }
+};
+
+void UTest::testBudgetBackpressure()
+{
+    static const size_t LIMIT = 4*CacheBudget::WAITER_LOW_WATER;
+    static const size_t CHUNK = 1024;
+
+    size_t oldLimit = gCacheBudget.getMemLimit();
+    gCacheBudget.setMemLimit(LIMIT);
+
+    // 内存越过高水位时暂停
+    BudgetSource src;
+    char chunk[CHUNK];
+    memset(chunk, 'b', CHUNK);
+    while (!src.paused)
+        src.read(chunk, CHUNK);
+    CPPUNIT_ASSERT(gCacheBudget.isUnderPressure());
+
+    // 转存到磁盘使内存回落, 但积压还在, 继续暂停
+    gCacheBudget.update();
+    CPPUNIT_ASSERT(!gCacheBudget.isUnderPressure() && gCacheBudget.getDiskUsed() > 0);
+    CPPUNIT_ASSERT(src.paused);
+
+    // 下游排出一部分, 积压仍高于低水位
+    src.quota = src.getBacklog()-2*CacheBudget::WAITER_LOW_WATER;
+    CPPUNIT_ASSERT(!src.cache.flushAll());
+    CPPUNIT_ASSERT(src.getBacklog() > CacheBudget::WAITER_LOW_WATER);
+    gCacheBudget.update();
+    CPPUNIT_ASSERT(src.paused);
+
+    // 积压降到低水位以下才恢复读取
+    src.quota = src.getBacklog()-CacheBudget::WAITER_LOW_WATER/2;
+    CPPUNIT_ASSERT(!src.cache.flushAll());
+    CPPUNIT_ASSERT(src.getBacklog() <= CacheBudget::WAITER_LOW_WATER);
+    gCacheBudget.update();
+    CPPUNIT_ASSERT(!src.paused);
+
+    src.cache.clear();
+    CPPUNIT_ASSERT(0 == gCacheBudget.getMemUsed()+gCacheBudget.getIOUsed()+gCacheBudget.getDiskUsed());
+    gCacheBudget.setMemLimit(oldLimit);
+}
+
+void UTest::testRingBuffer()
+{
+    static const int RECORD_COUNT = 100000;
+    static const size_t MAX_RECORD_LEN = 3000;
+
+    RingBuffer r;
+    char buf[MAX_RECORD_LEN];
+    int wseq = 0, rseq = 0;
+    while (rseq < RECORD_COUNT)
+    {
+        // 写多读少与读多写少交替, 覆盖回绕与扩容
+        int pushes = (wseq/1000)%2 == 0 ? 3 : 1;
+        for (int i = 0; i < pushes && wseq < RECORD_COUNT; ++i, ++wseq)
+        {
+            size_t len = (wseq*7919)%MAX_RECORD_LEN+1;
+            memset(buf, wseq%256, len);
+            r.push(buf, len);
+        }
+
+        for (int i = 0; i < 2 && !r.empty(); ++i, ++rseq)
+        {
+            size_t len = 0;
+            const void *ptr = r.front(len);
+            CPPUNIT_ASSERT(ptr != NULL);
+            CPPUNIT_ASSERT(len == (size_t)(rseq*7919)%MAX_RECORD_LEN+1);
+            memset(buf, rseq%256, len);
+            CPPUNIT_ASSERT(memcmp(ptr, buf, len) == 0);
+            r.pop();
+        }
+    }
+
+    CPPUNIT_ASSERT(r.empty());
+    CPPUNIT_ASSERT(wseq == rseq);
+}
+
+static uint32 s_wheelNow = 0;
+
+struct WheelProbe : public WheelTimer::Handler
+{
+    WheelTimer timer;
+    uint32 expire;
+    uint32 firedAt;
+    int fired;
+    WheelProbe *victim;
+
+    WheelProbe() : timer(this), expire(0), firedAt(0), fired(0), victim(NULL) {}
+
+    virtual void onTimeout(WheelTimer *pTimer)
+    {
+        firedAt = s_wheelNow;
+        ++fired;
+        if (victim)
+            victim->timer.cancel();
+    }
+};
+
+void UTest::testTimerWheel()
+{
+    static const int TIMER_COUNT = 3000;
+
+    TimerWheel w;
+    s_wheelNow = 0xFFFF0000; // 覆盖32位时钟回绕
+    w.process(s_wheelNow);
+
+    // 到期时间分布在各层
+    WheelProbe *probes = new WheelProbe[TIMER_COUNT];
+    uint32 maxDelay = 0;
+    for (int i = 0; i < TIMER_COUNT; ++i)
+    {
+        uint32 delay = (uint32)(i*7919)%(1<<(i%24+1))+1;
+        probes[i].expire = s_wheelNow+delay;
+        w.schedule(&probes[i].timer, probes[i].expire);
+        maxDelay = max(maxDelay, delay);
+    }
+
+    // 同一批中先触发的定时器取消后一个
+    probes[1].victim = &probes[2];
+    probes[2].victim = NULL;
+    w.schedule(&probes[1].timer, s_wheelNow+5000);
+    w.schedule(&probes[2].timer, s_wheelNow+5000);
+    probes[1].expire = s_wheelNow+5000;
+    CPPUNIT_ASSERT(w.size() == TIMER_COUNT);
+
+    uint32 begin = s_wheelNow;
+    uint32 step = 1;
+    while (s_wheelNow-begin <= maxDelay)
+    {
+        // nextExpire 只会提前, 不会错过到期的定时器
+        uint32 wait = w.nextExpire();
+        step = (step*1103515245+12345)%4093+1;
+        if (step < wait)
+        {
+            s_wheelNow += step;
+            CPPUNIT_ASSERT(w.process(s_wheelNow) == 0);
+        }
+        else
+        {
+            s_wheelNow += wait;
+            w.process(s_wheelNow);
+        }
+    }
+    CPPUNIT_ASSERT(0 == w.size());
+    CPPUNIT_ASSERT(0xFFFFFFFF == w.nextExpire());
+
+    for (int i = 0; i < TIMER_COUNT; ++i)
+    {
+        if (2 == i)
+        {
+            CPPUNIT_ASSERT(0 == probes[i].fired);
+            continue;
+        }
+        CPPUNIT_ASSERT(1 == probes[i].fired);
+        CPPUNIT_ASSERT(probes[i].firedAt == probes[i].expire);
+    }
+    delete [] probes;
+
+    // 周期定时器, 首次到期向上对齐到50ms, 即在[100, 150)ms之间
+    WheelProbe periodic;
+    w.schedule(&periodic.timer, s_wheelNow+100, 100, 50);
+    for (int i = 0; i < 1049; ++i)
+    {
+        ++s_wheelNow;
+        w.process(s_wheelNow);
+    }
+    CPPUNIT_ASSERT(10 == periodic.fired);
+    CPPUNIT_ASSERT(periodic.timer.isScheduled());
+    periodic.timer.cancel();
+    CPPUNIT_ASSERT(0 == w.size());
+}
+
+void UTest::testPreciseWait()
+{
+    // 等待时长扣除当前毫秒已经过去的部分
+    TimerWheel w;
+    uint32 now = getMonoClock();
+    w.process(now);
+    CPPUNIT_ASSERT(0.1 == w.nextWait(100));
+
+    WheelProbe probe;
+    w.schedule(&probe.timer, now+5);
+    double wait = w.nextWait(100);
+    CPPUNIT_ASSERT(wait > 0.003 && wait <= 0.005);
+    CPPUNIT_ASSERT(0.002 == w.nextWait(2));
+    // 当前毫秒到期的定时器在时钟前进后处理, 只需等到下一毫秒的起点
+    w.schedule(&probe.timer, now);
+    CPPUNIT_ASSERT(w.nextWait(100) <= 0.001);
+    probe.timer.cancel();
+
+    // 不足1毫秒的等待不会被取整
+    EventPoller *poller = new EpollPoller();
+    uint64 beg = getMonoClockUs();
+    CPPUNIT_ASSERT(0 == poller->processPendingEvents(0.0025));
+    CPPUNIT_ASSERT(getMonoClockUs()-beg >= 2400);
+    delete poller;
+}
+
+struct HeartBeatProbe : public PeerHeartBeat::Member
+{
+    uint32 lastRecv;
+    bool connected;
+    int sent;
+    int timeouts;
+
+    HeartBeatProbe() : lastRecv(0), connected(true), sent(0), timeouts(0) {}
+
+    virtual uint32 getLastRecvTime() const
+    {
+        return lastRecv;
+    }
+    virtual bool sendHeartBeat()
+    {
+        if (connected)
+            ++sent;
+        return connected;
+    }
+    virtual void onPeerTimeout()
+    {
+        ++timeouts;
+    }
+};
+
+void UTest::testPeerHeartBeat()
+{
+    static const uint32 PERIOD = PeerHeartBeat::CONNCHECK_INTERVAL+PeerHeartBeat::TIMER_SLACK;
+
+    uint32 now = getMonoClock();
+    gTimerWheel.process(now);
+    size_t timerCount = gTimerWheel.size();
+
+    HeartBeatManager mgr;
+    HeartBeatProbe a, b, c, solo, spoof;
+    uint32 ip = inet_addr("10.0.0.1"), otherIp = inet_addr("10.0.0.2");
+
+    // 同一对端共用一路心跳, 身份未知的独占; 其他主机报同一标识不算同一对端
+    PeerHeartBeat *peer = mgr.join(ip, 42, &a);
+    CPPUNIT_ASSERT(mgr.join(ip, 42, &b) == peer);
+    CPPUNIT_ASSERT(mgr.join(ip, 42, &c) == peer);
+    PeerHeartBeat *soloPeer = mgr.join(ip, 0, &solo);
+    CPPUNIT_ASSERT(soloPeer != peer);
+    PeerHeartBeat *spoofPeer = mgr.join(otherIp, 42, &spoof);
+    CPPUNIT_ASSERT(spoofPeer != peer && spoofPeer != soloPeer);
+    CPPUNIT_ASSERT(2 == mgr.peerCount());
+    CPPUNIT_ASSERT(3 == peer->size() && 1 == spoofPeer->size());
+    CPPUNIT_ASSERT(gTimerWheel.size() == timerCount+6);
+
+    // 任一成员有数据即视为对端存活, 不发心跳也不超时
+    a.lastRecv = c.lastRecv = now-HeartBeatRecord::CONNTIMEOUT_TIME-1;
+    b.lastRecv = solo.lastRecv = spoof.lastRecv = now;
+    gTimerWheel.process(now+PERIOD);
+    CPPUNIT_ASSERT(0 == a.sent+b.sent+c.sent+solo.sent);
+    CPPUNIT_ASSERT(0 == a.timeouts+b.timeouts+c.timeouts+solo.timeouts);
+
+    // 全部静默: 只经一个已连接的成员发一次心跳, 超时通知全部成员; 冒用标识的连接仍有数据也不能阻止
+    b.lastRecv = a.lastRecv;
+    a.connected = false;
+    gTimerWheel.process(now+PERIOD*2);
+    CPPUNIT_ASSERT(0 == a.sent);
+    CPPUNIT_ASSERT(1 == b.sent+c.sent);
+    CPPUNIT_ASSERT(1 == a.timeouts && 1 == b.timeouts && 1 == c.timeouts);
+    CPPUNIT_ASSERT(0 == solo.sent && 0 == solo.timeouts);
+    CPPUNIT_ASSERT(0 == spoof.sent && 0 == spoof.timeouts);
+
+    // 成员全部离开后释放对端及其定时器
+    mgr.leave(peer, &a);
+    mgr.leave(peer, &b);
+    CPPUNIT_ASSERT(2 == mgr.peerCount());
+    mgr.leave(peer, &c);
+    mgr.leave(spoofPeer, &spoof);
+    mgr.leave(soloPeer, &solo);
+    CPPUNIT_ASSERT(0 == mgr.peerCount());
+    CPPUNIT_ASSERT(gTimerWheel.size() == timerCount);
+}
+
+void UTest::testConvAllocator()
+{
+    static const int CYCLES = 1000000;
+    static const size_t WORKSET = 4096;
+
+    ConvAllocator a;
+    std::vector<uint32> live;
+    std::vector<uint32> lastConv(ConvAllocator::MAX_CONVS, 0);
+    std::vector<uint32> releasedAt(ConvAllocator::MAX_CONVS, 0);
+    uint32 releases = 0;
+    uint32 conv = 0;
+
+    for (size_t i = 0; i < WORKSET; ++i)
+    {
+        CPPUNIT_ASSERT(a.alloc(conv));
+        live.push_back(conv);
+    }
+
+    // 每轮随机关闭一个会话再打开一个
+    for (int i = 0; i < CYCLES; ++i)
+    {
+        size_t k = random()%live.size();
+        uint32 victim = live[k];
+        live[k] = live.back();
+        live.pop_back();
+
+        CPPUNIT_ASSERT(a.release(victim));
+        CPPUNIT_ASSERT(!a.release(victim));
+        CPPUNIT_ASSERT(!a.isAllocated(victim));
+        uint32 index = ConvAllocator::indexOf(victim);
+        lastConv[index] = victim;
+        releasedAt[index] = ++releases;
+
+        CPPUNIT_ASSERT(a.alloc(conv));
+        CPPUNIT_ASSERT(conv != 0);
+        CPPUNIT_ASSERT(a.isAllocated(conv));
+
+        // 复用的槽位代数不同, 且至少隔了 QUARANTINE 次释放
+        index = ConvAllocator::indexOf(conv);
+        if (releasedAt[index] > 0)
+        {
+            CPPUNIT_ASSERT(conv != lastConv[index]);
+            CPPUNIT_ASSERT(releases-releasedAt[index] >= ConvAllocator::QUARANTINE);
+        }
+        live.push_back(conv);
+    }
+    CPPUNIT_ASSERT(a.size() == WORKSET);
+
+    // 槽位数只取决于同时在用的会话数
+    for (size_t i = 0; i < live.size(); ++i)
+        CPPUNIT_ASSERT(a.release(live[i]));
+    CPPUNIT_ASSERT(0 == a.size());
+
+    // 容量用尽时立即复用空闲槽位
+    ConvAllocator small(100);
+    std::vector<uint32> convs;
+    while (small.alloc(conv))
+        convs.push_back(conv);
+    CPPUNIT_ASSERT(100 == convs.size() && 100 == small.size());
+    CPPUNIT_ASSERT(small.release(convs[50]));
+    CPPUNIT_ASSERT(small.alloc(conv));
+    CPPUNIT_ASSERT(ConvAllocator::indexOf(conv) == ConvAllocator::indexOf(convs[50]));
+    CPPUNIT_ASSERT(conv != convs[50]);
+    CPPUNIT_ASSERT(!small.isAllocated(convs[50]));
+}
+
+void UTest::testConvTable()
+{
+    static const int OPS = 200000;
+    static const uint32 KEYS = 5000;
+
+    ConvTable<uint32> t;
+    std::map<uint32, uint32 *> ref;
+    uint32 *values = new uint32[KEYS];
+
+    CPPUNIT_ASSERT(NULL == t.find(1));
+    CPPUNIT_ASSERT(!t.insert(0, &values[0]));
+
+    // 与 std::map 对照随机增删查, 键取自分配器会话号与小整数混合, 制造探测链冲突
+    for (int i = 0; i < OPS; ++i)
+    {
+        uint32 k = random()%KEYS;
+        uint32 conv = (k%2) ? ((((k>>1)+1)<<ConvAllocator::INDEX_BITS)|(k&7)) : k+1;
+        int op = random()%3;
+        if (0 == op)
+        {
+            bool inserted = t.insert(conv, &values[k]);
+            CPPUNIT_ASSERT(inserted == (ref.find(conv) == ref.end()));
+            ref[conv] = &values[k];
+        }
+        else if (1 == op)
+        {
+            uint32 *p = t.erase(conv);
+            std::map<uint32, uint32 *>::iterator it = ref.find(conv);
+            CPPUNIT_ASSERT(p == (it != ref.end() ? it->second : NULL));
+            if (it != ref.end())
+                ref.erase(it);
+        }
+        else
+        {
+            std::map<uint32, uint32 *>::iterator it = ref.find(conv);
+            CPPUNIT_ASSERT(t.find(conv) == (it != ref.end() ? it->second : NULL));
+        }
+        CPPUNIT_ASSERT(t.size() == ref.size());
+    }
+
+    // 遍历得到的元素与对照一致
+    size_t count = 0;
+    for (size_t i = 0; i < t.capacity(); ++i)
+    {
+        if (t.valueAt(i))
+            ++count;
+    }
+    CPPUNIT_ASSERT(count == ref.size());
+
+    std::map<uint32, uint32 *>::iterator it = ref.begin();
+    for (; it != ref.end(); ++it)
+        CPPUNIT_ASSERT(t.find(it->first) == it->second);
+
+    t.clear();
+    CPPUNIT_ASSERT(t.empty() && NULL == t.find(ref.begin()->first));
+    delete [] values;
+}
+
+struct StatsProbe : public StatsSource
+{
+    uint32 id;
+    uint64 bytes;
+
+    StatsProbe() : id(gStats.add(this)), bytes(0) {}
+    virtual ~StatsProbe()
+    {
+        gStats.remove(this);
+    }
+
+    virtual void collectStats(StatsWriter &w)
+    {
+        w.counter("utest_bytes_total", "probe", id, bytes);
+    }
+};
+
+void UTest::testStats()
+{
+    size_t sources = gStats.size();
+    {
+        StatsProbe a, b;
+        a.bytes = 12345678901ULL;
+        b.bytes = 7;
+        CPPUNIT_ASSERT(a.id != b.id);
+        CPPUNIT_ASSERT(gStats.size() == sources+2);
+
+        // 同名指标只输出一次类型, 样本连续
+        StatsWriter prom(StatsWriter::Format_Prometheus);
+        gStats.collect(prom);
+        std::string text = prom.str();
+        char line[128];
+        snprintf(line, sizeof(line), "utest_bytes_total{probe=\"%u\"} 12345678901\n", a.id);
+        CPPUNIT_ASSERT(text.find(line) != std::string::npos);
+        snprintf(line, sizeof(line), "utest_bytes_total{probe=\"%u\"} 7\n", b.id);
+        CPPUNIT_ASSERT(text.find(line) != std::string::npos);
+        size_t type = text.find("# TYPE utest_bytes_total counter\n");
+        CPPUNIT_ASSERT(type != std::string::npos);
+        CPPUNIT_ASSERT(text.find("# TYPE utest_bytes_total", type+1) == std::string::npos);
+
+        StatsWriter json(StatsWriter::Format_Json);
+        gStats.collect(json);
+        text = json.str();
+        snprintf(line, sizeof(line), "{\"probe\":%u,\"value\":12345678901}", a.id);
+        CPPUNIT_ASSERT(text.find(line) != std::string::npos);
+        CPPUNIT_ASSERT('{' == text[0] && text.find("\"utest_bytes_total\":{\"type\":\"counter\"") != std::string::npos);
+
+        // 本地端点的HTTP响应
+        std::string resp = StatsServer::buildResponse("GET /metrics HTTP/1.1\r\nHost: x\r\n\r\n");
+        CPPUNIT_ASSERT(resp.compare(0, 15, "HTTP/1.0 200 OK") == 0);
+        CPPUNIT_ASSERT(resp.find("utest_bytes_total") != std::string::npos);
+        resp = StatsServer::buildResponse("GET /json HTTP/1.1\r\n\r\n");
+        CPPUNIT_ASSERT(resp.find("application/json") != std::string::npos);
+        resp = StatsServer::buildResponse("GET /nothing HTTP/1.1\r\n\r\n");
+        CPPUNIT_ASSERT(resp.compare(0, 12, "HTTP/1.0 404") == 0);
+    }
+    CPPUNIT_ASSERT(gStats.size() == sources);
+
+    // 本地端点只接受Unix域套接字和回环地址
+    EpollPoller poller;
+    TimerWheel wheel;
+    StatsServer svr(&poller, &wheel);
+    CPPUNIT_ASSERT(!svr.initialise("0.0.0.0:9100"));
+
+    // 空闲的客户端超时断开, 关闭的客户端不等新连接接入就释放, 端点不会被占满
+    EventPoller &events = poller;
+    StatsServer local(&poller, &wheel);
+    local.setIdleTimeout(50);
+    CPPUNIT_ASSERT(local.initialise("unix:utest_stats.sock"));
+    struct sockaddr_un un;
+    memset(&un, 0, sizeof(un));
+    un.sun_family = AF_UNIX;
+    strcpy(un.sun_path, "utest_stats.sock");
+    int idle[17];
+    for (int i = 0; i < 17; ++i)
+    {
+        idle[i] = socket(AF_UNIX, SOCK_STREAM, 0);
+        CPPUNIT_ASSERT(connect(idle[i], (const SA *)&un, sizeof(un)) == 0);
+    }
+    for (int i = 0; i < 40; ++i)
+        events.processPendingEvents(0.001);
+    CPPUNIT_ASSERT(16 == local.clientCount());
+    char c;
+    CPPUNIT_ASSERT(recv(idle[16], &c, 1, 0) == 0);
+
+    close(idle[0]);
+    for (int i = 0; i < 10 && local.clientCount() > 15; ++i)
+    {
+        events.processPendingEvents(0.001);
+        wheel.process(getMonoClock());
+    }
+    CPPUNIT_ASSERT(15 == local.clientCount());
+
+    uint32 deadline = getMonoClock()+1000;
+    while (local.clientCount() > 0 && (int32)(getMonoClock()-deadline) < 0)
+    {
+        events.processPendingEvents(0.01);
+        wheel.process(getMonoClock());
+    }
+    CPPUNIT_ASSERT(0 == local.clientCount());
+    for (int i = 1; i < 17; ++i)
+    {
+        CPPUNIT_ASSERT(recv(idle[i], &c, 1, 0) == 0);
+        close(idle[i]);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    CPPUNIT_ASSERT(connect(fd, (const SA *)&un, sizeof(un)) == 0);
+    const char req[] = "GET /metrics HTTP/1.0\r\n\r\n";
+    CPPUNIT_ASSERT(send(fd, req, sizeof(req)-1, 0) == (int)sizeof(req)-1);
+    for (int i = 0; i < 10; ++i)
+        events.processPendingEvents(0.001);
+    char resp[16] = {0};
+    CPPUNIT_ASSERT(recv(fd, resp, 15, MSG_WAITALL) == 15);
+    CPPUNIT_ASSERT(strcmp(resp, "HTTP/1.0 200 OK") == 0);
+    close(fd);
+    local.finalise();
+}
+
+// 记录冲刷时恢复的数据入口
+struct LatencyProbe
+{
+    std::vector<uint64> stamps;
+    bool blocked;
+
+    LatencyProbe() : stamps(), blocked(false) {}
+
+    bool onFlush(const void *data, size_t datalen)
+    {
+        if (blocked)
+            return false;
+        stamps.push_back(gLatency.ingress.stamp);
+        return true;
+    }
+};
+
+void UTest::testLatencyHistogram()
+{
+    // 桶号随数值单调, 桶上界覆盖桶内所有值
+    int last = 0;
+    for (uint64 v = 0; v < 1000000; v += v/64+1)
+    {
+        int b = LatencyHistogram::bucketOf(v);
+        CPPUNIT_ASSERT(b >= last && b < LatencyHistogram::BUCKETS);
+        CPPUNIT_ASSERT(LatencyHistogram::bucketUpper(b) >= v);
+        CPPUNIT_ASSERT(0 == b || LatencyHistogram::bucketUpper(b-1) < v);
+        last = b;
+    }
+    CPPUNIT_ASSERT(LatencyHistogram::bucketOf(~(uint64)0) == LatencyHistogram::BUCKETS-1);
+
+    // 分位数的相对误差不超过 1/SUB_COUNT
+    LatencyHistogram h;
+    for (uint64 v = 1; v <= 100000; ++v)
+        h.record(v);
+    CPPUNIT_ASSERT(h.count() == 100000 && h.max() == 100000);
+    CPPUNIT_ASSERT(h.sum() == 100000ULL*100001/2);
+    static const double qs[] = {0.5, 0.9, 0.99, 0.999};
+    for (size_t i = 0; i < sizeof(qs)/sizeof(qs[0]); ++i)
+    {
+        double exact = qs[i]*100000;
+        double p = (double)h.percentile(qs[i]);
+        CPPUNIT_ASSERT(p >= exact && p <= exact*(1+1.0/LatencyHistogram::SUB_COUNT));
+    }
+    CPPUNIT_ASSERT(h.percentile(1) == 100000);
+
+    h.reset();
+    CPPUNIT_ASSERT(0 == h.count() && 0 == h.percentile(0.5));
+    CPPUNIT_ASSERT(h.totalCount() == 100000 && h.totalSum() == 100000ULL*100001/2);
+    h.record(7);
+    CPPUNIT_ASSERT(1 == h.count() && h.totalCount() == 100001 && h.totalSum() == 100000ULL*100001/2+7);
+
+    // 缓存中的每条记录在冲刷时恢复各自的入口, 冲刷失败的记录保留入口
+    LatencyProbe probe;
+    {
+        Cache<LatencyProbe> c(&probe, &LatencyProbe::onFlush);
+        for (uint64 i = 1; i <= 3; ++i)
+        {
+            IngressScope scope(LatencyTag(LatencyTag::Source_Tcp, i*100));
+            c.cache(&i, sizeof(i));
+        }
+        CPPUNIT_ASSERT(LatencyTag::Source_None == gLatency.ingress.source);
+
+        probe.blocked = true;
+        CPPUNIT_ASSERT(!c.flushAll());
+        probe.blocked = false;
+        CPPUNIT_ASSERT(c.flushAll());
+        CPPUNIT_ASSERT(probe.stamps.size() == 3);
+        CPPUNIT_ASSERT(100 == probe.stamps[0] && 200 == probe.stamps[1] && 300 == probe.stamps[2]);
+        CPPUNIT_ASSERT(0 == gLatency.ingress.stamp);
+    }
+
+    // 可经统计端点导出和清零
+    gLatency.kcpToTcp.record(5);
+    StatsWriter w(StatsWriter::Format_Prometheus);
+    gLatency.collectStats(w);
+    CPPUNIT_ASSERT(w.str().find("fasttun_latency_kcp_to_tcp_count 1\n") != std::string::npos);
+    gStats.add(&gLatency);
+    std::string resp = StatsServer::buildResponse("GET /reset HTTP/1.1\r\n\r\n");
+    CPPUNIT_ASSERT(resp.compare(0, 15, "HTTP/1.0 405 Me") == 0);
+    CPPUNIT_ASSERT(1 == gLatency.kcpToTcp.count());
+    resp = StatsServer::buildResponse("POST /reset HTTP/1.1\r\n\r\n");
+    CPPUNIT_ASSERT(resp.compare(0, 15, "HTTP/1.0 200 OK") == 0);
+    CPPUNIT_ASSERT(0 == gLatency.kcpToTcp.count());
+
+    // 分位数清零, 累计的总和与样本数照常导出为计数器
+    StatsWriter after(StatsWriter::Format_Prometheus);
+    gLatency.collectStats(after);
+    CPPUNIT_ASSERT(after.str().find("fasttun_latency_kcp_to_tcp_count 1\n") != std::string::npos);
+    CPPUNIT_ASSERT(after.str().find("fasttun_latency_kcp_to_tcp_max_us 0\n") != std::string::npos);
+    gStats.remove(&gLatency);
+}
+
+struct ProfileOuter {};
+struct ProfileInner {};
+
+static void profileSpin(uint64 stamps)
+{
+    uint64 start = core::getTimeStamp();
+    while (core::getTimeStamp()-start < stamps) {}
+}
+
+void UTest::testLoopProfiler()
+{
+    // 关闭时不记录
+    {
+        LoopProfiler::Scope scope(LoopProfiler::Site_Read, typeid(ProfileOuter), 3);
+    }
+    uint64 busy = 0, calls = 0;
+    CPPUNIT_ASSERT(!gLoopProfiler.getHandler(typeid(ProfileOuter).name(), busy, calls));
+
+    // 嵌套回调只计自身耗时, 内层的会话号和桥接对象带到外层的慢回调日志中
+    gLoopProfiler.setSlowThreshold(1);
+    uint64 ms = core::stampsPerSecond()/1000;
+    uint64 slow = gLoopProfiler.slowCount();
+    {
+        LoopProfiler::Scope outer(LoopProfiler::Site_Read, typeid(ProfileOuter), 3);
+        profileSpin(ms/2);
+        {
+            LoopProfiler::Scope inner(LoopProfiler::Site_KcpUpdate, typeid(ProfileInner));
+            gLoopProfiler.noteConv(42);
+            gLoopProfiler.noteBridge(this);
+            profileSpin(2*ms);
+        }
+    }
+    CPPUNIT_ASSERT(gLoopProfiler.slowCount() == slow+2);
+
+    uint64 innerBusy = 0;
+    CPPUNIT_ASSERT(gLoopProfiler.getHandler(typeid(ProfileInner).name(), innerBusy, calls));
+    CPPUNIT_ASSERT(1 == calls && innerBusy >= 2*ms);
+    CPPUNIT_ASSERT(gLoopProfiler.getHandler(typeid(ProfileOuter).name(), busy, calls));
+    CPPUNIT_ASSERT(1 == calls && busy >= ms/2 && busy < ms+ms/2);
+
+    StatsWriter w(StatsWriter::Format_Prometheus);
+    gLoopProfiler.collectStats(w);
+    std::string text = w.str();
+    CPPUNIT_ASSERT(text.find("fasttun_loop_handler_calls{handler=\"ProfileInner\"} 1\n") != std::string::npos);
+    CPPUNIT_ASSERT(text.find("fasttun_loop_site_calls{site=\"kcp_update\"} 1\n") != std::string::npos);
+
+    gLoopProfiler.resetStats();
+    CPPUNIT_ASSERT(!gLoopProfiler.getHandler(typeid(ProfileInner).name(), busy, calls));
+    gLoopProfiler.setSlowThreshold(0);
+}
+
+void UTest::testLossyLink()
+{
+    static const int PACKETS = 100000;
+    std::string pkt;
+
+    // 无损链路: 按序在单向时延后到达
+    LinkProfile clean = linkprofile::Clean;
+    LossyLink link(clean);
+    for (uint32 i = 0; i < 100; ++i)
+        link.send(&i, sizeof(i), i);
+    uint32 when = 0;
+    CPPUNIT_ASSERT(link.nextArrival(when) && when == clean.rtt/2);
+    CPPUNIT_ASSERT(!link.recv(pkt, clean.rtt/2-1));
+    for (uint32 i = 0; i < 100; ++i)
+    {
+        CPPUNIT_ASSERT(link.recv(pkt, i+clean.rtt/2));
+        CPPUNIT_ASSERT(pkt.size() == sizeof(i) && memcmp(pkt.data(), &i, sizeof(i)) == 0);
+    }
+    CPPUNIT_ASSERT(0 == link.inFlight());
+
+    // 独立丢包与突发丢包的比例, 同一种子结果相同
+    LinkProfile lossy = clean;
+    lossy.loss = 0.05;
+    LinkProfile burst = clean;
+    burst.burstEnter = 0.01;
+    burst.burstExit = 0.2;
+    burst.burstLoss = 1;
+    LossyLink l1(lossy, 7), l2(lossy, 7), b(burst, 7);
+    for (int i = 0; i < PACKETS; ++i)
+    {
+        l1.send(&i, sizeof(i), 0);
+        l2.send(&i, sizeof(i), 0);
+        b.send(&i, sizeof(i), 0);
+    }
+    CPPUNIT_ASSERT(l1.stats().dropped == l2.stats().dropped);
+    CPPUNIT_ASSERT(l1.stats().dropped > PACKETS*0.045 && l1.stats().dropped < PACKETS*0.055);
+    // 稳态坏状态占比 enter/(enter+exit)
+    CPPUNIT_ASSERT(b.stats().dropped > PACKETS*0.04 && b.stats().dropped < PACKETS*0.055);
+
+    // 瓶颈带宽: 100KB/s 下每个1000字节的包占10ms, 队列满后尾部丢弃
+    LinkProfile slow = clean;
+    slow.bandwidth = 100*1000;
+    slow.queueLimit = 10*1000;
+    LossyLink s(slow);
+    char data[1000] = {0};
+    for (int i = 0; i < 20; ++i)
+        s.send(data, sizeof(data), 0);
+    CPPUNIT_ASSERT(s.stats().queueDropped == 9);
+    CPPUNIT_ASSERT(s.nextArrival(when) && when == 10+clean.rtt/2);
+    int got = 0;
+    while (s.recv(pkt, 110+clean.rtt/2))
+        ++got;
+    CPPUNIT_ASSERT(11 == got);
+
+    // 乱序和重复
+    LinkProfile messy = clean;
+    messy.reorder = 0.1;
+    messy.reorderDelay = 5;
+    messy.duplicate = 0.1;
+    LossyLink m(messy, 3);
+    for (uint32 i = 0; i < 1000; ++i)
+        m.send(&i, sizeof(i), i);
+    uint32 last = 0, inversions = 0, delivered = 0;
+    while (m.recv(pkt, 1000000))
+    {
+        uint32 v = 0;
+        memcpy(&v, pkt.data(), sizeof(v));
+        if (v < last)
+            ++inversions;
+        last = v;
+        ++delivered;
+    }
+    CPPUNIT_ASSERT(inversions > 0);
+    CPPUNIT_ASSERT(delivered == 1000+m.stats().duplicated && m.stats().duplicated > 0);
+}
+
+struct HibernateSink : public KcpTunnelHandler
+{
+    std::string data;
+    int recvs;
+
+    HibernateSink() : data(), recvs(0) {}
+
+    virtual void onRecv(const void *p, size_t len)
+    {
+        data.append((const char *)p, len);
+        ++recvs;
+    }
+};
+
+// 其他用例把 gTimerWheel 推到了将来的时刻, 这里直接驱动 update
+struct HibernatePair
+{
+    EventPoller *poller;
+    KcpTunnel<false> *cli;
+    KcpTunnel<true> *svr;
+
+    bool pump(const HibernateSink &sink, const char *text)
+    {
+        ulong start = getMonoClock();
+        while (sink.data != text && getMonoClock()-start < 3000)
+            _step();
+        return sink.data == text;
+    }
+
+    bool hibernate()
+    {
+        // 对方的ACK到达、本端的ACK发出后才能休眠
+        ulong start = getMonoClock();
+        while (!(cli->hibernate() | cli->isHibernated()) || !(svr->hibernate() | svr->isHibernated()))
+        {
+            if (getMonoClock()-start >= 3000)
+                return false;
+            _step();
+        }
+        return true;
+    }
+
+    void _step()
+    {
+        poller->processPendingEvents(0.005);
+        cli->update(getMonoClock());
+        svr->update(getMonoClock());
+    }
+};
+
+void UTest::testKcpHibernate()
+{
+    EventPoller *poller = new EpollPoller();
+    sockaddr_in addr;
+    CPPUNIT_ASSERT(core::str2Ipv4("127.0.0.1:25443", addr));
+    KcpTunnelGroup<true> svrGroup(poller);
+    KcpTunnelGroup<false> cliGroup(poller);
+    CPPUNIT_ASSERT(svrGroup.create((const SA *)&addr, sizeof(addr)));
+    CPPUNIT_ASSERT(cliGroup.create((const SA *)&addr, sizeof(addr)));
+
+    HibernatePair pair = {poller,
+                          static_cast<KcpTunnel<false> *>(cliGroup.createTunnel(7)),
+                          static_cast<KcpTunnel<true> *>(svrGroup.createTunnel(7))};
+    HibernateSink svrSink, cliSink;
+    pair.svr->setEventHandler(&svrSink);
+    pair.cli->setEventHandler(&cliSink);
+
+    // 有数据在途时不能休眠
+    pair.cli->send("hello", 5);
+    CPPUNIT_ASSERT(!pair.cli->hibernate());
+    CPPUNIT_ASSERT(pair.pump(svrSink, "hello"));
+    pair.svr->send("world", 5);
+    CPPUNIT_ASSERT(pair.pump(cliSink, "world"));
+
+    CPPUNIT_ASSERT(pair.hibernate());
+    CPPUNIT_ASSERT(0 == pair.cli->getCachedSize() && 0 == pair.svr->getCachedSize());
+
+    // 收发数据时唤醒, 序号接着休眠前的继续
+    pair.cli->send("again", 5);
+    CPPUNIT_ASSERT(!pair.cli->isHibernated());
+    CPPUNIT_ASSERT(pair.pump(svrSink, "helloagain"));
+    CPPUNIT_ASSERT(!pair.svr->isHibernated());
+    pair.svr->send("back", 4);
+    CPPUNIT_ASSERT(pair.pump(cliSink, "worldback"));
+
+    cliGroup.shutdown();
+    svrGroup.shutdown();
+    delete poller;
+}
+
+void UTest::testKcpStream()
+{
+    EventPoller *poller = new EpollPoller();
+    sockaddr_in addr;
+    CPPUNIT_ASSERT(core::str2Ipv4("127.0.0.1:25444", addr));
+    KcpTunnelGroup<true> svrGroup(poller);
+    KcpTunnelGroup<false> cliGroup(poller);
+    CPPUNIT_ASSERT(svrGroup.create((const SA *)&addr, sizeof(addr)));
+    CPPUNIT_ASSERT(cliGroup.create((const SA *)&addr, sizeof(addr)));
+    KcpArg arg = kcpmode::Fast3;
+    arg.stream = 1;
+    cliGroup.setKcpMode(arg);
+
+    HibernatePair pair = {poller,
+                          static_cast<KcpTunnel<false> *>(cliGroup.createTunnel(8)),
+                          static_cast<KcpTunnel<true> *>(svrGroup.createTunnel(8))};
+    HibernateSink svrSink, cliSink;
+    pair.svr->setEventHandler(&svrSink);
+    pair.cli->setEventHandler(&cliSink);
+
+    // 小块写入合并成一个分片, 对端一次收到
+    std::string expect;
+    for (int i = 0; i < 100; ++i)
+    {
+        pair.cli->send("0123456789", 10);
+        expect.append("0123456789");
+    }
+    CPPUNIT_ASSERT(1000 == pair.cli->getCachedSize());
+    CPPUNIT_ASSERT(pair.pump(svrSink, expect.c_str()));
+    CPPUNIT_ASSERT(1 == svrSink.recvs);
+
+    // 跨越尾部的大块写入按整MSS切分, 数据保持原样
+    std::string big(3000, 'x');
+    for (size_t i = 0; i < big.size(); ++i)
+        big[i] = (char)('a'+i%26);
+    pair.cli->send("tail", 4);
+    pair.cli->send(big.data(), big.size());
+    expect += "tail"+big;
+    CPPUNIT_ASSERT(pair.pump(svrSink, expect.c_str()));
+
+    // 对端仍是消息模式
+    pair.svr->send("a", 1);
+    pair.svr->send("b", 1);
+    CPPUNIT_ASSERT(pair.pump(cliSink, "ab"));
+    CPPUNIT_ASSERT(2 == cliSink.recvs);
+
+    cliGroup.shutdown();
+    svrGroup.shutdown();
+    delete poller;
+}
+
+// 按 ikcp_encode 的小端格式拼一个分片
+static std::string kcpSegment(uint32 conv, uint8 cmd, uint32 sn, const char *payload, uint32 len)
+{
+    char hdr[24];
+    uint16 wnd = 128;
+    uint32 ts = 0, una = 0;
+    memcpy(hdr, &conv, 4);
+    hdr[4] = (char)cmd;
+    hdr[5] = 0;
+    memcpy(hdr+6, &wnd, 2);
+    memcpy(hdr+8, &ts, 4);
+    memcpy(hdr+12, &sn, 4);
+    memcpy(hdr+16, &una, 4);
+    memcpy(hdr+20, &len, 4);
+    return std::string(hdr, sizeof(hdr))+std::string(payload, len);
+}
+
+void UTest::testKcpAckDelay()
+{
+    // 纯ACK报文可以附带窗口通知, 含数据分片的不算
+    std::string acks = kcpSegment(1, 82, 0, "", 0)+kcpSegment(1, 82, 1, "", 0);
+    CPPUNIT_ASSERT(kcpAckOnly(acks.data(), acks.size()));
+    CPPUNIT_ASSERT(kcpAckOnly((acks+kcpSegment(1, 84, 0, "", 0)).c_str(), acks.size()+24));
+    CPPUNIT_ASSERT(!kcpAckOnly((acks+kcpSegment(1, 81, 2, "x", 1)).c_str(), acks.size()+25));
+    CPPUNIT_ASSERT(!kcpAckOnly(kcpSegment(1, 84, 0, "", 0).c_str(), 24));
+    CPPUNIT_ASSERT(!kcpAckOnly(acks.data(), acks.size()-1));
+
+    EventPoller *poller = new EpollPoller();
+    sockaddr_in addr;
+    CPPUNIT_ASSERT(core::str2Ipv4("127.0.0.1:25445", addr));
+    KcpTunnelGroup<true> svrGroup(poller);
+    KcpTunnelGroup<false> cliGroup(poller);
+    CPPUNIT_ASSERT(svrGroup.create((const SA *)&addr, sizeof(addr)));
+    CPPUNIT_ASSERT(cliGroup.create((const SA *)&addr, sizeof(addr)));
+    // 接收端的 interval 和 ackdelay 都足够长, 期间的ACK只能由空洞触发
+    KcpArg arg = kcpmode::Fast3;
+    arg.interval = 5000;
+    arg.ackdelay = 1000;
+    svrGroup.setKcpMode(arg);
+
+    HibernatePair pair = {poller,
+                          static_cast<KcpTunnel<false> *>(cliGroup.createTunnel(9)),
+                          static_cast<KcpTunnel<true> *>(svrGroup.createTunnel(9))};
+    HibernateSink svrSink, cliSink;
+    pair.svr->setEventHandler(&svrSink);
+    pair.cli->setEventHandler(&cliSink);
+
+    // 顺序到达的数据先交付, ACK推迟
+    pair.cli->send("a", 1);
+    CPPUNIT_ASSERT(pair.pump(svrSink, "a"));
+    for (int i = 0; i < 10; ++i)
+        pair._step();
+    CPPUNIT_ASSERT(0 == pair.cli->ackPacketsRecv());
+    CPPUNIT_ASSERT(pair.svr->packetsRecv() > 0 && 0 == pair.svr->ackPacketsRecv());
+
+    // 跳号的分片留下空洞, 攒下的ACK立即发出, 对端据此快速重传
+    std::string hole = kcpSegment(9, 81, 5, "f", 1);
+    CPPUNIT_ASSERT(pair.svr->input(hole.data(), hole.size()));
+    pair.svr->flushInput(getMonoClock());
+    ulong start = getMonoClock();
+    while (0 == pair.cli->ackPacketsRecv() && getMonoClock()-start < 1000)
+        poller->processPendingEvents(0.005);
+    CPPUNIT_ASSERT(pair.cli->ackPacketsRecv() > 0);
+    CPPUNIT_ASSERT("a" == svrSink.data);
+
+    cliGroup.shutdown();
+    svrGroup.shutdown();
+    delete poller;
+}
+
+static int sackOutput(const char *buf, int len, ikcpcb *kcp, void *user)
+{
+    ((std::vector<std::string> *)user)->push_back(std::string(buf, len));
+    return 0;
+}
+
+// 把 wire 上的数据报交给 kcp, 跳过第 drop 个, 交付后清空
+static void sackDeliver(std::vector<std::string> &wire, ikcpcb *kcp, int drop = -1)
+{
+    for (size_t i = 0; i < wire.size(); ++i)
+    {
+        if ((int)i != drop)
+            ikcp_input(kcp, wire[i].data(), wire[i].size());
+    }
+    wire.clear();
+}
+
+static ikcpcb* sackCreate(std::vector<std::string> *wire, int sack)
+{
+    ikcpcb *kcp = ikcp_create(1, wire);
+    kcp->output = sackOutput;
+    ikcp_nodelay(kcp, 1, 10, 2, 1);
+    ikcp_sack(kcp, sack);
+    ikcp_update(kcp, 0);
+    return kcp;
+}
+
+void UTest::testKcpSack()
+{
+    char data[1000];
+    memset(data, 0, sizeof(data));
+    std::vector<std::string> ab, ba;
+    ikcpcb *a = sackCreate(&ab, 1), *b = sackCreate(&ba, 1);
+
+    // 发送端随数据通告能力, 接收端随后只回一个不带区间的SACK
+    for (int i = 0; i < 4; ++i)
+        ikcp_send(a, data, sizeof(data));
+    ikcp_flush(a);
+    sackDeliver(ab, b);
+    ikcp_flush(b);
+    CPPUNIT_ASSERT(1 == ba.size() && 24 == ba[0].size() && 85 == (uint8)ba[0][4]);
+    sackDeliver(ba, a);
+    CPPUNIT_ASSERT(0 == a->nsnd_buf && 4 == b->rcv_nxt);
+
+    // 丢掉 sn=5: 一个区间确认 6,7, sn=5 攒够 fastack 后快速重传
+    for (int i = 0; i < 4; ++i)
+        ikcp_send(a, data, sizeof(data));
+    ikcp_flush(a);
+    CPPUNIT_ASSERT(4 == ab.size());
+    sackDeliver(ab, b, 1);
+    ikcp_flush(b);
+    CPPUNIT_ASSERT(1 == ba.size() && 28 == ba[0].size());
+    sackDeliver(ba, a);
+    CPPUNIT_ASSERT(1 == a->nsnd_buf);
+    ikcp_flush(a);
+    CPPUNIT_ASSERT(1 == ab.size());
+    sackDeliver(ab, b);
+    ikcp_flush(b);
+    sackDeliver(ba, a);
+    CPPUNIT_ASSERT(0 == a->nsnd_buf && 8 == b->rcv_nxt);
+    ikcp_release(a);
+    ikcp_release(b);
+
+    // 对端是旧版本: 一直逐个ACK, 收到ACK后不再附带能力通告
+    a = sackCreate(&ab, 1);
+    b = sackCreate(&ba, 0);
+    ikcp_send(a, data, sizeof(data));
+    ikcp_flush(a);
+    CPPUNIT_ASSERT(1 == ab.size() && 24+24+sizeof(data) == ab[0].size());
+    sackDeliver(ab, b);
+    ikcp_flush(b);
+    CPPUNIT_ASSERT(1 == ba.size() && 82 == (uint8)ba[0][4] && 0 == ba[0][5]);
+    sackDeliver(ba, a);
+    ikcp_send(a, data, sizeof(data));
+    ikcp_flush(a);
+    CPPUNIT_ASSERT(1 == ab.size() && 24+sizeof(data) == ab[0].size());
+    sackDeliver(ab, b);
+    ikcp_flush(b);
+    CPPUNIT_ASSERT(1 == ba.size() && 82 == (uint8)ba[0][4]);
+    ikcp_release(a);
+    ikcp_release(b);
+}
+
+void UTest::testKcpCompact()
+{
+    // 各种分片组合往返不变, 序号和时间戳可以回退
+    std::string dgrams[] = {
+        kcpSegment(7, 82, 99, "", 0)+kcpSegment(7, 81, 3000000000u, "hello", 5),
+        kcpSegment(7, 81, 10, "a", 1)+kcpSegment(7, 81, 11, "bb", 2)+kcpSegment(7, 81, 9, "ccc", 3),
+        kcpSegment(7, 85, 40, "\x01\x00\x02\x00", 4)+kcpSegment(7, 84, 0, "", 0),
+        kcpSegment(0xfff12345, 81, 1, std::string(1376, 'x').c_str(), 1376),
+    };
+    dgrams[1][5] = 2; // frg
+    dgrams[1][8] = 100; // ts
+    char enc[2048], dec[4096];
+    for (size_t i = 0; i < sizeof(dgrams)/sizeof(dgrams[0]); ++i)
+    {
+        const std::string &d = dgrams[i];
+        CPPUNIT_ASSERT(!ikcp_is_compact(d.data(), d.size()));
+        long enclen = ikcp_encode_compact(d.data(), d.size(), enc);
+        CPPUNIT_ASSERT(enclen > 0 && enclen < (long)d.size());
+        CPPUNIT_ASSERT(ikcp_is_compact(enc, enclen) && 0 == memcmp(enc, d.data(), 4));
+        CPPUNIT_ASSERT(ikcp_decode_compact(enc, enclen, dec, sizeof(dec)) == (long)d.size());
+        CPPUNIT_ASSERT(0 == memcmp(dec, d.data(), d.size()));
+
+        // 截断或输出空间不够时报错
+        CPPUNIT_ASSERT(ikcp_decode_compact(enc, enclen-1, dec, sizeof(dec)) < 0);
+        CPPUNIT_ASSERT(ikcp_decode_compact(enc, enclen, dec, d.size()-1) < 0);
+    }
+
+    // 一端开启即可发出紧凑包头, 对端按数据报识别
+    EventPoller *poller = new EpollPoller();
+    sockaddr_in addr;
+    CPPUNIT_ASSERT(core::str2Ipv4("127.0.0.1:25446", addr));
+    KcpTunnelGroup<true> svrGroup(poller);
+    KcpTunnelGroup<false> cliGroup(poller);
+    CPPUNIT_ASSERT(svrGroup.create((const SA *)&addr, sizeof(addr)));
+    CPPUNIT_ASSERT(cliGroup.create((const SA *)&addr, sizeof(addr)));
+    KcpArg arg = kcpmode::Fast3;
+    arg.pmtud = 0;
+    cliGroup.setKcpMode(arg);
+    arg.compact = 0;
+    svrGroup.setKcpMode(arg);
+
+    HibernatePair pair = {poller,
+                          static_cast<KcpTunnel<false> *>(cliGroup.createTunnel(10)),
+                          static_cast<KcpTunnel<true> *>(svrGroup.createTunnel(10))};
+    HibernateSink svrSink, cliSink;
+    pair.svr->setEventHandler(&svrSink);
+    pair.cli->setEventHandler(&cliSink);
+    CPPUNIT_ASSERT((ITunnel::Feature_CompactHeader | ITunnel::Feature_Tuning) == pair.cli->getFeatures() &&
+                   ITunnel::Feature_Tuning == pair.svr->getFeatures());
+    pair.cli->setPeerFeatures(ITunnel::Feature_CompactHeader);
+    pair.svr->setPeerFeatures(ITunnel::Feature_CompactHeader);
+    CPPUNIT_ASSERT(pair.cli->isCompactHeader() && !pair.svr->isCompactHeader());
+
+    pair.cli->send("ping", 4);
+    CPPUNIT_ASSERT(pair.pump(svrSink, "ping"));
+    pair.svr->send("pong", 4);
+    CPPUNIT_ASSERT(pair.pump(cliSink, "pong"));
+
+    cliGroup.shutdown();
+    svrGroup.shutdown();
+    delete poller;
+}
+
+// 模拟一条路径: 不超过 pathMtu 的探测有应答, 超过 localMtu 的在本地发送时报 EMSGSIZE
+static uint32 runProber(PathMtuProber &prober, uint32 &now, uint32 pathMtu, uint32 localMtu)
+{
+    uint32 probes = 0;
+    uint32 size = 0, id = 0;
+    for (int i = 0; i < 100000 && (prober.isSearching() || 0 == probes); ++i, now += 10)
+    {
+        if (!prober.poll(now, size, id))
+            continue;
+        ++probes;
+        if (size > localMtu)
+            prober.onTooBig(size);
+        else if (size <= pathMtu)
+            prober.onAck(id);
+    }
+    return probes;
+}
+
+void UTest::testPathMtu()
+{
+    // 二分查找停在路径MTU以下一个步长内, 超时的大小各重试 MAX_PROBES 次
+    PathMtuProber prober;
+    uint32 now = 0;
+    prober.start(1400, now);
+    CPPUNIT_ASSERT(prober.isSearching() && 0 == prober.mtu());
+    runProber(prober, now, 1252, 65535);
+    CPPUNIT_ASSERT(!prober.isSearching());
+    CPPUNIT_ASSERT(prober.mtu() <= 1252 && prober.mtu()+PathMtuProber::SEARCH_STEP > 1252);
+    CPPUNIT_ASSERT(prober.probesLost() > 0 && prober.probesLost()%PathMtuProber::MAX_PROBES == 0);
+
+    // 查找结束后不再探测, 到期后重新查找, 路径变小时跟着变小
+    uint32 size = 0, id = 0;
+    CPPUNIT_ASSERT(!prober.poll(now+PathMtuProber::RAISE_INTERVAL/2, size, id));
+    now += PathMtuProber::RAISE_INTERVAL;
+    CPPUNIT_ASSERT(prober.poll(now, size, id) && prober.mtu() == 0 && size > 1244);
+    prober.onAck(id-1); // 过期的应答
+    CPPUNIT_ASSERT(prober.isSearching());
+    runProber(prober, now, 1000, 65535);
+    CPPUNIT_ASSERT(prober.mtu() <= 1000 && prober.mtu()+PathMtuProber::SEARCH_STEP > 1000);
+
+    // 本地报 EMSGSIZE 的大小不等超时
+    PathMtuProber local;
+    now = 0;
+    local.start(1400, now);
+    runProber(local, now, 65535, 1500);
+    CPPUNIT_ASSERT(local.mtu() <= 1500 && local.mtu()+PathMtuProber::SEARCH_STEP > 1500);
+    CPPUNIT_ASSERT(0 == local.probesLost());
+
+    // 没有任何应答时结束查找, mtu 为0
+    PathMtuProber blackhole;
+    blackhole.start(1400, 0);
+    now = 0;
+    CPPUNIT_ASSERT(runProber(blackhole, now, 0, 65535) < 10*PathMtuProber::MAX_PROBES);
+    CPPUNIT_ASSERT(!blackhole.isSearching() && 0 == blackhole.mtu());
+
+    // 探测包填充到探测大小, 应答只有包头, 普通kcp分片不会被识别为探测
+    char buf[PathMtuProber::MAX_MTU];
+    uint8 cmd = 0;
+    CPPUNIT_ASSERT(PathMtuProber::buildProbe(buf, 9, 5, 600) == 600);
+    CPPUNIT_ASSERT(PathMtuProber::parse(buf, 600, cmd, id, size));
+    CPPUNIT_ASSERT(PathMtuProber::CMD_PROBE == cmd && 5 == id && 600 == size);
+    IUINT32 conv = 0;
+    CPPUNIT_ASSERT(ikcp_get_conv(buf, 600, &conv) && 9 == conv && !ikcp_is_compact(buf, 600));
+    CPPUNIT_ASSERT(PathMtuProber::buildAck(buf, 9, 5, 600) == PathMtuProber::HEADER_SIZE);
+    CPPUNIT_ASSERT(PathMtuProber::parse(buf, PathMtuProber::HEADER_SIZE, cmd, id, size));
+    CPPUNIT_ASSERT(PathMtuProber::CMD_PROBE_ACK == cmd && 5 == id && 600 == size);
+    std::string seg = kcpSegment(9, 81, 1, "data", 4);
+    CPPUNIT_ASSERT(!PathMtuProber::parse(seg.data(), seg.size(), cmd, id, size));
+
+    // 回环上双方都开启时探测到上限, kcp的mtu随之调大
+    EventPoller *poller = new EpollPoller();
+    sockaddr_in addr;
+    CPPUNIT_ASSERT(core::str2Ipv4("127.0.0.1:25447", addr));
+    KcpTunnelGroup<true> svrGroup(poller);
+    KcpTunnelGroup<false> cliGroup(poller);
+    CPPUNIT_ASSERT(svrGroup.create((const SA *)&addr, sizeof(addr)));
+    CPPUNIT_ASSERT(cliGroup.create((const SA *)&addr, sizeof(addr)));
+
+    HibernatePair pair = {poller,
+                          static_cast<KcpTunnel<false> *>(cliGroup.createTunnel(11)),
+                          static_cast<KcpTunnel<true> *>(svrGroup.createTunnel(11))};
+    HibernateSink svrSink, cliSink;
+    pair.svr->setEventHandler(&svrSink);
+    pair.cli->setEventHandler(&cliSink);
+    CPPUNIT_ASSERT(pair.cli->getFeatures() & ITunnel::Feature_PathMtu);
+    pair.cli->setPeerFeatures(pair.svr->getFeatures());
+    pair.svr->setPeerFeatures(pair.cli->getFeatures());
+    CPPUNIT_ASSERT(1400 == pair.cli->mtu());
+
+    pair.cli->send("ping", 4);
+    CPPUNIT_ASSERT(pair.pump(svrSink, "ping"));
+    ulong start = getMonoClock();
+    while ((pair.cli->pathMtu().isSearching() || pair.svr->pathMtu().isSearching()) &&
+           getMonoClock()-start < 3000)
+    {
+        pair._step();
+    }
+    CPPUNIT_ASSERT(pair.cli->mtu()+PathMtuProber::SEARCH_STEP > PathMtuProber::MAX_MTU);
+    CPPUNIT_ASSERT(pair.svr->mtu()+PathMtuProber::SEARCH_STEP > PathMtuProber::MAX_MTU);
+
+    std::string big(6000, 'm');
+    pair.svr->send(big.data(), big.size());
+    CPPUNIT_ASSERT(pair.pump(cliSink, big.c_str()));
+
+    cliGroup.shutdown();
+    svrGroup.shutdown();
+    delete poller;
+}
+
+void UTest::testKcpRetune()
+{
+    KcpArg arg;
+    CPPUNIT_ASSERT(kcpmode::byName("Bulk", arg) && 128 == arg.sndwnd && 1 == arg.stream);
+    CPPUNIT_ASSERT(kcpmode::byName("interactive", arg) && 0 == arg.ackdelay);
+    CPPUNIT_ASSERT(!kcpmode::byName("turbo", arg));
+
+    EventPoller *poller = new EpollPoller();
+    sockaddr_in addr;
+    CPPUNIT_ASSERT(core::str2Ipv4("127.0.0.1:25448", addr));
+    KcpTunnelGroup<true> svrGroup(poller);
+    KcpTunnelGroup<false> cliGroup(poller);
+    CPPUNIT_ASSERT(svrGroup.create((const SA *)&addr, sizeof(addr)));
+    CPPUNIT_ASSERT(cliGroup.create((const SA *)&addr, sizeof(addr)));
+
+    HibernatePair pair = {poller,
+                          static_cast<KcpTunnel<false> *>(cliGroup.createTunnel(12)),
+                          static_cast<KcpTunnel<true> *>(svrGroup.createTunnel(12))};
+    HibernateSink svrSink, cliSink;
+    pair.svr->setEventHandler(&svrSink);
+    pair.cli->setEventHandler(&cliSink);
+    CPPUNIT_ASSERT(pair.cli->getFeatures() & ITunnel::Feature_Tuning);
+    pair.cli->send("hello", 5);
+    CPPUNIT_ASSERT(pair.pump(svrSink, "hello"));
+
+    // 只改可调字段, 超出范围的截断
+    arg = kcpmode::Bulk;
+    arg.interval = 1;
+    arg.sndwnd = 100000;
+    arg.rcvwnd = 4;
+    arg.minrto = 20;
+    arg.mtu = 500;
+    pair.svr->retune(arg);
+    const KcpArg &tuned = pair.svr->getKcpArg();
+    CPPUNIT_ASSERT(0 == tuned.nodelay && 10 == tuned.interval && 2 == tuned.resend);
+    CPPUNIT_ASSERT(1024 == tuned.sndwnd && 32 == tuned.rcvwnd && 20 == tuned.minrto);
+    CPPUNIT_ASSERT(1400 == tuned.mtu && 0 == tuned.stream);
+
+    // 调整后的管道照常收发
+    std::string big(600*1024, 'r');
+    pair.svr->send(big.data(), big.size());
+    CPPUNIT_ASSERT(pair.pump(cliSink, big.c_str()));
+
+    // 休眠中调整的参数在唤醒后生效
+    CPPUNIT_ASSERT(pair.hibernate());
+    pair.cli->retune(kcpmode::Interactive);
+    CPPUNIT_ASSERT(pair.cli->isHibernated() && 10 == pair.cli->getKcpArg().minrto);
+    svrSink.data.clear();
+    pair.cli->send("again", 5);
+    CPPUNIT_ASSERT(!pair.cli->isHibernated() && 64 == pair.cli->getKcpArg().rcvwnd);
+    CPPUNIT_ASSERT(pair.pump(svrSink, "again"));
+
+    cliGroup.shutdown();
+    svrGroup.shutdown();
+    delete poller;
+}
+
+struct ArenaSink : public Connection::Handler
+{
+    std::vector<size_t> reads;
+
+    virtual void onRecv(Connection *pConn, const void *data, size_t datalen)
+    {
+        reads.push_back(datalen);
+        // 回调中嵌套的取用不能覆盖正在交付的数据
+        char *nested = gRecvArena.acquire(16);
+        CPPUNIT_ASSERT(nested >= (const char *)data+datalen);
+        gRecvArena.release(nested);
+    }
+};
+
+void UTest::testRecvArena()
+{
+    // 按栈的方式分配, 空间不够时临时分配
+    RecvArena arena(1024);
+    char *a = arena.acquire(512);
+    char *b = arena.acquire(256);
+    CPPUNIT_ASSERT(b == a+512 && 768 == arena.used());
+    char *c = arena.acquire(512);
+    CPPUNIT_ASSERT(1 == arena.fallbacks());
+    memset(c, 0, 512);
+    arena.release(c);
+    arena.release(b);
+    CPPUNIT_ASSERT(512 == arena.used());
+    arena.release(a);
+    CPPUNIT_ASSERT(0 == arena.used() && arena.acquire(1024) == a);
+    arena.release(a);
+
+    // 一次读事件的数据整块交付, 单次读取长度随数据量放大和缩小
+    int sv[2];
+    CPPUNIT_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    core::setNonblocking(sv[0]);
+    core::setNonblocking(sv[1]);
+    EventPoller *poller = new EpollPoller();
+    ArenaSink sink;
+    Connection conn(poller);
+    conn.setEventHandler(&sink);
+    CPPUNIT_ASSERT(conn.acceptConnection(sv[0]));
+    size_t initSize = conn.getReadSize();
+
+    static char data[48*1024]; // 不超过单次读事件的读取上限
+    CPPUNIT_ASSERT(send(sv[1], data, sizeof(data), 0) == (int)sizeof(data));
+    conn.handleInputNotification(sv[0]);
+    CPPUNIT_ASSERT(1 == sink.reads.size() && sizeof(data) == sink.reads[0]);
+    CPPUNIT_ASSERT(conn.getReadSize() >= sizeof(data));
+    CPPUNIT_ASSERT(0 == gRecvArena.used());
+
+    for (int i = 0; i < 8; ++i)
+    {
+        CPPUNIT_ASSERT(send(sv[1], data, 100, 0) == 100);
+        conn.handleInputNotification(sv[0]);
+    }
+    CPPUNIT_ASSERT(conn.getReadSize() < initSize);
+
+    conn.shutdown();
+    close(sv[1]);
+    delete poller;
+}
+
+void UTest::testReadBudget()
+{
+    // 一次读事件最多读 budget 字节, 剩下的留给下一次事件
+    static const size_t BUDGET = 16*1024;
+    Connection::setReadBudget(BUDGET);
+
+    int sv[2];
+    CPPUNIT_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    core::setNonblocking(sv[0]);
+    core::setNonblocking(sv[1]);
+    EventPoller *poller = new EpollPoller();
+    ArenaSink sink;
+    Connection conn(poller);
+    conn.setEventHandler(&sink);
+    CPPUNIT_ASSERT(conn.acceptConnection(sv[0]));
+
+    static char data[100*1024];
+    CPPUNIT_ASSERT(send(sv[1], data, sizeof(data), 0) == (int)sizeof(data));
+    size_t total = 0;
+    for (int i = 0; i < 16 && total < sizeof(data); ++i)
+    {
+        size_t before = sink.reads.size();
+        conn.handleInputNotification(sv[0]);
+        CPPUNIT_ASSERT(sink.reads.size() == before+1 && sink.reads.back() <= BUDGET);
+        total += sink.reads.back();
+    }
+    CPPUNIT_ASSERT(sizeof(data) == total && conn.getReadSize() <= BUDGET);
+
+    // 事件之间处理到期的定时器
+    TimerWheel wheel;
+    WheelProbe probe;
+    uint32 now = getMonoClock();
+    wheel.process(now-10);
+    wheel.schedule(&probe.timer, now-5);
+    poller->setTimerWheel(&wheel);
+    CPPUNIT_ASSERT(send(sv[1], data, 100, 0) == 100);
+    poller->processPendingEvents(0.01);
+    CPPUNIT_ASSERT(1 == probe.fired);
+    poller->setTimerWheel(NULL);
+
+    conn.shutdown();
+    close(sv[1]);
+    delete poller;
+    Connection::setReadBudget(Connection::DEFAULT_READ_BUDGET);
+}
+
+struct FastSink : public FastConnection::Handler
+{
+    std::string data;
+    int congested;
+    int drained;
+
+    FastSink() : data(), congested(0), drained(0) {}
+
+    virtual void onRecv(FastConnection *pConn, const void *p, size_t len)
+    {
+        data.append((const char *)p, len);
+    }
+    virtual void onCongested(FastConnection *pConn)
+    {
+        ++congested;
+    }
+    virtual void onDrained(FastConnection *pConn)
+    {
+        ++drained;
+    }
+};
+
+// 同一事件循环中的客户端/服务端FastConnection. 服务端经 Listener 接受连接, 断开的连接回收进对象池,
+// 与 tun-svr 复用桥接对象的方式相同. 其他用例把 gTimerWheel 推到了将来的时刻, 这里直接驱动kcp
+struct FastPair : public Listener::Handler
+{
+    EventPoller *poller;
+    KcpTunnelGroup<true> svrGroup;
+    KcpTunnelGroup<false> cliGroup;
+    Listener listener;
+    int port;
+
+    std::vector<FastConnection *> svrConns; // 按接受顺序
+    std::vector<FastConnection *> pool;
+    std::vector<FastConnection *> cliConns;
+    FastSink svrSink;
+
+    FastPair(EventPoller *p)
+            :poller(p)
+            ,svrGroup(p)
+            ,cliGroup(p)
+            ,listener(p)
+            ,port(0)
+            ,svrConns()
+            ,pool()
+            ,cliConns()
+            ,svrSink()
+    {}
+
+    ~FastPair()
+    {
+        for (size_t i = 0; i < svrConns.size(); ++i)
+            delete svrConns[i];
+        for (size_t i = 0; i < pool.size(); ++i)
+            delete pool[i];
+        listener.finalise();
+        cliGroup.shutdown();
+        svrGroup.shutdown();
+    }
+
+    bool create(int p)
+    {
+        char addr[32];
+        snprintf(addr, sizeof(addr), "127.0.0.1:%d", p);
+        port = p;
+        listener.setEventHandler(this);
+        return svrGroup.create(addr) && cliGroup.create(addr) && listener.initialise("127.0.0.1", p);
+    }
+
+    virtual void onAccept(int connfd)
+    {
+        FastConnection *pConn = NULL;
+        if (!pool.empty())
+        {
+            pConn = pool.back();
+            pool.pop_back();
+        }
+        else
+        {
+            pConn = new FastConnection(poller, &svrGroup);
+        }
+        pConn->setEventHandler(&svrSink);
+        if (!pConn->acceptConnection(connfd))
+        {
+            close(connfd);
+            pool.push_back(pConn);
+            return;
+        }
+        svrConns.push_back(pConn);
+    }
+
+    void recycle(FastConnection *pConn)
+    {
+        for (size_t i = 0; i < svrConns.size(); ++i)
+        {
+            if (svrConns[i] == pConn)
+            {
+                svrConns.erase(svrConns.begin()+i);
+                break;
+            }
+        }
+        pConn->recycle();
+        pool.push_back(pConn);
+    }
+
+    bool connect(FastConnection &cli, FastSink &sink)
+    {
+        cli.setEventHandler(&sink);
+        cliConns.push_back(&cli);
+        return cli.connect("127.0.0.1", port);
+    }
+
+    bool pump(const std::string &data, const std::string &text)
+    {
+        uint32 start = getMonoClock();
+        while (data != text && getMonoClock()-start < 3000)
+            step();
+        return data == text;
+    }
+
+    void step()
+    {
+        poller->processPendingEvents(0.002);
+        uint32 now = getMonoClock();
+        for (size_t i = 0; i < svrConns.size(); ++i)
+        {
+            if (svrConns[i]->getKcpTunnel())
+                static_cast<KcpTunnel<true> *>(svrConns[i]->getKcpTunnel())->update(now);
+        }
+        for (size_t i = 0; i < cliConns.size(); ++i)
+        {
+            if (cliConns[i]->getKcpTunnel())
+                static_cast<KcpTunnel<false> *>(cliConns[i]->getKcpTunnel())->update(now);
+        }
+    }
+};
+
+static uint64 connStat(Connection *pConn, const char *name)
+{
+    StatsWriter w(StatsWriter::Format_Prometheus);
+    pConn->collectStats(w);
+    std::string text = w.str();
+    size_t pos = text.find(std::string(name)+"{");
+    if (std::string::npos == pos)
+        return 0;
+    pos = text.find("} ", pos);
+    return strtoull(text.c_str()+pos+2, NULL, 10);
+}
+
+void UTest::testBridgeRecycle()
+{
+    EpollPoller epoll;
+    EventPoller *poller = &epoll;
+    FastPair pair(poller);
+    CPPUNIT_ASSERT(pair.create(25449));
+
+    // 一次可读事件最多接受 batch 个连接
+    pair.listener.setAcceptBatch(2);
+    FastSink sinks[3];
+    FastConnection a(poller, &pair.cliGroup), b(poller, &pair.cliGroup), c(poller, &pair.cliGroup);
+    CPPUNIT_ASSERT(pair.connect(a, sinks[0]) && pair.connect(b, sinks[1]) && pair.connect(c, sinks[2]));
+    usleep(20*1000);
+    poller->processPendingEvents(0.01);
+    CPPUNIT_ASSERT(2 == pair.svrConns.size());
+    poller->processPendingEvents(0.01);
+    CPPUNIT_ASSERT(3 == pair.svrConns.size());
+
+    FastConnection *svr = pair.svrConns[0];
+    a.send("ping", 4);
+    CPPUNIT_ASSERT(pair.pump(pair.svrSink.data, "ping"));
+    svr->send("pong", 4);
+    CPPUNIT_ASSERT(pair.pump(sinks[0].data, "pong"));
+
+    // 控制连接上的收发计入统计; 暂停读取模拟下游积压时被回收
+    for (int i = 0; i < 100; ++i)
+        a.triggerHeartBeatPacket();
+    Connection *pConn = svr->getConnection();
+    uint64 start = getMonoClock();
+    while (connStat(pConn, "fasttun_conn_recv_bytes_total") < 500 && getMonoClock()-start < 3000)
+        pair.step();
+    CPPUNIT_ASSERT(connStat(pConn, "fasttun_conn_recv_bytes_total") >= 500);
+    pConn->pauseRead();
+
+    a.shutdown();
+    b.shutdown();
+    c.shutdown();
+    pair.recycle(pair.svrConns[2]);
+    pair.recycle(pair.svrConns[1]);
+    pair.recycle(svr);
+    CPPUNIT_ASSERT(pair.svrConns.empty() && 3 == pair.pool.size());
+
+    // 复用的对象接受新连接, 状态和统计从头开始, 照常转发
+    FastSink sink;
+    FastConnection d(poller, &pair.cliGroup);
+    CPPUNIT_ASSERT(pair.connect(d, sink));
+    start = getMonoClock();
+    while (pair.svrConns.empty() && getMonoClock()-start < 3000)
+        pair.step();
+    CPPUNIT_ASSERT(1 == pair.svrConns.size() && svr == pair.svrConns[0] && pConn == svr->getConnection());
+    CPPUNIT_ASSERT(!pConn->isReadPaused() && !svr->isCongested() && 0 == svr->getCachedSize());
+    CPPUNIT_ASSERT(connStat(pConn, "fasttun_conn_recv_bytes_total") < 500);
+
+    pair.svrSink.data.clear();
+    d.send("again", 5);
+    CPPUNIT_ASSERT(pair.pump(pair.svrSink.data, "again"));
+    svr->send("reply", 5);
+    CPPUNIT_ASSERT(pair.pump(sink.data, "reply"));
+}
+
+// 与 ServerBridge 相同: 管道拥塞时暂停读取数据源, 回落后恢复
+struct CongestionBridge : public Connection::Handler, public FastConnection::Handler
+{
+    Connection *source;
+    FastConnection *fast;
+    int congested;
+    int drained;
+
+    CongestionBridge(Connection *s, FastConnection *f) : source(s), fast(f), congested(0), drained(0) {}
+
+    virtual void onRecv(Connection *pConn, const void *data, size_t datalen)
+    {
+        fast->send(data, datalen);
+    }
+    virtual void onRecv(FastConnection *pConn, const void *data, size_t datalen) {}
+    virtual void onCongested(FastConnection *pConn)
+    {
+        ++congested;
+        source->pauseRead();
+    }
+    virtual void onDrained(FastConnection *pConn)
+    {
+        ++drained;
+        source->resumeRead();
+    }
+};
+
+void UTest::testSendQueueWatermark()
+{
+    EpollPoller epoll;
+    EventPoller *poller = &epoll;
+    FastPair pair(poller);
+    CPPUNIT_ASSERT(pair.create(25450));
+
+    FastSink sink;
+    FastConnection cli(poller, &pair.cliGroup);
+    CPPUNIT_ASSERT(pair.connect(cli, sink));
+    uint32 start = getMonoClock();
+    while (NULL == cli.getKcpTunnel() && getMonoClock()-start < 3000)
+        pair.step();
+    CPPUNIT_ASSERT(cli.getKcpTunnel() != NULL);
+
+    int sv[2];
+    CPPUNIT_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    core::setNonblocking(sv[0]);
+    core::setNonblocking(sv[1]);
+    int sndbuf = 1024*1024;
+    setsockopt(sv[1], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    Connection source(poller);
+    CongestionBridge bridge(&source, &cli);
+    source.setEventHandler(&bridge);
+    cli.setEventHandler(&bridge);
+    CPPUNIT_ASSERT(source.acceptConnection(sv[0]));
+
+    std::string data(512*1024, 0);
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = (char)(i*7);
+    int sent = send(sv[1], data.data(), data.size(), 0);
+    CPPUNIT_ASSERT(sent > 256*1024);
+    data.resize(sent);
+
+    // 不驱动kcp, 发送队列越过高水位(2倍发送窗口)时暂停读取数据源
+    for (int i = 0; i < 8 && !source.isReadPaused(); ++i)
+        source.handleInputNotification(sv[0]);
+    CPPUNIT_ASSERT(source.isReadPaused() && cli.isCongested());
+    CPPUNIT_ASSERT(1 == bridge.congested && 0 == bridge.drained);
+    CPPUNIT_ASSERT(pair.svrSink.data.size() < data.size());
+
+    // 对端确认后队列回落到低水位(1倍发送窗口)以下, 恢复读取
+    start = getMonoClock();
+    while (0 == bridge.drained && getMonoClock()-start < 3000)
+        pair.step();
+    CPPUNIT_ASSERT(bridge.drained >= 1 && !source.isReadPaused() && !cli.isCongested());
+
+    // 暂停期间留在套接字里的数据在恢复后全部送达
+    CPPUNIT_ASSERT(pair.pump(pair.svrSink.data, data));
+    CPPUNIT_ASSERT(bridge.congested == bridge.drained);
+
+    source.shutdown();
+    close(sv[1]);
+}
+
+// 与桥接对象相同: 管道收到的数据写入本地连接, 本地连接发送积压时暂停从管道接收
+struct RelayBridge : public Connection::Handler, public FastConnection::Handler
+{
+    Connection *sink;
+    FastConnection *tunnel;
+    size_t relayed;
+    int congested;
+    int drained;
+
+    RelayBridge(Connection *s, FastConnection *t) : sink(s), tunnel(t), relayed(0), congested(0), drained(0) {}
+
+    virtual void onRecv(Connection *pConn, const void *data, size_t datalen) {}
+    virtual void onCongested(Connection *pConn)
+    {
+        ++congested;
+        tunnel->setRecvPaused(true);
+    }
+    virtual void onDrained(Connection *pConn)
+    {
+        ++drained;
+        tunnel->setRecvPaused(false);
+    }
+
+    virtual void onRecv(FastConnection *pConn, const void *data, size_t datalen)
+    {
+        relayed += datalen;
+        sink->send(data, datalen);
+    }
+};
+
+void UTest::testRecvBackpressure()
+{
+    EpollPoller epoll;
+    EventPoller *poller = &epoll;
+    FastPair pair(poller);
+    CPPUNIT_ASSERT(pair.create(25453));
+
+    int sv[2];
+    CPPUNIT_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    core::setNonblocking(sv[0]);
+    core::setNonblocking(sv[1]);
+    int sndbuf = 16*1024;
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    Connection sink(poller);
+    FastConnection cli(poller, &pair.cliGroup);
+    RelayBridge bridge(&sink, &cli);
+    CPPUNIT_ASSERT(sink.acceptConnection(sv[0]));
+    sink.setEventHandler(&bridge);
+    cli.setEventHandler(&bridge);
+    pair.cliConns.push_back(&cli);
+    CPPUNIT_ASSERT(cli.connect("127.0.0.1", 25453));
+
+    uint32 start = getMonoClock();
+    while ((pair.svrConns.empty() || NULL == cli.getKcpTunnel()) && getMonoClock()-start < 3000)
+        pair.step();
+    CPPUNIT_ASSERT(1 == pair.svrConns.size() && cli.getKcpTunnel() != NULL);
+
+    std::string data(4*1024*1024, 0);
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = (char)(i*13);
+    FastConnection *svr = pair.svrConns[0];
+    for (size_t off = 0; off < data.size(); off += 64*1024)
+        svr->send(data.data()+off, 64*1024);
+
+    // 本地连接不读, 发送队列越过高水位后停止从kcp接收, 接收窗口关闭, 对端停发
+    start = getMonoClock();
+    while (getMonoClock()-start < 500)
+        pair.step();
+    CPPUNIT_ASSERT(1 == bridge.congested && 0 == bridge.drained && cli.isRecvPaused());
+    CPPUNIT_ASSERT(sink.getPendingSize() >= Connection::SEND_HIGH_WATER);
+    CPPUNIT_ASSERT(sink.getPendingSize() < Connection::SEND_HIGH_WATER+64*1024);
+    CPPUNIT_ASSERT(gCacheBudget.getMemUsed() >= sink.getPendingSize());
+    size_t relayed = bridge.relayed;
+    CPPUNIT_ASSERT(relayed < data.size());
+    start = getMonoClock();
+    while (getMonoClock()-start < 200)
+        pair.step();
+    CPPUNIT_ASSERT(relayed == bridge.relayed);
+
+    // 本地对端开始读取, 队列回落后恢复接收, 数据完整有序
+    std::string got;
+    char buf[64*1024];
+    start = getMonoClock();
+    while (got.size() < data.size() && getMonoClock()-start < 10000)
+    {
+        int len = 0;
+        while ((len = recv(sv[1], buf, sizeof(buf), 0)) > 0)
+            got.append(buf, len);
+        pair.step();
+    }
+    CPPUNIT_ASSERT(got == data);
+    CPPUNIT_ASSERT(bridge.drained >= 1 && bridge.congested == bridge.drained && !cli.isRecvPaused());
+    CPPUNIT_ASSERT(0 == sink.getPendingSize());
+
+    size_t memUsed = gCacheBudget.getMemUsed();
+    sink.send(data.data(), 512*1024);
+    CPPUNIT_ASSERT(sink.isCongested() && gCacheBudget.getMemUsed() > memUsed);
+    sink.shutdown();
+    CPPUNIT_ASSERT(memUsed == gCacheBudget.getMemUsed());
+    close(sv[1]);
+}
+
+// FastConnection 控制消息: 1字节长度(含消息号), 消息号, 内容
+enum
+{
+    CtrlMsg_CreateKcpTunnel = 0,
+    CtrlMsg_ConfirmCreateKcpTunnel = 1,
+    CtrlMsg_TuneKcpTunnel = 4,
+};
+
+static void sendCtrlMsg(int fd, int msgid, const void *data, size_t datalen)
+{
+    char buf[256];
+    buf[0] = (char)(sizeof(msgid)+datalen);
+    memcpy(buf+1, &msgid, sizeof(msgid));
+    memcpy(buf+1+sizeof(msgid), data, datalen);
+    send(fd, buf, 1+sizeof(msgid)+datalen, 0);
+}
+
+// 收一条控制消息, 等待期间驱动事件循环; wait 毫秒内没有完整的消息时返回false
+static bool recvCtrlMsg(FastPair &pair, int fd, uint32 wait, int &msgid, std::string &body)
+{
+    uint32 start = getMonoClock();
+    uint8 buf[256];
+    do
+    {
+        int len = recv(fd, buf, sizeof(buf), MSG_PEEK);
+        if (len > 0 && len >= 1+buf[0])
+        {
+            recv(fd, buf, 1+buf[0], 0);
+            memcpy(&msgid, buf+1, sizeof(msgid));
+            body.assign((const char *)buf+1+sizeof(msgid), buf[0]-sizeof(msgid));
+            return true;
+        }
+        pair.step();
+    } while (getMonoClock()-start < wait);
+    return false;
+}
+
+static bool waitKcpArg(FastPair &pair, ITunnel *pTunnel, int sndwnd, int rcvwnd)
+{
+    uint32 start = getMonoClock();
+    while (!(pTunnel->getKcpArg().sndwnd == sndwnd && pTunnel->getKcpArg().rcvwnd == rcvwnd) &&
+           getMonoClock()-start < 3000)
+    {
+        pair.step();
+    }
+    return pTunnel->getKcpArg().sndwnd == sndwnd && pTunnel->getKcpArg().rcvwnd == rcvwnd;
+}
+
+void UTest::testKcpTuningWire()
+{
+    EpollPoller epoll;
+    EventPoller *poller = &epoll;
+    FastPair pair(poller);
+    CPPUNIT_ASSERT(pair.create(25451));
+
+    // 建管道时服务端按客户端的参数调整, 窗口按方向互换
+    KcpArg arg = kcpmode::Interactive;
+    arg.sndwnd = 48;
+    arg.rcvwnd = 256;
+    pair.cliGroup.setKcpMode(arg);
+    FastSink sink;
+    FastConnection cli(poller, &pair.cliGroup);
+    CPPUNIT_ASSERT(pair.connect(cli, sink));
+    uint32 start = getMonoClock();
+    while (pair.svrConns.empty() && getMonoClock()-start < 3000)
+        pair.step();
+    CPPUNIT_ASSERT(1 == pair.svrConns.size());
+    FastConnection *svr = pair.svrConns[0];
+    svr->send("hello", 5);
+    CPPUNIT_ASSERT(pair.pump(sink.data, "hello"));
+    const KcpArg &svrArg = svr->getKcpTunnel()->getKcpArg();
+    CPPUNIT_ASSERT(256 == svrArg.sndwnd && 48 == svrArg.rcvwnd);
+    CPPUNIT_ASSERT(1 == svrArg.nodelay && 10 == svrArg.interval && 10 == svrArg.minrto);
+
+    // 任一端在线调整, 对端随之调整
+    arg.interval = 20;
+    arg.sndwnd = 100;
+    arg.rcvwnd = 200;
+    CPPUNIT_ASSERT(cli.retune(arg));
+    CPPUNIT_ASSERT(waitKcpArg(pair, svr->getKcpTunnel(), 200, 100));
+    CPPUNIT_ASSERT(20 == svr->getKcpTunnel()->getKcpArg().interval);
+    arg = kcpmode::Bulk;
+    CPPUNIT_ASSERT(svr->retune(arg));
+    CPPUNIT_ASSERT(waitKcpArg(pair, cli.getKcpTunnel(), 128, 128));
+    CPPUNIT_ASSERT(0 == cli.getKcpTunnel()->getKcpArg().nodelay && 20 == cli.getKcpTunnel()->getKcpArg().interval);
+
+    // 旧版本客户端的确认不带特性和参数, 服务端保持自己的参数, 也不发调整消息
+    sockaddr_in addr;
+    CPPUNIT_ASSERT(core::str2Ipv4("127.0.0.1:25451", addr));
+    int old = socket(AF_INET, SOCK_STREAM, 0);
+    CPPUNIT_ASSERT(::connect(old, (const SA *)&addr, sizeof(addr)) == 0);
+    core::setNonblocking(old);
+    int msgid = -1;
+    std::string body;
+    CPPUNIT_ASSERT(recvCtrlMsg(pair, old, 3000, msgid, body));
+    CPPUNIT_ASSERT(CtrlMsg_CreateKcpTunnel == msgid && 2 == pair.svrConns.size());
+    uint64 peerId = 99;
+    sendCtrlMsg(old, CtrlMsg_ConfirmCreateKcpTunnel, &peerId, sizeof(peerId));
+    FastConnection *oldSvr = pair.svrConns[1];
+    start = getMonoClock();
+    while (oldSvr->getPeerId() != peerId && getMonoClock()-start < 3000)
+        pair.step();
+    CPPUNIT_ASSERT(peerId == oldSvr->getPeerId());
+    CPPUNIT_ASSERT(0 == oldSvr->getKcpTunnel()->getKcpArg().sndwnd);
+    CPPUNIT_ASSERT(oldSvr->retune(kcpmode::Bulk) && 128 == oldSvr->getKcpTunnel()->getKcpArg().sndwnd);
+    CPPUNIT_ASSERT(!recvCtrlMsg(pair, old, 50, msgid, body));
+    close(old);
+
+    // 旧版本服务端的建管道消息不带特性, 客户端的确认不带参数, 之后也不发调整消息
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    CPPUNIT_ASSERT(core::str2Ipv4("127.0.0.1:25452", addr));
+    CPPUNIT_ASSERT(bind(lfd, (const SA *)&addr, sizeof(addr)) == 0 && listen(lfd, 4) == 0);
+    FastSink oldSink;
+    FastConnection oldCli(poller, &pair.cliGroup);
+    oldCli.setEventHandler(&oldSink);
+    pair.cliConns.push_back(&oldCli);
+    CPPUNIT_ASSERT(oldCli.connect("127.0.0.1", 25452));
+    int fd = accept(lfd, NULL, NULL);
+    CPPUNIT_ASSERT(fd >= 0);
+    core::setNonblocking(fd);
+    uint32 conv = 77;
+    sendCtrlMsg(fd, CtrlMsg_CreateKcpTunnel, &conv, sizeof(conv));
+    CPPUNIT_ASSERT(recvCtrlMsg(pair, fd, 3000, msgid, body));
+    uint32 features = 1;
+    CPPUNIT_ASSERT(CtrlMsg_ConfirmCreateKcpTunnel == msgid && sizeof(uint64)+sizeof(features) == body.size());
+    memcpy(&features, body.data()+sizeof(uint64), sizeof(features));
+    CPPUNIT_ASSERT(0 == features);
+    CPPUNIT_ASSERT(oldCli.retune(kcpmode::Bulk));
+    CPPUNIT_ASSERT(!recvCtrlMsg(pair, fd, 50, msgid, body));
+    oldCli.shutdown();
+    close(fd);
+    close(lfd);
+}
 
 int main(int argc, char *argv[])
 {
@@ -7,12 +7,55 @@
 #include "fasttun_base.h"
 #include "message_receiver.h"
 #include "disk_cache.h"
+#include "disk_io.h"
+#include "cache.h"
+#include "ring_buffer.h"
+#include "timer_wheel.h"
+#include "heartbeat.h"
+#include "conv_allocator.h"
+#include "conv_table.h"
+#include "stats.h"
+#include "latency.h"
+#include "loop_profiler.h"
+#include "lossy_link.h"
+#include "kcp_tunnel.h"
+#include "recv_arena.h"
+#include "listener.h"
+#include "fast_connection.h"
 
 class UTest : public CppUnit::TestFixture
 {
     CPPUNIT_TEST_SUITE(UTest);
     CPPUNIT_TEST(testMessageReceiver);
     CPPUNIT_TEST(testDiskCache);
+    CPPUNIT_TEST(testDiskCacheRecycle);
+    CPPUNIT_TEST(testDiskCacheAsync);
+    CPPUNIT_TEST(testCacheBudget);
+    CPPUNIT_TEST(testCacheAccounting);
+    CPPUNIT_TEST(testBudgetBackpressure);
+    CPPUNIT_TEST(testRingBuffer);
+    CPPUNIT_TEST(testTimerWheel);
+    CPPUNIT_TEST(testPreciseWait);
+    CPPUNIT_TEST(testPeerHeartBeat);
+    CPPUNIT_TEST(testConvAllocator);
+    CPPUNIT_TEST(testConvTable);
+    CPPUNIT_TEST(testStats);
+    CPPUNIT_TEST(testLatencyHistogram);
+    CPPUNIT_TEST(testLoopProfiler);
+    CPPUNIT_TEST(testLossyLink);
+    CPPUNIT_TEST(testKcpHibernate);
+    CPPUNIT_TEST(testKcpStream);
+    CPPUNIT_TEST(testKcpAckDelay);
+    CPPUNIT_TEST(testKcpSack);
+    CPPUNIT_TEST(testKcpCompact);
+    CPPUNIT_TEST(testPathMtu);
+    CPPUNIT_TEST(testKcpRetune);
+    CPPUNIT_TEST(testRecvArena);
+    CPPUNIT_TEST(testReadBudget);
+    CPPUNIT_TEST(testBridgeRecycle);
+    CPPUNIT_TEST(testSendQueueWatermark);
+    CPPUNIT_TEST(testRecvBackpressure);
+    CPPUNIT_TEST(testKcpTuningWire);
     CPPUNIT_TEST_SUITE_END();
   public:
     UTest()
@@ -29,6 +72,38 @@ class UTest : public CppUnit::TestFixture
     void _onRecvMsgError(void *);
 
     void testDiskCache();
+    void testDiskCacheRecycle();
+    void testDiskCacheAsync();
+
+    void testCacheBudget();
+    bool _onFlushCache(const void *data, size_t datalen);
+    void testCacheAccounting();
+    void testBudgetBackpressure();
+
+    void testRingBuffer();
+
+    void testTimerWheel();
+    void testPreciseWait();
+    void testPeerHeartBeat();
+    void testConvAllocator();
+    void testConvTable();
+    void testStats();
+    void testLatencyHistogram();
+    void testLoopProfiler();
+    void testLossyLink();
+    void testKcpHibernate();
+    void testKcpStream();
+    void testKcpAckDelay();
+    void testKcpSack();
+    void testKcpCompact();
+    void testPathMtu();
+    void testKcpRetune();
+    void testRecvArena();
+    void testReadBudget();
+    void testBridgeRecycle();
+    void testSendQueueWatermark();
+    void testRecvBackpressure();
+    void testKcpTuningWire();
 };
 
 #endif // __UTEST_H__